@@ -1,5 +1,21 @@
+#ifdef __linux__
+#define _GNU_SOURCE             /* for O_DIRECT */
+#endif
+
+#include <stddef.h>
 #include "bpptree.h"
 
+#if defined(BPP_DIRECT_IO) || defined(BPP_MMAP)
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#ifdef BPP_MMAP
+#include <sys/mman.h>
+#endif
+#ifdef BPP_THREADS
+#include <pthread.h>
+#endif
+
 /*************
  * internals *
  *************/
@@ -20,13 +36,78 @@
  *    each 3/4 full.  On deletion, if 3 nodes are 1/2 full, they are
  *    joined to create 2 nodes 3/4 full.
  *
- *    A LRR (least-recently-read) buffering scheme for nodes is used to
+ *    A LRU (least-recently-used) buffering scheme for nodes is used to
  *    simplify storage management, and, assuming some locality of reference,
- *    improve performance.
+ *    improve performance.  Buffers are found by node address through a
+ *    hash table.  Insertion and deletion need their last 7 buffers to
+ *    stay put, which LRU order guarantees so long as 7 buffers are not
+ *    pinned.  Internal nodes may be pinned, taking them out of the LRU
+ *    list for good, so that lookups only ever wait on leaves.
  *
  *    To simplify matters, both internal nodes and leafs contain the
  *    same fields.
- *   
+ *
+ *    Keys sit between the addresses around them, so a search strides
+ *    through the node and compares through h->comp.  Where the compare
+ *    is known, buffers also keep 8 bytes of each key, past any bytes
+ *    all keys in the node share, as integers that order the same way.
+ *    These are built when the node is first searched, and searches
+ *    bisect them without branching.
+ *
+ *    The first sector of the file is a header recording the sector
+ *    size, so a tree always reopens with the size it was made with;
+ *    the root follows it.  Files made before the header existed have
+ *    the root first, and are opened with the sector size given.
+ *
+ *    A packed tree keeps nodes in memory as above, BPP_PACK_RATIO
+ *    sectors each, and packs them as they go to disk: the node header
+ *    as it is, then the bytes all keys share, then for each entry the
+ *    rest of its key less trailing zeros, and its addresses.  Internal
+ *    nodes share nothing, as keys may be added outside their range.
+ *    Nodes are full when their packed size won't fit a sector (3 for
+ *    the root), and share keys out by packed size; insertion adds its
+ *    key to the gathered leaves before they are scattered, so a leaf
+ *    never needs room for a key it hasn't seen.  Separators between
+ *    leaves are cut to the fewest bytes that tell the leaves apart.
+ *
+ *    A mapped tree reads the file through a read-only mapping.  During
+ *    lookups, a buffer that misses points into the mapping rather than
+ *    at its own memory; before a change latches it, the node is copied
+ *    back to its own memory, so changes are only ever made there and
+ *    written through the file as before.
+ *
+ *    Threads share the tree by latching nodes.  Readers descend
+ *    holding a node shared until its child is latched, and move right
+ *    along the leaves the same way.  One change runs at a time; it
+ *    latches nodes exclusively top down and left to right, the order
+ *    readers take them, and lets go of each level once the next is
+ *    ready, keeping only the node whose key it may have to fix up.  A
+ *    reader moving left can only try the latch, and looks again from
+ *    the root if that fails.  Each buffer counts the threads using
+ *    it, and is only replaced when none are; each operation reserves
+ *    the buffers it may use before latching anything, so none waits
+ *    for a buffer while holding a latch.  The pool, the file and
+ *    these counts are guarded by one mutex.  Buffers are given a new
+ *    version whenever a change lets go of them, and scans resume
+ *    where they were only while the version is the same.
+ *
+ *    A snapshot is a scan that sees the tree as it was after some
+ *    number of changes.  While any are open, a change copies each node
+ *    it latches before altering it, tagged with the changes the copy
+ *    stands for, and keeps the copy if it did alter the node and a
+ *    snapshot may read it.  Snapshots latch nodes as other readers do,
+ *    then read the copy of their time in place of any node changed
+ *    since; copies never change, so a snapshot resumes at the same
+ *    place in its leaf.  Node addresses are never reused, so nodes a
+ *    change adds are out of sight of older copies.  Copies go as the
+ *    last snapshot that sees them closes.
+ *
+ *    A journal keeps the file as it was at the last checkpoint.  The
+ *    first time a node below the end of the file, as it then was, is
+ *    written, what it writes over goes to the journal first; a bit for
+ *    each sector marks the nodes done.  A checkpoint writes out every
+ *    node changed, syncs the file and clears the bits.
+ *
  */
 
 /* macros for addressing fields */
@@ -53,6 +134,9 @@
 /* shortcuts */
 #define ks(ct) ((ct) * h->ks)
 
+/* bytes of a node ahead of its first key */
+#define hdrSize offsetof(nodeType, fkey)
+
 typedef char keyType;           /* keys entries are treated as char arrays */
 
 typedef struct {
@@ -65,34 +149,166 @@ typedef struct {
     keyType fkey;               /* first occurrence */
 } nodeType;
 
+typedef struct {
+    char magic[4];              /* BPP_MAGIC */
+    int sectorSize;             /* size of sector on disk */
+    int flags;                  /* BPP_PACKED, or 0 */
+} headerType;
+
+#define BPP_MAGIC "BPT1"
+#define BPP_PACKED 1            /* keys are packed on disk */
+
+/* most nodes 3 can be scattered to; parents keep room for 2 more */
+#define PACK_MAX_GROUPS 5
+
+typedef struct {                /* packed size of a run of keys */
+    keyType *first;             /* first key */
+    int n;                      /* number of keys */
+    int lcp;                    /* bytes all keys share */
+    int minT;                   /* shortest key, less trailing zeros */
+    int sumT;                   /* total of keys, less trailing zeros */
+} packType;
+
+typedef unsigned long long prefixType;
+
+typedef enum {                  /* how keys map to prefixes */
+    PFX_NONE,                   /* they don't */
+    PFX_SIGNED,                 /* little-endian signed integers */
+    PFX_UNSIGNED,               /* little-endian unsigned integers */
+    PFX_BYTES,                  /* byte arrays */
+    PFX_STRING                  /* null-terminated strings */
+} prefixEnum;
+
 typedef struct bufTypeTag {     /* location of node */
     struct bufTypeTag *next;    /* next */
     struct bufTypeTag *prev;    /* previous */
-    bAdrType adr;               /* on disk */
+    struct bufTypeTag *hashNext;/* next in hash chain */
+    bAdrType adr;               /* on disk, or -1 if unassigned */
     nodeType *p;                /* in memory */
+    nodeType *own;              /* buffer's memory, if p is in the map */
     bpp_bool_t valid;                 /* true if buffer contents valid */
     bpp_bool_t modified;              /* true if buffer modified */
+    bpp_bool_t pinned;                /* true if never to be replaced */
+    prefixType *pfx;            /* key prefixes, or NULL */
+    int pfxOff;                 /* key bytes skipped by pfx */
+    bpp_bool_t pfxValid;        /* true if pfx matches keys */
+    packType pack;              /* packed size of keys */
+    bpp_bool_t packValid;       /* true if pack matches keys */
+    int fix;                    /* threads using buf; never replaced while > 0 */
+    unsigned long version;      /* changed whenever the node may have */
+    bpp_bool_t held;            /* true if latched by the change running */
+    struct savedTag *before;    /* node as it was before the change, or NULL */
+    bpp_bool_t saved;           /* true if an image kept for snapshots */
+#ifdef BPP_THREADS
+    pthread_rwlock_t latch;     /* shared to read the node, exclusive to change it */
+#endif
 } bufType;
 
+typedef struct savedTag {       /* a node as snapshots opened before a change see it */
+    struct savedTag *next;      /* next in hash chain, newest first */
+    unsigned long from;         /* changes made before the node was this */
+    unsigned long to;           /* change that made it otherwise */
+    bufType buf;                /* image, held in memory following this */
+} savedType;
+
+/* hash chains of saved images */
+#define SAVED_HASH_CT 64
+
+typedef enum {                  /* how a node is latched */
+    LATCH_S,                    /* shared, to read it */
+    LATCH_X,                    /* exclusively, to change it */
+    LATCH_TRY                   /* shared, unless that means waiting */
+} latchEnum;
+
+/* most bufs a change holds: root, lastGE, parent, tmps, next leaf */
+#define HELD_MAX (PACK_MAX_GROUPS + 4)
+
+/* bufs reserved by each reader */
+#define READ_BUF_CT 2
+
+typedef struct {                /* a place in the leaves */
+    bAdrType adr;               /* leaf, or -1 if none */
+    unsigned long version;      /* leaf's version when placed */
+    int pos;                    /* entry in leaf */
+} placeType;
+
 /* one node for each open handle */
 typedef struct hNodeTag {
     file_handle_t fp;           /* idx file */
+    int fd;                     /* idx file for direct I/O, or -1 */
     int keySize;                /* key length */
     bpp_bool_t dupKeys;         /* true if duplicate keys */
     int sectorSize;             /* block size for idx records */
+    int nodeSize;               /* size of node in memory */
+    bpp_bool_t packed;          /* true if keys are packed on disk */
+    bpp_bool_t truncate;        /* true if separators are cut short */
+    int lenSize;                /* size of a packed key length */
+    int maxEntry;               /* size of the largest packed entry */
+    char *image;                /* packed node, 3 sectors */
+    char *old;                  /* node being journaled, 3 sectors */
+    char *map;                  /* idx file mapped for reading, or NULL */
+    bAdrType mapEnd;            /* bytes of idx file readable in map */
     bCompType comp;             /* pointer to compare routine */
+    prefixEnum pfxKind;         /* how keys map to prefixes */
     bufType root;               /* root of b-tree, room for 3 sets */
-    bufType bufList;            /* head of buf list */
+    bAdrType rootAdr;           /* address of root */
+    bufType bufList;            /* head of buf list, LRU last */
+    bufType *bufs;              /* every buf */
+    int bufCt;                  /* number of bufs */
+    bufType **hash;             /* bufs by adr, chained */
+    unsigned int hashMask;      /* hash table size - 1 */
+    int pinCt;                  /* number of pinned bufs */
+    int maxPinCt;               /* most bufs that may be pinned */
+    bpp_bool_t pinInternal;     /* true to pin internal nodes */
+    int reserved;               /* bufs reserved by running operations */
+    unsigned long stamp;        /* last version given a buf */
+    bufType *held[HELD_MAX];    /* bufs latched by the change running */
+    int heldCt;                 /* number of held bufs */
+    unsigned long changes;      /* changes made since bOpen */
+    struct scanTag *snaps;      /* open snapshots */
+    savedType *saved[SAVED_HASH_CT]; /* images snapshots may need, by adr */
+    bJournalType journal;       /* keeps what nodes overwrite, or NULL */
+    void *journalArg;           /* passed to journal */
+    bAdrType journalEnd;        /* end of idx file at the checkpoint */
+    unsigned char *journaled;   /* a bit for each sector journaled since */
+#ifdef BPP_THREADS
+    pthread_mutex_t poolLock;   /* bufs, their counts, and the idx file */
+    pthread_cond_t poolFree;    /* signalled as reservations end */
+    pthread_mutex_t writeLock;  /* held by the change running */
+    pthread_mutex_t scanLock;   /* held while using scan */
+    pthread_mutex_t snapLock;   /* snaps, saved and stale */
+#endif
     void *malloc1;              /* malloc'd resources */
     void *malloc2;              /* malloc'd resources */
     bufType gbuf;               /* gather buffer, room for 3 sets */
-    bufType *curBuf;            /* current location */
-    keyType *curKey;            /* current key in current node */
+    struct scanTag *scan;       /* scan for bFindNextKey and the like */
     unsigned int maxCt;         /* minimum # keys in node */
     int ks;                     /* sizeof key entry */
     bAdrType nextFreeAdr;       /* next free b-tree record address */
+    bStatsType stats;           /* counted under poolLock and writeLock */
 } hNode;
 
+typedef struct scanTag {        /* scan from bOpenScan */
+    hNode *h;                   /* tree */
+    placeType at;               /* place of current key */
+    eAdrType rec;               /* current record address */
+    keyType *key;               /* current key */
+    bpp_bool_t snap;            /* true if from bOpenSnapshot */
+    bpp_bool_t stale;           /* true if the snapshot couldn't be kept */
+    unsigned long asOf;         /* changes the snapshot sees */
+    struct scanTag *nextSnap;   /* next open snapshot */
+} scanType;
+
+#ifdef BPP_THREADS
+#define mutexLock(m) pthread_mutex_lock(m)
+#define mutexUnlock(m) pthread_mutex_unlock(m)
+#else
+#define mutexLock(m)
+#define mutexUnlock(m)
+#endif
+
+int bErrLineNo;
+
 #define error(rc) lineError(__LINE__, rc)
 
 static bErrType lineError(int lineno, bErrType rc) {
@@ -110,109 +326,762 @@ static bAdrType allocAdr(bHandleType handle) {
     return adr;
 }
 
+static bErrType ioRead(hNode *h, bAdrType adr, int len, void *p) {
+#ifdef BPP_MMAP
+    if (h->map != NULL && adr + len <= h->mapEnd) {
+        memcpy(p, h->map + adr, len);
+        return bErrOk;
+    }
+#endif
+#if defined(BPP_DIRECT_IO) || defined(BPP_MMAP)
+    if (h->fd >= 0) {
+        if (pread(h->fd, p, len, adr) != len) return error(bErrIO);
+        return bErrOk;
+    }
+#endif
+    if (err_ok != ion_fread_at(h->fp, adr, len, (byte*) p)) return error(bErrIO);
+    return bErrOk;
+}
+
+static bErrType ioWrite(hNode *h, bAdrType adr, int len, void *p) {
+#if defined(BPP_DIRECT_IO) || defined(BPP_MMAP)
+    if (h->fd >= 0) {
+        if (pwrite(h->fd, p, len, adr) != len) return error(bErrIO);
+#ifdef BPP_MMAP
+        /* the mapping shares the page cache, so sees it at once */
+        if (h->map != NULL && adr + len > h->mapEnd)
+            h->mapEnd = (adr + len < (bAdrType)BPP_MAP_SIZE)
+                ? adr + len : (bAdrType)BPP_MAP_SIZE;
+#endif
+        return bErrOk;
+    }
+#endif
+    if (err_ok != ion_fwrite_at(h->fp, adr, len, (byte*) p)) return error(bErrIO);
+    return bErrOk;
+}
+
+static int trimLen(hNode *h, unsigned char *key) {
+    prefixType w;               /* 8 bytes of key */
+    int t;
+
+    /* length of key less trailing zeros, skipping 8 at a time */
+    for (t = h->keySize; t >= (int)sizeof(w); t -= sizeof(w)) {
+        memcpy(&w, key + t - sizeof(w), sizeof(w));
+        if (w) break;
+    }
+    for (; t > 0 && key[t - 1] == 0; t--)
+        ;
+    return t;
+}
+
+static int commonLen(unsigned char *a, unsigned char *b, int n) {
+    prefixType x, y;            /* 8 bytes of a and b */
+    int i;
+
+    /* bytes a and b share, up to n, comparing 8 at a time */
+    for (i = 0; i + (int)sizeof(x) <= n; i += sizeof(x)) {
+        memcpy(&x, a + i, sizeof(x));
+        memcpy(&y, b + i, sizeof(y));
+        if (x != y) break;
+    }
+    for (; i < n && a[i] == b[i]; i++)
+        ;
+    return i;
+}
+
+static void packAdd(hNode *h, packType *pk, keyType *key) {
+    int t;                      /* length less trailing zeros */
+
+    /* keys share what each shares with the first */
+    t = trimLen(h, (unsigned char *)key);
+    if (pk->n == 0) {
+        pk->first = key;
+        pk->lcp = h->keySize;
+        pk->minT = t;
+        pk->sumT = 0;
+    } else {
+        pk->lcp = commonLen((unsigned char *)pk->first, (unsigned char *)key, pk->lcp);
+        if (t < pk->minT) pk->minT = t;
+    }
+    pk->sumT += t;
+    pk->n++;
+}
+
+static int packPrefix(packType *pk, int isLeaf) {
+    /* bytes packed once for all keys; internal nodes share none */
+    if (!isLeaf || pk->n == 0) return 0;
+    return (pk->lcp < pk->minT) ? pk->lcp : pk->minT;
+}
+
+static int packEntry(hNode *h, int isLeaf) {
+    /* packed size of an entry, less its key */
+    return h->lenSize + sizeof(eAdrType) + (isLeaf ? 0 : sizeof(bAdrType));
+}
+
+static int packSize(hNode *h, packType *pk, int isLeaf) {
+    /* header, prefix, then each entry less the prefix */
+    return hdrSize + h->lenSize + pk->n * packEntry(h, isLeaf) + pk->sumT
+        - (pk->n - 1) * packPrefix(pk, isLeaf);
+}
+
+static int packWeight(hNode *h, packType *pk, int isLeaf) {
+    /* packed size of entries, were nothing shared; this adds up */
+    return pk->n * packEntry(h, isLeaf) + pk->sumT;
+}
+
+static packType *packRun(hNode *h, keyType *e, int n, packType *pk) {
+    int i;
+
+    /* packed size of n entries from e */
+    pk->n = 0;
+    pk->sumT = 0;
+    for (i = 0; i < n; i++)
+        packAdd(h, pk, e + ks(i));
+    return pk;
+}
+
+static packType *packStats(hNode *h, bufType *buf) {
+    if (!buf->packValid) {
+        packRun(h, fkey(buf), ct(buf), &buf->pack);
+        buf->packValid = boolean_true;
+    }
+    return &buf->pack;
+}
+
+static void putLen(hNode *h, char *d, int len) {
+    d[0] = (char)len;
+    if (h->lenSize > 1) d[1] = (char)(len >> 8);
+}
+
+static int getLen(hNode *h, char *d) {
+    int len;
+
+    len = (unsigned char)d[0];
+    if (h->lenSize > 1) len |= (unsigned char)d[1] << 8;
+    return len;
+}
+
+static void pack(hNode *h, nodeType *p, packType *pk, char *d, int len) {
+    packType run;               /* packed size of keys, if not given */
+    keyType *k;                 /* key */
+    char *end;                  /* end of packed node */
+    int pl;                     /* length of prefix */
+    int t;                      /* length of key less trailing zeros */
+    int n;                      /* length of addresses */
+    int i;
+
+    /* pack node p into len bytes at d */
+    end = d + len;
+    memcpy(d, p, hdrSize);
+    d += hdrSize;
+    if (pk == NULL) pk = packRun(h, &p->fkey, p->ct, &run);
+    pl = packPrefix(pk, p->leaf);
+    putLen(h, d, pl);
+    memcpy(d + h->lenSize, &p->fkey, pl);
+    d += h->lenSize + pl;
+    n = packEntry(h, p->leaf) - h->lenSize;
+    for (i = 0; i < p->ct; i++) {
+        k = &p->fkey + ks(i);
+        t = trimLen(h, (unsigned char *)k);
+        putLen(h, d, t - pl);
+        memcpy(d + h->lenSize, k + pl, t - pl);
+        d += h->lenSize + t - pl;
+        /* rec, then childGE if internal */
+        memcpy(d, k + h->keySize, n);
+        d += n;
+    }
+    memset(d, 0, end - d);
+}
+
+static void unpack(hNode *h, char *d, nodeType *p) {
+    keyType *k;                 /* key */
+    char *pre;                  /* prefix */
+    int pl;                     /* length of prefix */
+    int sl;                     /* length of suffix */
+    int n;                      /* length of addresses */
+    int i;
+
+    /* unpack node at d into p */
+    memcpy(p, d, hdrSize);
+    d += hdrSize;
+    pl = getLen(h, d);
+    pre = d + h->lenSize;
+    d = pre + pl;
+    n = packEntry(h, p->leaf) - h->lenSize;
+    for (i = 0; i < p->ct; i++) {
+        k = &p->fkey + ks(i);
+        sl = getLen(h, d);
+        memcpy(k, pre, pl);
+        memcpy(k + pl, d + h->lenSize, sl);
+        memset(k + pl + sl, 0, h->keySize - pl - sl);
+        d += h->lenSize + sl;
+        memcpy(k + h->keySize, d, n);
+        if (p->leaf) childGE(k) = 0;
+        d += n;
+    }
+}
+
+static bErrType nodeWrite(hNode *h, bAdrType adr, int len, nodeType *p, packType *pk) {
+    /* packed nodes go through the image; pk is p's packed size, or NULL */
+    if (!h->packed) return ioWrite(h, adr, len, p);
+    pack(h, p, pk, h->image, len);
+    return ioWrite(h, adr, len, h->image);
+}
+
+static bErrType nodeRead(hNode *h, bAdrType adr, int len, nodeType *p) {
+    bErrType rc;                /* return code */
+
+    if (!h->packed) return ioRead(h, adr, len, p);
+    if ((rc = ioRead(h, adr, len, h->image)) != 0) return rc;
+    unpack(h, h->image, p);
+    return bErrOk;
+}
+
+static bErrType journal(hNode *h, bAdrType adr, int len) {
+    /* journal what a node overwrites, the first time since the
+       checkpoint */
+    unsigned long sector;       /* sector the node starts at */
+    bErrType rc;                /* return code */
+
+    if (h->journal == NULL || adr >= h->journalEnd) return bErrOk;
+    sector = adr / h->sectorSize;
+    if (h->journaled[sector / 8] & (1 << (sector % 8))) return bErrOk;
+    if (adr + len > h->journalEnd) len = h->journalEnd - adr;
+    if ((rc = ioRead(h, adr, len, h->old)) != 0) return rc;
+    if ((rc = h->journal(h->journalArg, adr, len, h->old)) != 0) return rc;
+    h->journaled[sector / 8] |= 1 << (sector % 8);
+    return bErrOk;
+}
+
+static bErrType startJournal(hNode *h, bAdrType end) {
+    /* journal nodes below end afresh */
+    unsigned char *journaled;
+    size_t n;                   /* bytes of bits */
+
+    if (h->journal == NULL) return bErrOk;
+    n = (end / h->sectorSize + 7) / 8;
+    if ((journaled = realloc(h->journaled, n + 1)) == NULL) return error(bErrMemory);
+    memset(journaled, 0, n + 1);
+    h->journaled = journaled;
+    h->journalEnd = end;
+    return bErrOk;
+}
+
+static bErrType syncFile(hNode *h) {
+    /* wait for the idx file to reach the disk */
+#if defined(BPP_DIRECT_IO) || defined(BPP_MMAP)
+    if (h->fd >= 0 && fsync(h->fd) != 0) return error(bErrIO);
+#endif
+    if (err_ok != ion_fsync(h->fp)) return error(bErrIO);
+    return bErrOk;
+}
+
 static bErrType flush(bHandleType handle, bufType *buf) {
     hNode *h = handle;
     int len;            /* number of bytes to write */
+    bErrType rc;                /* return code */
 
     /* flush buffer to disk */
     len = h->sectorSize;
-    if (buf->adr == 0) len *= 3;        /* root */
-    if (err_ok != ion_fwrite_at(h->fp, buf->adr, len, (byte*) buf->p)) return error(bErrIO);
+    if (buf == &h->root) len *= 3;      /* root */
+    if ((rc = journal(h, buf->adr, len)) != 0) return rc;
+    if ((rc = nodeWrite(h, buf->adr, len, buf->p,
+        h->packed ? packStats(h, buf) : NULL)) != 0) return rc;
     buf->modified = boolean_false;
-    nDiskWrites++;
+    h->stats.nDiskWrites++;
     return bErrOk;
 }
 
 static bErrType flushAll(bHandleType handle) {
     hNode *h = handle;
     bErrType rc;                /* return code */
-    bufType *buf;               /* buffer */
+    int i;
 
     if (h->root.modified)
         if ((rc = flush(handle, &h->root)) != 0) return rc;
 
-    buf = h->bufList.next;
-    while (buf != &h->bufList) {
-        if (buf->modified)
-            if ((rc = flush(handle, buf)) != 0) return rc;
-        buf = buf->next;
+    /* pinned bufs aren't in the list, so go through them all */
+    for (i = 0; i < h->bufCt; i++) {
+        if (h->bufs[i].modified)
+            if ((rc = flush(handle, &h->bufs[i])) != 0) return rc;
     }
     
     return bErrOk;
 }
 
+static bufType **hashSlot(hNode *h, bAdrType adr) {
+    /* addresses are whole sectors apart, so consecutive ones spread */
+    return &h->hash[(unsigned long)(adr / h->sectorSize) & h->hashMask];
+}
+
+static void hashRemove(hNode *h, bufType *buf) {
+    bufType **link;
+
+    for (link = hashSlot(h, buf->adr); *link != buf; link = &(*link)->hashNext)
+        ;
+    *link = buf->hashNext;
+}
+
+static void unlinkBuf(bufType *buf) {
+    buf->next->prev = buf->prev;
+    buf->prev->next = buf->next;
+}
+
+static prefixType *prefixes(hNode *h, bufType *buf);
+
+static void reserve(hNode *h, int n) {
+    /* wait until n unpinned bufs are free of other reservations */
+    mutexLock(&h->poolLock);
+#ifdef BPP_THREADS
+    while (h->bufCt - h->pinCt - h->reserved < n)
+        pthread_cond_wait(&h->poolFree, &h->poolLock);
+#endif
+    h->reserved += n;
+    mutexUnlock(&h->poolLock);
+}
+
+static void unreserve(hNode *h, int n) {
+    mutexLock(&h->poolLock);
+    h->reserved -= n;
+#ifdef BPP_THREADS
+    pthread_cond_broadcast(&h->poolFree);
+#endif
+    mutexUnlock(&h->poolLock);
+}
+
 static bErrType assignBuf(bHandleType handle, bAdrType adr, bufType **b) {
     hNode *h = handle;
-    /* assign buf to adr */
+    /* assign buf to adr, and fix it there; the pool is locked */
     bufType *buf;               /* buffer */
+    bufType **slot;             /* hash chain for adr */
     bErrType rc;                /* return code */
 
-    if (adr == 0) {
+    if (adr == h->rootAdr) {
         *b = &h->root;
         return bErrOk;
     }
 
-    /* search for buf with matching adr */
-    buf = h->bufList.next;
-    while (buf->next != &h->bufList) {
-        if (buf->valid && buf->adr == adr) break;
-        buf = buf->next;
+    /* look up buf with matching adr */
+    slot = hashSlot(h, adr);
+    for (buf = *slot; buf != NULL && buf->adr != adr; buf = buf->hashNext)
+        ;
+    if (buf != NULL && buf->pinned) {
+        buf->fix++;
+        *b = buf;
+        return bErrOk;
     }
 
-    /* either buf points to a match, or it's last one in list (LRR) */
-    if (buf->valid) {
-        if (buf->adr != adr) {
-            if (buf->modified) {
-                if ((rc = flush(handle, buf)) != 0) return rc;
-            }
-            buf->adr = adr;
-            buf->valid = boolean_false;
+    if (buf == NULL) {
+        /* replace the least recently used buf no one is using;
+           reservations leave one */
+        for (buf = h->bufList.prev; buf != &h->bufList && buf->fix; buf = buf->prev)
+            ;
+        if (buf == &h->bufList) return error(bErrMemory);
+        if (buf->modified) {
+            if ((rc = flush(handle, buf)) != 0) return rc;
         }
-    } else {
+        if (buf->adr != -1) hashRemove(h, buf);
         buf->adr = adr;
+        buf->p = buf->own;
+        buf->valid = boolean_false;
+        buf->version = ++h->stamp;
+        buf->hashNext = *slot;
+        *slot = buf;
     }
 
     /* remove from current position and place at front of list */
-    buf->next->prev = buf->prev;
-    buf->prev->next = buf->next;
+    unlinkBuf(buf);
     buf->next = h->bufList.next;
     buf->prev = &h->bufList;
     buf->next->prev = buf;
     buf->prev->next = buf;
+    buf->fix++;
     *b = buf;
     return bErrOk;
 }
 
+static void unfix(hNode *h, bufType *buf) {
+    /* the pool is locked */
+    if (buf != &h->root) buf->fix--;
+}
+
 static bErrType writeDisk(bufType *buf) {
     /* write buf to disk */
     buf->valid = boolean_true;
     buf->modified = boolean_true;
+    buf->pfxValid = boolean_false;
+    buf->packValid = boolean_false;
     return bErrOk;
 }
 
-static bErrType readDisk(bHandleType handle, bAdrType adr, bufType **b) {
+static bErrType fixBuf(bHandleType handle, bAdrType adr, bufType **b, bpp_bool_t view) {
     hNode *h = handle;
-    /* read data into buf */
+    /* fix buf at adr, reading it if need be; with view, a mapped node
+       may be used where it lies */
     int len;
     bufType *buf;               /* buffer */
     bErrType rc;                /* return code */
-    if ((rc = assignBuf(handle, adr, &buf)) != 0) return rc;
-    if (!buf->valid) {
+
+    mutexLock(&h->poolLock);
+    if ((rc = assignBuf(handle, adr, &buf)) != 0) {
+        mutexUnlock(&h->poolLock);
+        return rc;
+    }
+    if (!buf->valid && view && !h->packed && buf != &h->root
+    && adr + h->sectorSize <= h->mapEnd) {
+        /* use the node where it lies */
+        buf->p = (nodeType *)(h->map + adr);
+        buf->modified = boolean_false;
+        buf->valid = boolean_true;
+        buf->pfxValid = boolean_false;
+        buf->packValid = boolean_false;
+        h->stats.nMapReads++;
+        h->stats.nBufMisses++;
+    } else if (!buf->valid) {
         len = h->sectorSize;
-        if (adr == 0) len *= 3;         /* root */
-        if (err_ok != ion_fread_at(h->fp, adr, len, (byte*) buf->p)) {
-            return error(bErrIO);
+        if (adr == h->rootAdr) len *= 3;        /* root */
+        if ((rc = nodeRead(h, adr, len, buf->p)) != 0) {
+            unfix(h, buf);
+            mutexUnlock(&h->poolLock);
+            return rc;
         }
         buf->modified = boolean_false;
         buf->valid = boolean_true;
-        nDiskReads++;
+        buf->pfxValid = boolean_false;
+        buf->packValid = boolean_false;
+        h->stats.nDiskReads++;
+        h->stats.nBufMisses++;
+    } else {
+        h->stats.nBufHits++;
+    }
+
+    /* readers only search, so give them prefixes now */
+    if (h->pfxKind != PFX_NONE && buf->pfx && ct(buf)) prefixes(h, buf);
+
+    /* a node's level never changes, so internal nodes can stay put,
+       so long as reservations can still be met */
+    if (h->pinInternal && !leaf(buf) && !buf->pinned && buf != &h->root
+    && h->pinCt < h->maxPinCt && h->bufCt - h->pinCt > h->reserved) {
+        unlinkBuf(buf);
+        buf->pinned = boolean_true;
+        h->pinCt++;
+    }
+    mutexUnlock(&h->poolLock);
+    *b = buf;
+    return bErrOk;
+}
+
+static savedType **savedSlot(hNode *h, bAdrType adr) {
+    return &h->saved[(adr / h->sectorSize) % SAVED_HASH_CT];
+}
+
+static int imageLen(hNode *h, bufType *buf) {
+    return (buf->adr == h->rootAdr ? 3 : 1) * h->nodeSize;
+}
+
+static void unsave(hNode *h, savedType *e) {
+    savedType **slot;
+
+    /* drop an image; snapLock is held */
+    for (slot = savedSlot(h, e->buf.adr); *slot != e; slot = &(*slot)->next)
+        ;
+    *slot = e->next;
+    free(e);
+}
+
+static void keepImage(hNode *h, bufType *buf) {
+    savedType *e;               /* newest image of buf's node */
+    scanType *s;                /* open snapshot */
+    scanType **ps;              /* link to s */
+    unsigned long from;         /* changes made before buf's node was as it is */
+    bpp_bool_t need;            /* true if a snapshot sees the node as it is */
+    int len;
+
+    /* a change has just latched buf; keep the node as it is for the
+       snapshots that see it so, unless none do */
+    mutexLock(&h->snapLock);
+    for (e = *savedSlot(h, buf->adr); e != NULL && e->buf.adr != buf->adr; e = e->next)
+        ;
+    from = e ? e->to : 0;
+    need = boolean_false;
+    for (s = h->snaps; s != NULL; s = s->nextSnap)
+        if (s->asOf >= from) need = boolean_true;
+    if (need) {
+        len = imageLen(h, buf);
+        if ((e = malloc(sizeof(savedType) + len)) != NULL) {
+            memset(&e->buf, 0, sizeof(bufType));
+            e->buf.adr = buf->adr;
+            e->buf.p = e->buf.own = (nodeType *)(e + 1);
+            e->buf.saved = boolean_true;
+            memcpy(e->buf.p, buf->p, len);
+            e->from = from;
+            e->to = h->changes + 1;
+            e->next = *savedSlot(h, buf->adr);
+            *savedSlot(h, buf->adr) = e;
+            buf->before = e;
+        } else {
+            /* rather than fail the change, the snapshots that needed
+               the node go on as plain scans */
+            for (ps = &h->snaps; (s = *ps) != NULL; ) {
+                if (s->asOf >= from) {
+                    s->stale = boolean_true;
+                    *ps = s->nextSnap;
+                } else {
+                    ps = &s->nextSnap;
+                }
+            }
+        }
+    }
+    mutexUnlock(&h->snapLock);
+}
+
+static void dropImage(hNode *h, bufType *buf) {
+    /* the change is done with buf; an image of a node it left as it
+       was, or that no snapshot is left to see, needn't be kept */
+    mutexLock(&h->snapLock);
+    if (h->snaps == NULL || memcmp(buf->before->buf.p, buf->p, imageLen(h, buf)) == 0)
+        unsave(h, buf->before);
+    buf->before = NULL;
+    mutexUnlock(&h->snapLock);
+}
+
+static void pruneImages(hNode *h) {
+    savedType *e;               /* image */
+    savedType *enext;           /* next image */
+    scanType *s;                /* open snapshot */
+    int i;
+
+    /* drop images no open snapshot sees, but those of the change
+       running; snapLock is held */
+    for (i = 0; i < SAVED_HASH_CT; i++) {
+        for (e = h->saved[i]; e != NULL; e = enext) {
+            enext = e->next;
+            if (e->to > h->changes) continue;
+            for (s = h->snaps; s != NULL; s = s->nextSnap)
+                if (e->from <= s->asOf && s->asOf < e->to) break;
+            if (s == NULL) unsave(h, e);
+        }
+    }
+}
+
+static bpp_bool_t latch(hNode *h, bufType *buf, latchEnum mode) {
+    /* returns false if LATCH_TRY would have waited */
+    switch (mode) {
+    case LATCH_S:
+#ifdef BPP_THREADS
+        pthread_rwlock_rdlock(&buf->latch);
+#endif
+        break;
+    case LATCH_TRY:
+#ifdef BPP_THREADS
+        if (pthread_rwlock_tryrdlock(&buf->latch)) return boolean_false;
+#endif
+        break;
+    case LATCH_X:
+#ifdef BPP_THREADS
+        pthread_rwlock_wrlock(&buf->latch);
+#endif
+        buf->held = boolean_true;
+        h->held[h->heldCt++] = buf;
+        if (buf->p != buf->own) {
+            /* copy the node out of the map, so it can change */
+            memcpy(buf->own, buf->p, h->sectorSize);
+            buf->p = buf->own;
+        }
+        break;
+    }
+    return boolean_true;
+}
+
+static void release(hNode *h, bufType *buf) {
+    bpp_bool_t held;            /* true if latched exclusively */
+    int i;
+
+    /* let go of buf; a change leaves it ready to search */
+    if (buf->saved) return;
+    held = buf->held;
+    if (held) {
+        if (buf->before) dropImage(h, buf);
+        if (h->pfxKind != PFX_NONE && buf->pfx && ct(buf)) prefixes(h, buf);
+        buf->held = boolean_false;
+        for (i = 0; h->held[i] != buf; i++)
+            ;
+        h->held[i] = h->held[--h->heldCt];
+    }
+    mutexLock(&h->poolLock);
+    if (held) buf->version = ++h->stamp;
+#ifdef BPP_THREADS
+    pthread_rwlock_unlock(&buf->latch);
+#endif
+    unfix(h, buf);
+    mutexUnlock(&h->poolLock);
+}
+
+static void releaseExcept(hNode *h, bufType *keep1, bufType *keep2) {
+    int i;
+
+    /* release moves the last held buf into place, and it was kept */
+    for (i = h->heldCt - 1; i >= 0; i--)
+        if (h->held[i] != keep1 && h->held[i] != keep2)
+            release(h, h->held[i]);
+}
+
+static bErrType readDisk(bHandleType handle, bAdrType adr, bufType **b, latchEnum mode) {
+    hNode *h = handle;
+    /* read data into buf, and latch it; with LATCH_TRY, *b is NULL if
+       that would wait */
+    bufType *buf;               /* buffer */
+    bErrType rc;                /* return code */
+
+    if ((rc = fixBuf(handle, adr, &buf, mode != LATCH_X)) != 0) return rc;
+    if (mode == LATCH_X && buf->held) {
+        /* the change has it already */
+        mutexLock(&h->poolLock);
+        unfix(h, buf);
+        mutexUnlock(&h->poolLock);
+    } else if (!latch(h, buf, mode)) {
+        mutexLock(&h->poolLock);
+        unfix(h, buf);
+        mutexUnlock(&h->poolLock);
+        buf = NULL;
+    } else if (mode == LATCH_X) {
+        keepImage(h, buf);
     }
     *b = buf;
     return bErrOk;
 }
 
+static bufType *asOf(hNode *h, scanType *view, bufType *buf) {
+    savedType *e;               /* image */
+
+    /* buf's node as the snapshot view sees it; buf is latched, and
+       let go of if an image stands in for it */
+    if (view == NULL) return buf;
+    mutexLock(&h->snapLock);
+    for (e = *savedSlot(h, buf->adr); e != NULL; e = e->next)
+        if (e->buf.adr == buf->adr && e->from <= view->asOf && view->asOf < e->to) break;
+    mutexUnlock(&h->snapLock);
+    if (e == NULL) return buf;
+    release(h, buf);
+    return &e->buf;
+}
+
+static bErrType readNode(hNode *h, scanType *view, bAdrType adr, bufType **b, latchEnum mode) {
+    bErrType rc;                /* return code */
+
+    /* read and latch a node as view sees it, or as it is if view is NULL */
+    if ((rc = readDisk(h, adr, b, mode)) != 0) return rc;
+    if (*b != NULL) *b = asOf(h, view, *b);
+    return bErrOk;
+}
+
+static bErrType newBuf(bHandleType handle, bufType **b) {
+    hNode *h = handle;
+    bErrType rc;                /* return code */
+
+    /* latch a buf for a new node */
+    mutexLock(&h->poolLock);
+    rc = assignBuf(handle, allocAdr(handle), b);
+    mutexUnlock(&h->poolLock);
+    if (rc) return rc;
+    latch(h, *b, LATCH_X);
+    return bErrOk;
+}
+
 typedef enum { MODE_FIRST, MODE_MATCH, MODE_FGEQ, MODE_LLEQ } modeEnum;
 
+static prefixEnum prefixKind(bOpenType *info) {
+#ifdef BPP_KEY_PREFIX
+    /* duplicates are searched in an order prefixes can't give */
+    if (info->dupKeys) return PFX_NONE;
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    if (info->comp == dictionary_compare_signed_value) return PFX_SIGNED;
+    if (info->comp == dictionary_compare_unsigned_value) return PFX_UNSIGNED;
+#endif
+    if (info->comp == dictionary_compare_char_array) return PFX_BYTES;
+    if (info->comp == dictionary_compare_null_terminated_string) return PFX_STRING;
+#endif
+    return PFX_NONE;
+}
+
+static prefixType prefix(hNode *h, unsigned char *key, int off) {
+    prefixType p;               /* prefix */
+    int n;                      /* bytes of key in prefix */
+    int i;
+
+    /* prefixes compare as keys do, or equal if only later bytes differ;
+       byte keys skip the off bytes all keys in the node share */
+    p = 0;
+    n = h->keySize - off;
+    if (n > (int)sizeof(prefixType)) n = sizeof(prefixType);
+    switch (h->pfxKind) {
+    case PFX_SIGNED:
+    case PFX_UNSIGNED:
+        /* most significant bytes are last */
+        for (i = 0; i < n; i++)
+            p = (p << 8) | key[h->keySize - 1 - i];
+        p <<= 8 * (sizeof(prefixType) - n);
+        if (h->pfxKind == PFX_SIGNED) p ^= (prefixType)1 << 63;
+        break;
+    case PFX_BYTES:
+    case PFX_STRING:
+        key += off;
+        for (i = 0; i < n && (h->pfxKind == PFX_BYTES || key[i]); i++)
+            p |= (prefixType)key[i] << (8 * (sizeof(prefixType) - 1 - i));
+        break;
+    case PFX_NONE:
+        break;
+    }
+    return p;
+}
+
+static prefixType *prefixes(hNode *h, bufType *buf) {
+    unsigned char *first;       /* first key */
+    unsigned char *last;        /* last key */
+    int off;                    /* bytes shared by all keys */
+    int i;
+
+    if (!buf->pfxValid) {
+        /* keys between the first and last share what those two do */
+        off = 0;
+        if (h->pfxKind == PFX_BYTES || h->pfxKind == PFX_STRING) {
+            first = (unsigned char *)fkey(buf);
+            last = (unsigned char *)fkey(buf) + ks(ct(buf) - 1);
+            while (off < h->keySize && first[off] == last[off]
+                && (h->pfxKind == PFX_BYTES || first[off]))
+                off++;
+        }
+        for (i = 0; i < ct(buf); i++)
+            buf->pfx[i] = prefix(h, (unsigned char *)fkey(buf) + ks(i), off);
+        buf->pfxOff = off;
+        buf->pfxValid = boolean_true;
+    }
+    return buf->pfx;
+}
+
+static int lowerBound(prefixType *pfx, int n, prefixType kp, bpp_bool_t orEqual) {
+    prefixType *base;
+    int half;
+
+    /* first prefix greater than kp, or not less with orEqual false;
+       the select compiles to a conditional move, so while the next
+       probe is a cache line or more away, fetch both places it might
+       land while this one is compared */
+    base = pfx;
+    while (n > 1) {
+        half = n / 2;
+#ifdef __GNUC__
+        if (half >= 16) {
+            __builtin_prefetch(base + half / 2);
+            __builtin_prefetch(base + half + half / 2);
+        }
+#endif
+        base += (base[half] < kp || (orEqual && base[half] == kp)) ? half : 0;
+        n -= half;
+    }
+    return (base - pfx) + (n && (*base < kp || (orEqual && *base == kp)));
+}
+
 static int search(
     bHandleType handle,
     bufType *buf,
@@ -243,6 +1112,37 @@ static int search(
     foundDup = boolean_false;
     lb = 0; 
     ub = ct(buf) - 1;
+    if (h->pfxKind != PFX_NONE && buf->pfx && ct(buf)) {
+        /* only keys sharing key's prefix are left to compare */
+        prefixType *pfx = prefixes(h, buf);
+        prefixType kp;
+        int off = buf->pfxOff;
+
+        cc = off ? memcmp(key, fkey(buf), off) : 0;
+        if (cc < 0) {
+            lb = 0;
+            ub = -1;
+        } else if (cc > 0) {
+            lb = ct(buf);
+        } else {
+            kp = prefix(h, (unsigned char *)key, off);
+            lb = lowerBound(pfx, ct(buf), kp, boolean_false);
+            if (off + (int)sizeof(prefixType) >= h->keySize)
+                ub = (lb < ct(buf) && pfx[lb] == kp) ? lb : lb - 1;
+            else
+                ub = lowerBound(pfx + lb, ct(buf) - lb, kp, boolean_true) + lb - 1;
+        }
+        if (lb > ub) {
+            /* as if last compared with a key beside where key goes */
+            if (lb < ct(buf)) {
+                *mkey = fkey(buf) + ks(lb);
+                cc = CC_LT;
+            } else {
+                *mkey = fkey(buf) + ks(lb - 1);
+                cc = CC_GT;
+            }
+        }
+    }
     while (lb <= ub) {
         m = (lb + ub) / 2;
         *mkey = fkey(buf) + ks(m);
@@ -317,27 +1217,191 @@ static int search(
     return cc;
 }
 
-static bErrType scatterRoot(bHandleType handle) {
-    hNode *h = handle;
-    bufType *gbuf;
-    bufType *root;
+static bpp_bool_t packRoom(hNode *h, bufType *buf, void *key) {
+    packType pk;                /* packed size, with key */
+    int cap;                    /* most bytes packed */
+    int maxCt;                  /* most keys */
+
+    /* true if a leaf can take key, or an internal node 2 separators */
+    cap = h->sectorSize;
+    maxCt = h->maxCt;
+    if (buf == &h->root) {
+        cap *= 3;
+        maxCt *= 3;
+    }
+    pk = *packStats(h, buf);
+    if (!leaf(buf))
+        return pk.n + 2 <= maxCt && packSize(h, &pk, 0) + 2 * h->maxEntry <= cap;
+    packAdd(h, &pk, key);
+    return pk.n <= maxCt && packSize(h, &pk, 1) <= cap;
+}
 
-    /* scatter gbuf to root */
+static void shorten(hNode *h, keyType *sep, keyType *prev) {
+    int n;                      /* bytes kept */
 
-    root = &h->root;
-    gbuf = &h->gbuf;
-    memcpy(fkey(root), fkey(gbuf), ks(ct(gbuf)));
-    childLT(fkey(root)) = childLT(fkey(gbuf));
-    ct(root) = ct(gbuf);
-    leaf(root) = leaf(gbuf);
-    return bErrOk;
+    /* sep is the first key after prev; keep just enough of it to
+       follow prev */
+    n = commonLen((unsigned char *)sep, (unsigned char *)prev, h->keySize) + 1;
+    if (n < h->keySize) memset(sep + n, 0, h->keySize - n);
 }
 
-static bErrType scatter(bHandleType handle, bufType *pbuf, keyType *pkey, int is, bufType **tmp) {
-    hNode *h = handle;
-    bufType *gbuf;              /* gather buf */
-    keyType *gkey;              /* gather buf key */
-    bErrType rc;                /* return code */
+static int packCount(int *first, int g, int isLeaf) {
+    /* keys group g keeps; after the first, internal groups pass one up */
+    return first[g + 1] - first[g] - (!isLeaf && g);
+}
+
+static int packGroups(hNode *h, keyType *e, int n, int isLeaf, int reserve, int k, int *first) {
+    packType pk;                /* packed size of group */
+    packType npk;               /* packed size with next entry */
+    int cap;                    /* most bytes packed */
+    int maxCt;                  /* most keys */
+    int total;                  /* weight of all entries */
+    int done;                   /* weight of entries grouped */
+    int target;                 /* weight to aim for */
+    int w;                      /* weight of group */
+    int ew;                     /* weight of next entry */
+    int g;
+    int i;
+
+    /*
+     * input:
+     *   e                      n entries [key,rec,childGE]
+     *   isLeaf                 true if entries are for leaves
+     *   reserve                separators internal nodes keep room for
+     *   k                      groups to share the weight evenly, or 0
+     *                          to fill each group in turn
+     * output:
+     *   first                  first entry of each group, then n
+     * returns:
+     *   number of groups, more than PACK_MAX_GROUPS if that won't do
+     */
+    if (isLeaf) reserve = 0;
+    cap = h->sectorSize - reserve * h->maxEntry;
+    maxCt = h->maxCt - reserve;
+    total = 0;
+    if (k)
+        for (i = 0; i < n; i++)
+            total += packEntry(h, isLeaf) + trimLen(h, (unsigned char *)e + ks(i));
+    done = 0;
+    i = 0;
+    for (g = 0; i < n; g++) {
+        if (g == PACK_MAX_GROUPS) return g + 1;
+        first[g] = i;
+        target = k > g ? (total - done) / (k - g) : 0;
+        w = 0;
+        if (!isLeaf && g) {
+            /* passed up to the parent */
+            done += packEntry(h, isLeaf) + trimLen(h, (unsigned char *)e + ks(i));
+            i++;
+        }
+        pk.n = 0;
+        pk.sumT = 0;
+        while (i < n) {
+            npk = pk;
+            packAdd(h, &npk, e + ks(i));
+            ew = npk.sumT - pk.sumT + packEntry(h, isLeaf);
+            if (pk.n && (npk.n > maxCt || packSize(h, &npk, isLeaf) > cap))
+                break;
+            if (g < k - 1 && pk.n >= 2 && 2 * w + ew > 2 * target)
+                break;
+            pk = npk;
+            w += ew;
+            i++;
+        }
+        done += w;
+    }
+    first[g] = n;
+    return g;
+}
+
+static int packSplit(hNode *h, keyType *e, int n, int isLeaf, int reserve, int minGroups, int *first) {
+    int even[PACK_MAX_GROUPS + 1];      /* groups of even weight */
+    int k;                      /* number of groups */
+    int m;                      /* group with the most entries */
+    int g;
+
+    /*
+     * input:
+     *   e                      n entries [key,rec,childGE]
+     *   isLeaf                 true if entries are for leaves
+     *   reserve                separators internal nodes keep room for
+     *   minGroups              fewest groups to make
+     * output:
+     *   first                  first entry of each group, then n
+     * returns:
+     *   number of groups, or 0 if the entries won't fit
+     * notes:
+     *   Groups keep 2 keys at least where there are enough, and share
+     *   the entries by weight where they fit that way.
+     */
+    k = packGroups(h, e, n, isLeaf, reserve, 0, first);
+    if (k > PACK_MAX_GROUPS) return 0;
+    if (minGroups > PACK_MAX_GROUPS) minGroups = PACK_MAX_GROUPS;
+    if (k < minGroups) {
+        /* any part of a group fits, so halve the biggest */
+        while (k < minGroups) {
+            m = 0;
+            for (g = 1; g < k; g++)
+                if (first[g + 1] - first[g] > first[m + 1] - first[m]) m = g;
+            if (first[m + 1] - first[m] < 5) break;
+            memmove(first + m + 2, first + m + 1, (k - m) * sizeof(int));
+            first[m + 1] = (first[m] + first[m + 2]) / 2;
+            k++;
+        }
+    }
+    if (k > 1 && packGroups(h, e, n, isLeaf, reserve, k, even) == k) {
+        for (g = 0; g < k && packCount(even, g, isLeaf) >= 2; g++)
+            ;
+        if (g == k) {
+            memcpy(first, even, (k + 1) * sizeof(int));
+            return k;
+        }
+    }
+
+    /* a few keys more or less fit any small group */
+    for (g = 0; g < k; g++) {
+        while (packCount(first, g, isLeaf) < 2 && g > 0
+            && packCount(first, g - 1, isLeaf) > 2)
+            first[g]--;
+        while (packCount(first, g, isLeaf) < 2 && g < k - 1
+            && packCount(first, g + 1, isLeaf) > 2)
+            first[g + 1]++;
+    }
+    return k;
+}
+
+static bpp_bool_t packLow(hNode *h, bufType *buf) {
+    packType pk;                /* packed size */
+
+    /* true if buf fits 3/4 of the root */
+    packRun(h, fkey(buf), ct(buf), &pk);
+    return pk.n < (3*(3*h->maxCt))/4
+        && packSize(h, &pk, leaf(buf)) < (3*(3*h->sectorSize))/4;
+}
+
+static bErrType scatterRoot(bHandleType handle) {
+    hNode *h = handle;
+    bufType *gbuf;
+    bufType *root;
+
+    /* scatter gbuf to root */
+
+    root = &h->root;
+    gbuf = &h->gbuf;
+    memcpy(fkey(root), fkey(gbuf), ks(ct(gbuf)));
+    childLT(fkey(root)) = childLT(fkey(gbuf));
+    ct(root) = ct(gbuf);
+    leaf(root) = leaf(gbuf);
+    root->pfxValid = boolean_false;
+    root->packValid = boolean_false;
+    return bErrOk;
+}
+
+static bErrType scatter(bHandleType handle, bufType *pbuf, keyType *pkey, int is, bufType **tmp, int reserve) {
+    hNode *h = handle;
+    bufType *gbuf;              /* gather buf */
+    keyType *gkey;              /* gather buf key */
+    bErrType rc;                /* return code */
     int iu;                     /* number of tmp's used */
     int k0Min;                  /* min #keys that can be mapped to tmp[0] */
     int knMin;                  /* min #keys that can be mapped to tmp[1..3] */
@@ -347,6 +1411,8 @@ static bErrType scatter(bHandleType handle, bufType *pbuf, keyType *pkey, int is
     int len;                    /* length of remainder of buf */
     int base;                   /* base count distributed to tmps */
     int extra;                  /* extra counts */
+    int first[PACK_MAX_GROUPS + 1];     /* first key of each tmp, packed */
+    int want;                   /* number of tmps wanted, packed */
     int ct;
     int i;
 
@@ -356,6 +1422,8 @@ static bErrType scatter(bHandleType handle, bufType *pbuf, keyType *pkey, int is
      *   pkey                   where we insert a key if needed in parent
      *   is                     number of supplied tmps
      *   tmp                    array of tmp's to be used for scattering
+     *   reserve                separators internal tmps keep room for,
+     *                          packed
      * output:
      *   tmp                    array of tmp's used for scattering
      */
@@ -387,11 +1455,20 @@ static bErrType scatter(bHandleType handle, bufType *pbuf, keyType *pkey, int is
         knMin = ((h->maxCt+1) / 2) + 1;
     }
 
+    /* packed, share by size, and leave the parent 2 keys at least */
+    want = 0;
+    if (h->packed) {
+        want = is ? is + 2 - ct(pbuf) : 3;
+        if (want < 1) want = 1;
+        want = packSplit(h, gkey, ct, leaf(gbuf), reserve, want, first);
+        if (want == 0) return error(bErrMemory);
+    }
+
     /* calculate iu, number of tmps to use */
     while(1) {
-        if (iu == 0 || ct > (k0Max + (iu-1)*knMax)) {
+        if (h->packed ? iu < want : (iu == 0 || ct > (k0Max + (iu-1)*knMax))) {
             /* add a buffer */
-            if ((rc = assignBuf(handle, allocAdr(handle), &tmp[iu])) != 0) 
+            if ((rc = newBuf(handle, &tmp[iu])) != 0)
                 return rc;
             /* update sequential links */
             if (leaf(gbuf)) {
@@ -407,16 +1484,20 @@ static bErrType scatter(bHandleType handle, bufType *pbuf, keyType *pkey, int is
                 }
             }
             iu++;
-            nNodesIns++;
-        } else if (iu > 1 && ct < (k0Min + (iu-1)*knMin)) {
-            /* del a buffer */
+            h->stats.nNodesIns++;
+        } else if (h->packed ? iu > want : (iu > 1 && ct < (k0Min + (iu-1)*knMin)
+                && ct <= (k0Max + (iu-2)*knMax))) {
+            /* del a buffer, if the rest can hold the keys; with small
+               nodes, no count of buffers may meet both limits */
             iu--;
             /* adjust sequential links */
             if (leaf(gbuf) && tmp[iu-1]->adr) {
                 next(tmp[iu-1]) = next(tmp[iu]);
             }
             next(tmp[iu-1]) = next(tmp[iu]);
-            nNodesDel++;
+            /* it stays latched till the change ends; leave it empty */
+            ct(tmp[iu]) = 0;
+            h->stats.nNodesDel++;
         } else {
             break;
         }
@@ -435,6 +1516,7 @@ static bErrType scatter(bHandleType handle, bufType *pbuf, keyType *pkey, int is
             n++;
             extra--;
         }
+        if (h->packed) n = first[i + 1] - first[i];
         ct(tmp[i]) = n;
     }
 
@@ -446,7 +1528,7 @@ static bErrType scatter(bHandleType handle, bufType *pbuf, keyType *pkey, int is
         /* link last node to next */
         if (leaf(gbuf) && next(tmp[iu-1])) {
             bufType *buf;
-            if ((rc = readDisk(handle, next(tmp[iu-1]), &buf)) != 0) return rc;
+            if ((rc = readDisk(handle, next(tmp[iu-1]), &buf, LATCH_X)) != 0) return rc;
             prev(buf) = tmp[iu-1]->adr;
             if ((rc = writeDisk(buf)) != 0) return rc;
         }
@@ -481,6 +1563,7 @@ static bErrType scatter(bHandleType handle, bufType *pbuf, keyType *pkey, int is
                 childLT(pkey) = tmp[i]->adr;
             } else {
                 memcpy(pkey, gkey, ks(1));
+                if (h->truncate) shorten(h, key(pkey), gkey - ks(1));
                 childGE(pkey) = tmp[i]->adr;
                 pkey += ks(1);
             }
@@ -528,9 +1611,11 @@ static bErrType gatherRoot(bHandleType handle) {
     /* gather root to gbuf */
     root = &h->root;
     gbuf = &h->gbuf;
-    memcpy(p(gbuf), root->p, 3 * h->sectorSize);
+    memcpy(p(gbuf), root->p, 3 * h->nodeSize);
     leaf(gbuf) = leaf(root);
     ct(root) = 0;
+    root->pfxValid = boolean_false;
+    root->packValid = boolean_false;
     return bErrOk;
 }
 
@@ -559,9 +1644,9 @@ static bErrType gather(bHandleType handle, bufType *pbuf, keyType **pkey, bufTyp
     /* find 3 adjacent buffers */
     if (*pkey == lkey(pbuf))
         *pkey -= ks(1);
-    if ((rc = readDisk(handle, childLT(*pkey), &tmp[0])) != 0) return rc;
-    if ((rc = readDisk(handle, childGE(*pkey), &tmp[1])) != 0) return rc;
-    if ((rc = readDisk(handle, childGE(*pkey + ks(1)), &tmp[2])) != 0) return rc;
+    if ((rc = readDisk(handle, childLT(*pkey), &tmp[0], LATCH_X)) != 0) return rc;
+    if ((rc = readDisk(handle, childGE(*pkey), &tmp[1], LATCH_X)) != 0) return rc;
+    if ((rc = readDisk(handle, childGE(*pkey + ks(1)), &tmp[2], LATCH_X)) != 0) return rc;
 
     /* gather nodes to gbuf */
     gbuf = &h->gbuf;
@@ -603,29 +1688,104 @@ bErrType bOpen(bOpenType info, bHandleType *handle) {
     hNode *h;
     bErrType rc;                /* return code */
     int bufCt;                  /* number of tmp buffers */
+    unsigned int hashCt;        /* number of hash chains */
+    int pfxCt;                  /* number of key prefixes */
+    prefixType *pfx;            /* key prefixes */
     bufType *buf;               /* buffer */
     int maxCt;                  /* maximum number of keys in a node */
     bufType *root;
     int i;
     nodeType *p;
+    file_handle_t fp;           /* idx file */
+    bpp_bool_t exists;          /* true if opening an existing tree */
+    headerType hdr;             /* header of idx file */
+    int sectorSize;             /* size of sector on disk */
+    bAdrType rootAdr;           /* address of root */
+    int flags;                  /* header flags */
+    int lenSize;                /* size of a packed key length */
+    int maxEntry;               /* size of the largest packed entry */
+    int nodeSize;               /* size of node in memory */
+    int imageSize;              /* size of packed image */
+    int oldSize;                /* size of node being journaled */
+#ifdef BPP_THREADS
+    pthread_rwlockattr_t attr;  /* latch attributes */
+#endif
+
+    /* an existing tree keeps the sector size it was made with */
+    exists = ion_fexists(info.iName);
+    fp = ion_fopen(info.iName);
+/** TODO make this cleaner **/
+#ifdef ION_ARDUINO
+    if (NULL == fp.file) return bErrFileNotOpen;
+#else
+    if (NULL == fp) return bErrFileNotOpen;
+#endif
+    sectorSize = info.sectorSize;
+    rootAdr = sectorSize;
+    flags = 0;
+    if (exists) {
+        if (err_ok == ion_fread_at(fp, 0, sizeof(headerType), (byte*) &hdr)
+        && memcmp(hdr.magic, BPP_MAGIC, sizeof(hdr.magic)) == 0) {
+            sectorSize = rootAdr = hdr.sectorSize;
+            flags = hdr.flags;
+        } else {
+            rootAdr = 0;        /* no header; root is first */
+        }
+    }
 
-    if ((info.sectorSize < sizeof(hNode)) || (info.sectorSize % 4))
+    if ((sectorSize < sizeof(nodeType)) || (sectorSize % 4)
+    || (sectorSize > BPP_MAX_SECTOR_SIZE)
+    || (info.directIO && (sectorSize % BPP_PAGE_SIZE))) {
+        ion_fclose(fp);
         return bErrSectorSize;
+    }
 
     /* determine sizes and offsets */
     /* leaf/n, prev, next, [childLT,key,rec]... childGE */
     /* ensure that there are at least 3 children/parent for gather/scatter */
-    maxCt = info.sectorSize - (sizeof(nodeType) - sizeof(keyType));
+    maxCt = sectorSize - (sizeof(nodeType) - sizeof(keyType));
     maxCt /= sizeof(bAdrType) + info.keySize + sizeof(eAdrType);
-    if (maxCt < 6) return bErrSectorSize;
+    if (maxCt < 6) {
+        ion_fclose(fp);
+        return bErrSectorSize;
+    }
+
+    /* pack new trees where a sector holds enough of the largest keys */
+    lenSize = (info.keySize < 256) ? 1 : 2;
+    maxEntry = lenSize + info.keySize + sizeof(eAdrType) + sizeof(bAdrType);
+    if (!exists && info.packKeys && sectorSize >= BPP_PACK_MIN_ENTRIES * maxEntry)
+        flags |= BPP_PACKED;
+    nodeSize = sectorSize;
+    imageSize = 0;
+    if (flags & BPP_PACKED) {
+        /* the root counts its keys in 15 bits */
+        nodeSize *= BPP_PACK_RATIO;
+        imageSize = 3 * sectorSize;
+        maxCt = nodeSize - (sizeof(nodeType) - sizeof(keyType));
+        maxCt /= sizeof(bAdrType) + info.keySize + sizeof(eAdrType);
+        if (maxCt > 32767 / 3) maxCt = 32767 / 3;
+    }
 
     /* copy parms to hNode */
     if ((h = malloc(sizeof(hNode))) == NULL) return error(bErrMemory);
     memset(h, 0, sizeof(hNode));
+    h->fp = fp;
+    h->fd = -1;
     h->keySize = info.keySize;
     h->dupKeys = info.dupKeys;
-    h->sectorSize = info.sectorSize;
+    h->sectorSize = sectorSize;
+    h->nodeSize = nodeSize;
+    h->packed = (flags & BPP_PACKED) != 0;
+    h->truncate = h->packed && !info.dupKeys
+        && (info.comp == dictionary_compare_char_array
+            || info.comp == dictionary_compare_null_terminated_string);
+    h->lenSize = lenSize;
+    h->maxEntry = maxEntry;
+    h->rootAdr = rootAdr;
     h->comp = info.comp;
+    h->pfxKind = prefixKind(&info);
+    h->journal = info.journal;
+    h->journalArg = info.journalArg;
 
     /* childLT, key, rec */
     h->ks = sizeof(bAdrType) + h->keySize + sizeof(eAdrType);
@@ -637,23 +1797,62 @@ bErrType bOpen(bOpenType info, bHandleType *handle) {
      *  - 1 parent buf
      *  - 1 next sequential link
      *  - 1 lastGE
+     * Packed trees may need 5 child bufs, but never lastGE.
+     * Any more are kept for the next operations.
      */
-    bufCt = 7;
-    if ((h->malloc1 = malloc(bufCt * sizeof(bufType))) == NULL) 
+    bufCt = info.bufCt;
+    if (bufCt < BPP_MIN_BUF_CT) bufCt = BPP_MIN_BUF_CT;
+    for (hashCt = 1; hashCt < (unsigned int)bufCt; hashCt *= 2)
+        ;
+    /* key prefixes for each buf and 3 sets for root, first for alignment */
+    pfxCt = (h->pfxKind == PFX_NONE) ? 0 : (bufCt + 3) * maxCt;
+    if ((h->malloc1 = malloc(pfxCt * sizeof(prefixType) + bufCt * sizeof(bufType) + hashCt * sizeof(bufType *))) == NULL) 
         return error(bErrMemory);
-    buf = h->malloc1;
+    pfx = h->malloc1;
+    buf = (bufType *)(pfx + pfxCt);
+    h->bufs = buf;
+    h->bufCt = bufCt;
+    h->hash = (bufType **)(buf + bufCt);
+    h->hashMask = hashCt - 1;
+    memset(h->hash, 0, hashCt * sizeof(bufType *));
+    h->pinCt = 0;
+    h->maxPinCt = bufCt - BPP_MIN_BUF_CT;
+    h->pinInternal = info.pinInternal;
+#ifdef BPP_THREADS
+    /* readers come and go all the time, so a change mustn't wait on them all */
+    pthread_rwlockattr_init(&attr);
+#ifdef __GLIBC__
+    pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+#endif
+    pthread_mutex_init(&h->poolLock, NULL);
+    pthread_cond_init(&h->poolFree, NULL);
+    pthread_mutex_init(&h->writeLock, NULL);
+    pthread_mutex_init(&h->scanLock, NULL);
+    pthread_mutex_init(&h->snapLock, NULL);
+#endif
 
     /*
      * Allocate bufs.
      * We need space for the following:
-     *  - bufCt buffers, of size sectorSize
-     *  - 1 buffer for root, of size 3*sectorSize
-     *  - 1 buffer for gbuf, size 3*sectorsize + 2 extra keys
+     *  - 1 image of a packed root, of size 3*sectorSize, if packed
+     *  - 1 root as it is on disk, of size 3*sectorSize, if journaled
+     *  - bufCt buffers, of size nodeSize
+     *  - 1 buffer for root, of size 3*nodeSize
+     *  - 1 buffer for gbuf, size 3*nodeSize + 2 extra keys
      *    to allow for LT pointers in last 2 nodes when gathering 3 full nodes
+     * Direct I/O needs them on page boundaries.
      */
-    if ((h->malloc2 = malloc((bufCt+6) * h->sectorSize + 2 * h->ks)) == NULL) 
+    oldSize = info.journal ? 3 * sectorSize : 0;
+#ifdef BPP_DIRECT_IO
+    if (posix_memalign(&h->malloc2, BPP_PAGE_SIZE, imageSize + oldSize + (bufCt+6) * h->nodeSize + 2 * h->ks))
+        return error(bErrMemory);
+#else
+    if ((h->malloc2 = malloc(imageSize + oldSize + (bufCt+6) * h->nodeSize + 2 * h->ks)) == NULL) 
         return error(bErrMemory);
-    p = h->malloc2;
+#endif
+    h->image = h->malloc2;
+    h->old = h->image + imageSize;
+    p = (nodeType *)(h->old + oldSize);
 
     /* initialize buflist */
     h->bufList.next = buf;
@@ -663,8 +1862,22 @@ bErrType bOpen(bOpenType info, bHandleType *handle) {
         buf->prev = buf - 1;
         buf->modified = boolean_false;
         buf->valid = boolean_false;
-        buf->p = p;
-        p = (nodeType *)((char *)p + h->sectorSize);
+        buf->pinned = boolean_false;
+        buf->held = boolean_false;
+        buf->before = NULL;
+        buf->saved = boolean_false;
+        buf->fix = 0;
+        buf->version = 0;
+        buf->adr = -1;
+        buf->hashNext = NULL;
+        buf->p = buf->own = p;
+        buf->pfx = pfxCt ? pfx + i * maxCt : NULL;
+        buf->pfxValid = boolean_false;
+        buf->packValid = boolean_false;
+#ifdef BPP_THREADS
+        pthread_rwlock_init(&buf->latch, &attr);
+#endif
+        p = (nodeType *)((char *)p + h->nodeSize);
         buf++;
     }
     h->bufList.next->prev = &h->bufList;
@@ -672,37 +1885,69 @@ bErrType bOpen(bOpenType info, bHandleType *handle) {
 
     /* initialize root */
     root = &h->root;
-    root->p = p;
-    p = (nodeType *)((char *)p + 3*h->sectorSize);
-    h->gbuf.p = p;      /* done last to include extra 2 keys */
+    root->p = root->own = p;
+    root->pfx = pfxCt ? pfx + bufCt * maxCt : NULL;
+#ifdef BPP_THREADS
+    pthread_rwlock_init(&root->latch, &attr);
+    pthread_rwlockattr_destroy(&attr);
+#endif
+    p = (nodeType *)((char *)p + 3*h->nodeSize);
+    h->gbuf.p = h->gbuf.own = p;        /* done last to include extra 2 keys */
+
+    if ((rc = bOpenScan(h, (bScanType *)&h->scan)) != 0) return rc;
+
+    root->adr = h->rootAdr;
+    if (!exists) {
+        /* write the header, padded to a sector, ahead of the root */
+        memset(h->gbuf.p, 0, h->sectorSize);
+        memset(&hdr, 0, sizeof(headerType));
+        memcpy(hdr.magic, BPP_MAGIC, sizeof(hdr.magic));
+        hdr.sectorSize = h->sectorSize;
+        hdr.flags = flags;
+        memcpy(h->gbuf.p, &hdr, sizeof(headerType));
+        if (err_ok != ion_fwrite_at(h->fp, 0, h->sectorSize, (byte*) h->gbuf.p))
+            return error(bErrIO);
+    }
 
-    h->curBuf = NULL;
-    h->curKey = NULL;
+#ifdef BPP_DIRECT_IO
+    /* where the file system can't do direct I/O, stay buffered */
+    if (info.directIO && fflush(h->fp) == 0)
+        h->fd = open(info.iName, O_RDWR | O_DIRECT);
+#endif
+#ifdef BPP_MMAP
+    /* map as much as may ever be read; pages past the end of the file
+     * are only touched once written through fd */
+    if (info.mapFile && h->fd < 0 && fflush(h->fp) == 0
+    && (h->fd = open(info.iName, O_RDWR)) >= 0) {
+        void *map = mmap(NULL, BPP_MAP_SIZE, PROT_READ, MAP_SHARED, h->fd, 0);
+        off_t end = lseek(h->fd, 0, SEEK_END);
+        if (map == MAP_FAILED || end < 0) {
+            if (map != MAP_FAILED) munmap(map, BPP_MAP_SIZE);
+            close(h->fd);
+            h->fd = -1;
+        } else {
+            h->map = map;
+            h->mapEnd = (end < (off_t)BPP_MAP_SIZE) ? end : (off_t)BPP_MAP_SIZE;
+        }
+    }
+#endif
 
     /* initialize root */
-    if (ion_fexists(info.iName)) {
+    if (exists) {
         /* open an existing database */
-	    h->fp = ion_fopen(info.iName);
-        if ((rc = readDisk(h, 0, &root)) != 0) return rc;
+        if ((rc = fixBuf(h, h->rootAdr, &root, boolean_false)) != 0) return rc;
         if (ion_fseek(h->fp, 0, ION_FILE_END)) return error(bErrIO);
         if ((h->nextFreeAdr = ion_ftell(h->fp)) == -1) return error(bErrIO);
     }
-    /** TODO make this cleaner **/
-#ifdef ION_ARDUINO
-    else if (NULL != (h->fp = ion_fopen(info.iName)).file) {
-#else
-    else if (NULL != (h->fp = ion_fopen(info.iName))) {
-#endif
+    else {
         /* initialize root */
-        memset(root->p, 0, 3*h->sectorSize);
+        memset(root->p, 0, 3*h->nodeSize);
         leaf(root) = 1;
-        h->nextFreeAdr = 3 * h->sectorSize;
-    }
-    else {
-        /* something's wrong */
-        free(h);
-        return bErrFileNotOpen;
+        root->valid = boolean_true;
+        root->modified = boolean_true;
+        h->nextFreeAdr = h->rootAdr + 3 * h->sectorSize;
     }
+    if ((rc = startJournal(h, exists ? h->nextFreeAdr : h->rootAdr)) != 0) return rc;
 
     *handle = h;
     return bErrOk;
@@ -711,6 +1956,9 @@ bErrType bOpen(bOpenType info, bHandleType *handle) {
 
 bErrType bClose(bHandleType handle) {
     hNode *h = handle;
+    savedType *e;
+    int i;
+
     if (h == NULL) return bErrOk;
 
     /* flush idx */
@@ -723,107 +1971,247 @@ bErrType bClose(bHandleType handle) {
         flushAll(handle);
         ion_fclose(h->fp);
     }
+#ifdef BPP_MMAP
+    if (h->map != NULL) munmap(h->map, BPP_MAP_SIZE);
+#endif
+#if defined(BPP_DIRECT_IO) || defined(BPP_MMAP)
+    if (h->fd >= 0) close(h->fd);
+#endif
 
+#ifdef BPP_THREADS
+    for (i = 0; i < h->bufCt; i++)
+        pthread_rwlock_destroy(&h->bufs[i].latch);
+    pthread_rwlock_destroy(&h->root.latch);
+    pthread_mutex_destroy(&h->poolLock);
+    pthread_cond_destroy(&h->poolFree);
+    pthread_mutex_destroy(&h->writeLock);
+    pthread_mutex_destroy(&h->scanLock);
+    pthread_mutex_destroy(&h->snapLock);
+#endif
+    bCloseScan(h->scan);
+    for (i = 0; i < SAVED_HASH_CT; i++) {
+        while ((e = h->saved[i]) != NULL) {
+            h->saved[i] = e->next;
+            free(e);
+        }
+    }
+
+    if (h->journaled) free(h->journaled);
     if (h->malloc2) free(h->malloc2);
     if (h->malloc1) free(h->malloc1);
     free(h);
     return bErrOk;
 }
 
-bErrType bFindKey(bHandleType handle, void *key, eAdrType *rec) {
+bErrType bCheckpoint(bHandleType handle) {
+    hNode *h = handle;
+    bErrType rc;                /* return code */
+
+    /* readers may be replacing bufs, so hold the pool throughout */
+    mutexLock(&h->writeLock);
+    mutexLock(&h->poolLock);
+    if ((rc = flushAll(handle)) == 0 && (rc = syncFile(h)) == 0)
+        rc = startJournal(h, ion_fend(h->fp));
+    mutexUnlock(&h->poolLock);
+    mutexUnlock(&h->writeLock);
+    return rc;
+}
+
+void bStats(bHandleType handle, bStatsType *stats) {
+    hNode *h = handle;
+
+    mutexLock(&h->writeLock);
+    mutexLock(&h->poolLock);
+    *stats = h->stats;
+    mutexUnlock(&h->poolLock);
+    mutexUnlock(&h->writeLock);
+}
+
+static bErrType findLeaf(hNode *h, scanType *view, void *key, eAdrType rec, modeEnum mode, bufType **b) {
     keyType *mkey;              /* matched key */
     bufType *buf;               /* buffer */
+    bufType *cbuf;              /* child buffer */
+    bAdrType adr;               /* child address */
     bErrType rc;                /* return code */
 
-    hNode *h = handle;
+    /* descend to the leaf for key, latching each node before letting
+       go of its parent; without a key, to the first leaf, or with
+       MODE_LLEQ the last */
     buf = &h->root;
+    latch(h, buf, LATCH_S);
+    buf = asOf(h, view, buf);
+    while (!leaf(buf)) {
+        if (key == NULL)
+            adr = (mode == MODE_LLEQ) ? childGE(lkey(buf)) : childLT(fkey(buf));
+        else if (search(h, buf, key, rec, &mkey, mode) < 0)
+            adr = childLT(mkey);
+        else
+            adr = childGE(mkey);
+        rc = readNode(h, view, adr, &cbuf, LATCH_S);
+        release(h, buf);
+        if (rc) return rc;
+        buf = cbuf;
+    }
+    *b = buf;
+    return bErrOk;
+}
 
-    /* find key, and return address */
-    while (1) {
-        if (leaf(buf)) {
-            if (search(handle, buf, key, 0, &mkey, MODE_FIRST) == 0) {
-                *rec = rec(mkey);
-                h->curBuf = buf; h->curKey = mkey;
-                return bErrOk;
-            } else {
-                return bErrKeyNotFound;
-            }
-        } else {
-            if (search(handle, buf, key, 0, &mkey, MODE_FIRST) < 0) {
-                if ((rc = readDisk(handle, childLT(mkey), &buf)) != 0) return rc;
-            } else {
-                if ((rc = readDisk(handle, childGE(mkey), &buf)) != 0) return rc;
-            }
+static bErrType entryAt(hNode *h, scanType *view, bufType *buf, int i, placeType *at, void *key, eAdrType *rec) {
+    bufType *nbuf;              /* next leaf */
+    bErrType rc;                /* return code */
+
+    /* entry i of leaf buf, or the first in the leaves after if buf
+       has no more; lets go of buf */
+    while (i >= ct(buf)) {
+        if (next(buf) == 0) {
+            release(h, buf);
+            return bErrKeyNotFound;
         }
+        rc = readNode(h, view, next(buf), &nbuf, LATCH_S);
+        release(h, buf);
+        if (rc) return rc;
+        buf = nbuf;
+        i = 0;
     }
+    at->adr = buf->adr;
+    at->version = buf->version;
+    at->pos = i;
+    if (key) memcpy(key, key(fkey(buf) + ks(i)), h->keySize);
+    *rec = rec(fkey(buf) + ks(i));
+    release(h, buf);
+    return bErrOk;
 }
 
-bErrType bFindFirstGreaterOrEqual(bHandleType handle, void *key, void *mkey, eAdrType *rec) {
-    keyType *lgeqkey;              /* matched key */
+static void keep(scanType *scan, placeType *at, void *key, eAdrType rec) {
+    /* place scan at the key just returned */
+    scan->at = *at;
+    memcpy(scan->key, key, scan->h->keySize);
+    scan->rec = rec;
+}
+
+static bErrType findKey(hNode *h, void *key, eAdrType *rec, placeType *at) {
+    keyType *mkey;              /* matched key */
     bufType *buf;               /* buffer */
     bErrType rc;                /* return code */
-    int      cc;
 
+    if ((rc = findLeaf(h, NULL, key, 0, MODE_FIRST, &buf)) != 0) return rc;
+    if (search(h, buf, key, 0, &mkey, MODE_FIRST) != 0) {
+        release(h, buf);
+        return bErrKeyNotFound;
+    }
+    return entryAt(h, NULL, buf, (mkey - fkey(buf)) / h->ks, at, NULL, rec);
+}
+
+static bErrType findGreaterOrEqual(hNode *h, scanType *view, void *key, void *mkey, eAdrType *rec, placeType *at) {
+    keyType *lgeqkey;           /* matched key */
+    bufType *buf;               /* buffer */
+    bErrType rc;                /* return code */
+    int i;
+
+    if ((rc = findLeaf(h, view, key, 0, MODE_LLEQ, &buf)) != 0) return rc;
+    if (ct(buf) == 0) {
+        release(h, buf);
+        return bErrKeyNotFound;
+    }
+    i = 0;
+    if (search(h, buf, key, 0, &lgeqkey, MODE_LLEQ) > 0)
+        /* the first greater key follows, perhaps in the next leaf */
+        i = 1;
+    i += (lgeqkey - fkey(buf)) / h->ks;
+    return entryAt(h, view, buf, i, at, mkey, rec);
+}
+
+bErrType bFindKey(bHandleType handle, void *key, eAdrType *rec) {
+    hNode *h = handle;
+    placeType at;               /* place found */
+    bErrType rc;                /* return code */
+
+    reserve(h, READ_BUF_CT);
+    rc = findKey(h, key, rec, &at);
+    unreserve(h, READ_BUF_CT);
+    if (rc == bErrOk) {
+        mutexLock(&h->scanLock);
+        keep(h->scan, &at, key, *rec);
+        mutexUnlock(&h->scanLock);
+    }
+    return rc;
+}
+
+bErrType bFindFirstGreaterOrEqual(bHandleType handle, void *key, void *mkey, eAdrType *rec) {
     hNode *h = handle;
-    buf = &h->root;
+    placeType at;               /* place found */
+    bErrType rc;                /* return code */
 
-    /* find key, and return address */
-    while (1) {
-        if (leaf(buf)) {
-            if ((cc = search(handle, buf, key, 0, &lgeqkey, MODE_LLEQ)) > 0) {
-                if ((lgeqkey - fkey(buf))/(h->ks) == (ct(buf)))
-                {
-                    return bErrKeyNotFound;
-                }
-                lgeqkey += ks(1);
-            }
-            h->curBuf = buf; h->curKey = lgeqkey;
-            memcpy(mkey, key(lgeqkey), h->keySize);
-            *rec = rec(lgeqkey);
-            
-            return bErrOk;
-        } else {
-            cc = search(handle, buf, key, 0, &lgeqkey, MODE_LLEQ);
-            if (cc < 0) {
-                if ((rc = readDisk(handle, childLT(lgeqkey), &buf)) != 0)
-                {
-                    return rc;
-                }
-            } else {
-                if ((rc = readDisk(handle, childGE(lgeqkey), &buf)) != 0)
-                {
-                    return rc;
-                }
-            }
-        }
+    reserve(h, READ_BUF_CT);
+    rc = findGreaterOrEqual(h, NULL, key, mkey, rec, &at);
+    unreserve(h, READ_BUF_CT);
+    if (rc == bErrOk) {
+        mutexLock(&h->scanLock);
+        keep(h->scan, &at, mkey, *rec);
+        mutexUnlock(&h->scanLock);
     }
+    return rc;
 }
 
-bErrType bInsertKey(bHandleType handle, void *key, eAdrType rec) {
+static bErrType leafInsert(bHandleType handle, bufType *buf, void *key, eAdrType rec, keyType **mkey) {
+    hNode *h = handle;
+    int len;                    /* length to shift */
+
+    /* set mkey to point to insertion point */
+    switch(search(handle, buf, key, rec, mkey, MODE_MATCH)) {
+    case CC_LT:  /* key < mkey */
+        if (!h->dupKeys && 0 != ct(buf) && h->comp((ion_key_t)key, (ion_key_t)*mkey, (ion_key_size_t)(h->keySize)) == CC_EQ)
+            return bErrDupKeys;
+        break;
+    case CC_EQ:  /* key = mkey */
+        return bErrDupKeys;
+        break;
+    case CC_GT:  /* key > mkey */
+        if (!h->dupKeys && h->comp((ion_key_t)key, (ion_key_t)*mkey, (ion_key_size_t)(h->keySize)) == CC_EQ)
+            return bErrDupKeys;
+        *mkey += ks(1);
+        break;
+    }
+
+    /* shift items GE key to right */
+    len = ks(ct(buf)) - (*mkey - fkey(buf));
+    if (len) memmove(*mkey + ks(1), *mkey, len);
+
+    /* insert new key */
+    memcpy(key(*mkey), key, h->keySize);
+    rec(*mkey) = rec;
+    childGE(*mkey) = 0;
+    ct(buf)++;
+    return bErrOk;
+}
+
+static bErrType insertKey(bHandleType handle, void *key, eAdrType rec) {
     int rc;                     /* return code */
     keyType *mkey;              /* match key */
-    int len;                    /* length to shift */
     int cc;                     /* condition code */
     bufType *buf, *root;
-    bufType *tmp[4];
+    bufType *tmp[PACK_MAX_GROUPS];
     unsigned int keyOff;
     bpp_bool_t lastGEvalid;           /* true if GE branch taken */
     bpp_bool_t lastLTvalid;           /* true if LT branch taken after GE branch */
     bAdrType lastGE;            /* last childGE traversed */
     unsigned int lastGEkey;     /* last childGE key traversed */
+    bufType *lastGEbuf;         /* buf of lastGE, held to fix up */
     int height;                 /* height of tree */
+    bpp_bool_t packValid;       /* true if leaf's packed size was known */
 
     hNode *h = handle;
     root = &h->root;
+    lastGEbuf = NULL;
     lastGEvalid = boolean_false;
     lastLTvalid = boolean_false;
 
     /* check for full root */
-    if (ct(root) == 3 * h->maxCt) {
+    if (h->packed ? !packRoom(h, root, key) : ct(root) == 3 * h->maxCt) {
         /* gather root and scatter to 4 bufs */
         /* this increases b-tree height by 1 */
         if ((rc = gatherRoot(handle)) != 0) return rc;
-        if ((rc = scatter(handle, root, fkey(root), 0, tmp)) != 0) return rc;
+        if ((rc = scatter(handle, root, fkey(root), 0, tmp, 2)) != 0) return rc;
     }
     buf = root;
     height = 0;
@@ -831,48 +2219,35 @@ bErrType bInsertKey(bHandleType handle, void *key, eAdrType rec) {
         if (leaf(buf)) {
             /* in leaf, and there' room guaranteed */
 
-            if (height > maxHeight) maxHeight = height;
-
-            /* set mkey to point to insertion point */
-            switch(search(handle, buf, key, rec, &mkey, MODE_MATCH)) {
-            case CC_LT:  /* key < mkey */
-                if (!h->dupKeys && 0 != ct(buf) && h->comp((ion_key_t)key, (ion_key_t)mkey, (ion_key_size_t)(h->keySize)) == CC_EQ)
-                    return bErrDupKeys;
-                break;
-            case CC_EQ:  /* key = mkey */
-                return bErrDupKeys;
-                break;
-            case CC_GT:  /* key > mkey */
-                if (!h->dupKeys && h->comp((ion_key_t)key, (ion_key_t)mkey, (ion_key_size_t)(h->keySize)) == CC_EQ)
-                    return bErrDupKeys;
-                mkey += ks(1);
-                break;
-            }
+            if (height > h->stats.maxHeight) h->stats.maxHeight = height;
 
-            /* shift items GE key to right */
+            if ((rc = leafInsert(handle, buf, key, rec, &mkey)) != 0) return rc;
             keyOff = mkey - fkey(buf);
-            len = ks(ct(buf)) - keyOff;
-            if (len) memmove(mkey + ks(1), mkey, len);
-
-            /* insert new key */
-            memcpy(key(mkey), key, h->keySize);
-            rec(mkey) = rec;
-            childGE(mkey) = 0;
-            ct(buf)++;
+            packValid = buf->packValid;
             if ((rc = writeDisk(buf)) != 0) return rc;
+            if (packValid) {
+                /* the key adds to the packed size, rather than redo it;
+                   keys are measured against one already there */
+                buf->pack.first = (mkey == fkey(buf)) ? lkey(buf) : fkey(buf);
+                packAdd(h, &buf->pack, mkey);
+                buf->packValid = boolean_true;
+            }
 
-            /* if new key is first key, then fixup lastGE key */
-            if (!keyOff && lastLTvalid) {
+            /* if new key is first key, then fixup lastGE key; packed
+               separators may be shorter, and needn't be keys */
+            if (!keyOff && lastLTvalid && !h->packed) {
                 bufType *tbuf;
                 keyType *tkey;
-                if ((rc = readDisk(handle, lastGE, &tbuf)) != 0) return rc;
-                //tkey = fkey(tbuf) + lastGEkey;
-                tkey = fkey(tbuf);
+                if (lastGE == root->adr)
+                    tbuf = root;
+                else if ((rc = readDisk(handle, lastGE, &tbuf, LATCH_X)) != 0)
+                    return rc;
+                tkey = fkey(tbuf) + lastGEkey;
                 memcpy(key(tkey), key, h->keySize);
                 rec(tkey) = rec;
                 if ((rc = writeDisk(tbuf)) != 0) return rc;
             }
-            nKeysIns++;
+            h->stats.nKeysIns++;
             break;
         } else {
             /* internal node, descend to child */
@@ -882,23 +2257,35 @@ bErrType bInsertKey(bHandleType handle, void *key, eAdrType rec) {
           
             /* read child */
             if ((cc = search(handle, buf, key, rec, &mkey, MODE_MATCH)) < 0) {
-                if ((rc = readDisk(handle, childLT(mkey), &cbuf)) != 0) return rc;
+                if ((rc = readDisk(handle, childLT(mkey), &cbuf, LATCH_X)) != 0) return rc;
             } else {
-                if ((rc = readDisk(handle, childGE(mkey), &cbuf)) != 0) return rc;
+                if ((rc = readDisk(handle, childGE(mkey), &cbuf, LATCH_X)) != 0) return rc;
             }
 
             /* check for room in child */
-            if (ct(cbuf) == h->maxCt) {
+            if (h->packed ? !packRoom(h, cbuf, key) : ct(cbuf) == h->maxCt) {
 
-                /* gather 3 bufs and scatter */
+                /* gather 3 bufs and scatter; cbuf may not be the first,
+                   and they're latched left to right */
+                release(h, cbuf);
                 if ((rc = gather(handle, buf, &mkey, tmp)) != 0) return rc;
-                if ((rc = scatter(handle, buf, mkey, 3, tmp)) != 0) return rc;
+                if (h->packed && leaf(tmp[0])) {
+                    /* the key goes in with the rest */
+                    keyType *gkey;      /* gathered key */
+
+                    if (height > h->stats.maxHeight) h->stats.maxHeight = height;
+                    if ((rc = leafInsert(handle, &h->gbuf, key, rec, &gkey)) != 0) return rc;
+                    if ((rc = scatter(handle, buf, mkey, 3, tmp, 2)) != 0) return rc;
+                    h->stats.nKeysIns++;
+                    break;
+                }
+                if ((rc = scatter(handle, buf, mkey, 3, tmp, 2)) != 0) return rc;
 
                 /* read child */
                 if ((cc = search(handle, buf, key, rec, &mkey, MODE_MATCH)) < 0) {
-                    if ((rc = readDisk(handle, childLT(mkey), &cbuf)) != 0) return rc;
+                    if ((rc = readDisk(handle, childLT(mkey), &cbuf, LATCH_X)) != 0) return rc;
                 } else {
-                    if ((rc = readDisk(handle, childGE(mkey), &cbuf)) != 0) return rc;
+                    if ((rc = readDisk(handle, childGE(mkey), &cbuf, LATCH_X)) != 0) return rc;
                 }
             }
             if (cc >= 0 || mkey != fkey(buf)) {
@@ -907,9 +2294,12 @@ bErrType bInsertKey(bHandleType handle, void *key, eAdrType rec) {
                 lastGE = buf->adr;
                 lastGEkey = mkey - fkey(buf);
                 if (cc < 0) lastGEkey -= ks(1);
+                lastGEbuf = buf;
             } else {
                 if (lastGEvalid) lastLTvalid = boolean_true;
             }
+            /* of what's above cbuf, only lastGE may change again */
+            releaseExcept(h, cbuf, h->packed ? NULL : lastGEbuf);
             buf = cbuf;
         }
     }
@@ -917,23 +2307,23 @@ bErrType bInsertKey(bHandleType handle, void *key, eAdrType rec) {
     return bErrOk;
 }
 
-bErrType bUpdateKey(bHandleType handle, void *key, eAdrType rec) {
+static bErrType updateKey(bHandleType handle, void *key, eAdrType rec) {
     int rc;                     /* return code */
     keyType *mkey;              /* match key */
     int cc;                     /* condition code */
     bufType *buf, *root;
-    bufType *tmp[4];
+    bufType *tmp[PACK_MAX_GROUPS];
     int height;                 /* height of tree */
 
     hNode *h = handle;
     root = &h->root;
 
-    /* check for full root */
-    if (ct(root) == 3 * h->maxCt) {
+    /* check for full root; packed, updates don't change sizes */
+    if (!h->packed && ct(root) == 3 * h->maxCt) {
         /* gather root and scatter to 4 bufs */
         /* this increases b-tree height by 1 */
         if ((rc = gatherRoot(handle)) != 0) return rc;
-        if ((rc = scatter(handle, root, fkey(root), 0, tmp)) != 0) return rc;
+        if ((rc = scatter(handle, root, fkey(root), 0, tmp, 2)) != 0) return rc;
     }
     buf = root;
     height = 0;
@@ -941,7 +2331,7 @@ bErrType bUpdateKey(bHandleType handle, void *key, eAdrType rec) {
         if (leaf(buf)) {
             /* in leaf, and there' room guaranteed */
 
-            if (height > maxHeight) maxHeight = height;
+            if (height > h->stats.maxHeight) h->stats.maxHeight = height;
 
             /* set mkey to point to update point */
             switch(search(handle, buf, key, rec, &mkey, MODE_MATCH)) {
@@ -957,6 +2347,7 @@ bErrType bUpdateKey(bHandleType handle, void *key, eAdrType rec) {
 
             /* update key */
             rec(mkey) = rec;
+            if ((rc = writeDisk(buf)) != 0) return rc;
             break;
         } else {
             /* internal node, descend to child */
@@ -966,25 +2357,27 @@ bErrType bUpdateKey(bHandleType handle, void *key, eAdrType rec) {
           
             /* read child */
             if ((cc = search(handle, buf, key, rec, &mkey, MODE_MATCH)) < 0) {
-                if ((rc = readDisk(handle, childLT(mkey), &cbuf)) != 0) return rc;
+                if ((rc = readDisk(handle, childLT(mkey), &cbuf, LATCH_X)) != 0) return rc;
             } else {
-                if ((rc = readDisk(handle, childGE(mkey), &cbuf)) != 0) return rc;
+                if ((rc = readDisk(handle, childGE(mkey), &cbuf, LATCH_X)) != 0) return rc;
             }
 
             /* check for room in child */
-            if (ct(cbuf) == h->maxCt) {
+            if (!h->packed && ct(cbuf) == h->maxCt) {
 
                 /* gather 3 bufs and scatter */
+                release(h, cbuf);
                 if ((rc = gather(handle, buf, &mkey, tmp)) != 0) return rc;
-                if ((rc = scatter(handle, buf, mkey, 3, tmp)) != 0) return rc;
+                if ((rc = scatter(handle, buf, mkey, 3, tmp, 2)) != 0) return rc;
 
                 /* read child */
                 if ((cc = search(handle, buf, key, rec, &mkey, MODE_MATCH)) < 0) {
-                    if ((rc = readDisk(handle, childLT(mkey), &cbuf)) != 0) return rc;
+                    if ((rc = readDisk(handle, childLT(mkey), &cbuf, LATCH_X)) != 0) return rc;
                 } else {
-                    if ((rc = readDisk(handle, childGE(mkey), &cbuf)) != 0) return rc;
+                    if ((rc = readDisk(handle, childGE(mkey), &cbuf, LATCH_X)) != 0) return rc;
                 }
             }
+            releaseExcept(h, cbuf, NULL);
             buf = cbuf;
         }
     }
@@ -992,23 +2385,25 @@ bErrType bUpdateKey(bHandleType handle, void *key, eAdrType rec) {
     return bErrOk;
 }
 
-bErrType bDeleteKey(bHandleType handle, void *key, eAdrType *rec) {
+static bErrType deleteKey(bHandleType handle, void *key, eAdrType *rec) {
     int rc;                     /* return code */
     keyType *mkey;              /* match key */
     int len;                    /* length to shift */
     int cc;                     /* condition code */
     bufType *buf;               /* buffer */
-    bufType *tmp[4];
+    bufType *tmp[PACK_MAX_GROUPS];
     unsigned int keyOff;
     bpp_bool_t lastGEvalid;           /* true if GE branch taken */
     bpp_bool_t lastLTvalid;           /* true if LT branch taken after GE branch */
     bAdrType lastGE;            /* last childGE traversed */
     unsigned int lastGEkey;     /* last childGE key traversed */
+    bufType *lastGEbuf;         /* buf of lastGE, held to fix up */
     bufType *root;
     bufType *gbuf;
 
     hNode *h = handle;
     root = &h->root;
+    lastGEbuf = NULL;
     gbuf = &h->gbuf;
     lastGEvalid = boolean_false;
     lastLTvalid = boolean_false;
@@ -1031,16 +2426,19 @@ bErrType bDeleteKey(bHandleType handle, void *key, eAdrType *rec) {
             if ((rc = writeDisk(buf)) != 0) return rc;
 
             /* if deleted key is first key, then fixup lastGE key */
-            if (!keyOff && lastLTvalid) {
+            if (!keyOff && lastLTvalid && !h->packed) {
                 bufType *tbuf;
                 keyType *tkey;
-                if ((rc = readDisk(handle, lastGE, &tbuf)) != 0) return rc;
+                if (lastGE == root->adr)
+                    tbuf = root;
+                else if ((rc = readDisk(handle, lastGE, &tbuf, LATCH_X)) != 0)
+                    return rc;
                 tkey = fkey(tbuf) + lastGEkey;
                 memcpy(key(tkey), mkey, h->keySize);
                 rec(tkey) = rec(mkey);
                 if ((rc = writeDisk(tbuf)) != 0) return rc;
             }
-            nKeysDel++;
+            h->stats.nKeysDel++;
             break;
         } else {
             /* internal node, descend to child */
@@ -1048,34 +2446,40 @@ bErrType bDeleteKey(bHandleType handle, void *key, eAdrType *rec) {
           
             /* read child */
             if ((cc = search(handle, buf, key, *rec, &mkey, MODE_MATCH)) < 0) {
-                if ((rc = readDisk(handle, childLT(mkey), &cbuf)) != 0) return rc;
+                if ((rc = readDisk(handle, childLT(mkey), &cbuf, LATCH_X)) != 0) return rc;
             } else {
-                if ((rc = readDisk(handle, childGE(mkey), &cbuf)) != 0) return rc;
+                if ((rc = readDisk(handle, childGE(mkey), &cbuf, LATCH_X)) != 0) return rc;
             }
 
-            /* check for room to delete */
-            if (ct(cbuf) == h->maxCt/2) {
+            /* check for room to delete; with an even maxCt, scatter can
+               leave an internal node at maxCt/2, and a join below it can
+               take it under that; packed, half a sector by weight */
+            if (h->packed
+                ? packWeight(h, packStats(h, cbuf), leaf(cbuf)) * 2 <= h->sectorSize
+                : ct(cbuf) <= h->maxCt/2) {
 
                 /* gather 3 bufs and scatter */
+                release(h, cbuf);
                 if ((rc = gather(handle, buf, &mkey, tmp)) != 0) return rc;
 
                 /* if last 3 bufs in root, and count is low enough... */
                 if (buf == root
                 && ct(root) == 2 
-                && ct(gbuf) < (3*(3*h->maxCt))/4) {
+                && (h->packed ? packLow(h, gbuf) : ct(gbuf) < (3*(3*h->maxCt))/4)) {
                     /* collapse tree by one level */
                     scatterRoot(handle);
-                    nNodesDel += 3;
+                    h->stats.nNodesDel += 3;
+                    releaseExcept(h, root, NULL);
                     continue;
                 }
 
-                if ((rc = scatter(handle, buf, mkey, 3, tmp)) != 0) return rc;
+                if ((rc = scatter(handle, buf, mkey, 3, tmp, 0)) != 0) return rc;
 
                 /* read child */
                 if ((cc = search(handle, buf, key, *rec, &mkey, MODE_MATCH)) < 0) {
-                    if ((rc = readDisk(handle, childLT(mkey), &cbuf)) != 0) return rc;
+                    if ((rc = readDisk(handle, childLT(mkey), &cbuf, LATCH_X)) != 0) return rc;
                 } else {
-                    if ((rc = readDisk(handle, childGE(mkey), &cbuf)) != 0) return rc;
+                    if ((rc = readDisk(handle, childGE(mkey), &cbuf, LATCH_X)) != 0) return rc;
                 }
             }
             if (cc >= 0 || mkey != fkey(buf)) {
@@ -1084,9 +2488,12 @@ bErrType bDeleteKey(bHandleType handle, void *key, eAdrType *rec) {
                 lastGE = buf->adr;
                 lastGEkey = mkey - fkey(buf);
                 if (cc < 0) lastGEkey -= ks(1);
+                lastGEbuf = buf;
             } else {
                 if (lastGEvalid) lastLTvalid = boolean_true;
             }
+            /* of what's above cbuf, only lastGE may change again */
+            releaseExcept(h, cbuf, h->packed ? NULL : lastGEbuf);
             buf = cbuf;
         }
     }
@@ -1094,90 +2501,569 @@ bErrType bDeleteKey(bHandleType handle, void *key, eAdrType *rec) {
     return bErrOk;
 }
 
-bErrType bFindFirstKey(bHandleType handle, void *key, eAdrType *rec) {
+static void writeBegin(hNode *h) {
+    /* changes run one at a time, latching from the root down */
+    mutexLock(&h->writeLock);
+    reserve(h, BPP_MIN_BUF_CT);
+    latch(h, &h->root, LATCH_X);
+    keepImage(h, &h->root);
+}
+
+static void writeEnd(hNode *h) {
+    releaseExcept(h, NULL, NULL);
+    mutexLock(&h->snapLock);
+    h->changes++;
+    mutexUnlock(&h->snapLock);
+    unreserve(h, BPP_MIN_BUF_CT);
+    mutexUnlock(&h->writeLock);
+}
+
+bErrType bInsertKey(bHandleType handle, void *key, eAdrType rec) {
     bErrType rc;                /* return code */
-    bufType *buf;               /* buffer */
 
+    writeBegin(handle);
+    rc = insertKey(handle, key, rec);
+    writeEnd(handle);
+    return rc;
+}
+
+bErrType bUpdateKey(bHandleType handle, void *key, eAdrType rec) {
+    bErrType rc;                /* return code */
+
+    writeBegin(handle);
+    rc = updateKey(handle, key, rec);
+    writeEnd(handle);
+    return rc;
+}
+
+bErrType bDeleteKey(bHandleType handle, void *key, eAdrType *rec) {
+    bErrType rc;                /* return code */
+
+    writeBegin(handle);
+    rc = deleteKey(handle, key, rec);
+    writeEnd(handle);
+    return rc;
+}
+
+bErrType bOpenScan(bHandleType handle, bScanType *scan) {
     hNode *h = handle;
-    buf = &h->root;
-    while (!leaf(buf)) {
-        if ((rc = readDisk(handle, childLT(fkey(buf)), &buf)) != 0) return rc;
+    scanType *s;
+
+    if ((s = malloc(sizeof(scanType) + h->keySize)) == NULL) return error(bErrMemory);
+    s->h = h;
+    s->at.adr = -1;
+    s->key = (keyType *)(s + 1);
+    s->snap = boolean_false;
+    s->stale = boolean_false;
+    s->asOf = 0;
+    s->nextSnap = NULL;
+    *scan = s;
+    return bErrOk;
+}
+
+bErrType bOpenSnapshot(bHandleType handle, bScanType *scan) {
+    hNode *h = handle;
+    scanType *s;
+    bErrType rc;                /* return code */
+
+    if ((rc = bOpenScan(handle, scan)) != 0) return rc;
+    s = *scan;
+
+    /* wait out the change running, so the snapshot sees all of it */
+    mutexLock(&h->writeLock);
+    mutexLock(&h->snapLock);
+    s->snap = boolean_true;
+    s->asOf = h->changes;
+    s->nextSnap = h->snaps;
+    h->snaps = s;
+    mutexUnlock(&h->snapLock);
+    mutexUnlock(&h->writeLock);
+    return bErrOk;
+}
+
+bErrType bCloseScan(bScanType scan) {
+    scanType *s = scan;
+    hNode *h = s->h;
+    scanType **ps;              /* link to an open snapshot */
+
+    if (s->snap) {
+        mutexLock(&h->snapLock);
+        for (ps = &h->snaps; *ps != NULL && *ps != s; ps = &(*ps)->nextSnap)
+            ;
+        if (*ps != NULL) *ps = s->nextSnap;
+        pruneImages(h);
+        mutexUnlock(&h->snapLock);
     }
-    if (ct(buf) == 0) return bErrKeyNotFound;
-    memcpy(key, key(fkey(buf)), h->keySize);
-    *rec = rec(fkey(buf));
-    h->curBuf = buf; h->curKey = fkey(buf);
+    free(scan);
     return bErrOk;
 }
 
-bErrType bFindLastKey(bHandleType handle, void *key, eAdrType *rec) {
+static scanType *viewOf(scanType *s) {
+    bpp_bool_t stale;
+
+    /* the snapshot s reads, or NULL to read the tree as it is */
+    if (!s->snap) return NULL;
+    mutexLock(&s->h->snapLock);
+    stale = s->stale;
+    mutexUnlock(&s->h->snapLock);
+    return stale ? NULL : s;
+}
+
+bpp_bool_t bScanSnapshot(bScanType scan) {
+    return viewOf(scan) != NULL;
+}
+
+bErrType bScanFirstGreaterOrEqual(bScanType scan, void *key, void *mkey, eAdrType *rec) {
+    scanType *s = scan;
+    hNode *h = s->h;
+    placeType at;               /* place found */
     bErrType rc;                /* return code */
+
+    reserve(h, READ_BUF_CT);
+    rc = findGreaterOrEqual(h, viewOf(s), key, mkey, rec, &at);
+    unreserve(h, READ_BUF_CT);
+    if (rc == bErrOk) keep(s, &at, mkey, *rec);
+    return rc;
+}
+
+static bErrType scanEnd(scanType *s, bpp_bool_t last, void *key, eAdrType *rec) {
+    hNode *h = s->h;
+    scanType *view;             /* snapshot read */
+    placeType at;               /* place found */
     bufType *buf;               /* buffer */
+    bErrType rc;                /* return code */
 
-    hNode *h = handle;
-    buf = &h->root;
-    while (!leaf(buf)) {
-        if ((rc = readDisk(handle, childGE(lkey(buf)), &buf)) != 0) return rc;
+    reserve(h, READ_BUF_CT);
+    view = viewOf(s);
+    rc = findLeaf(h, view, NULL, 0, last ? MODE_LLEQ : MODE_FIRST, &buf);
+    if (rc == bErrOk) {
+        if (ct(buf) == 0) {
+            release(h, buf);
+            rc = bErrKeyNotFound;
+        } else {
+            rc = entryAt(h, view, buf, last ? ct(buf) - 1 : 0, &at, key, rec);
+        }
     }
-    if (ct(buf) == 0) return bErrKeyNotFound;
-    memcpy(key, key(lkey(buf)), h->keySize);
-    *rec = rec(lkey(buf));
-    h->curBuf = buf; h->curKey = lkey(buf);
+    unreserve(h, READ_BUF_CT);
+    if (rc == bErrOk) keep(s, &at, key, *rec);
+    return rc;
+}
+
+bErrType bScanFirstKey(bScanType scan, void *key, eAdrType *rec) {
+    return scanEnd(scan, boolean_false, key, rec);
+}
+
+bErrType bScanLastKey(bScanType scan, void *key, eAdrType *rec) {
+    return scanEnd(scan, boolean_true, key, rec);
+}
+
+static bErrType refind(scanType *s, scanType *view, bufType **b, int *i) {
+    hNode *h = s->h;
+    keyType *mkey;              /* matched key */
+    bufType *buf;               /* buffer */
+    bErrType rc;                /* return code */
+    int cc;                     /* condition code */
+
+    /* the leaf has changed since, so find where the current key
+       is, or would be, from the root; *i is the first entry after it */
+    if ((rc = findLeaf(h, view, s->key, s->rec, MODE_MATCH, &buf)) != 0) return rc;
+    cc = search(h, buf, s->key, s->rec, &mkey, MODE_MATCH);
+    *i = (mkey - fkey(buf)) / h->ks + (cc >= 0);
+    *b = buf;
     return bErrOk;
 }
 
-bErrType bFindNextKey(bHandleType handle, void *key, eAdrType *rec) {
+bErrType bScanNextKey(bScanType scan, void *key, eAdrType *rec) {
+    scanType *s = scan;
+    hNode *h = s->h;
+    scanType *view;             /* snapshot read */
+    placeType at;               /* place found */
+    bufType *buf;               /* buffer */
     bErrType rc;                /* return code */
-    keyType *nkey;              /* next key */
+    int i;
+
+    if (s->at.adr == -1) return bErrKeyNotFound;
+    reserve(h, READ_BUF_CT);
+    view = viewOf(s);
+    if ((rc = readNode(h, view, s->at.adr, &buf, LATCH_S)) == bErrOk) {
+        /* a snapshot's leaves never change */
+        i = s->at.pos + 1;
+        if (view == NULL && buf->version != s->at.version) {
+            release(h, buf);
+            rc = refind(s, view, &buf, &i);
+        }
+        if (rc == bErrOk) rc = entryAt(h, view, buf, i, &at, key, rec);
+    }
+    unreserve(h, READ_BUF_CT);
+    if (rc == bErrOk) keep(s, &at, key, *rec);
+    return rc;
+}
+
+bErrType bScanPrevKey(bScanType scan, void *key, eAdrType *rec) {
+    scanType *s = scan;
+    hNode *h = s->h;
+    scanType *view;             /* snapshot read */
+    placeType at;               /* place found */
     bufType *buf;               /* buffer */
+    bufType *pbuf;              /* previous leaf */
+    bAdrType padr;              /* address of previous leaf */
+    bErrType rc;                /* return code */
+    int i;
 
-    hNode *h = handle;
-    if ((buf = h->curBuf) == NULL) return bErrKeyNotFound;
-    if (h->curKey == lkey(buf)) {
-        /* current key is last key in leaf node */
-        if (next(buf)) {
-            /* fetch next set */
-            if ((rc = readDisk(handle, next(buf), &buf)) != 0) return rc;
-            nkey = fkey(buf);
-        } else {
-            /* no more sets */
-            return bErrKeyNotFound;
+    if (s->at.adr == -1) return bErrKeyNotFound;
+    reserve(h, READ_BUF_CT);
+    view = viewOf(s);
+    if ((rc = readNode(h, view, s->at.adr, &buf, LATCH_S)) != 0) goto done;
+    i = s->at.pos;
+    if (view == NULL && buf->version != s->at.version) {
+        release(h, buf);
+        buf = NULL;
+    }
+    while (1) {
+        if (buf == NULL) {
+            if ((rc = refind(s, view, &buf, &i)) != 0) goto done;
+            if (i && h->comp((ion_key_t)s->key, (ion_key_t)key(fkey(buf) + ks(i - 1)),
+                (ion_key_size_t)(h->keySize)) == 0
+            && (!h->dupKeys || rec(fkey(buf) + ks(i - 1)) == s->rec))
+                /* skip the current key itself */
+                i--;
+        }
+        /* leaves are latched left to right, so only try the one before */
+        for (i--; i < 0 && prev(buf); i = ct(buf) - 1) {
+            padr = prev(buf);
+            if ((rc = readNode(h, view, padr, &pbuf, LATCH_TRY)) != 0) {
+                release(h, buf);
+                goto done;
+            }
+            if (pbuf == NULL) break;
+            release(h, buf);
+            buf = pbuf;
         }
+        if (i >= 0 || prev(buf) == 0) break;
+
+        /* wait out the change that has it, then look again */
+        release(h, buf);
+        if ((rc = readDisk(h, padr, &pbuf, LATCH_S)) != 0) goto done;
+        release(h, pbuf);
+        buf = NULL;
+    }
+    if (i < 0) {
+        release(h, buf);
+        rc = bErrKeyNotFound;
     } else {
-        /* bump to next key */
-        nkey = h->curKey + ks(1);
+        rc = entryAt(h, view, buf, i, &at, key, rec);
     }
-    memcpy(key, key(nkey), h->keySize);
-    *rec = rec(nkey);
-    h->curBuf = buf; h->curKey = nkey;
-    return bErrOk;
+done:
+    unreserve(h, READ_BUF_CT);
+    if (rc == bErrOk) keep(s, &at, key, *rec);
+    return rc;
+}
+
+bErrType bFindFirstKey(bHandleType handle, void *key, eAdrType *rec) {
+    hNode *h = handle;
+    bErrType rc;                /* return code */
+
+    mutexLock(&h->scanLock);
+    rc = bScanFirstKey(h->scan, key, rec);
+    mutexUnlock(&h->scanLock);
+    return rc;
+}
+
+bErrType bFindLastKey(bHandleType handle, void *key, eAdrType *rec) {
+    hNode *h = handle;
+    bErrType rc;                /* return code */
+
+    mutexLock(&h->scanLock);
+    rc = bScanLastKey(h->scan, key, rec);
+    mutexUnlock(&h->scanLock);
+    return rc;
+}
+
+bErrType bFindNextKey(bHandleType handle, void *key, eAdrType *rec) {
+    hNode *h = handle;
+    bErrType rc;                /* return code */
+
+    mutexLock(&h->scanLock);
+    rc = bScanNextKey(h->scan, key, rec);
+    mutexUnlock(&h->scanLock);
+    return rc;
 }
 
 bErrType bFindPrevKey(bHandleType handle, void *key, eAdrType *rec) {
+    hNode *h = handle;
     bErrType rc;                /* return code */
-    keyType *pkey;              /* previous key */
-    keyType *fkey;              /* first key */
+
+    mutexLock(&h->scanLock);
+    rc = bScanPrevKey(h->scan, key, rec);
+    mutexUnlock(&h->scanLock);
+    return rc;
+}
+
+/* most levels bBulkLoad can build; every node has at least 4 children */
+#define BULK_MAX_LEVELS 16
+
+typedef struct {                /* a level being built by bBulkLoad */
+    keyType *e;                 /* [key,rec,child] for the last 3 nodes,
+                                   then 1 to pass up to the parent */
+    int n;                      /* number of entries */
+    int np;                     /* number of pending nodes */
+    int cnt[2];                 /* entries in pending nodes */
+    packType pk;                /* packed size of keys in last node */
+    bAdrType pendAdr[2];        /* addresses of pending nodes */
+    bAdrType prevAdr;           /* last node written, or 0 if none */
+} bulkLevelType;
+
+typedef struct {
+    bulkLevelType lv[BULK_MAX_LEVELS];
+    int t[2];                   /* entries per leaf, internal node */
+    int size;                   /* packed size per node */
+} bulkType;
+
+static bErrType bulkWrite(hNode *h, int isLeaf, keyType *e, int n,
+    bAdrType adr, bAdrType prevAdr, bAdrType nextAdr) {
     bufType *buf;               /* buffer */
+    bErrType rc;                /* return code */
 
-    hNode *h = handle;
-    if ((buf = h->curBuf) == NULL) return bErrKeyNotFound;
-    fkey = fkey(buf);
-    if (h->curKey == fkey) {
-        /* current key is first key in leaf node */
-        if (prev(buf)) {
-            /* fetch previous set */
-            if ((rc = readDisk(handle, prev(buf), &buf)) != 0) return rc;
-            pkey = fkey(buf) + ks((ct(buf) - 1));
-        } else {
-            /* no more sets */
-            return bErrKeyNotFound;
-        }
+    /* gbuf isn't otherwise used while loading */
+    buf = &h->gbuf;
+    memset(p(buf), 0, h->sectorSize);
+    if (isLeaf) {
+        leaf(buf) = 1;
+        ct(buf) = n;
+        prev(buf) = prevAdr;
+        next(buf) = nextAdr;
+        memcpy(fkey(buf), e, ks(n));
     } else {
-        /* bump to previous key */
-        pkey = h->curKey - ks(1);
+        /* the first child is LT the rest */
+        leaf(buf) = 0;
+        ct(buf) = n - 1;
+        childLT(fkey(buf)) = childGE(e);
+        memcpy(fkey(buf), e + ks(1), ks(n - 1));
+    }
+    mutexLock(&h->poolLock);
+    rc = nodeWrite(h, adr, h->sectorSize, buf->p, NULL);
+    if (rc == 0) {
+        h->stats.nDiskWrites++;
+        h->stats.nNodesIns++;
+    }
+    mutexUnlock(&h->poolLock);
+    return rc;
+}
+
+static bErrType bulkAdd(hNode *h, bulkType *bk, int l, keyType *e);
+
+static bErrType bulkPush(hNode *h, bulkType *bk, int l, keyType *first, bAdrType *adr) {
+    keyType *pe;                /* entry for parent */
+
+    /* address a node, and add its first key to its parent */
+    if (l + 1 == BULK_MAX_LEVELS) return error(bErrMemory);
+    *adr = allocAdr(h);
+    pe = bk->lv[l].e + ks(3 * bk->t[l != 0]);
+    memcpy(pe, first, ks(1));
+    if (h->truncate && l == 0 && first != bk->lv[l].e)
+        shorten(h, key(pe), first - ks(1));
+    childGE(pe) = *adr;
+    return bulkAdd(h, bk, l + 1, pe);
+}
+
+static bErrType bulkAdd(hNode *h, bulkType *bk, int l, keyType *e) {
+    bulkLevelType *lv;
+    packType pk;                /* packed size of last node, with e */
+    bErrType rc;                /* return code */
+    int t;                      /* entries per node */
+    int cur;                    /* first entry of last node */
+    int full;                   /* true if last node is full */
+
+    lv = &bk->lv[l];
+    t = bk->t[l != 0];
+    if (lv->e == NULL && (lv->e = malloc(ks(3 * t + 1))) == NULL)
+        return error(bErrMemory);
+
+    /* packed, the last node is full once e won't fit; internal
+       nodes keep all but their first key */
+    cur = (lv->np > 0 ? lv->cnt[0] : 0) + (lv->np > 1 ? lv->cnt[1] : 0);
+    full = lv->n - cur == t;
+    if (h->packed && lv->n - cur > (l != 0)) {
+        pk = lv->pk;
+        pk.first = lv->e + ks(cur + (l != 0));
+        packAdd(h, &pk, e);
+        if (packSize(h, &pk, l == 0) > bk->size) full = 1;
+    }
+
+    if (full) {
+        if (lv->np == 2) {
+            /* oldest pending node can't be one of the last 2 now */
+            if ((rc = bulkWrite(h, l == 0, lv->e, lv->cnt[0],
+                lv->pendAdr[0], lv->prevAdr, lv->pendAdr[1])) != 0) return rc;
+            lv->prevAdr = lv->pendAdr[0];
+            lv->pendAdr[0] = lv->pendAdr[1];
+            memmove(lv->e, lv->e + ks(lv->cnt[0]), ks(lv->n - lv->cnt[0]));
+            lv->n -= lv->cnt[0];
+            cur -= lv->cnt[0];
+            lv->cnt[0] = lv->cnt[1];
+            lv->np--;
+        }
+        /* last node is full, so it's pending */
+        if ((rc = bulkPush(h, bk, l, lv->e + ks(cur), &lv->pendAdr[lv->np])) != 0)
+            return rc;
+        lv->cnt[lv->np] = lv->n - cur;
+        lv->np++;
+        cur = lv->n;
+        lv->pk.n = 0;
+        lv->pk.sumT = 0;
+    }
+    memcpy(lv->e + ks(lv->n), e, ks(1));
+    lv->n++;
+    if (h->packed && lv->n - cur > (l != 0)) {
+        lv->pk.first = lv->e + ks(cur + (l != 0));
+        packAdd(h, &lv->pk, lv->e + ks(lv->n - 1));
     }
-    memcpy(key, key(pkey), h->keySize);
-    *rec = rec(pkey);
-    h->curBuf = buf; h->curKey = pkey;
     return bErrOk;
-}
\ No newline at end of file
+}
+
+static bErrType bulkFinish(hNode *h, bulkType *bk) {
+    bulkLevelType *lv;
+    bufType *root;
+    packType pk;                /* packed size of level */
+    bErrType rc;                /* return code */
+    bAdrType lastAdr;           /* address of last node */
+    int first[PACK_MAX_GROUPS + 1];     /* split of last 2 nodes, packed */
+    int last;                   /* first entry of last node */
+    int pend;                   /* first entry of last pending node */
+    int start;                  /* first entry of node */
+    int c;                      /* entries in last 2 nodes */
+    int l;
+    int i;
+
+    for (l = 0; ; l++) {
+        lv = &bk->lv[l];
+
+        /* a level of no more than 3 nodes that fits is the root */
+        if (lv->prevAdr == 0 && lv->n - (l != 0) <= 3 * (int)h->maxCt
+        && (!h->packed || packSize(h, packRun(h, lv->e + ks(l != 0),
+                lv->n - (l != 0), &pk), l == 0) <= 3 * h->sectorSize))
+            break;
+
+        /* last 2 nodes share what's left, as a half-full node at least */
+        last = lv->cnt[0] + (lv->np > 1 ? lv->cnt[1] : 0);
+        pend = last - lv->cnt[lv->np - 1];
+        if (h->packed) {
+            /* packed, by weight */
+            if (packWeight(h, &lv->pk, l == 0) * 2 < h->sectorSize) {
+                c = packSplit(h, lv->e + ks(pend + (l != 0)),
+                    lv->n - pend - (l != 0), l == 0, 0, 1, first);
+                if (c == 1)
+                    last = lv->n;
+                else if (c == 2)
+                    last = pend + (l != 0) + first[1];
+            }
+        } else if (lv->n - last < (int)h->maxCt / 2 + (l != 0)) {
+            c = lv->cnt[lv->np - 1] + lv->n - last;
+            if (c <= (int)h->maxCt + (l != 0))
+                last = lv->n;
+            else
+                last = lv->n - c / 2;
+        }
+        lastAdr = 0;
+        if (last < lv->n)
+            if ((rc = bulkPush(h, bk, l, lv->e + ks(last), &lastAdr)) != 0)
+                return rc;
+        for (i = 0, start = 0; i < lv->np; start += lv->cnt[i], i++) {
+            c = (i == lv->np - 1) ? last - start : lv->cnt[i];
+            if ((rc = bulkWrite(h, l == 0, lv->e + ks(start), c, lv->pendAdr[i],
+                i ? lv->pendAdr[i - 1] : lv->prevAdr,
+                (i == lv->np - 1) ? lastAdr : lv->pendAdr[i + 1])) != 0) return rc;
+        }
+        if (lastAdr)
+            if ((rc = bulkWrite(h, l == 0, lv->e + ks(last), lv->n - last,
+                lastAdr, lv->pendAdr[lv->np - 1], 0)) != 0) return rc;
+    }
+
+    /* everything else is on disk, so the tree is whole once this is */
+    root = &h->root;
+    memset(root->p, 0, 3 * h->nodeSize);
+    if (l == 0) {
+        leaf(root) = 1;
+        ct(root) = lv->n;
+        if (lv->n) memcpy(fkey(root), lv->e, ks(lv->n));
+    } else {
+        leaf(root) = 0;
+        ct(root) = lv->n - 1;
+        childLT(fkey(root)) = childGE(lv->e);
+        memcpy(fkey(root), lv->e + ks(1), ks(lv->n - 1));
+    }
+    if (l > h->stats.maxHeight) h->stats.maxHeight = l;
+    return writeDisk(root);
+}
+
+static bErrType bulkLoad(bHandleType handle, bIterType iter, void *arg, int fill) {
+    bulkType bk;                /* levels being built */
+    keyType *e;                 /* entry read */
+    keyType *last;              /* last entry read */
+    eAdrType rec;               /* record address read */
+    bufType *root;
+    bErrType rc;                /* return code */
+    int cc;                     /* condition code */
+    int n;                      /* number of keys read */
+    int i;
+
+    hNode *h = handle;
+    root = &h->root;
+    if (ct(root) || !leaf(root)) return bErrNotEmpty;
+    if (fill <= 0) fill = BPP_BULK_FILL;
+
+    /* leaves hold maxCt keys; internal nodes hold maxCt keys, maxCt+1 children */
+    memset(&bk, 0, sizeof(bulkType));
+    for (i = 0; i < 2; i++) {
+        bk.t[i] = (h->maxCt + i) * fill / 100;
+        if (bk.t[i] < (int)h->maxCt / 2 + i) bk.t[i] = h->maxCt / 2 + i;
+        if (bk.t[i] > (int)h->maxCt + i) bk.t[i] = h->maxCt + i;
+        /* packed, nodes fill by size instead */
+        if (h->packed) bk.t[i] = h->maxCt + i;
+    }
+    bk.size = h->sectorSize * fill / 100;
+    if (bk.size < h->sectorSize / 2) bk.size = h->sectorSize / 2;
+    if (bk.size > h->sectorSize) bk.size = h->sectorSize;
+    if ((e = malloc(ks(1))) == NULL) return error(bErrMemory);
+    if ((bk.lv[0].e = malloc(ks(3 * bk.t[0] + 1))) == NULL) {
+        free(e);
+        return error(bErrMemory);
+    }
+
+    n = 0;
+    while ((rc = iter(arg, key(e), &rec)) == bErrOk) {
+        rec(e) = rec;
+        childGE(e) = 0;
+        if (n) {
+            last = bk.lv[0].e + ks(bk.lv[0].n - 1);
+            cc = h->comp((ion_key_t)key(e), (ion_key_t)key(last), (ion_key_size_t)(h->keySize));
+            if (cc == 0 && !h->dupKeys) {
+                rc = bErrDupKeys;
+                break;
+            }
+            if (cc < 0 || (cc == 0 && rec <= rec(last))) {
+                rc = bErrKeyOrder;
+                break;
+            }
+        }
+        if ((rc = bulkAdd(h, &bk, 0, e)) != 0) break;
+        n++;
+    }
+    if (rc == bErrKeyNotFound) {
+        if ((rc = bulkFinish(h, &bk)) == 0) h->stats.nKeysIns += n;
+    }
+
+    for (i = 0; i < BULK_MAX_LEVELS; i++)
+        if (bk.lv[i].e) free(bk.lv[i].e);
+    free(e);
+    return rc;
+}
+
+bErrType bBulkLoad(bHandleType handle, bIterType iter, void *arg, int fill) {
+    bErrType rc;                /* return code */
+
+    writeBegin(handle);
+    rc = bulkLoad(handle, iter, arg, fill);
+    writeEnd(handle);
+    return rc;
+}
@@ -35,17 +35,22 @@ typedef char (*bCompType)(ion_key_t key1, ion_key_t key2, ion_key_size_t size);
  * implementation independent *
  ******************************/
 
-/* statistics */
-int maxHeight;          /* maximum height attained */
-int nNodesIns;          /* number of nodes inserted */
-int nNodesDel;          /* number of nodes deleted */
-int nKeysIns;           /* number of keys inserted */
-int nKeysDel;           /* number of keys deleted */
-int nDiskReads;         /* number of disk reads */
-int nDiskWrites;        /* number of disk writes */
+/* statistics, for one tree since bOpen */
+typedef struct {
+    int maxHeight;          /* maximum height attained */
+    int nNodesIns;          /* number of nodes inserted */
+    int nNodesDel;          /* number of nodes deleted */
+    int nKeysIns;           /* number of keys inserted */
+    int nKeysDel;           /* number of keys deleted */
+    int nDiskReads;         /* number of disk reads */
+    int nDiskWrites;        /* number of disk writes */
+    int nBufHits;           /* number of node reads served by a buffer */
+    int nBufMisses;         /* number of node reads that went to disk */
+    int nMapReads;          /* number of node reads served in place by a mapping */
+} bStatsType;
 
 /* line number for last IO or memory error */
-int bErrLineNo;
+extern int bErrLineNo;
 
 typedef boolean_e bpp_bool_t;
 
@@ -58,17 +63,82 @@ typedef enum {
     bErrFileNotOpen,
     bErrFileExists,
     bErrIO,
-    bErrMemory 
+    bErrMemory,
+    bErrNotEmpty,
+    bErrKeyOrder
 } bErrType;
 
 typedef void* bHandleType;
 
+typedef void* bScanType;
+
+/* supplies keys for bBulkLoad: fills in key and rec and returns
+ * bErrOk, or returns bErrKeyNotFound when there are no more, or
+ * any other error to abandon the load
+ */
+typedef bErrType (*bIterType)(void *arg, void *key, eAdrType *rec);
+
+/* keeps len bytes of the index file at adr, old, as they are on disk
+ * before a node first overwrites them after bOpen or bCheckpoint:
+ * returns bErrOk once they are safely kept, or any other error to
+ * leave them as they are
+ */
+typedef bErrType (*bJournalType)(void *arg, bAdrType adr, int len, void *old);
+
+/* fewest node buffers a tree can work with */
+#define BPP_MIN_BUF_CT  7
+
+/* largest sector size; the root must count its keys in 15 bits */
+#define BPP_MAX_SECTOR_SIZE     65536
+
+/* default percentage of each node filled by bBulkLoad */
+#define BPP_BULK_FILL   100
+
+/* sector sizes for direct I/O must be a multiple of this */
+#define BPP_PAGE_SIZE   4096
+
+/* most of a file mapped; nodes past it are read as usual */
+#define BPP_MAP_SIZE    ((size_t)1 << (sizeof(void *) < 8 ? 28 : 36))
+
+/* a packed node may hold this many sectors of keys once unpacked */
+#define BPP_PACK_RATIO  4
+
+/* packing needs a sector to hold this many of the largest entries */
+#define BPP_PACK_MIN_ENTRIES    16
+
+/* defined to search nodes through an in-memory array of key prefixes */
+#if !defined(ION_ARDUINO)
+#define BPP_KEY_PREFIX
+#endif
+
+/* defined where direct I/O is available */
+#if defined(__linux__) && !defined(ION_ARDUINO)
+#define BPP_DIRECT_IO
+#endif
+
+/* defined where the index file can be memory mapped */
+#if defined(__linux__) && !defined(ION_ARDUINO)
+#define BPP_MMAP
+#endif
+
+/* defined to let threads share a tree */
+#if !defined(ION_ARDUINO)
+#define BPP_THREADS
+#endif
+
 typedef struct {                /* info for bOpen() */
     char *iName;                /* name of index file */
     int keySize;                /* length, in bytes, of key */
     bpp_bool_t dupKeys;               /* true if duplicate keys allowed */
     int sectorSize;             /* size of sector on disk */
     bCompType comp;             /* pointer to compare function */
+    int bufCt;                  /* node buffers; at least BPP_MIN_BUF_CT */
+    bpp_bool_t pinInternal;     /* true to keep internal nodes buffered */
+    bpp_bool_t directIO;        /* true to bypass the OS page cache */
+    bpp_bool_t packKeys;        /* true to compress keys on disk */
+    bpp_bool_t mapFile;         /* true to read nodes through mmap */
+    bJournalType journal;       /* called before nodes are overwritten, or NULL */
+    void *journalArg;           /* passed to journal */
 } bOpenType;
 
 /***********************
@@ -83,8 +153,67 @@ bErrType bOpen(bOpenType info, bHandleType *handle);
      * returns:
      *   bErrOk                 open was successful
      *   bErrMemory             insufficient memory
-     *   bErrSectorSize         sector size too small or not 0 mod 4
+     *   bErrSectorSize         sector size too small, too large, not
+     *                          0 mod 4, or not 0 mod BPP_PAGE_SIZE
+     *                          with directIO
      *   bErrFileNotOpen        unable to open index file
+     * notes:
+     *   The sector size is kept in the index file, and an existing
+     *   tree is opened with that rather than info.sectorSize.  With
+     *   directIO, nodes are read and written around the OS page cache
+     *   where BPP_DIRECT_IO is defined and the file system allows;
+     *   elsewhere the tree quietly uses buffered I/O.
+     *   With mapFile, and not directIO, the file is mapped read-only
+     *   where BPP_MMAP is defined, up to BPP_MAP_SIZE bytes.  Lookups
+     *   and cursor moves then use nodes in place in the mapping
+     *   rather than copying them to buffers, and count them in
+     *   nMapReads (see bStats); a node about to change is copied to a buffer
+     *   first, and written back through the file as usual.  Packed
+     *   nodes are unpacked from the mapping.  Where it can't be
+     *   mapped, the tree quietly reads as usual.
+     *   Nodes are kept in bufCt buffers, found by address through a
+     *   hash table, and replaced least recently used first.  With
+     *   pinInternal, internal nodes are never replaced once read, so
+     *   long as BPP_MIN_BUF_CT buffers are left for the rest; a warm
+     *   tree then reads at most one leaf from disk per lookup, and
+     *   none if the leaves fit too.  nBufHits and nBufMisses count
+     *   node reads served from buffers and from disk (see bStats).
+     *
+     *   Where BPP_THREADS is defined, any number of threads may use
+     *   the tree at once.  Each node has a latch, shared by readers
+     *   and taken exclusively by the thread changing it; readers
+     *   latch a node before letting go of its parent, or of the leaf
+     *   to its left, so lookups and scans pass inserts and deletes
+     *   anywhere the two don't meet.  Changes are made one at a time.
+     *   Each reading thread needs 2 buffers, and a change
+     *   BPP_MIN_BUF_CT, for as long as it runs; threads wait for
+     *   buffers, so bufCt bounds how many run at once.  The
+     *   sequential calls share a scan kept in the handle; threads
+     *   scanning at once should each use their own, from bOpenScan.
+     *
+     *   Where BPP_KEY_PREFIX is defined, and comp is one of the
+     *   dictionary_compare_ functions and dupKeys is false, each
+     *   buffer also keeps 8 bytes of each key, past any its keys all
+     *   share, side by side and ordered as comp orders them.  Searches
+     *   run over those without calling comp, which is then only needed
+     *   between keys longer than 8 bytes that share a prefix.
+     *
+     *   With packKeys, a new tree stores each leaf's keys on disk as
+     *   the bytes they all share, then what is left of each without
+     *   trailing zeros; with dupKeys false and comp one of
+     *   dictionary_compare_char_array or _null_terminated_string,
+     *   internal nodes keep only as much of each separator as tells
+     *   its neighbours apart.  Nodes then fill by packed size, up to
+     *   BPP_PACK_RATIO sectors of keys each once read.  Where a sector
+     *   can't hold BPP_PACK_MIN_ENTRIES of the largest entries, and in
+     *   trees made without it, keys are stored as they are.  Whether a
+     *   tree is packed is kept in the index file.
+     *
+     *   With a journal, the file as it was at bOpen, or at the last
+     *   bCheckpoint, can always be put back: before a node is written
+     *   over any of it, journal is given what was there, once for each
+     *   node until the next checkpoint.  Nodes added since are only
+     *   ever written past it.
      */
 
 bErrType bClose(bHandleType handle);
@@ -95,6 +224,33 @@ bErrType bClose(bHandleType handle);
      *   bErrOk                 file closed, resources deleted
      */
 
+bErrType bCheckpoint(bHandleType handle);
+    /*
+     * input:
+     *   handle                 handle returned by bOpen
+     * returns:
+     *   bErrOk                 every change is on disk
+     *   bErrIO                 i/o error
+     *   bErrMemory             insufficient memory
+     *   any error from the journal
+     * notes:
+     *   Writes every node changed out to the file, and waits for the
+     *   file to reach the disk.  Waits for a change running to finish.
+     *   The journal, if any, starts over from the file as it is now.
+     */
+
+void bStats(bHandleType handle, bStatsType *stats);
+    /*
+     * input:
+     *   handle                 handle returned by bOpen
+     * output:
+     *   stats                  the tree's statistics
+     * notes:
+     *   Each tree counts on its own, under its own locks, so trees
+     *   used by different threads don't share counters.  Waits for a
+     *   change running to finish.
+     */
+
 bErrType bInsertKey(bHandleType handle, void *key, eAdrType rec);
     /*
      * input:
@@ -219,6 +375,94 @@ bErrType bFindPrevKey(bHandleType handle, void *key, eAdrType *rec);
      *   bErrKeyNotFound        key not found
      */
 
+bErrType bOpenScan(bHandleType handle, bScanType *scan);
+    /*
+     * input:
+     *   handle                 handle returned by bOpen
+     * output:
+     *   scan                   scan of the tree, used in bScan calls
+     * returns:
+     *   bErrOk                 scan opened
+     *   bErrMemory             insufficient memory
+     * notes:
+     *   A scan keeps its place by the key and record address last
+     *   returned, and holds nothing of the tree between calls.  Where
+     *   the leaf it was in has changed since, it finds its place
+     *   again from the root, so keys inserted or deleted between calls
+     *   are seen or passed over as they fall.
+     */
+
+bErrType bOpenSnapshot(bHandleType handle, bScanType *scan);
+    /*
+     * input:
+     *   handle                 handle returned by bOpen
+     * output:
+     *   scan                   scan of the tree as it is now
+     * returns:
+     *   bErrOk                 scan opened
+     *   bErrMemory             insufficient memory
+     * notes:
+     *   As bOpenScan, but the scan sees the tree as it was when
+     *   opened, whatever changes follow.  Waits for a change running
+     *   to finish.  Changes never wait for a snapshot: while one is
+     *   open, a change keeps a copy of each node it alters that the
+     *   snapshot still reads, in memory, until the snapshot closes.
+     *   Should memory for a copy run out, the snapshots needing it go
+     *   on as scans from bOpenScan.
+     */
+
+bErrType bCloseScan(bScanType scan);
+    /*
+     * input:
+     *   scan                   scan returned by bOpenScan or bOpenSnapshot
+     * returns:
+     *   bErrOk                 scan closed
+     */
+
+bpp_bool_t bScanSnapshot(bScanType scan);
+    /*
+     * input:
+     *   scan                   scan returned by bOpenScan or bOpenSnapshot
+     * returns:
+     *   boolean_true           scan still sees the tree as it was opened
+     *   boolean_false          scan sees the tree as it is
+     */
+
+bErrType bScanFirstGreaterOrEqual(bScanType scan, void *key, void *mkey, eAdrType *rec);
+bErrType bScanFirstKey(bScanType scan, void *key, eAdrType *rec);
+bErrType bScanLastKey(bScanType scan, void *key, eAdrType *rec);
+bErrType bScanNextKey(bScanType scan, void *key, eAdrType *rec);
+bErrType bScanPrevKey(bScanType scan, void *key, eAdrType *rec);
+    /*
+     * As bFindFirstGreaterOrEqual, bFindFirstKey, bFindLastKey,
+     * bFindNextKey and bFindPrevKey, placing scan rather than the
+     * handle's own scan.
+     */
+
+bErrType bBulkLoad(bHandleType handle, bIterType iter, void *arg, int fill);
+    /*
+     * input:
+     *   handle                 handle returned by bOpen
+     *   iter                   called for each key, in ascending order
+     *   arg                    passed to iter
+     *   fill                   percentage of each node to fill, or 0
+     *                          for BPP_BULK_FILL
+     * returns:
+     *   bErrOk                 operation successful
+     *   bErrNotEmpty           tree already holds keys
+     *   bErrKeyOrder           keys not in ascending order
+     *   bErrDupKeys            duplicate keys (and info.dupKeys = false)
+     *   any error from iter
+     * notes:
+     *   Builds the tree bottom up into an empty tree: leaves are
+     *   filled in order, and each level of internal nodes as the one
+     *   below fills, so every node is written once, in address
+     *   order.  Nodes are filled to fill percent, but never less than
+     *   half or more than full; the last two on each level share
+     *   what's left.  With dupKeys, equal keys must be in ascending
+     *   order of rec.  If the load fails, the tree is left empty.
+     */
+
 #ifdef  __cplusplus
 }
 #endif
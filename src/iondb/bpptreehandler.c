@@ -29,6 +29,246 @@ bpptree_get_value_filename(
 	sprintf(str, "%d.val", id);
 }
 
+void
+bpptree_get_log_filename(
+	ion_dictionary_id_t id,
+	char 				*str
+)
+{
+	sprintf(str, "%d.wal", id);
+}
+
+/**
+@brief		Frees the first @p count retired values.
+
+@details	If freeing one fails, it and those after it stay retired,
+			to be freed another time.
+*/
+static err_t
+bpptree_release_retired(
+	bpptree_t		*bpptree,
+	int				count
+)
+{
+	err_t			err;
+	int				i;
+
+	err	= err_ok;
+	for (i = 0; i < count; i++)
+	{
+		err	= lfb_delete_all(&(bpptree->values), bpptree->retired[i]);
+		if (err_ok != err)
+		{
+			break;
+		}
+	}
+	if (0 == i)
+	{
+		return err;
+	}
+
+	memmove(
+		bpptree->retired,
+		bpptree->retired + i,
+		(bpptree->retired_count - i) * sizeof(file_offset_t)
+	);
+	bpptree->retired_count	-= i;
+	bpptree->retired_safe	= (bpptree->retired_safe > i) ? bpptree->retired_safe - i : 0;
+
+	return err;
+}
+
+/**
+@brief		Writes everything out to the files, and starts the log over.
+*/
+static err_t
+bpptree_save(
+	bpptree_t		*bpptree
+)
+{
+	err_t			err;
+
+	err	= (NULL != bpptree->log) ? wal_sync(bpptree->log) : err_ok;
+	if (err_ok == err && bErrOk != bCheckpoint(bpptree->tree))
+	{
+		err	= err_file_write_error;
+	}
+	if (err_ok == err)
+	{
+		err	= ion_fsync(bpptree->values.file_handle);
+	}
+	if (err_ok == err && NULL != bpptree->log)
+	{
+		err	= wal_checkpoint(bpptree->log);
+		if (err_ok == err)
+		{
+			/* Only snapshot cursors may yet read the values retired. */
+			bpptree->retired_safe	= bpptree->retired_count;
+			if (0 == bpptree->snapshots)
+			{
+				err	= bpptree_release_retired(bpptree, bpptree->retired_safe);
+			}
+		}
+	}
+
+	return err;
+}
+
+/**
+@brief		Logs a change once made, checkpointing if the log is full.
+*/
+static err_t
+bpptree_log(
+	bpptree_t		*bpptree,
+	wal_op_t		op,
+	ion_key_t		key,
+	ion_value_t		value
+)
+{
+	err_t			err;
+
+	if (NULL == bpptree->log || bpptree->log->replaying)
+	{
+		return err_ok;
+	}
+
+	err	= wal_append(bpptree->log, op, key, value);
+	if (err_ok == err && bpptree->checkpoint_size <= wal_size(bpptree->log))
+	{
+		err	= bpptree_save(bpptree);
+	}
+
+	return err;
+}
+
+/**
+@brief		Keeps a page of the tree's file in the log before it is
+			overwritten.
+*/
+static bErrType
+bpptree_journal(
+	void			*log,
+	bAdrType		adr,
+	int				len,
+	void			*old
+)
+{
+	if (err_ok != wal_keep((wal_t *) log, adr, len, (byte *) old))
+	{
+		return bErrIO;
+	}
+
+	return bErrOk;
+}
+
+/**
+@brief		Puts a page of the tree's file back as it was at the last
+			checkpoint.
+*/
+static err_t
+bpptree_restore_page(
+	void			*file,
+	wal_record_t	*record
+)
+{
+	if (wal_op_page != record->op)
+	{
+		return err_ok;
+	}
+
+	return ion_fwrite_at(*(file_handle_t *) file, record->offset, record->length, record->bytes);
+}
+
+/**
+@brief		Redoes a change logged since the last checkpoint.
+*/
+static err_t
+bpptree_redo(
+	void			*dictionary,
+	wal_record_t	*record
+)
+{
+	switch (record->op)
+	{
+		case wal_op_insert:
+		{
+			return bpptree_insert(dictionary, record->key, record->value);
+		}
+		case wal_op_update:
+		{
+			return bpptree_update(dictionary, record->key, record->value);
+		}
+		case wal_op_delete:
+		{
+			return bpptree_delete(dictionary, record->key);
+		}
+		default:
+		{
+			return err_ok;
+		}
+	}
+}
+
+/**
+@brief		Opens the log, and puts the tree's file back as it was at
+			the last checkpoint.
+*/
+static err_t
+bpptree_open_log(
+	bpptree_t			*bpptree,
+	ion_dictionary_id_t	id,
+	int					key_size,
+	int					value_size
+)
+{
+	err_t				err;
+	file_handle_t		file;
+	char				log_filename[20];
+	char				addr_filename[20];
+
+	bpptree->log			= malloc(sizeof(wal_t));
+	if (NULL == bpptree->log)
+	{
+		return err_out_of_memory;
+	}
+
+	bpptree_get_log_filename(id, log_filename);
+	err	= wal_open(
+			bpptree->log,
+			log_filename,
+			key_size,
+			value_size,
+			BPPTREE_WAL_BATCH,
+			BPPTREE_WAL_INTERVAL
+		);
+	if (err_ok != err)
+	{
+		free(bpptree->log);
+		bpptree->log		= NULL;
+		return err;
+	}
+
+	bpptree_get_addr_filename(id, addr_filename);
+	if (ion_fexists(addr_filename))
+	{
+		file	= ion_fopen(addr_filename);
+		err		= wal_replay(bpptree->log, bpptree_restore_page, &file);
+		if (err_ok == err)
+		{
+			err	= ion_fsync(file);
+		}
+		ion_fclose(file);
+	}
+	if (err_ok != err)
+	{
+		wal_close(bpptree->log);
+		free(bpptree->log);
+		bpptree->log		= NULL;
+	}
+
+	return err;
+}
+
 void
 bpptree_init(
 	dictionary_handler_t 	*handler
@@ -89,7 +329,7 @@ bpptree_insert(
 			// TODO: lfb_delete from values
 			return err_unable_to_insert;
 		}
-		return err_ok;
+		return bpptree_log(bpptree, wal_op_insert, key, value);
 	}
 	else
 	{
@@ -144,7 +384,21 @@ bpptree_create_dictionary(
 {
 	bpptree_t				*bpptree;
 	bErrType				bErr;
+	err_t					err;
 	bOpenType				info;
+	int					sector_size;
+
+	/* The page size must be a power of two. */
+	sector_size				= (0 < dictionary_size) ? (dictionary_size & ~(BPPTREE_DIRECT_IO | BPPTREE_MAP_FILE | BPPTREE_WAL)) : 0;
+	if (0 == sector_size)
+	{
+		sector_size			= BPPTREE_SECTOR_SIZE;
+	}
+	if (	BPPTREE_MIN_SECTOR_SIZE > sector_size || BPP_MAX_SECTOR_SIZE < sector_size ||
+		0 != (sector_size & (sector_size - 1)))
+	{
+		return err_dictionary_initialization_failed;
+	}
 
 	bpptree					= malloc(sizeof(bpptree_t));
 	if (NULL == bpptree)
@@ -157,7 +411,25 @@ bpptree_create_dictionary(
 	bpptree->values.file_handle		= ion_fopen(value_filename);
 	
 	bpptree->values.next_empty		= FILE_NULL;
+	bpptree->snapshots			= 0;
+	bpptree->retired			= NULL;
+	bpptree->retired_count			= 0;
+	bpptree->retired_size			= 0;
+	bpptree->retired_safe			= 0;
+	bpptree->log				= NULL;
+	bpptree->checkpoint_size		= BPPTREE_WAL_CHECKPOINT;
 		// FIXME: read this from a property bag.
+
+	if (0 < dictionary_size && 0 != (dictionary_size & BPPTREE_WAL))
+	{
+		err	= bpptree_open_log(bpptree, id, key_size, value_size);
+		if (err_ok != err)
+		{
+			ion_fclose(bpptree->values.file_handle);
+			free(bpptree);
+			return err_dictionary_initialization_failed;
+		}
+	}
 	
 	// FIXME: VARIABLE NAMES!
 	char addr_filename[20];
@@ -165,12 +437,35 @@ bpptree_create_dictionary(
 	info.iName					= addr_filename;
 	info.keySize				= key_size;
 	info.dupKeys				= boolean_false;
-	// FIXME: HOW DO WE SET BLOCK SIZE?
-	info.sectorSize				= 256;
+	info.sectorSize				= sector_size;
 	info.comp				= compare;
+	info.bufCt				= BPPTREE_BUFFER_COUNT;
+	info.pinInternal			= boolean_true;
+	info.directIO				= (0 < dictionary_size && 0 != (dictionary_size & BPPTREE_DIRECT_IO))
+						? boolean_true : boolean_false;
+	info.mapFile				= (0 < dictionary_size && 0 != (dictionary_size & BPPTREE_MAP_FILE))
+						? boolean_true : boolean_false;
+	/* Text keys share prefixes and trailing padding worth packing away;
+	   on Arduino the unpacked nodes would not fit in memory. */
+#if !defined(ION_ARDUINO)
+	info.packKeys				= (key_type_char_array == key_type
+						|| key_type_null_terminated_string == key_type)
+						? boolean_true : boolean_false;
+#else
+	info.packKeys				= boolean_false;
+#endif
+	info.journal				= (NULL != bpptree->log) ? bpptree_journal : NULL;
+	info.journalArg				= bpptree->log;
 	
 	if (bErrOk != (bErr = bOpen(info, &(bpptree->tree))))
 	{
+		if (NULL != bpptree->log)
+		{
+			wal_close(bpptree->log);
+			free(bpptree->log);
+		}
+		ion_fclose(bpptree->values.file_handle);
+		free(bpptree);
 		return err_dictionary_initialization_failed;
 	}
 
@@ -182,6 +477,28 @@ bpptree_create_dictionary(
 	//todo: need to check to make sure that the handler is registered
 	dictionary->handler							= handler;		
 
+	if (NULL != bpptree->log)
+	{
+		/* Redo what was logged since the checkpoint, and keep it. */
+		err	= wal_replay(bpptree->log, bpptree_redo, dictionary);
+		if (err_ok == err)
+		{
+			err	= bpptree_save(bpptree);
+		}
+		if (err_ok != err)
+		{
+			/* Keep the log, so that the next open tries again. */
+			bClose(bpptree->tree);
+			wal_close(bpptree->log);
+			free(bpptree->log);
+			ion_fclose(bpptree->values.file_handle);
+			free(bpptree->retired);
+			free(bpptree);
+			dictionary->instance	= NULL;
+			return err_dictionary_initialization_failed;
+		}
+	}
+
 	return err_ok;
 }
 
@@ -193,16 +510,53 @@ bpptree_delete(
 {
 	bpptree_t		*bpptree;
 	bErrType		bErr;
+	err_t			err;
 	file_offset_t		offset;
 	
 	bpptree	= (bpptree_t *) dictionary->instance;
 	
 	bErr	= bDeleteKey(bpptree->tree, key, &offset);
 	if (bErrKeyNotFound != bErr)
+	{
+		err	= bpptree_retire_values(bpptree, offset);
+		if (err_ok != err)
+		{
+			return err;
+		}
+		return bpptree_log(bpptree, wal_op_delete, key, NULL);
+	}
+	
+	return err_ok;
+}
+
+err_t
+bpptree_retire_values(
+		bpptree_t		*bpptree,
+		file_offset_t	offset
+)
+{
+	file_offset_t		*retired;
+	int			size;
+	
+	if (0 == bpptree->snapshots && NULL == bpptree->log)
 	{
 		return lfb_delete_all(&(bpptree->values), offset);
 	}
 	
+	if (bpptree->retired_count == bpptree->retired_size)
+	{
+		size		= (0 < bpptree->retired_size) ? 2 * bpptree->retired_size : 16;
+		retired		= realloc(bpptree->retired, size * sizeof(file_offset_t));
+		if (NULL == retired)
+		{
+			/* The values are never freed, rather than freed early. */
+			return err_ok;
+		}
+		bpptree->retired	= retired;
+		bpptree->retired_size	= size;
+	}
+	bpptree->retired[bpptree->retired_count++]	= offset;
+	
 	return err_ok;
 }
 
@@ -215,8 +569,10 @@ bpptree_delete_dictionary(
 	
 	char addr_filename[20];
 	char value_filename[20];
+	char log_filename[20];
 	bpptree_get_addr_filename(dictionary->instance->id, addr_filename);
 	bpptree_get_value_filename(dictionary->instance->id, value_filename);
+	bpptree_get_log_filename(dictionary->instance->id, log_filename);
 
 	error = bpptree_close_dictionary(dictionary);
 
@@ -224,6 +580,7 @@ bpptree_delete_dictionary(
 
 	ion_fremove(addr_filename);
 	ion_fremove(value_filename);
+	ion_fremove(log_filename);
 	
 	return err_ok;
 }
@@ -237,12 +594,18 @@ bpptree_update(
 {
 	bpptree_t		*bpptree;
 	bErrType		bErr;
+	err_t			err;
 	file_offset_t		offset;
+	file_offset_t		fresh;
 	
 	bpptree	= (bpptree_t *) dictionary->instance;
 	
 	bErr	= bFindKey(bpptree->tree, key, &offset);
-	if (bErrKeyNotFound != bErr)
+	if (bErrKeyNotFound == bErr)
+	{
+		return bpptree_insert(dictionary, key, value);
+	}
+	else if (0 == bpptree->snapshots && NULL == bpptree->log)
 	{
 		lfb_update_all(
 			&(bpptree->values),
@@ -252,7 +615,87 @@ bpptree_update(
 		);
 	}
 	else
-		return bpptree_insert(dictionary, key, value);
+	{
+		/* Snapshot cursors, or the checkpoint, may yet need the old values. */
+		err	= lfb_put_all(
+				&(bpptree->values),
+				offset,
+				bpptree->super.record.value_size,
+				(byte *)value,
+				&fresh
+			);
+		if (err_ok != err || bErrOk != bUpdateKey(bpptree->tree, key, fresh))
+		{
+			return err_unable_to_insert;
+		}
+		err	= bpptree_retire_values(bpptree, offset);
+		if (err_ok != err)
+		{
+			return err;
+		}
+	}
+	
+	return bpptree_log(bpptree, wal_op_update, key, value);
+}
+
+err_t
+bpptree_sync(
+		dictionary_t 	*dictionary
+)
+{
+	bpptree_t		*bpptree;
+	
+	bpptree	= (bpptree_t *) dictionary->instance;
+	if (NULL == bpptree->log)
+	{
+		return err_ok;
+	}
+	
+	return wal_sync(bpptree->log);
+}
+
+err_t
+bpptree_poll(
+		dictionary_t 	*dictionary
+)
+{
+	bpptree_t		*bpptree;
+	
+	bpptree	= (bpptree_t *) dictionary->instance;
+	if (NULL == bpptree->log)
+	{
+		return err_ok;
+	}
+	
+	return wal_poll(bpptree->log);
+}
+
+err_t
+bpptree_checkpoint(
+		dictionary_t 	*dictionary
+)
+{
+	return bpptree_save((bpptree_t *) dictionary->instance);
+}
+
+err_t
+bpptree_set_group_commit(
+		dictionary_t 	*dictionary,
+		int				batch_size,
+		unsigned long	interval,
+		file_offset_t	checkpoint_size
+)
+{
+	bpptree_t		*bpptree;
+	
+	bpptree	= (bpptree_t *) dictionary->instance;
+	if (NULL == bpptree->log)
+	{
+		return err_uninitialized;
+	}
+	
+	wal_set_commit(bpptree->log, batch_size, interval);
+	bpptree->checkpoint_size	= checkpoint_size;
 	
 	return err_ok;
 }
@@ -276,6 +719,7 @@ bpptree_find(
 		free(bCursor);
 		return err_out_of_memory;
 	}
+	bCursor->scan				= NULL;
 
 	(*cursor)->dictionary 		= dictionary;
 	(*cursor)->status 			= cs_cursor_uninitialized;
@@ -368,9 +812,18 @@ bpptree_find(
 				key_size
 			);
 
+			/* Each cursor sees the tree as it is now, and keeps its own
+			   place, so cursors can run at once and alongside changes. */
+			if (bErrOk != bOpenSnapshot(bpptree->tree, &bCursor->scan))
+			{
+				bpptree_destroy_cursor(cursor);
+				return err_out_of_memory;
+			}
+			bpptree->snapshots++;
+
 			/* We search for the FGEQ of the Lower bound. */
-			bFindFirstGreaterOrEqual(
-			                         bpptree->tree,
+			bScanFirstGreaterOrEqual(
+			                         bCursor->scan,
 			                         (*cursor)->predicate->statement.range.lower_bound,
 			                         bCursor->cur_key,
 			                         &bCursor->offset
@@ -393,9 +846,16 @@ bpptree_find(
 		{
 			bErrType err;
 
+			if (bErrOk != bOpenSnapshot(bpptree->tree, &bCursor->scan))
+			{
+				bpptree_destroy_cursor(cursor);
+				return err_out_of_memory;
+			}
+			bpptree->snapshots++;
+
 			/* We search for first key in B++ tree. */
-			err	= bFindFirstKey(
-					bpptree->tree,
+			err	= bScanFirstKey(
+					bCursor->scan,
 					bCursor->cur_key,
 					&bCursor->offset
 				);
@@ -441,9 +901,10 @@ bpptree_next(
 		return cursor->status;
 	}
 	else if(cursor->status == cs_cursor_initialized ||
-			cursor->status == cs_cursor_active)
+			cursor->status == cs_cursor_active ||
+			cursor->status == cs_possible_data_inconsistency)
 	{
-		if(cursor->status == cs_cursor_active)
+		if(cursor->status != cs_cursor_initialized)
 		{
 			boolean_t 	is_valid = boolean_true;
 			switch(cursor->predicate->type)
@@ -462,7 +923,7 @@ bpptree_next(
 					/*do bFindNextKey then test_predicate */
 					if (-1 == bCursor->offset)
 					{
-						bErrType bErr = bFindNextKey(bpptree->tree, bCursor->cur_key, &bCursor->offset);
+						bErrType bErr = bScanNextKey(bCursor->scan, bCursor->cur_key, &bCursor->offset);
 						if (bErrOk != bErr || boolean_false == bpptree_test_predicate(cursor, bCursor->cur_key))
 						{
 							is_valid = boolean_false;
@@ -474,7 +935,7 @@ bpptree_next(
 				{
 					if (-1 == bCursor->offset)
 					{
-						bErrType bErr = bFindNextKey(bpptree->tree, bCursor->cur_key, &bCursor->offset);
+						bErrType bErr = bScanNextKey(bCursor->scan, bCursor->cur_key, &bCursor->offset);
 						if (bErrOk != bErr)
 						{
 							is_valid = boolean_false;
@@ -499,6 +960,12 @@ bpptree_next(
 			cursor->status 	= cs_cursor_active;
 		}
 
+		if (NULL != bCursor->scan && boolean_false == bScanSnapshot(bCursor->scan))
+		{
+			/* Changes made since the cursor was found may show. */
+			cursor->status	= cs_possible_data_inconsistency;
+		}
+
 		/* Get key */
 		memcpy(
 	       record->key,
@@ -525,8 +992,24 @@ bpptree_destroy_cursor(
 	dict_cursor_t	 **cursor
 )
 {
+	bCursorType *bCursor = (bCursorType *) (*cursor);
+	bpptree_t *bpptree = (bpptree_t *) (*cursor)->dictionary->instance;
+
 	(*cursor)->predicate->destroy(&(*cursor)->predicate);
-	free( (( bCursorType *) (*cursor))->cur_key);
+	if (NULL != bCursor->scan)
+	{
+		bCloseScan(bCursor->scan);
+		if (0 == --bpptree->snapshots)
+		{
+			/* No cursor is left to read the values changes replaced,
+			   though the checkpoint may be. */
+			bpptree_release_retired(
+				bpptree,
+				(NULL == bpptree->log) ? bpptree->retired_count : bpptree->retired_safe
+			);
+		}
+	}
+	free(bCursor->cur_key);
 	free( (*cursor));
 	*cursor = NULL;
 }
@@ -607,14 +1090,27 @@ bpptree_close_dictionary(
 {
 	bpptree_t		*bpptree;
 	bErrType		bErr;
+	err_t			err;
 
 	bpptree			= (bpptree_t *) dictionary->instance;
+	err				= err_ok;
+	if (NULL != bpptree->log)
+	{
+		/* Leave nothing to redo when next opened. */
+		err			= bpptree_save(bpptree);
+	}
 	bErr			= bClose(bpptree->tree);
+	if (NULL != bpptree->log)
+	{
+		wal_close(bpptree->log);
+		free(bpptree->log);
+	}
 	ion_fclose(bpptree->values.file_handle);
+	free(bpptree->retired);
 	free(dictionary->instance);
 	dictionary->instance	= NULL;
 	
-	if (bErrOk != bErr)
+	if (bErrOk != bErr || err_ok != err)
 	{
 		return err_colllection_destruction_error;
 	}
@@ -17,19 +17,90 @@ extern "C" {
 #include "dictionary.h"
 #include "kv_system.h"
 #include "linkedfilebag.h"
+#include "writeaheadlog.h"
 #include "bpptree.h"
 
+/**
+@brief		The number of node buffers each B+ tree keeps in memory.
+*/
+#ifdef ION_ARDUINO
+#define BPPTREE_BUFFER_COUNT	BPP_MIN_BUF_CT
+#else
+#define BPPTREE_BUFFER_COUNT	64
+#endif
+
+/**
+@brief		The page size of a B+ tree made without one given.
+*/
+#ifdef ION_ARDUINO
+#define BPPTREE_SECTOR_SIZE	256
+#else
+#define BPPTREE_SECTOR_SIZE	4096
+#endif
+
+/**
+@brief		The smallest page size a B+ tree may be given.
+*/
+#define BPPTREE_MIN_SECTOR_SIZE	256
+
+/**
+@brief		Or'd into the dictionary size to read and write a B+ tree's
+		pages around the operating system's page cache.
+*/
+#define BPPTREE_DIRECT_IO	(1 << 30)
+
+/**
+@brief		Or'd into the dictionary size to read a B+ tree's pages
+		through a memory mapping of its file.
+*/
+#define BPPTREE_MAP_FILE	(1 << 29)
+
+/**
+@brief		Or'd into the dictionary size to log each change ahead of
+		making it, so that a B+ tree survives a crash.
+*/
+#define BPPTREE_WAL		(1 << 28)
+
+/**
+@brief		Changes a logged B+ tree syncs to disk together, by default.
+*/
+#define BPPTREE_WAL_BATCH	64
+
+/**
+@brief		Most milliseconds a logged change waits to be synced, by
+		default.
+*/
+#define BPPTREE_WAL_INTERVAL	50
+
+/**
+@brief		Bytes a B+ tree's log may grow to before a checkpoint, by
+		default.
+*/
+#ifdef ION_ARDUINO
+#define BPPTREE_WAL_CHECKPOINT	16384
+#else
+#define BPPTREE_WAL_CHECKPOINT	(4L << 20)
+#endif
+
 typedef struct bplusplustree
 {
 	dictionary_parent_t	super;
 	bHandleType		tree;
 	lfb_t			values;
+	int			snapshots;	/**< Cursors open on snapshots */
+	file_offset_t		*retired;	/**< Values snapshots may still read */
+	int			retired_count;	/**< Number of retired values */
+	int			retired_size;	/**< Room in retired */
+	int			retired_safe;	/**< Retired values the files no longer need */
+	wal_t			*log;		/**< Write-ahead log, or NULL */
+	file_offset_t		checkpoint_size;/**< Log size that brings a checkpoint */
 } bpptree_t;
 
 typedef struct {
     dict_cursor_t   super;  	/**< Supertype of cursor 		*/
     ion_key_t 		cur_key; 	/**< Current key we're visiting */
     file_offset_t   offset; 	/**< offset in LFB; holds value */
+    bScanType		scan;		/**< Snapshot of the tree, or NULL */
 } bCursorType;
 
 /**
@@ -101,14 +172,33 @@ bpptree_query(
 
 @details	Creates as instance of a dictionary given a @p key_size and
 			@p value_size, in bytes as well as the @p dictionary size
- 	 	 	which is the number of buckets available in the hashmap.
+			which is the page size of the tree, in bytes.
+
+			The page size must be a power of two from
+			@ref BPPTREE_MIN_SECTOR_SIZE to 65536; 0 or less
+			uses @ref BPPTREE_SECTOR_SIZE. Or in
+			@ref BPPTREE_DIRECT_IO for direct I/O, which needs a
+			multiple of 4096, or @ref BPPTREE_MAP_FILE to read pages
+			in place in a mapping of the file. A tree already on disk
+			keeps the page size it was made with.
+
+			Or in @ref BPPTREE_WAL to log changes.  Each insert,
+			update and delete is then appended to a log, synced every
+			@ref BPPTREE_WAL_BATCH changes or
+			@ref BPPTREE_WAL_INTERVAL milliseconds, and the tree's
+			pages and values are not overwritten until the next
+			checkpoint, which the log brings on as it grows.  Opening
+			the dictionary after a crash puts the tree back as it was
+			at the last checkpoint, and redoes each change synced
+			since.  The dictionary size, flags and all, must be the
+			same each time it is opened.
 
 @param 		key_size
 				The size of the key in bytes.
 @param 		value_size
 				The size of the value in bytes.
 @param 		dictionary_size
-				The size of the hashmap in discrete units
+				The page size, and flags.
 @param		compare
 				Function pointer for the comparison function for the collection.
 @param 		handler
@@ -158,11 +248,102 @@ bpptree_delete_dictionary(
 		dictionary_t 	*dictionary
 );
 
+/**
+@brief		Frees a key's values once no snapshot cursor can read them.
+
+@details	While cursors are open on snapshots, the values are kept
+			in the file until the last of those cursors is destroyed;
+			while changes are logged, until the next checkpoint too.
+
+@param 		bpptree
+				The B+ tree the values belong to.
+@param 		offset
+				The first of the values, in the values file.
+@return		The status of the operation.
+ */
+err_t
+bpptree_retire_values(
+		bpptree_t		*bpptree,
+		file_offset_t	offset
+);
+
+/**
+@brief		Syncs the changes logged so far to disk.
+
+@param 		dictionary
+				The instance of the dictionary to sync.
+@return		The status of the sync; @c err_ok if changes are not
+			logged.
+ */
+err_t
+bpptree_sync(
+		dictionary_t 	*dictionary
+);
+
+/**
+@brief		Syncs the changes logged so far if the oldest has waited
+			out the commit interval.
+
+@details	Changes are otherwise only synced as more are logged, so
+			call this regularly to bound how long the last changes
+			before a lull wait.
+
+@param 		dictionary
+				The instance of the dictionary to sync.
+@return		The status of the sync; @c err_ok if changes are not
+			logged.
+ */
+err_t
+bpptree_poll(
+		dictionary_t 	*dictionary
+);
+
+/**
+@brief		Writes every change out to the dictionary's files, and
+			empties its log.
+
+@details	Values deleted or updated since the last checkpoint are
+			freed, unless a snapshot cursor may still read them.
+
+@param 		dictionary
+				The instance of the dictionary to checkpoint.
+@return		The status of the checkpoint.
+ */
+err_t
+bpptree_checkpoint(
+		dictionary_t 	*dictionary
+);
+
+/**
+@brief		Changes how a logged dictionary syncs its changes.
+
+@param 		dictionary
+				The instance of the dictionary.
+@param 		batch_size
+				Changes synced together; 1 or less syncs each.
+@param 		interval
+				Most milliseconds a change waits to be synced.
+@param 		checkpoint_size
+				Bytes the log may grow to before a checkpoint.
+@return		@c err_ok, or @c err_uninitialized if changes are not
+			logged.
+ */
+err_t
+bpptree_set_group_commit(
+		dictionary_t 	*dictionary,
+		int				batch_size,
+		unsigned long	interval,
+		file_offset_t	checkpoint_size
+);
+
 /**
 @brief		Updates the value for a given key.
 
 @details	Updates the value for a given @pkey.  If the key does not currently
 			exist in the hashmap, it will be created and the value sorted.
+			While cursors are open on snapshots, or changes are
+			logged, the values are written afresh rather than over
+			the ones those cursors, or the last checkpoint, may read.
 
 @param 		dictionary
 				The instance of the dictionary to be updated.
@@ -185,7 +366,11 @@ bpptree_update(
 
 @details 	Generates a cursor that allows the traversal of items where
 			the items key satisfies the @p predicate (if the underlying
-			implementation allows it).
+			implementation allows it).  Range and all-records cursors
+			see the dictionary as it was when found, however it is
+			changed while they are open; should a snapshot not be kept,
+			the cursor reads on as the dictionary is, and its status is
+			@ref cs_possible_data_inconsistency from then on.
 
 @param 		dictionary
 				The instance of the dictionary to search.
@@ -118,6 +118,101 @@ dictionary_delete(
 	return dictionary->handler->remove(dictionary,key);
 }
 
+/**
+@brief		Copy a key of @p key_length bytes into @p padded, zeroing the
+			rest of the dictionary's key size.
+*/
+static status_t
+dictionary_pad_key(
+	dictionary_t		*dictionary,
+	ion_key_t			padded,
+	const void			*key,
+	int					key_length
+)
+{
+	int key_size = dictionary->instance->record.key_size;
+
+	if (key_length < 0 || key_length > key_size)
+	{
+		return err_key_too_long;
+	}
+	memcpy(padded, key, key_length);
+	memset(padded + key_length, 0, key_size - key_length);
+
+	return err_ok;
+}
+
+status_t
+dictionary_insert_sized(
+	dictionary_t		*dictionary,
+	const void			*key,
+	int					key_length,
+	ion_value_t			value
+)
+{
+	unsigned char padded[dictionary->instance->record.key_size];
+	status_t err = dictionary_pad_key(dictionary, padded, key, key_length);
+
+	if (err_ok != err)
+	{
+		return err;
+	}
+	return dictionary->handler->insert(dictionary, padded, value);
+}
+
+status_t
+dictionary_get_sized(
+	dictionary_t		*dictionary,
+	const void			*key,
+	int					key_length,
+	ion_value_t			value
+)
+{
+	unsigned char padded[dictionary->instance->record.key_size];
+	status_t err = dictionary_pad_key(dictionary, padded, key, key_length);
+
+	if (err_ok != err)
+	{
+		return err;
+	}
+	return dictionary->handler->get(dictionary, padded, value);
+}
+
+status_t
+dictionary_delete_sized(
+	dictionary_t		*dictionary,
+	const void			*key,
+	int					key_length
+)
+{
+	unsigned char padded[dictionary->instance->record.key_size];
+	status_t err = dictionary_pad_key(dictionary, padded, key, key_length);
+
+	if (err_ok != err)
+	{
+		return err;
+	}
+	return dictionary->handler->remove(dictionary, padded);
+}
+
+status_t
+dictionary_update_sized(
+	dictionary_t		*dictionary,
+	const void			*key,
+	int					key_length,
+	ion_value_t			value
+)
+{
+	unsigned char padded[dictionary->instance->record.key_size];
+	status_t err = dictionary_pad_key(dictionary, padded, key, key_length);
+
+	if (err_ok != err)
+	{
+		return err;
+	}
+	return dictionary->handler->update(dictionary, padded, value);
+}
+
 char
 dictionary_compare_unsigned_value(
 	ion_key_t 		first_key,
@@ -232,9 +327,16 @@ dictionary_open(
     ion_dictionary_config_info_t 	*config
 )
 {
+	err_t err;
 	ion_dictionary_compare_t compare = dictionary_switch_compare(config->type);
 
-	return handler->open_dictionary(handler, dictionary, config, compare);
+	err = handler->open_dictionary(handler, dictionary, config, compare);
+	if (err_ok == err)
+	{
+		dictionary->instance->id = config->id;
+	}
+
+	return err;
 }
 
 err_t
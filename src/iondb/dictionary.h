@@ -105,6 +105,68 @@ dictionary_update(
 		ion_value_t		value
 );
 
+/**
+@brief		Insert a value under a key given with its length.
+
+@details	Keys shorter than the dictionary's key size are padded out
+			with zeros, so that callers with variable-length keys, such
+			as names, need not pad them themselves.  The same holds for
+			the other @c _sized functions.
+
+@param		dictionary
+				The dictionary that the value is to be inserted to.
+@param		key
+				The key that identifies @p value.
+@param		key_length
+				The length of @p key in bytes, at most the key size.
+@param		value
+				The value to store under @p key.
+@returns	A status describing the result of the insertion, or
+			@c err_key_too_long if @p key does not fit.
+*/
+status_t
+dictionary_insert_sized(
+	dictionary_t			*dictionary,
+	const void				*key,
+	int						key_length,
+	ion_value_t				value
+);
+
+/**
+@brief		Retrieve a value given a key and its length.
+@see		dictionary_insert_sized
+*/
+status_t
+dictionary_get_sized(
+	dictionary_t			*dictionary,
+	const void				*key,
+	int						key_length,
+	ion_value_t				value
+);
+
+/**
+@brief		Delete a value given a key and its length.
+@see		dictionary_insert_sized
+*/
+status_t
+dictionary_delete_sized(
+	dictionary_t			*dictionary,
+	const void				*key,
+	int						key_length
+);
+
+/**
+@brief		Update all records with a given key and its length.
+@see		dictionary_insert_sized
+*/
+status_t
+dictionary_update_sized(
+	dictionary_t			*dictionary,
+	const void				*key,
+	int						key_length,
+	ion_value_t				value
+);
+
 /**
 @brief 		Destroys dictionay
 
@@ -1,6 +1,15 @@
 
 #include "ion_file.h"
 
+/* a seek and what follows it are one step to other threads */
+#ifdef ION_ARDUINO
+#define ION_FLOCK(file)
+#define ION_FUNLOCK(file)
+#else
+#define ION_FLOCK(file)		flockfile(file)
+#define ION_FUNLOCK(file)	funlockfile(file)
+#endif
+
 boolean_t
 ion_fexists(
 	char		*name
@@ -145,13 +154,16 @@ ion_fwrite_at(
 {
 	err_t	error;
 	
+	ION_FLOCK(file);
 	error	= ion_fseek(file, offset, ION_FILE_START);
 	if (err_ok != error)
 	{
+		ION_FUNLOCK(file);
 		return error;
 	}
 	
 	error	= ion_fwrite(file, num_bytes, to_write);
+	ION_FUNLOCK(file);
 	return error;
 }
 
@@ -164,16 +176,37 @@ ion_fappend(
 {
 	err_t	error;
 	
+	ION_FLOCK(file);
 	error	= ion_fseek(file, 0, ION_FILE_END);
 	if (err_ok != error)
 	{
+		ION_FUNLOCK(file);
 		return error;
 	}
 	
 	error	= ion_fwrite(file, num_bytes, to_write);
+	ION_FUNLOCK(file);
 	return error;
 }
 
+err_t
+ion_fsync(
+	file_handle_t	file
+)
+{
+#ifdef ION_ARDUINO
+	fflush(file.file);
+	return err_ok;
+#else
+	if (0 != fflush(file) || 0 != fsync(fileno(file)))
+	{
+		return err_file_write_error;
+	}
+	
+	return err_ok;
+#endif
+}
+
 err_t
 ion_fread(
 	file_handle_t	file,
@@ -205,12 +238,15 @@ ion_fread_at(
 )
 {
 	err_t	error;
+	ION_FLOCK(file);
 	error	= ion_fseek(file, offset, ION_FILE_START);
 	if (err_ok != error)
 	{
+		ION_FUNLOCK(file);
 		return error;
 	}
 	
 	error	= ion_fread(file, num_bytes, write_to);
+	ION_FUNLOCK(file);
 	return error;
 }
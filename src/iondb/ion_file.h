@@ -105,6 +105,11 @@ ion_fappend(
 	byte*		to_write
 );
 
+err_t
+ion_fsync(
+	file_handle_t	file
+);
+
 err_t
 ion_fread(
 	file_handle_t	file,
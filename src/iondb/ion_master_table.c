@@ -20,8 +20,9 @@ ion_master_table_get_next_id(
     int oldpos = ftell(ion_master_table_file);
     fseek(ion_master_table_file, 0, SEEK_SET);
     /* Flush master row                           This writes the next ID to be used, so +1 */
-    ion_dictionary_config_info_t master_config = {ion_master_table_next_id + 1, 0, 0, 0, 0};
+    ion_dictionary_config_info_t master_config = { .id = ion_master_table_next_id + 1 };
     fwrite(&master_config, sizeof(master_config), 1, ion_master_table_file);
+    fflush(ion_master_table_file);
     fseek(ion_master_table_file, oldpos, SEEK_SET);
 
     return ion_master_table_next_id++;
@@ -106,7 +107,8 @@ ion_master_table_create_dictionary(
     key_type_t              key_type,
     int                     key_size,
     int                     value_size,
-    int                     dictionary_size
+    int                     dictionary_size,
+    ion_dict_use_t          use_type
 )
 {
     err_t err;
@@ -122,7 +124,7 @@ ion_master_table_create_dictionary(
 
     if (err_ok != err) { return err; }
 
-    err = ion_add_to_master_table(dictionary, dictionary_size);
+    err = ion_add_to_master_table(dictionary, dictionary_size, use_type);
 
     return err;
 }
@@ -130,21 +132,26 @@ ion_master_table_create_dictionary(
 err_t
 ion_add_to_master_table(
     dictionary_t    *dictionary,
-    int             dictionary_size
+    int             dictionary_size,
+    ion_dict_use_t  use_type
 )
 {
-    fseek(ion_master_table_file, 0, SEEK_END);
+    /* Rows are indexed by id, see ion_lookup_in_master_table. */
+    fseek(ion_master_table_file, dictionary->instance->id * sizeof(ion_dictionary_config_info_t), SEEK_SET);
 
     ion_dictionary_config_info_t config =
     {
-        dictionary->instance->id,
-        dictionary->instance->key_type,
-        dictionary->instance->record.key_size,
-        dictionary->instance->record.value_size,
-        dictionary_size
+        .id                 = dictionary->instance->id,
+        .use_type           = use_type,
+        .type               = dictionary->instance->key_type,
+        .key_size           = dictionary->instance->record.key_size,
+        .value_size         = dictionary->instance->record.value_size,
+        .dictionary_size    = dictionary_size
     };
 
-    fwrite(&config, sizeof(config), 1, ion_master_table_file);
+    if (1 != fwrite(&config, sizeof(config), 1, ion_master_table_file)) { return err_file_write_error; }
+    /* The row must outlive a crash of the process that made it. */
+    if (0 != fflush(ion_master_table_file)) { return err_file_write_error; }
 
     return err_ok;
 }
@@ -155,8 +162,15 @@ ion_lookup_in_master_table(
 	ion_dictionary_config_info_t    *config
 )
 {
-    fseek(ion_master_table_file, id * sizeof(ion_dictionary_config_info_t), SEEK_SET);
-    fread(config, sizeof(*config), 1, ion_master_table_file);
+    if (0 != fseek(ion_master_table_file, id * sizeof(ion_dictionary_config_info_t), SEEK_SET))
+    {
+        return err_file_bad_seek;
+    }
+    /* A short read is a row never written, not a stale config. */
+    if (1 != fread(config, sizeof(*config), 1, ion_master_table_file))
+    {
+        return err_item_not_found;
+    }
 
     if (0 == config->id) { return err_item_not_found; }
     return err_ok;
@@ -212,8 +226,9 @@ ion_delete_from_master_table(
 )
 {
     fseek(ion_master_table_file, dictionary->instance->id * sizeof(ion_dictionary_config_info_t), SEEK_SET);
-    ion_dictionary_config_info_t blank = {0,0,0,0,0,0};
+    ion_dictionary_config_info_t blank = { .id = 0 };
     fwrite(&blank, sizeof(blank), 1, ion_master_table_file);
+    fflush(ion_master_table_file);
 
     return err_ok;
 }
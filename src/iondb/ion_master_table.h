@@ -98,7 +98,8 @@ ion_master_table_create_dictionary(
     key_type_t              key_type,
     int                     key_size,
     int                     value_size,
-    int                     dictionary_size
+    int                     dictionary_size,
+    ion_dict_use_t          use_type
 );
 
 /**
@@ -107,7 +108,8 @@ ion_master_table_create_dictionary(
 err_t
 ion_add_to_master_table(
     dictionary_t    *dictionary,
-    int             dictionary_size
+    int             dictionary_size,
+    ion_dict_use_t  use_type
 );
 
 /**
@@ -84,7 +84,8 @@ enum error
 	err_not_implemented,
 	err_illegal_state,
 	err_invalid_initial_size,
-	err_uninitialized
+	err_uninitialized,
+	err_key_too_long
 };
 
 typedef char err_t;
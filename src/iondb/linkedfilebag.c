@@ -237,3 +237,44 @@ lfb_update_all(
 	
 	return err_ok;
 }
+
+err_t
+lfb_put_all(
+	lfb_t		*bag,
+	file_offset_t	offset,
+	unsigned int	num_bytes,
+	byte		*to_write,
+	file_offset_t	*wrote_at
+)
+{
+	err_t		error;
+	file_offset_t	next;
+	
+	/* A new list as long as the one at offset, which is left as is. */
+	*wrote_at	= LFB_NULL;
+	while (LFB_NULL != offset)
+	{
+		error	= ion_fread_at(
+				bag->file_handle,
+				offset,
+				sizeof(file_offset_t),
+				(byte *)&next
+			);
+		
+		if (err_ok != error)
+		{
+			return error;
+		}
+		
+		error	= lfb_put(bag, to_write, num_bytes, *wrote_at, wrote_at);
+		
+		if (err_ok != error)
+		{
+			return error;
+		}
+		
+		offset	= next;
+	}
+	
+	return err_ok;
+}
@@ -79,6 +79,15 @@ lfb_update_all(
 	byte		*to_write
 );
 
+err_t
+lfb_put_all(
+	lfb_t		*bag,
+	file_offset_t	offset,
+	unsigned int	num_bytes,
+	byte		*to_write,
+	file_offset_t	*wrote_at
+);
+
 #ifdef  __cplusplus
 }
 #endif
@@ -0,0 +1,592 @@
+/******************************************************************************/
+/**
+@file
+@author		Graeme Douglas
+@details	For more information, see @ref writeaheadlog.h.
+*/
+/******************************************************************************/
+
+#include "writeaheadlog.h"
+#include <stddef.h>
+
+#ifdef ION_ARDUINO
+#include "Arduino.h"
+#else
+#include <time.h>
+#endif
+
+#ifdef WAL_THREADS
+#define WAL_LOCK(wal)		pthread_mutex_lock(&(wal)->lock)
+#define WAL_UNLOCK(wal)		pthread_mutex_unlock(&(wal)->lock)
+#else
+#define WAL_LOCK(wal)
+#define WAL_UNLOCK(wal)
+#endif
+
+#define WAL_MAGIC		"WAL1"
+
+/**
+@brief		Bytes set aside for each of the two headers.
+*/
+#define WAL_HEADER_SIZE		512
+
+/**
+@brief		Where the first record of each generation goes.
+*/
+#define WAL_START		(2 * WAL_HEADER_SIZE)
+
+/**
+@brief		Where the check of a run of bytes starts.
+*/
+#define WAL_CHECK_SEED		2166136261u
+
+typedef struct wal_header
+{
+	char		magic[4];
+	int		key_size;
+	int		value_size;
+	unsigned long	generation;
+	unsigned int	check;		/**< Of the fields above. */
+} wal_header_t;
+
+typedef struct wal_head
+{
+	unsigned int	size;		/**< Bytes of the record that follow. */
+	unsigned int	check;		/**< Of size and the bytes that follow,
+					     for this generation. */
+} wal_head_t;
+
+/**
+@brief		Continue a check over @p length more bytes (FNV-1a).
+*/
+static unsigned int
+wal_check(
+	unsigned int	check,
+	const void	*data,
+	int		length
+)
+{
+	const byte	*next	= data;
+
+	while (0 < length--)
+	{
+		check	^= *next++;
+		check	*= 16777619u;
+	}
+
+	return check;
+}
+
+static unsigned long
+wal_now(
+)
+{
+#ifdef ION_ARDUINO
+	return millis();
+#else
+	struct timespec	now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (unsigned long)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+#endif
+}
+
+static unsigned int
+wal_seed(
+	wal_t		*wal
+)
+{
+	return wal_check(WAL_CHECK_SEED, &(wal->generation), sizeof(unsigned long));
+}
+
+static err_t
+wal_write_header(
+	wal_t		*wal
+)
+{
+	wal_header_t	header;
+	err_t		error;
+
+	memset(&header, 0, sizeof(wal_header_t));
+	memcpy(header.magic, WAL_MAGIC, sizeof(header.magic));
+	header.key_size		= wal->key_size;
+	header.value_size	= wal->value_size;
+	header.generation	= wal->generation;
+	header.check		= wal_check(WAL_CHECK_SEED, &header, offsetof(wal_header_t, check));
+
+	error			= ion_fwrite_at(
+					wal->file_handle,
+					(wal->generation & 1) * WAL_HEADER_SIZE,
+					sizeof(wal_header_t),
+					(byte *)&header
+				);
+	if (err_ok != error)
+	{
+		return error;
+	}
+
+	return ion_fsync(wal->file_handle);
+}
+
+/**
+@brief		Reads the record at @p offset, if it is whole and of this
+		generation.
+@return		@c err_ok, @c err_item_not_found past the last record, or
+		@c err_out_of_memory.
+*/
+static err_t
+wal_read(
+	wal_t		*wal,
+	file_offset_t	*offset,
+	byte		**bytes,
+	int		*room,
+	wal_record_t	*record
+)
+{
+	wal_head_t	head;
+	byte		*body;
+	unsigned int	least;
+
+	if (err_ok != ion_fread_at(wal->file_handle, *offset, sizeof(wal_head_t), (byte *)&head))
+	{
+		return err_item_not_found;
+	}
+
+	least	= 1 + wal->key_size;
+	if (head.size < least || head.size > 1 + sizeof(file_offset_t) + WAL_MAX_PAGE)
+	{
+		return err_item_not_found;
+	}
+	if ((int)head.size > *room)
+	{
+		body	= realloc(*bytes, head.size);
+		if (NULL == body)
+		{
+			return err_out_of_memory;
+		}
+		*bytes	= body;
+		*room	= head.size;
+	}
+	body	= *bytes;
+
+	if (	err_ok != ion_fread_at(wal->file_handle, *offset + sizeof(wal_head_t), head.size, body) ||
+		head.check != wal_check(wal_check(wal_seed(wal), &(head.size), sizeof(unsigned int)), body, head.size))
+	{
+		return err_item_not_found;
+	}
+
+	record->op		= (wal_op_t)body[0];
+	record->key		= NULL;
+	record->value		= NULL;
+	record->bytes		= NULL;
+	switch (record->op)
+	{
+		case wal_op_insert:
+		case wal_op_update:
+		{
+			if (least + wal->value_size != head.size)
+			{
+				return err_item_not_found;
+			}
+			record->key	= body + 1;
+			record->value	= body + least;
+			break;
+		}
+		case wal_op_delete:
+		{
+			if (least != head.size)
+			{
+				return err_item_not_found;
+			}
+			record->key	= body + 1;
+			break;
+		}
+		case wal_op_page:
+		{
+			if (1 + sizeof(file_offset_t) >= head.size)
+			{
+				return err_item_not_found;
+			}
+			memcpy(&(record->offset), body + 1, sizeof(file_offset_t));
+			record->length	= head.size - 1 - sizeof(file_offset_t);
+			record->bytes	= body + 1 + sizeof(file_offset_t);
+			break;
+		}
+		default:
+		{
+			return err_item_not_found;
+		}
+	}
+
+	*offset	+= sizeof(wal_head_t) + head.size;
+	return err_ok;
+}
+
+/**
+@brief		Writes out the records gathered in memory.
+*/
+static err_t
+wal_write(
+	wal_t		*wal
+)
+{
+	err_t		error;
+
+	if (0 == wal->buffered)
+	{
+		return err_ok;
+	}
+
+	error	= ion_fwrite_at(wal->file_handle, wal->end, wal->buffered, wal->buffer);
+	if (err_ok != error)
+	{
+		return error;
+	}
+	wal->end	+= wal->buffered;
+	wal->buffered	= 0;
+
+	return err_ok;
+}
+
+static err_t
+wal_flush(
+	wal_t		*wal
+)
+{
+	err_t		error;
+
+	error	= wal_write(wal);
+	if (err_ok == error)
+	{
+		error	= ion_fsync(wal->file_handle);
+	}
+	if (err_ok == error)
+	{
+		wal->pending	= 0;
+	}
+
+	return error;
+}
+
+/**
+@brief		Appends a record of @p op followed by two runs of bytes.
+*/
+static err_t
+wal_put(
+	wal_t		*wal,
+	wal_op_t	op,
+	void		*first,
+	int		first_length,
+	void		*second,
+	int		second_length
+)
+{
+	wal_head_t	head;
+	byte		code;
+	int		total;
+	err_t		error;
+
+	code		= (byte)op;
+	head.size	= 1 + first_length + second_length;
+	head.check	= wal_check(wal_seed(wal), &(head.size), sizeof(unsigned int));
+	head.check	= wal_check(head.check, &code, 1);
+	head.check	= wal_check(head.check, first, first_length);
+	head.check	= wal_check(head.check, second, second_length);
+	total		= sizeof(wal_head_t) + head.size;
+
+	if (WAL_BUFFER_SIZE < wal->buffered + total)
+	{
+		error	= wal_write(wal);
+		if (err_ok != error)
+		{
+			return error;
+		}
+	}
+
+	if (WAL_BUFFER_SIZE < total)
+	{
+		/* Too big to gather, so straight to the file. */
+		if (	err_ok != (error = ion_fwrite_at(wal->file_handle, wal->end, sizeof(wal_head_t), (byte *)&head)) ||
+			err_ok != (error = ion_fwrite(wal->file_handle, 1, &code)) ||
+			err_ok != (error = ion_fwrite(wal->file_handle, first_length, first)) ||
+			(0 < second_length && err_ok != (error = ion_fwrite(wal->file_handle, second_length, second))))
+		{
+			return error;
+		}
+		wal->end	+= total;
+		return err_ok;
+	}
+
+	memcpy(wal->buffer + wal->buffered, &head, sizeof(wal_head_t));
+	wal->buffer[wal->buffered + sizeof(wal_head_t)]	= code;
+	memcpy(wal->buffer + wal->buffered + sizeof(wal_head_t) + 1, first, first_length);
+	if (0 < second_length)
+	{
+		memcpy(wal->buffer + wal->buffered + sizeof(wal_head_t) + 1 + first_length, second, second_length);
+	}
+	wal->buffered	+= total;
+
+	return err_ok;
+}
+
+err_t
+wal_open(
+	wal_t		*wal,
+	char		*name,
+	int		key_size,
+	int		value_size,
+	int		batch_size,
+	unsigned long	interval
+)
+{
+	wal_header_t	header;
+	wal_record_t	record;
+	byte		*bytes;
+	int		room;
+	int		slot;
+	boolean_t	found;
+	err_t		error;
+
+	wal->file_handle	= ion_fopen(name);
+#ifdef ION_ARDUINO
+	if (NULL == wal->file_handle.file)
+#else
+	if (NULL == wal->file_handle)
+#endif
+	{
+		return err_file_open_error;
+	}
+	wal->key_size		= key_size;
+	wal->value_size		= value_size;
+	wal->buffered		= 0;
+	wal->pending		= 0;
+	wal->first_at		= 0;
+	wal->replaying		= boolean_false;
+	wal_set_commit(wal, batch_size, interval);
+
+	/* Take up from the newer of the headers that are whole. */
+	found			= boolean_false;
+	for (slot = 0; slot < 2; slot++)
+	{
+		if (	err_ok == ion_fread_at(wal->file_handle, slot * WAL_HEADER_SIZE, sizeof(wal_header_t), (byte *)&header) &&
+			0 == memcmp(header.magic, WAL_MAGIC, sizeof(header.magic)) &&
+			header.check == wal_check(WAL_CHECK_SEED, &header, offsetof(wal_header_t, check)) &&
+			(!found || header.generation > wal->generation))
+		{
+			if (header.key_size != key_size || header.value_size != value_size)
+			{
+				ion_fclose(wal->file_handle);
+				return err_illegal_state;
+			}
+			wal->generation	= header.generation;
+			found		= boolean_true;
+		}
+	}
+
+	if (!found)
+	{
+		wal->generation	= 1;
+		error		= wal_write_header(wal);
+		if (err_ok != error)
+		{
+			ion_fclose(wal->file_handle);
+			return error;
+		}
+	}
+
+	/* New records go after the last whole one. */
+	wal->end		= WAL_START;
+	bytes			= NULL;
+	room			= 0;
+	while (err_ok == (error = wal_read(wal, &(wal->end), &bytes, &room, &record)))
+		;
+	free(bytes);
+	if (err_out_of_memory == error)
+	{
+		ion_fclose(wal->file_handle);
+		return error;
+	}
+
+#ifdef WAL_THREADS
+	pthread_mutex_init(&(wal->lock), NULL);
+#endif
+	return err_ok;
+}
+
+err_t
+wal_replay(
+	wal_t		*wal,
+	wal_apply_t	apply,
+	void		*state
+)
+{
+	wal_record_t	record;
+	file_offset_t	offset;
+	file_offset_t	end;
+	byte		*bytes;
+	int		room;
+	err_t		error;
+
+	offset		= WAL_START;
+	end		= wal->end;
+	bytes		= NULL;
+	room		= 0;
+	error		= err_ok;
+	wal->replaying	= boolean_true;
+	while (offset < end && err_ok == error)
+	{
+		error	= wal_read(wal, &offset, &bytes, &room, &record);
+		if (err_ok == error)
+		{
+			error	= apply(state, &record);
+		}
+	}
+	wal->replaying	= boolean_false;
+	free(bytes);
+
+	return error;
+}
+
+err_t
+wal_append(
+	wal_t		*wal,
+	wal_op_t	op,
+	ion_key_t	key,
+	ion_value_t	value
+)
+{
+	err_t		error;
+	unsigned long	now;
+
+	WAL_LOCK(wal);
+	error	= wal_put(wal, op, key, wal->key_size, value, (NULL != value) ? wal->value_size : 0);
+	if (err_ok == error)
+	{
+		now	= wal_now();
+		if (0 == wal->pending++)
+		{
+			wal->first_at	= now;
+		}
+		if (wal->pending >= wal->batch_size || now - wal->first_at >= wal->interval)
+		{
+			error	= wal_flush(wal);
+		}
+	}
+	WAL_UNLOCK(wal);
+
+	return error;
+}
+
+err_t
+wal_keep(
+	wal_t		*wal,
+	file_offset_t	offset,
+	int		length,
+	byte		*bytes
+)
+{
+	err_t		error;
+
+	if (0 >= length || WAL_MAX_PAGE < length)
+	{
+		return err_illegal_state;
+	}
+
+	WAL_LOCK(wal);
+	error	= wal_put(wal, wal_op_page, &offset, sizeof(file_offset_t), bytes, length);
+	if (err_ok == error)
+	{
+		error	= wal_flush(wal);
+	}
+	WAL_UNLOCK(wal);
+
+	return error;
+}
+
+err_t
+wal_sync(
+	wal_t		*wal
+)
+{
+	err_t		error;
+
+	WAL_LOCK(wal);
+	error	= (0 < wal->pending) ? wal_flush(wal) : err_ok;
+	WAL_UNLOCK(wal);
+
+	return error;
+}
+
+err_t
+wal_poll(
+	wal_t		*wal
+)
+{
+	err_t		error;
+
+	WAL_LOCK(wal);
+	error	= err_ok;
+	if (0 < wal->pending && wal_now() - wal->first_at >= wal->interval)
+	{
+		error	= wal_flush(wal);
+	}
+	WAL_UNLOCK(wal);
+
+	return error;
+}
+
+err_t
+wal_checkpoint(
+	wal_t		*wal
+)
+{
+	err_t		error;
+
+	WAL_LOCK(wal);
+	/* Whatever is still gathered is no longer needed. */
+	wal->buffered	= 0;
+	wal->pending	= 0;
+	wal->generation++;
+	error		= wal_write_header(wal);
+	if (err_ok == error)
+	{
+		wal->end	= WAL_START;
+	}
+	else
+	{
+		wal->generation--;
+	}
+	WAL_UNLOCK(wal);
+
+	return error;
+}
+
+void
+wal_set_commit(
+	wal_t		*wal,
+	int		batch_size,
+	unsigned long	interval
+)
+{
+	wal->batch_size	= (1 < batch_size) ? batch_size : 1;
+	wal->interval	= interval;
+}
+
+file_offset_t
+wal_size(
+	wal_t		*wal
+)
+{
+	return wal->end + wal->buffered - WAL_START;
+}
+
+err_t
+wal_close(
+	wal_t		*wal
+)
+{
+#ifdef WAL_THREADS
+	pthread_mutex_destroy(&(wal->lock));
+#endif
+	return ion_fclose(wal->file_handle);
+}
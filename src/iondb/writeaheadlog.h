@@ -0,0 +1,249 @@
+/******************************************************************************/
+/**
+@file		writeaheadlog.h
+@author		Graeme Douglas
+@brief		A write-ahead log of the changes made to a dictionary.
+@details	Records are appended to the end of the log, gathered in
+		memory and synced to disk in groups: a group is synced once
+		it holds a batch of records, or once its first record has
+		waited out the commit interval, whichever comes first.  The
+		interval is checked as records are appended, and by
+		@ref wal_poll, which should be called regularly so that the
+		last records before a lull are not left waiting.
+
+		Besides changes, the log keeps pages of another file as they
+		were before being overwritten, so that the file can be put
+		back as it was at the last checkpoint.  These are synced at
+		once, as the page may be overwritten as soon as they are.
+
+		A checkpoint empties the log.  The log is never truncated;
+		each checkpoint starts a new generation, written to one of
+		two headers in turn, and records of older generations that
+		lie past the end of the new one fail their checks.
+*/
+/******************************************************************************/
+
+#ifndef WRITEAHEADLOG_H
+#define WRITEAHEADLOG_H
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+#include "kv_system.h"
+#include "ion_file.h"
+
+/**
+@brief		Defined to let threads share a log.
+*/
+#if !defined(ION_ARDUINO)
+#define WAL_THREADS
+#endif
+
+#ifdef WAL_THREADS
+#include <pthread.h>
+#endif
+
+/**
+@brief		Bytes of records gathered in memory before being written.
+*/
+#ifdef ION_ARDUINO
+#define WAL_BUFFER_SIZE		128
+#else
+#define WAL_BUFFER_SIZE		16384
+#endif
+
+/**
+@brief		Largest page a log keeps.
+*/
+#define WAL_MAX_PAGE		(3 * 65536)
+
+/**
+@brief		What a log record records.
+*/
+enum wal_op
+{
+	wal_op_insert	= 1,	/**< A value inserted under a key. */
+	wal_op_update,		/**< A key's values updated. */
+	wal_op_delete,		/**< A key and its values deleted. */
+	wal_op_page		/**< A page of another file as it was. */
+};
+
+typedef char			wal_op_t;
+
+/**
+@brief		A record read back from a log.
+*/
+typedef struct wal_record
+{
+	wal_op_t	op;		/**< What the record records. */
+	ion_key_t	key;		/**< Key changed, unless a page. */
+	ion_value_t	value;		/**< Value inserted or updated to. */
+	file_offset_t	offset;		/**< Where the page was. */
+	int		length;		/**< Bytes of the page. */
+	byte		*bytes;		/**< The page. */
+} wal_record_t;
+
+/**
+@brief		Called by @ref wal_replay for each record in the log.
+@return		@c err_ok to go on, or an error to stop the replay with.
+*/
+typedef err_t (*wal_apply_t)(void *state, wal_record_t *record);
+
+typedef struct writeaheadlog
+{
+	file_handle_t	file_handle;
+	int		key_size;	/**< Bytes of each key. */
+	int		value_size;	/**< Bytes of each value. */
+	unsigned long	generation;	/**< Checkpoints since the log was made. */
+	file_offset_t	end;		/**< Where the next records are written. */
+	byte		buffer[WAL_BUFFER_SIZE];
+					/**< Records not yet written. */
+	int		buffered;	/**< Bytes in @c buffer. */
+	int		pending;	/**< Records not yet synced. */
+	int		batch_size;	/**< Records synced together. */
+	unsigned long	interval;	/**< Most milliseconds a record waits
+					     to be synced. */
+	unsigned long	first_at;	/**< When the oldest pending record
+					     was appended. */
+	boolean_t	replaying;	/**< True during @ref wal_replay. */
+#ifdef WAL_THREADS
+	pthread_mutex_t	lock;		/**< Held while using the log. */
+#endif
+} wal_t;
+
+/**
+@brief		Opens a log, making it if it does not exist.
+
+@param		wal
+			The log to open.
+@param		name
+			The name of the log's file.
+@param		key_size
+			Bytes of each key logged.
+@param		value_size
+			Bytes of each value logged.
+@param		batch_size
+			Records synced together; 1 or less syncs each.
+@param		interval
+			Most milliseconds a record waits to be synced.
+@return		@c err_ok, @c err_file_open_error, or
+		@c err_illegal_state if the log was made for keys or
+		values of other sizes.
+*/
+err_t
+wal_open(
+	wal_t		*wal,
+	char		*name,
+	int		key_size,
+	int		value_size,
+	int		batch_size,
+	unsigned long	interval
+);
+
+/**
+@brief		Calls @p apply for each record logged since the last
+		checkpoint, in the order they were appended.
+
+@details	Records and pages appended during the replay are not
+		replayed, and @c replaying is true throughout, so that
+		callers can tell changes being redone from new ones.
+*/
+err_t
+wal_replay(
+	wal_t		*wal,
+	wal_apply_t	apply,
+	void		*state
+);
+
+/**
+@brief		Appends a change, syncing the group it ends if due.
+
+@param		wal
+			The log to append to.
+@param		op
+			@ref wal_op_insert, @ref wal_op_update or
+			@ref wal_op_delete.
+@param		key
+			The key changed.
+@param		value
+			The value inserted or updated to, or @c NULL for a
+			delete.
+*/
+err_t
+wal_append(
+	wal_t		*wal,
+	wal_op_t	op,
+	ion_key_t	key,
+	ion_value_t	value
+);
+
+/**
+@brief		Appends a page of another file as it was, and syncs it
+		along with any records pending.
+*/
+err_t
+wal_keep(
+	wal_t		*wal,
+	file_offset_t	offset,
+	int		length,
+	byte		*bytes
+);
+
+/**
+@brief		Syncs every record appended so far.
+*/
+err_t
+wal_sync(
+	wal_t		*wal
+);
+
+/**
+@brief		Syncs the records pending if the oldest has waited out the
+		commit interval.
+*/
+err_t
+wal_poll(
+	wal_t		*wal
+);
+
+/**
+@brief		Empties the log, once what it records is safely elsewhere.
+*/
+err_t
+wal_checkpoint(
+	wal_t		*wal
+);
+
+/**
+@brief		Changes how records are grouped to be synced.
+@see		wal_open
+*/
+void
+wal_set_commit(
+	wal_t		*wal,
+	int		batch_size,
+	unsigned long	interval
+);
+
+/**
+@brief		Bytes of records appended since the last checkpoint.
+*/
+file_offset_t
+wal_size(
+	wal_t		*wal
+);
+
+/**
+@brief		Closes a log, without syncing what is pending.
+*/
+err_t
+wal_close(
+	wal_t		*wal
+);
+
+#ifdef  __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,248 @@
+/******************************************************************************/
+/**
+@file
+@author		Graeme Douglas
+@details	For more information, see @ref jobbatch.h.
+*/
+/******************************************************************************/
+
+#include "jobbatch.h"
+
+/**
+@brief		Look up a job by name.
+@param		jobmanager
+			The job manager holding the job.
+@param		name
+			The job's name.
+@param		job
+			Set to the stored job.
+@returns	@c SJM_ERROR_OK on successes, an appropriate error code
+		otherwise.
+*/
+static sjm_error_t
+sjm_batch_get_job(
+	sjm_t			*jobmanager,
+	char			*name,
+	sensor_job_t		*job
+)
+{
+	err_t			ion_error;
+	
+	ion_error		= dictionary_get_sized(
+					&(jobmanager->dictionary),
+					name,
+					sjm_name_length(jobmanager, name),
+					(ion_value_t)job
+				);
+	if (err_ok != ion_error)
+	{
+		return SJM_ERROR_DICT_GET_FAILURE;
+	}
+	
+	return SJM_ERROR_OK;
+}
+
+sjm_error_t
+sjm_perform_job_batch(
+	sjm_t			*jobmanager,
+	char			*name,
+	void			*params,
+	void			*results,
+	int			count
+)
+{
+	sjm_error_t		error;
+	sensor_job_t		job;
+	
+	error			= sjm_batch_get_job(jobmanager, name, &job);
+	if (SJM_ERROR_OK != error)
+	{
+		return error;
+	}
+	
+	return sjm_run_job_batch(jobmanager, &job, name, params, results, count);
+}
+
+/**
+@brief		Run a job's gathered requests and hand out the results.
+*/
+static void
+sjm_batch_flush(
+	sjm_t			*jobmanager,
+	sjm_batch_t		*batch
+)
+{
+	int			i;
+	
+	if (0 == batch->count)
+	{
+		return;
+	}
+	
+	sjm_run_job_batch(jobmanager, &(batch->job), batch->name, batch->params, batch->results, batch->count);
+	
+	if (0 < batch->job.result_size)
+	{
+		for (i = 0; i < batch->count; i++)
+		{
+			if (NULL != batch->destinations[i])
+			{
+				memcpy(
+					batch->destinations[i],
+					batch->results + i * batch->job.result_size,
+					batch->job.result_size
+				);
+			}
+		}
+	}
+	batch->count		= 0;
+}
+
+/**
+@brief		Start a new batch for a job, sizing its buffers for the
+		job as currently stored.
+@param		jobmanager
+			The job manager holding the job.
+@param		batch
+			An empty batch.
+@returns	@c SJM_ERROR_OK on successes, an appropriate error code
+		otherwise.
+*/
+static sjm_error_t
+sjm_batch_start(
+	sjm_t			*jobmanager,
+	sjm_batch_t		*batch
+)
+{
+	sjm_error_t		error;
+	sensor_job_t		job;
+	unsigned char		*params;
+	unsigned char		*results;
+	
+	/* The job may have changed since the last batch. */
+	error			= sjm_batch_get_job(jobmanager, batch->name, &job);
+	if (SJM_ERROR_OK != error)
+	{
+		return error;
+	}
+	
+	if (NULL == batch->params || job.param_size != batch->job.param_size)
+	{
+		params		= realloc(batch->params, SJM_BATCH_SIZE * job.param_size + 1);
+		if (NULL == params)
+		{
+			return SJM_ERROR_MEMORY_ALLOCATION_FAILURE;
+		}
+		batch->params	= params;
+	}
+	if (NULL == batch->results || job.result_size != batch->job.result_size)
+	{
+		results		= realloc(batch->results, SJM_BATCH_SIZE * job.result_size + 1);
+		if (NULL == results)
+		{
+			return SJM_ERROR_MEMORY_ALLOCATION_FAILURE;
+		}
+		batch->results	= results;
+	}
+	batch->job		= job;
+	
+	return SJM_ERROR_OK;
+}
+
+sjm_error_t
+sjm_gather_job(
+	sjm_t			*jobmanager,
+	char			*name,
+	void			*params,
+	void			*result
+)
+{
+	sjm_error_t		error;
+	sjm_batch_t		*batch;
+	
+	for (batch = jobmanager->batches; NULL != batch; batch = batch->next)
+	{
+		if (0 == strncmp(batch->name, name, jobmanager->maximum_name_size))
+		{
+			break;
+		}
+	}
+	
+	if (NULL == batch)
+	{
+		batch		= calloc(1, sizeof(sjm_batch_t) + jobmanager->maximum_name_size + 1);
+		if (NULL == batch)
+		{
+			return SJM_ERROR_MEMORY_ALLOCATION_FAILURE;
+		}
+		batch->name	= (char *)(batch+1);
+		strncpy(batch->name, name, jobmanager->maximum_name_size);
+		batch->destinations
+				= malloc(SJM_BATCH_SIZE * sizeof(void *));
+		if (NULL == batch->destinations)
+		{
+			free(batch);
+			return SJM_ERROR_MEMORY_ALLOCATION_FAILURE;
+		}
+		batch->next	= jobmanager->batches;
+		jobmanager->batches
+				= batch;
+	}
+	
+	if (0 == batch->count)
+	{
+		error		= sjm_batch_start(jobmanager, batch);
+		if (SJM_ERROR_OK != error)
+		{
+			return error;
+		}
+	}
+	
+	memcpy(
+		batch->params + batch->count * batch->job.param_size,
+		params,
+		batch->job.param_size
+	);
+	batch->destinations[batch->count]
+				= result;
+	batch->count++;
+	
+	if (SJM_BATCH_SIZE == batch->count)
+	{
+		sjm_batch_flush(jobmanager, batch);
+	}
+	
+	return SJM_ERROR_OK;
+}
+
+void
+sjm_flush_batches(
+	sjm_t			*jobmanager
+)
+{
+	sjm_batch_t		*batch;
+	
+	for (batch = jobmanager->batches; NULL != batch; batch = batch->next)
+	{
+		sjm_batch_flush(jobmanager, batch);
+	}
+}
+
+void
+sjm_batches_delete(
+	sjm_t			*jobmanager
+)
+{
+	sjm_batch_t		*batch;
+	
+	while (NULL != jobmanager->batches)
+	{
+		batch		= jobmanager->batches;
+		jobmanager->batches
+				= batch->next;
+		free(batch->params);
+		free(batch->results);
+		free(batch->destinations);
+		free(batch);
+	}
+}
@@ -0,0 +1,137 @@
+/******************************************************************************/
+/**
+@file
+@author		Graeme Douglas
+@brief		Running a job over many parameter sets at once.
+@details	A job that is requested many times over with different
+		parameters (converting every ADC channel, checksumming N
+		records) can register a batch entry point (see
+		@ref batch_job_function) along with the size of one
+		parameter set and one result. Requests can then be run as a
+		batch directly (@ref sjm_perform_job_batch), or gathered one
+		at a time (@ref sjm_gather_job) and run together once the
+		batch fills up or is flushed (@ref sjm_flush_batches). Either
+		way, the job is looked up once per batch rather than once
+		per request.
+		
+		Jobs without a batch entry point can still be batched; their
+		ordinary function is then called once per parameter set,
+		with @c params[0] pointing to the set and @c returned
+		pointing to its result.
+*/
+/******************************************************************************/
+
+#ifndef JOB_BATCH_H
+#define JOB_BATCH_H
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+#include "jobmanager.h"
+
+/**
+@brief		The most requests gathered for a job before its batch is
+		run automatically.
+*/
+#define SJM_BATCH_SIZE		64
+
+/**
+@brief		Requests gathered for a single job.
+@details	The name is stored immediately after the structure. The
+		buffers are kept between batches so they stay warm.
+*/
+struct sjm_batch
+{
+	char			*name;		/**< The job's name. */
+	sensor_job_t		job;		/**< The job, looked up when
+						     the batch was started. */
+	unsigned char		*params;	/**< Gathered parameter sets.
+						*/
+	unsigned char		*results;	/**< Results of the batch. */
+	void			**destinations;	/**< Where to copy each
+						     result, or @c NULL. */
+	int			count;		/**< Requests gathered. */
+	struct sjm_batch	*next;		/**< Next job's batch. */
+};
+
+/**
+@brief		Run a job over many parameter sets at once.
+@details	The batch runs as one run of the job; see
+		@ref sjm_run_job_batch.
+@param		jobmanager
+			The job manager holding the job.
+@param		name
+			The job's name.
+@param		params
+			@p count parameter sets of the job's @c param_size
+			bytes each, one after another.
+@param		results
+			Room for @p count results of the job's
+			@c result_size bytes each, one after another.
+@param		count
+			The number of parameter sets.
+@returns	@c SJM_ERROR_OK on successes, an appropriate error code
+		otherwise.
+*/
+sjm_error_t
+sjm_perform_job_batch(
+	sjm_t			*jobmanager,
+	char			*name,
+	void			*params,
+	void			*results,
+	int			count
+);
+
+/**
+@brief		Gather a request to be run as part of its job's batch.
+@details	The parameter set is copied. The result is only available
+		once the batch has run: either when @ref SJM_BATCH_SIZE
+		requests have been gathered for the job (possibly during
+		this call), or when @ref sjm_flush_batches is called.
+@param		jobmanager
+			The job manager holding the job.
+@param		name
+			The job's name.
+@param		params
+			One parameter set of the job's @c param_size bytes.
+@param		result
+			Where to copy the result (@c result_size bytes) once
+			the batch runs, or @c NULL to discard it. It must
+			stay valid until then.
+@returns	@c SJM_ERROR_OK on successes, an appropriate error code
+		otherwise.
+*/
+sjm_error_t
+sjm_gather_job(
+	sjm_t			*jobmanager,
+	char			*name,
+	void			*params,
+	void			*result
+);
+
+/**
+@brief		Run every gathered batch.
+@param		jobmanager
+			The job manager whose batches to run.
+*/
+void
+sjm_flush_batches(
+	sjm_t			*jobmanager
+);
+
+/**
+@brief		Free every batch, without running them.
+@param		jobmanager
+			The job manager whose batches to free.
+*/
+void
+sjm_batches_delete(
+	sjm_t			*jobmanager
+);
+
+#ifdef  __cplusplus
+}
+#endif
+
+#endif
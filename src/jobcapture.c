@@ -0,0 +1,486 @@
+/******************************************************************************/
+/**
+@file
+@author		Graeme Douglas
+@details	For more information, see @ref jobcapture.h.
+*/
+/******************************************************************************/
+
+#include "jobcapture.h"
+
+#ifdef  SJM_CAPTURE
+#include <time.h>
+
+/**
+@brief		The most bytes a 64-bit varint may take.
+*/
+#define SJM_CAPTURE_VARINT_MAX	10
+
+/**
+@brief		A request loaded for replay.
+*/
+typedef struct sjm_replay_request
+{
+	unsigned long long	due;	/**< Microseconds after the first
+					     request that this one arrived.
+					*/
+	long			offset;	/**< Where the request starts in the
+					     loaded text. */
+	int			length;	/**< Bytes of request. */
+} sjm_replay_request_t;
+
+unsigned long long
+sjm_capture_now(
+	void
+)
+{
+	struct timespec		now;
+	
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (unsigned long long)now.tv_sec * 1000000ULL + now.tv_nsec / 1000;
+}
+
+/**
+@brief		Encode a varint.
+@returns	The number of bytes written.
+*/
+static int
+sjm_capture_put_varint(
+	unsigned char		*buffer,
+	unsigned long long	value
+)
+{
+	int			length;
+	
+	length			= 0;
+	while (value >= 0x80)
+	{
+		buffer[length++]
+				= (unsigned char)(value | 0x80);
+		value		>>= 7;
+	}
+	buffer[length++]	= (unsigned char)value;
+	
+	return length;
+}
+
+/**
+@brief		Decode a varint from a file.
+@returns	@c SJM_ERROR_OK on successes, @c SJM_ERROR_END_OF_CAPTURE
+		if the file ends before it starts,
+		@c SJM_ERROR_CAPTURE_CORRUPT if it ends partway or is too
+		long.
+*/
+static sjm_error_t
+sjm_capture_get_varint(
+	FILE			*file,
+	unsigned long long	*value
+)
+{
+	int			byte;
+	int			shift;
+	
+	*value			= 0;
+	for (shift = 0; shift < 7 * SJM_CAPTURE_VARINT_MAX; shift += 7)
+	{
+		byte		= getc(file);
+		if (EOF == byte)
+		{
+			return (0 == shift) ? SJM_ERROR_END_OF_CAPTURE : SJM_ERROR_CAPTURE_CORRUPT;
+		}
+		*value		|= (unsigned long long)(byte & 0x7F) << shift;
+		if (0 == (byte & 0x80))
+		{
+			return SJM_ERROR_OK;
+		}
+	}
+	
+	return SJM_ERROR_CAPTURE_CORRUPT;
+}
+
+sjm_error_t
+sjm_capture_open(
+	sjm_capture_t		*capture,
+	char			*path
+)
+{
+	capture->file		= fopen(path, "wb");
+	if (NULL == capture->file)
+	{
+		return SJM_ERROR_SINK_WRITE;
+	}
+	
+	fwrite(SJM_CAPTURE_MAGIC, 1, sizeof(SJM_CAPTURE_MAGIC) - 1, capture->file);
+	putc(SJM_CAPTURE_VERSION, capture->file);
+	capture->last		= sjm_capture_now();
+	capture->count		= 0;
+	capture->dropped	= 0;
+	capture->error		= SJM_ERROR_OK;
+	
+	return SJM_ERROR_OK;
+}
+
+void
+sjm_capture_request(
+	sjm_capture_t		*capture,
+	char			*json
+)
+{
+	unsigned char		header[2 * SJM_CAPTURE_VARINT_MAX];
+	unsigned long long	now;
+	size_t			length;
+	int			used;
+	
+	length			= strlen(json);
+	
+	/* The time is taken under the lock, so that records stay in
+	   order and delays are never negative. */
+	flockfile(capture->file);
+	if (length > SJM_CAPTURE_REQUEST_MAX)
+	{
+		if (SJM_ERROR_OK == capture->error)
+		{
+			capture->error	= SJM_ERROR_PARAMS_TOO_LARGE;
+		}
+		capture->dropped++;
+		funlockfile(capture->file);
+		return;
+	}
+	now			= sjm_capture_now();
+	used			= sjm_capture_put_varint(header, now - capture->last);
+	used			+= sjm_capture_put_varint(header + used, length);
+	capture->last		= now;
+	if (	(size_t)used != fwrite(header, 1, used, capture->file) ||
+		length != fwrite(json, 1, length, capture->file))
+	{
+		if (SJM_ERROR_OK == capture->error)
+		{
+			capture->error	= SJM_ERROR_SINK_WRITE;
+		}
+	}
+	capture->count++;
+	funlockfile(capture->file);
+}
+
+sjm_error_t
+sjm_capture_close(
+	sjm_capture_t		*capture
+)
+{
+	if (0 != fclose(capture->file) && SJM_ERROR_OK == capture->error)
+	{
+		capture->error	= SJM_ERROR_SINK_WRITE;
+	}
+	capture->file		= NULL;
+	
+	return capture->error;
+}
+
+sjm_error_t
+sjm_capture_reader_open(
+	sjm_capture_reader_t	*reader,
+	char			*path
+)
+{
+	char			magic[sizeof(SJM_CAPTURE_MAGIC)];
+	
+	reader->request		= NULL;
+	reader->file		= fopen(path, "rb");
+	if (NULL == reader->file)
+	{
+		return SJM_ERROR_CAPTURE_CORRUPT;
+	}
+	
+	if (	sizeof(magic) != fread(magic, 1, sizeof(magic), reader->file) ||
+		0 != memcmp(magic, SJM_CAPTURE_MAGIC, sizeof(magic) - 1) ||
+		SJM_CAPTURE_VERSION != magic[sizeof(magic) - 1])
+	{
+		sjm_capture_reader_close(reader);
+		return SJM_ERROR_CAPTURE_CORRUPT;
+	}
+	
+	reader->request		= malloc(SJM_CAPTURE_REQUEST_MAX + 1);
+	if (NULL == reader->request)
+	{
+		sjm_capture_reader_close(reader);
+		return SJM_ERROR_MEMORY_ALLOCATION_FAILURE;
+	}
+	
+	return SJM_ERROR_OK;
+}
+
+sjm_error_t
+sjm_capture_read(
+	sjm_capture_reader_t	*reader,
+	unsigned long long	*delay,
+	char			**json
+)
+{
+	unsigned long long	length;
+	sjm_error_t		error;
+	
+	error			= sjm_capture_get_varint(reader->file, delay);
+	if (SJM_ERROR_OK != error)
+	{
+		return error;
+	}
+	error			= sjm_capture_get_varint(reader->file, &length);
+	if (SJM_ERROR_END_OF_CAPTURE == error || length > SJM_CAPTURE_REQUEST_MAX)
+	{
+		return SJM_ERROR_CAPTURE_CORRUPT;
+	}
+	if (SJM_ERROR_OK != error)
+	{
+		return error;
+	}
+	
+	if (length != fread(reader->request, 1, length, reader->file))
+	{
+		return SJM_ERROR_CAPTURE_CORRUPT;
+	}
+	reader->request[length]	= '\0';
+	*json			= reader->request;
+	
+	return SJM_ERROR_OK;
+}
+
+void
+sjm_capture_reader_close(
+	sjm_capture_reader_t	*reader
+)
+{
+	if (NULL != reader->file)
+	{
+		fclose(reader->file);
+		reader->file	= NULL;
+	}
+	free(reader->request);
+	reader->request		= NULL;
+}
+
+/**
+@brief		Compare latencies, for sorting.
+*/
+static int
+sjm_replay_compare(
+	const void		*a,
+	const void		*b
+)
+{
+	unsigned long long	x;
+	unsigned long long	y;
+	
+	x			= *(const unsigned long long *)a;
+	y			= *(const unsigned long long *)b;
+	return (x > y) - (x < y);
+}
+
+/**
+@brief		Load every request in a capture file.
+@param		path
+			The capture file.
+@param		requests
+			Set to the requests, to be freed by the caller.
+@param		text
+			Set to the requests' text, each null-terminated, to
+			be freed by the caller.
+@param		count
+			Set to the number of requests.
+@returns	@c SJM_ERROR_OK on successes, an appropriate error code
+		otherwise.
+*/
+static sjm_error_t
+sjm_replay_load(
+	char			*path,
+	sjm_replay_request_t	**requests,
+	char			**text,
+	unsigned long		*count
+)
+{
+	sjm_capture_reader_t	reader;
+	sjm_error_t		error;
+	unsigned long long	delay;
+	unsigned long long	due;
+	unsigned long		capacity;
+	long			used;
+	long			size;
+	char			*json;
+	void			*grown;
+	int			length;
+	
+	*requests		= NULL;
+	*text			= NULL;
+	*count			= 0;
+	error			= sjm_capture_reader_open(&reader, path);
+	if (SJM_ERROR_OK != error)
+	{
+		return error;
+	}
+	
+	capacity		= 0;
+	used			= 0;
+	size			= 0;
+	due			= 0;
+	while (SJM_ERROR_OK == (error = sjm_capture_read(&reader, &delay, &json)))
+	{
+		length		= strlen(json);
+		if (*count == capacity)
+		{
+			capacity	= (0 == capacity) ? 256 : 2 * capacity;
+			grown		= realloc(*requests, capacity * sizeof(sjm_replay_request_t));
+			if (NULL == grown)
+			{
+				error	= SJM_ERROR_MEMORY_ALLOCATION_FAILURE;
+				break;
+			}
+			*requests	= grown;
+		}
+		if (used + length + 1 > size)
+		{
+			size		= 2 * (used + length + 1);
+			grown		= realloc(*text, size);
+			if (NULL == grown)
+			{
+				error	= SJM_ERROR_MEMORY_ALLOCATION_FAILURE;
+				break;
+			}
+			*text		= grown;
+		}
+	
+		/* The first request is due at once. */
+		due		+= (0 == *count) ? 0 : delay;
+		(*requests)[*count].due
+				= due;
+		(*requests)[*count].offset
+				= used;
+		(*requests)[*count].length
+				= length;
+		memcpy(*text + used, json, length + 1);
+		used		+= length + 1;
+		(*count)++;
+	}
+	sjm_capture_reader_close(&reader);
+	
+	if (SJM_ERROR_END_OF_CAPTURE != error)
+	{
+		free(*requests);
+		free(*text);
+		*requests	= NULL;
+		*text		= NULL;
+		return error;
+	}
+	
+	return SJM_ERROR_OK;
+}
+
+sjm_error_t
+sjm_replay(
+	sjm_t			*jobmanager,
+	char			*path,
+	double			speed,
+	sjm_replay_stats_t	*stats
+)
+{
+	sjm_replay_request_t	*requests;
+	sjm_capture_t		*capture;
+	sjm_error_t		error;
+	unsigned long long	*latencies;
+	unsigned long long	start;
+	unsigned long long	due;
+	unsigned long long	now;
+	unsigned long		count;
+	unsigned long		i;
+	struct timespec		pause;
+	char			*text;
+	char			*json;
+	int			longest;
+	
+	memset(stats, 0, sizeof(sjm_replay_stats_t));
+	error			= sjm_replay_load(path, &requests, &text, &count);
+	if (SJM_ERROR_OK != error)
+	{
+		return error;
+	}
+	
+	longest			= 0;
+	for (i = 0; i < count; i++)
+	{
+		if (requests[i].length > longest)
+		{
+			longest	= requests[i].length;
+		}
+	}
+	latencies		= malloc((count + 1) * sizeof(unsigned long long));
+	json			= malloc(longest + 1);
+	if (NULL == latencies || NULL == json)
+	{
+		free(requests);
+		free(text);
+		free(latencies);
+		free(json);
+		return SJM_ERROR_MEMORY_ALLOCATION_FAILURE;
+	}
+	
+	/* Don't capture the replay. */
+	capture			= jobmanager->capture;
+	jobmanager->capture	= NULL;
+	
+	start			= sjm_capture_now();
+	for (i = 0; i < count; i++)
+	{
+		/* Requests are parsed in place, so work on a copy. */
+		memcpy(json, text + requests[i].offset, requests[i].length + 1);
+	
+		now		= sjm_capture_now();
+		due		= now;
+		if (speed > 0)
+		{
+			due	= start + (unsigned long long)(requests[i].due / speed);
+			/* Sleep until nearly due, then spin the rest of
+			   the way, as sleeps tend to overshoot. */
+			if (due > now + 1000)
+			{
+				pause.tv_sec
+					= (due - now - 1000) / 1000000;
+				pause.tv_nsec
+					= ((due - now - 1000) % 1000000) * 1000;
+				nanosleep(&pause, NULL);
+			}
+			while (sjm_capture_now() < due)
+				;
+		}
+	
+		if (SJM_ERROR_OK != sjm_request_job(jobmanager, json, NULL))
+		{
+			stats->failures++;
+		}
+		latencies[i]	= sjm_capture_now() - due;
+	}
+	now			= sjm_capture_now();
+	jobmanager->capture	= capture;
+	
+	stats->requests		= count;
+	stats->elapsed		= now - start;
+	if (0 < stats->elapsed)
+	{
+		stats->throughput
+				= count * 1000000.0 / stats->elapsed;
+	}
+	if (0 < count)
+	{
+		qsort(latencies, count, sizeof(unsigned long long), sjm_replay_compare);
+		stats->p50	= latencies[(count - 1) * 500 / 1000];
+		stats->p90	= latencies[(count - 1) * 900 / 1000];
+		stats->p99	= latencies[(count - 1) * 990 / 1000];
+		stats->p999	= latencies[(count - 1) * 999 / 1000];
+		stats->max	= latencies[count - 1];
+	}
+	
+	free(requests);
+	free(text);
+	free(latencies);
+	free(json);
+	
+	return SJM_ERROR_OK;
+}
+#endif
@@ -0,0 +1,244 @@
+/******************************************************************************/
+/**
+@file
+@author		Graeme Douglas
+@brief		Capture of incoming requests, and their replay.
+@details	A job manager with a capture attached logs every request
+		given to @ref sjm_request_job, with the time it arrived, to
+		a compact binary file. Replaying the file against a job
+		manager reproduces the same load offline, at the recorded
+		pace, faster, or as fast as possible, and measures
+		throughput and latency.
+		
+		A capture file starts with @ref SJM_CAPTURE_MAGIC and a
+		version byte, followed by records:
+		
+			varint		microseconds since the previous
+					request (or since capture began)
+			varint		request length
+			bytes		the request, without a terminator
+		
+		Varints are little-endian base 128.
+*/
+/******************************************************************************/
+
+#ifndef JOB_CAPTURE_H
+#define JOB_CAPTURE_H
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include "jobmanager.h"
+
+/**
+@brief		Defined if requests can be captured and replayed.
+*/
+#if MILLISEC_PLATFORM != MILLISEC_PLATFORM_AVR
+#define SJM_CAPTURE
+#endif
+
+#ifdef  SJM_CAPTURE
+
+/**
+@brief		The bytes every capture file starts with.
+*/
+#define SJM_CAPTURE_MAGIC	"SJMC"
+
+/**
+@brief		The version of the capture format.
+*/
+#define SJM_CAPTURE_VERSION	1
+
+/**
+@brief		The longest request a capture file may hold.
+*/
+#define SJM_CAPTURE_REQUEST_MAX	65536
+
+/**
+@brief		A capture being written.
+*/
+struct sjm_capture
+{
+	FILE			*file;	/**< The capture file. */
+	unsigned long long	last;	/**< When the last request arrived,
+					     in microseconds. */
+	unsigned long		count;	/**< Requests captured so far. */
+	unsigned long		dropped;/**< Requests too long to capture,
+					     see @ref SJM_CAPTURE_REQUEST_MAX.
+					     These are not in @c count. */
+	sjm_error_t		error;	/**< The first error writing, if
+					     any requests were lost. */
+};
+
+/**
+@brief		A capture file being read.
+*/
+typedef struct sjm_capture_reader
+{
+	FILE			*file;	/**< The capture file. */
+	char			*request;
+					/**< The last request read,
+					     null-terminated. */
+} sjm_capture_reader_t;
+
+/**
+@brief		Measurements from a replay.
+@details	Latencies are in microseconds. When replaying at a
+		recorded pace, each request's latency is counted from when
+		it was due rather than when it started, so a slow request
+		holding up later ones shows in their latencies too.
+*/
+typedef struct sjm_replay_stats
+{
+	unsigned long		requests;
+					/**< Requests replayed. */
+	unsigned long		failures;
+					/**< Requests that did not return
+					     @c SJM_ERROR_OK. */
+	unsigned long long	elapsed;/**< Microseconds from the first
+					     request to the end of the last.
+					*/
+	double			throughput;
+					/**< Requests per second. */
+	unsigned long long	p50;	/**< Median latency. */
+	unsigned long long	p90;	/**< 90th percentile latency. */
+	unsigned long long	p99;	/**< 99th percentile latency. */
+	unsigned long long	p999;	/**< 99.9th percentile latency. */
+	unsigned long long	max;	/**< Worst latency. */
+} sjm_replay_stats_t;
+
+/**
+@brief		Get a monotonic time in microseconds.
+*/
+unsigned long long
+sjm_capture_now(
+	void
+);
+
+/**
+@brief		Start capturing to a file.
+@details	Attach the capture to a job manager by setting its
+		@c capture to it; detach it before closing it.
+@param		capture
+			The capture to initialize. This must already be
+			allocated.
+@param		path
+			The file to capture to. Anything already there is
+			replaced.
+@returns	@c SJM_ERROR_OK on successes, an appropriate error code
+		otherwise.
+*/
+sjm_error_t
+sjm_capture_open(
+	sjm_capture_t		*capture,
+	char			*path
+);
+
+/**
+@brief		Capture a request, timestamped now.
+@details	This is called by @ref sjm_request_job. It may be called
+		from several threads at once.
+@param		capture
+			The capture.
+@param		json
+			The request.
+*/
+void
+sjm_capture_request(
+	sjm_capture_t		*capture,
+	char			*json
+);
+
+/**
+@brief		Finish capturing.
+@param		capture
+			The capture.
+@returns	@c SJM_ERROR_OK if every request was captured, an
+		appropriate error code otherwise.
+*/
+sjm_error_t
+sjm_capture_close(
+	sjm_capture_t		*capture
+);
+
+/**
+@brief		Open a capture file for reading.
+@param		reader
+			The reader to initialize. This must already be
+			allocated.
+@param		path
+			The capture file.
+@returns	@c SJM_ERROR_OK on successes, @c SJM_ERROR_CAPTURE_CORRUPT
+		if the file is not a capture, an appropriate error code
+		otherwise.
+*/
+sjm_error_t
+sjm_capture_reader_open(
+	sjm_capture_reader_t	*reader,
+	char			*path
+);
+
+/**
+@brief		Read the next request.
+@param		reader
+			The reader.
+@param		delay
+			Set to the microseconds since the previous request.
+@param		json
+			Set to the request, null-terminated. It is valid
+			until the next read.
+@returns	@c SJM_ERROR_OK on successes, @c SJM_ERROR_END_OF_CAPTURE
+		if there are no more requests, an appropriate error code
+		otherwise.
+*/
+sjm_error_t
+sjm_capture_read(
+	sjm_capture_reader_t	*reader,
+	unsigned long long	*delay,
+	char			**json
+);
+
+/**
+@brief		Close a capture file being read.
+*/
+void
+sjm_capture_reader_close(
+	sjm_capture_reader_t	*reader
+);
+
+/**
+@brief		Replay a capture file against a job manager.
+@details	The whole file is read before the first request is
+		replayed, so reading does not disturb the measurements.
+		Jobs are given a @c NULL return pointer.
+@param		jobmanager
+			The job manager to replay against. Its jobs must
+			already be added.
+@param		path
+			The capture file.
+@param		speed
+			How many times faster than recorded to replay, or 0
+			to replay as fast as possible.
+@param		stats
+			Filled in with the measurements.
+@returns	@c SJM_ERROR_OK on successes, an appropriate error code
+		otherwise. Failed requests do not stop the replay; they
+		are counted in @p stats.
+*/
+sjm_error_t
+sjm_replay(
+	sjm_t			*jobmanager,
+	char			*path,
+	double			speed,
+	sjm_replay_stats_t	*stats
+);
+
+#endif
+
+#ifdef  __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,584 @@
+/******************************************************************************/
+/**
+@file
+@author		Graeme Douglas
+@details	For more information, see @ref jobframe.h.
+*/
+/******************************************************************************/
+
+#include "jobframe.h"
+
+/**
+@brief		Integers in this range are smaller as varints.
+*/
+#define SJM_FRAME_VARINT_LIMIT	4096
+
+/**
+@brief		CRC-16/CCITT, four bits at a time, to stay small on
+		devices short of memory.
+*/
+static const unsigned short sjm_frame_crc_table[16] =
+{
+	0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50a5, 0x60c6, 0x70e7,
+	0x8108, 0x9129, 0xa14a, 0xb16b, 0xc18c, 0xd1ad, 0xe1ce, 0xf1ef
+};
+
+/**
+@brief		Compute the CRC of some bytes.
+@param		bytes
+			The bytes.
+@param		length
+			The number of bytes.
+@returns	The CRC.
+*/
+static unsigned short
+sjm_frame_crc(
+	const unsigned char	*bytes,
+	int			length
+)
+{
+	unsigned short		crc;
+	int			i;
+	
+	crc			= 0xFFFF;
+	for (i = 0; i < length; i++)
+	{
+		crc		= (crc << 4) ^ sjm_frame_crc_table[((crc >> 12) ^ (bytes[i] >> 4)) & 0xF];
+		crc		= (crc << 4) ^ sjm_frame_crc_table[((crc >> 12) ^ bytes[i]) & 0xF];
+	}
+	
+	return crc;
+}
+
+/**
+@brief		Write a varint.
+@param		bytes
+			Where to write it. There must be room for
+			@ref SJM_FRAME_VARINT_MAX bytes.
+@param		value
+			The value, of at most 32 bits.
+@returns	The number of bytes written.
+*/
+static int
+sjm_frame_put_varint(
+	unsigned char		*bytes,
+	unsigned long		value
+)
+{
+	int			i;
+	
+	for (i = 0; value >= 0x80; i++)
+	{
+		bytes[i]	= (unsigned char)(value | 0x80);
+		value		>>= 7;
+	}
+	bytes[i]		= (unsigned char)value;
+	
+	return i + 1;
+}
+
+/**
+@brief		Read a varint.
+@param		bytes
+			Where to read it from.
+@param		end
+			The end of the readable bytes.
+@param		value
+			Set to the value.
+@returns	The number of bytes read, 0 if @p end came first, or -1
+		if the varint is too long.
+*/
+static int
+sjm_frame_get_varint(
+	const unsigned char	*bytes,
+	const unsigned char	*end,
+	unsigned long		*value
+)
+{
+	int			i;
+	
+	*value			= 0;
+	for (i = 0; i < SJM_FRAME_VARINT_MAX; i++)
+	{
+		if (bytes + i >= end)
+		{
+			return 0;
+		}
+		*value		|= (unsigned long)(bytes[i] & 0x7F) << (7 * i);
+		if (0 == (bytes[i] & 0x80))
+		{
+			return i + 1;
+		}
+	}
+	
+	return -1;
+}
+
+/**
+@brief		Reserve room for more of a frame's body.
+@param		writer
+			The writer.
+@param		bytes
+			The number of bytes needed.
+@returns	Where to write them, or @c NULL if they do not fit.
+*/
+static unsigned char *
+sjm_frame_reserve(
+	sjm_frame_writer_t	*writer,
+	int			bytes
+)
+{
+	unsigned char		*position;
+	
+	/* Room for the CRC is always kept. */
+	if (writer->overflow ||
+	    SJM_FRAME_VARINT_MAX + writer->length + bytes + SJM_FRAME_CRC_SIZE > writer->size)
+	{
+		writer->overflow
+				= true;
+		return NULL;
+	}
+	position		= writer->buffer + SJM_FRAME_VARINT_MAX + writer->length;
+	writer->length		+= bytes;
+	
+	return position;
+}
+
+/**
+@brief		Add an argument's type, if there is room for another.
+@param		writer
+			The writer.
+@param		type
+			The argument type.
+@returns	@c true if the argument may be written.
+*/
+static sjm_bool_t
+sjm_frame_add_type(
+	sjm_frame_writer_t	*writer,
+	sjm_frame_arg_type_t	type
+)
+{
+	unsigned char		*position;
+	
+	if (writer->count >= SJM_FRAME_ARGS_MAX)
+	{
+		writer->overflow
+				= true;
+		return false;
+	}
+	position		= sjm_frame_reserve(writer, 1);
+	if (NULL == position)
+	{
+		return false;
+	}
+	*position		= (unsigned char)type;
+	writer->count++;
+	
+	return true;
+}
+
+/**
+@brief		Add a length-prefixed, null-terminated string.
+@param		writer
+			The writer.
+@param		string
+			The string.
+*/
+static void
+sjm_frame_put_string(
+	sjm_frame_writer_t	*writer,
+	char			*string
+)
+{
+	unsigned char		prefix[SJM_FRAME_VARINT_MAX];
+	unsigned char		*position;
+	int			length;
+	int			bytes;
+	
+	length			= strlen(string) + 1;
+	bytes			= sjm_frame_put_varint(prefix, length);
+	position		= sjm_frame_reserve(writer, bytes + length);
+	if (NULL != position)
+	{
+		memcpy(position, prefix, bytes);
+		memcpy(position + bytes, string, length);
+	}
+}
+
+void
+sjm_frame_begin(
+	sjm_frame_writer_t	*writer,
+	unsigned char		*buffer,
+	int			size,
+	char			*name
+)
+{
+	writer->buffer		= buffer;
+	writer->size		= size;
+	writer->length		= 0;
+	writer->count		= 0;
+	writer->overflow	= false;
+	sjm_frame_put_string(writer, name);
+}
+
+void
+sjm_frame_add_int(
+	sjm_frame_writer_t	*writer,
+	long			value
+)
+{
+	unsigned char		*position;
+	unsigned long		zigzag;
+	int			padding;
+	
+	if (-SJM_FRAME_VARINT_LIMIT <= value && value < SJM_FRAME_VARINT_LIMIT)
+	{
+		if (sjm_frame_add_type(writer, SJM_FRAME_ARG_VARINT))
+		{
+			zigzag	= (value < 0) ? (((unsigned long)-value) << 1) - 1 : ((unsigned long)value) << 1;
+			position
+				= sjm_frame_reserve(writer, SJM_FRAME_VARINT_MAX);
+			if (NULL != position)
+			{
+				writer->length
+					-= SJM_FRAME_VARINT_MAX - sjm_frame_put_varint(position, zigzag);
+			}
+		}
+		return;
+	}
+	
+	if (sjm_frame_add_type(writer, SJM_FRAME_ARG_INT32))
+	{
+		padding		= (4 - (writer->length & 3)) & 3;
+		position	= sjm_frame_reserve(writer, padding + 4);
+		if (NULL != position)
+		{
+			memset(position, 0, padding);
+			position	+= padding;
+			position[0]	= (unsigned char)value;
+			position[1]	= (unsigned char)(value >> 8);
+			position[2]	= (unsigned char)(value >> 16);
+			position[3]	= (unsigned char)(value >> 24);
+		}
+	}
+}
+
+void
+sjm_frame_add_string(
+	sjm_frame_writer_t	*writer,
+	char			*string
+)
+{
+	if (sjm_frame_add_type(writer, SJM_FRAME_ARG_STRING))
+	{
+		sjm_frame_put_string(writer, string);
+	}
+}
+
+sjm_error_t
+sjm_frame_finish(
+	sjm_frame_writer_t	*writer,
+	unsigned char		**frame,
+	int			*length
+)
+{
+	unsigned char		prefix[SJM_FRAME_VARINT_MAX];
+	unsigned char		*body;
+	unsigned short		crc;
+	int			bytes;
+	
+	if (writer->overflow)
+	{
+		return SJM_ERROR_FRAME_TOO_LARGE;
+	}
+	
+	/* The length goes immediately before the body, wherever that
+	   leaves the start of the frame. */
+	body			= writer->buffer + SJM_FRAME_VARINT_MAX;
+	bytes			= sjm_frame_put_varint(prefix, writer->length);
+	*frame			= body - bytes;
+	memcpy(*frame, prefix, bytes);
+	
+	crc			= sjm_frame_crc(body, writer->length);
+	body[writer->length]	= (unsigned char)crc;
+	body[writer->length+1]	= (unsigned char)(crc >> 8);
+	*length			= bytes + writer->length + SJM_FRAME_CRC_SIZE;
+	
+	return SJM_ERROR_OK;
+}
+
+/**
+@brief		Find a whole frame's body and check its CRC.
+@param		buffer
+			Received bytes, starting at a frame.
+@param		length
+			The number of bytes received.
+@param		body
+			Set to the start of the body.
+@param		body_length
+			Set to the length of the body.
+@param		consumed
+			Set to the number of bytes in the frame.
+@returns	@c SJM_ERROR_OK on successes, an appropriate error code
+		otherwise.
+*/
+static sjm_error_t
+sjm_frame_body(
+	unsigned char		*buffer,
+	int			length,
+	unsigned char		**body,
+	int			*body_length,
+	int			*consumed
+)
+{
+	unsigned long		value;
+	unsigned short		crc;
+	int			bytes;
+	
+	bytes			= sjm_frame_get_varint(buffer, buffer + length, &value);
+	if (0 == bytes)
+	{
+		return SJM_ERROR_FRAME_INCOMPLETE;
+	}
+	if (bytes < 0 || value > 0x7FFFFFFFUL - SJM_FRAME_VARINT_MAX - SJM_FRAME_CRC_SIZE)
+	{
+		return SJM_ERROR_FRAME_CORRUPT;
+	}
+	if (bytes + (int)value + SJM_FRAME_CRC_SIZE > length)
+	{
+		return SJM_ERROR_FRAME_INCOMPLETE;
+	}
+	
+	*body			= buffer + bytes;
+	*body_length		= (int)value;
+	*consumed		= bytes + (int)value + SJM_FRAME_CRC_SIZE;
+	crc			= (*body)[value] | ((*body)[value+1] << 8);
+	if (crc != sjm_frame_crc(*body, *body_length))
+	{
+		return SJM_ERROR_FRAME_CORRUPT;
+	}
+	
+	return SJM_ERROR_OK;
+}
+
+/**
+@brief		Read a length-prefixed, null-terminated string in place.
+@param		position
+			Where the string starts.
+@param		end
+			The end of the body.
+@param		string
+			Set to the string.
+@returns	Where the string ends, or @c NULL if it is malformed.
+*/
+static unsigned char *
+sjm_frame_get_string(
+	unsigned char		*position,
+	unsigned char		*end,
+	char			**string
+)
+{
+	unsigned long		length;
+	int			bytes;
+	
+	bytes			= sjm_frame_get_varint(position, end, &length);
+	if (bytes <= 0 ||
+	    0 == length ||
+	    length > (unsigned long)(end - position - bytes) ||
+	    '\0' != position[bytes + length - 1])
+	{
+		return NULL;
+	}
+	*string			= (char *)(position + bytes);
+	
+	return position + bytes + length;
+}
+
+sjm_error_t
+sjm_frame_decode(
+	unsigned char		*buffer,
+	int			length,
+	sjm_frame_t		*frame,
+	int			*consumed
+)
+{
+	sjm_error_t		error;
+	unsigned char		*body;
+	unsigned char		*position;
+	unsigned char		*end;
+	unsigned long		value;
+	int			body_length;
+	int			bytes;
+	
+	error			= sjm_frame_body(buffer, length, &body, &body_length, consumed);
+	if (SJM_ERROR_OK != error)
+	{
+		return error;
+	}
+	end			= body + body_length;
+	
+	position		= sjm_frame_get_string(body, end, &(frame->name));
+	if (NULL == position)
+	{
+		return SJM_ERROR_FRAME_CORRUPT;
+	}
+	
+	for (frame->count = 0; position < end; frame->count++)
+	{
+		if (frame->count >= SJM_FRAME_ARGS_MAX)
+		{
+			return SJM_ERROR_FRAME_TOO_LARGE;
+		}
+	
+		switch (*(position++))
+		{
+		 case SJM_FRAME_ARG_VARINT:
+		 {
+			bytes		= sjm_frame_get_varint(position, end, &value);
+			if (bytes <= 0)
+			{
+				return SJM_ERROR_FRAME_CORRUPT;
+			}
+			position	+= bytes;
+			frame->integers[frame->count]
+					= (value & 1) ? -(long)(value >> 1) - 1 : (long)(value >> 1);
+			frame->params[frame->count]
+					= frame->integers + frame->count;
+		 } break;
+		 case SJM_FRAME_ARG_INT32:
+		 {
+			position	+= (4 - ((position - body) & 3)) & 3;
+			if (end - position < 4)
+			{
+				return SJM_ERROR_FRAME_CORRUPT;
+			}
+#ifdef  SJM_FRAME_IN_PLACE
+			if (0 == ((unsigned long)position & 3))
+			{
+				frame->params[frame->count]
+					= position;
+				position	+= 4;
+				break;
+			}
+#endif
+			frame->integers[frame->count]
+					= (int)((unsigned long)position[0] |
+					        ((unsigned long)position[1] << 8) |
+					        ((unsigned long)position[2] << 16) |
+					        ((unsigned long)position[3] << 24));
+			frame->params[frame->count]
+					= frame->integers + frame->count;
+			position	+= 4;
+		 } break;
+		 case SJM_FRAME_ARG_STRING:
+		 {
+			position	= sjm_frame_get_string(
+						position,
+						end,
+						(char **)&(frame->params[frame->count])
+					);
+			if (NULL == position)
+			{
+				return SJM_ERROR_FRAME_CORRUPT;
+			}
+		 } break;
+		 default:
+			return SJM_ERROR_FRAME_CORRUPT;
+		}
+	}
+	
+	return SJM_ERROR_OK;
+}
+
+sjm_error_t
+sjm_frame_request_job(
+	sjm_t			*jobmanager,
+	unsigned char		*buffer,
+	int			length,
+	void			*retval,
+	int			*consumed
+)
+{
+	sjm_frame_t		frame;
+	sjm_error_t		error;
+	
+	error			= sjm_frame_decode(buffer, length, &frame, consumed);
+	if (SJM_ERROR_OK != error)
+	{
+		return error;
+	}
+	if ((int)strlen(frame.name) >= jobmanager->maximum_name_size)
+	{
+		return SJM_ERROR_DICT_GET_FAILURE;
+	}
+	
+	return sjm_perform_job(jobmanager, frame.name, frame.params, retval);
+}
+
+sjm_error_t
+sjm_frame_encode_response(
+	unsigned char		*buffer,
+	int			size,
+	sjm_error_t		status,
+	void			*result,
+	int			result_size,
+	unsigned char		**frame,
+	int			*length
+)
+{
+	sjm_frame_writer_t	writer;
+	unsigned char		*position;
+	
+	writer.buffer		= buffer;
+	writer.size		= size;
+	writer.length		= 0;
+	writer.count		= 0;
+	writer.overflow		= false;
+	
+	position		= sjm_frame_reserve(&writer, SJM_FRAME_VARINT_MAX);
+	if (NULL != position)
+	{
+		writer.length	-= SJM_FRAME_VARINT_MAX - sjm_frame_put_varint(position, status);
+	}
+	position		= sjm_frame_reserve(&writer, result_size);
+	if (NULL != position && 0 != result_size)
+	{
+		memcpy(position, result, result_size);
+	}
+	
+	return sjm_frame_finish(&writer, frame, length);
+}
+
+sjm_error_t
+sjm_frame_decode_response(
+	unsigned char		*buffer,
+	int			length,
+	sjm_error_t		*status,
+	void			**result,
+	int			*result_size,
+	int			*consumed
+)
+{
+	sjm_error_t		error;
+	unsigned char		*body;
+	unsigned long		value;
+	int			body_length;
+	int			bytes;
+	
+	error			= sjm_frame_body(buffer, length, &body, &body_length, consumed);
+	if (SJM_ERROR_OK != error)
+	{
+		return error;
+	}
+	
+	bytes			= sjm_frame_get_varint(body, body + body_length, &value);
+	if (bytes <= 0)
+	{
+		return SJM_ERROR_FRAME_CORRUPT;
+	}
+	*status			= (sjm_error_t)value;
+	*result			= body + bytes;
+	*result_size		= body_length - bytes;
+	
+	return SJM_ERROR_OK;
+}
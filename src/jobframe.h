@@ -0,0 +1,275 @@
+/******************************************************************************/
+/**
+@file
+@author		Graeme Douglas
+@brief		A compact binary request and response protocol.
+@details	An alternative to JSON requests for links where bytes and
+		cycles are scarce, such as serial ports. A request frame
+		is laid out as follows, all integers little-endian:
+		
+			varint		body length
+			varint		name length, including its null
+			bytes		job name, null-terminated
+			arguments, until the end of the body:
+				byte	argument type
+				...	argument value (see
+					@ref sjm_frame_arg_type_t)
+			2 bytes		CRC-16/CCITT of the body
+		
+		Decoding copies nothing: names, strings and 32-bit integers
+		are all used where they lie in the receive buffer, which
+		is not modified. 32-bit integers are aligned to four bytes
+		from the start of the body, so they are used in place when
+		the body is aligned in the buffer and the host is
+		little-endian with 32-bit @c int; otherwise they are
+		converted into the decoded frame, as varints always are.
+		
+		A response frame has the same length and CRC, around a
+		body holding a varint status (an @ref sjm_error_t) and
+		then the raw result bytes.
+*/
+/******************************************************************************/
+
+#ifndef JOB_FRAME_H
+#define JOB_FRAME_H
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+#include "jobmanager.h"
+
+/**
+@brief		The most arguments a frame may carry.
+*/
+#define SJM_FRAME_ARGS_MAX	16
+
+/**
+@brief		The most bytes a varint may take.
+*/
+#define SJM_FRAME_VARINT_MAX	5
+
+/**
+@brief		Bytes of CRC ending a frame.
+*/
+#define SJM_FRAME_CRC_SIZE	2
+
+/**
+@brief		Defined if decoded 32-bit integers can be used in place.
+*/
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__ && \
+    defined(__SIZEOF_INT__) && __SIZEOF_INT__ == 4
+#define SJM_FRAME_IN_PLACE
+#endif
+
+/**
+@brief		Argument types.
+*/
+typedef enum sjm_frame_arg_type
+{
+	SJM_FRAME_ARG_VARINT	= 1,	/**< A zig-zag encoded varint. */
+	SJM_FRAME_ARG_INT32	= 2,	/**< Zero bytes padding to a multiple
+					     of four from the start of the
+					     body, then four bytes. */
+	SJM_FRAME_ARG_STRING	= 3,	/**< A varint length, including the
+					     null terminator, then the bytes.
+					*/
+} sjm_frame_arg_type_t;
+
+/**
+@brief		A decoded request frame.
+*/
+typedef struct sjm_frame
+{
+	char			*name;	/**< The job name, in the buffer. */
+	void			*params[SJM_FRAME_ARGS_MAX];
+					/**< Parameters, ready for the job.
+					*/
+	int			integers[SJM_FRAME_ARGS_MAX];
+					/**< Integers that could not be used
+					     in place. */
+	int			count;	/**< Number of parameters. */
+} sjm_frame_t;
+
+/**
+@brief		Builds a request frame in a caller's buffer.
+*/
+typedef struct sjm_frame_writer
+{
+	unsigned char		*buffer;/**< The caller's buffer. */
+	int			size;	/**< Size of @c buffer. */
+	int			length;	/**< Bytes of body written so far. */
+	int			count;	/**< Arguments written so far. */
+	sjm_bool_t		overflow;
+					/**< Set if anything did not fit. */
+} sjm_frame_writer_t;
+
+/**
+@brief		Start building a request frame.
+@param		writer
+			The writer to initialize. This must already be
+			allocated.
+@param		buffer
+			Where to build the frame.
+@param		size
+			The size of @p buffer. The frame needs
+			@ref SJM_FRAME_VARINT_MAX bytes more than its
+			encoded size while it is built.
+@param		name
+			The name of the job to request.
+*/
+void
+sjm_frame_begin(
+	sjm_frame_writer_t	*writer,
+	unsigned char		*buffer,
+	int			size,
+	char			*name
+);
+
+/**
+@brief		Add an integer argument.
+@details	Small integers are sent as varints, larger ones as
+		aligned 32-bit integers, whichever is smaller.
+@param		writer
+			The writer.
+@param		value
+			The integer.
+*/
+void
+sjm_frame_add_int(
+	sjm_frame_writer_t	*writer,
+	long			value
+);
+
+/**
+@brief		Add a string argument.
+@param		writer
+			The writer.
+@param		string
+			The null-terminated string.
+*/
+void
+sjm_frame_add_string(
+	sjm_frame_writer_t	*writer,
+	char			*string
+);
+
+/**
+@brief		Finish a request frame.
+@param		writer
+			The writer.
+@param		frame
+			Set to the start of the frame, within the writer's
+			buffer.
+@param		length
+			Set to the number of bytes in the frame.
+@returns	@c SJM_ERROR_OK on successes, an appropriate error code
+		otherwise.
+*/
+sjm_error_t
+sjm_frame_finish(
+	sjm_frame_writer_t	*writer,
+	unsigned char		**frame,
+	int			*length
+);
+
+/**
+@brief		Decode a request frame.
+@param		buffer
+			Received bytes, starting at a frame. Nothing is
+			copied out of it, so it must outlive @p frame.
+@param		length
+			The number of bytes received.
+@param		frame
+			The decoded frame.
+@param		consumed
+			Set to the number of bytes in the frame, so the
+			next frame starts there.
+@returns	@c SJM_ERROR_OK on successes, @c SJM_ERROR_FRAME_INCOMPLETE
+		if more bytes are needed, an appropriate error code
+		otherwise.
+*/
+sjm_error_t
+sjm_frame_decode(
+	unsigned char		*buffer,
+	int			length,
+	sjm_frame_t		*frame,
+	int			*consumed
+);
+
+/**
+@brief		Perform the job requested by a request frame.
+@details	See @ref sjm_frame_decode and @ref sjm_perform_job.
+*/
+sjm_error_t
+sjm_frame_request_job(
+	sjm_t			*jobmanager,
+	unsigned char		*buffer,
+	int			length,
+	void			*retval,
+	int			*consumed
+);
+
+/**
+@brief		Encode a response frame.
+@param		buffer
+			Where to build the frame.
+@param		size
+			The size of @p buffer.
+@param		status
+			The outcome of the request.
+@param		result
+			The result bytes, or @c NULL if there are none.
+@param		result_size
+			The number of result bytes.
+@param		frame
+			Set to the start of the frame, within @p buffer.
+@param		length
+			Set to the number of bytes in the frame.
+@returns	@c SJM_ERROR_OK on successes, an appropriate error code
+		otherwise.
+*/
+sjm_error_t
+sjm_frame_encode_response(
+	unsigned char		*buffer,
+	int			size,
+	sjm_error_t		status,
+	void			*result,
+	int			result_size,
+	unsigned char		**frame,
+	int			*length
+);
+
+/**
+@brief		Decode a response frame.
+@param		buffer
+			Received bytes, starting at a frame.
+@param		length
+			The number of bytes received.
+@param		status
+			Set to the outcome of the request.
+@param		result
+			Set to the result bytes, in @p buffer.
+@param		result_size
+			Set to the number of result bytes.
+@param		consumed
+			Set to the number of bytes in the frame.
+@returns	@c SJM_ERROR_OK on successes, @c SJM_ERROR_FRAME_INCOMPLETE
+		if more bytes are needed, an appropriate error code
+		otherwise.
+*/
+sjm_error_t
+sjm_frame_decode_response(
+	unsigned char		*buffer,
+	int			length,
+	sjm_error_t		*status,
+	void			**result,
+	int			*result_size,
+	int			*consumed
+);
+
+#ifdef  __cplusplus
+}
+#endif
+
+#endif
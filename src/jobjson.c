@@ -0,0 +1,555 @@
+/******************************************************************************/
+/**
+@file
+@author		Graeme Douglas
+@details	For more information, see @ref jobjson.h.
+*/
+/******************************************************************************/
+
+#include "jobjson.h"
+
+/**
+@brief		Every two-digit number, for formatting two digits at a time.
+*/
+static const char sjm_json_digits[201] =
+	"00010203040506070809"
+	"10111213141516171819"
+	"20212223242526272829"
+	"30313233343536373839"
+	"40414243444546474849"
+	"50515253545556575859"
+	"60616263646566676869"
+	"70717273747576777879"
+	"80818283848586878889"
+	"90919293949596979899";
+
+/**
+@brief		Powers of ten, up to @ref SJM_JSON_PRECISION_MAX.
+*/
+static const unsigned long sjm_json_powers[SJM_JSON_PRECISION_MAX+1] =
+{
+	1UL, 10UL, 100UL, 1000UL, 10000UL, 100000UL, 1000000UL, 10000000UL,
+	100000000UL, 1000000000UL
+};
+
+/**
+@brief		Room for any formatted number.
+*/
+#define SJM_JSON_NUMBER_SIZE	48
+
+/**
+@brief		Hand what may be flushed to the flush callback, making
+		room in the buffer.
+@param		writer
+			The writer.
+@returns	@c true if any room was made.
+*/
+static sjm_bool_t
+sjm_json_drain(
+	sjm_json_writer_t	*writer
+)
+{
+	int			limit;
+	
+	/* An open response must stay put until its status is in. */
+	limit			= (writer->hold >= 0) ? writer->hold : writer->length;
+	if (NULL == writer->flush || 0 == limit)
+	{
+		return false;
+	}
+	if (!writer->flush(writer->state, writer->buffer, limit))
+	{
+		writer->error	= SJM_ERROR_SINK_WRITE;
+		return false;
+	}
+	
+	memmove(writer->buffer, writer->buffer + limit, writer->length - limit);
+	writer->length		-= limit;
+	if (writer->hold >= 0)
+	{
+		writer->hold	= 0;
+	}
+	
+	return true;
+}
+
+/**
+@brief		Append bytes, flushing as the buffer fills.
+@param		writer
+			The writer.
+@param		data
+			The bytes.
+@param		length
+			The number of bytes.
+*/
+static void
+sjm_json_put(
+	sjm_json_writer_t	*writer,
+	const char		*data,
+	int			length
+)
+{
+	int			chunk;
+	
+	while (length > 0 && SJM_ERROR_OK == writer->error)
+	{
+		if (writer->length == writer->size && !sjm_json_drain(writer))
+		{
+			if (SJM_ERROR_OK == writer->error)
+			{
+				writer->error
+					= SJM_ERROR_BUFFER_FULL;
+			}
+			return;
+		}
+	
+		chunk		= writer->size - writer->length;
+		if (chunk > length)
+		{
+			chunk	= length;
+		}
+		memcpy(writer->buffer + writer->length, data, chunk);
+		writer->length	+= chunk;
+		data		+= chunk;
+		length		-= chunk;
+	}
+}
+
+/**
+@brief		Write whatever must come before the next value.
+@param		writer
+			The writer.
+*/
+static void
+sjm_json_separate(
+	sjm_json_writer_t	*writer
+)
+{
+	if (writer->keyed)
+	{
+		writer->keyed	= false;
+		return;
+	}
+	if (writer->count[writer->depth]++ > 0)
+	{
+		sjm_json_put(writer, (0 == writer->depth) ? "\n" : ",", 1);
+	}
+}
+
+/**
+@brief		Format an unsigned integer, two digits at a time.
+@param		end
+			Where the digits end. They are written backwards
+			from here.
+@param		value
+			The integer.
+@returns	The number of digits written.
+*/
+static int
+sjm_json_format(
+	char			*end,
+	unsigned long long	value
+)
+{
+	char			*position;
+	int			pair;
+	
+	position		= end;
+	while (value >= 100)
+	{
+		pair		= (int)(value % 100) * 2;
+		value		/= 100;
+		*(--position)	= sjm_json_digits[pair+1];
+		*(--position)	= sjm_json_digits[pair];
+	}
+	if (value >= 10)
+	{
+		pair		= (int)value * 2;
+		*(--position)	= sjm_json_digits[pair+1];
+		*(--position)	= sjm_json_digits[pair];
+	}
+	else
+	{
+		*(--position)	= (char)('0' + value);
+	}
+	
+	return end - position;
+}
+
+/**
+@brief		Begin an array or object.
+*/
+static void
+sjm_json_begin(
+	sjm_json_writer_t	*writer,
+	char			bracket
+)
+{
+	sjm_json_separate(writer);
+	if (writer->depth >= SJM_JSON_DEPTH_MAX)
+	{
+		writer->error	= SJM_ERROR_BUFFER_FULL;
+		return;
+	}
+	sjm_json_put(writer, &bracket, 1);
+	writer->depth++;
+	writer->count[writer->depth]
+				= 0;
+}
+
+/**
+@brief		End an array or object.
+*/
+static void
+sjm_json_end(
+	sjm_json_writer_t	*writer,
+	char			bracket
+)
+{
+	if (writer->depth > 0)
+	{
+		sjm_json_put(writer, &bracket, 1);
+		writer->depth--;
+	}
+}
+
+void
+sjm_json_init(
+	sjm_json_writer_t	*writer,
+	char			*buffer,
+	int			size,
+	sjm_json_flush_t	flush,
+	void			*state
+)
+{
+	writer->buffer		= buffer;
+	writer->size		= size;
+	writer->length		= 0;
+	writer->hold		= -1;
+	writer->depth		= 0;
+	writer->count[0]	= 0;
+	writer->keyed		= false;
+	writer->error		= SJM_ERROR_OK;
+	writer->flush		= flush;
+	writer->state		= state;
+}
+
+void
+sjm_json_begin_array(
+	sjm_json_writer_t	*writer
+)
+{
+	sjm_json_begin(writer, '[');
+}
+
+void
+sjm_json_end_array(
+	sjm_json_writer_t	*writer
+)
+{
+	sjm_json_end(writer, ']');
+}
+
+void
+sjm_json_begin_object(
+	sjm_json_writer_t	*writer
+)
+{
+	sjm_json_begin(writer, '{');
+}
+
+void
+sjm_json_end_object(
+	sjm_json_writer_t	*writer
+)
+{
+	sjm_json_end(writer, '}');
+}
+
+void
+sjm_json_key(
+	sjm_json_writer_t	*writer,
+	const char		*key
+)
+{
+	sjm_json_string(writer, key);
+	sjm_json_put(writer, ":", 1);
+	writer->keyed		= true;
+}
+
+void
+sjm_json_int(
+	sjm_json_writer_t	*writer,
+	long			value
+)
+{
+	char			number[SJM_JSON_NUMBER_SIZE];
+	int			length;
+	
+	sjm_json_separate(writer);
+	if (value < 0)
+	{
+		/* Negate after the cast, so the most negative works too. */
+		length		= sjm_json_format(number + SJM_JSON_NUMBER_SIZE, -(unsigned long)value);
+		number[SJM_JSON_NUMBER_SIZE - (++length)]
+				= '-';
+	}
+	else
+	{
+		length		= sjm_json_format(number + SJM_JSON_NUMBER_SIZE, value);
+	}
+	sjm_json_put(writer, number + SJM_JSON_NUMBER_SIZE - length, length);
+}
+
+void
+sjm_json_double(
+	sjm_json_writer_t	*writer,
+	double			value,
+	int			precision
+)
+{
+	char			number[SJM_JSON_NUMBER_SIZE];
+	char			*position;
+	unsigned long long	scaled;
+	unsigned long		fraction;
+	unsigned long		scale;
+	sjm_bool_t		negative;
+	int			exponent;
+	int			i;
+	
+	/* NaN is unequal to itself; infinity less itself is NaN. */
+	if (value != value || value - value != 0)
+	{
+		sjm_json_null(writer);
+		return;
+	}
+	if (precision < 0)
+	{
+		precision	= 0;
+	}
+	if (precision > SJM_JSON_PRECISION_MAX)
+	{
+		precision	= SJM_JSON_PRECISION_MAX;
+	}
+	
+	sjm_json_separate(writer);
+	negative		= (value < 0);
+	if (negative)
+	{
+		value		= -value;
+	}
+	scale			= sjm_json_powers[precision];
+	position		= number + SJM_JSON_NUMBER_SIZE;
+	
+	if (value < 9.2e18 / scale)
+	{
+		scaled		= (unsigned long long)(value * scale + 0.5);
+		fraction	= (unsigned long)(scaled % scale);
+		for (i = 0; i < precision; i++)
+		{
+			*(--position)
+				= (char)('0' + fraction % 10);
+			fraction	/= 10;
+		}
+		if (precision > 0)
+		{
+			*(--position)
+				= '.';
+		}
+		position	-= sjm_json_format(position, scaled / scale);
+		/* Never write negative zero. */
+		negative	= negative && 0 != scaled;
+	}
+	else
+	{
+		for (exponent = 0; value >= 1e16; exponent++)
+		{
+			value	/= 10;
+		}
+		position	-= sjm_json_format(position, exponent);
+		*(--position)	= 'e';
+		position	-= sjm_json_format(position, (unsigned long long)(value + 0.5));
+	}
+	if (negative)
+	{
+		*(--position)	= '-';
+	}
+	
+	sjm_json_put(writer, position, number + SJM_JSON_NUMBER_SIZE - position);
+}
+
+void
+sjm_json_bool(
+	sjm_json_writer_t	*writer,
+	sjm_bool_t		value
+)
+{
+	sjm_json_separate(writer);
+	if (value)
+	{
+		sjm_json_put(writer, "true", 4);
+	}
+	else
+	{
+		sjm_json_put(writer, "false", 5);
+	}
+}
+
+void
+sjm_json_null(
+	sjm_json_writer_t	*writer
+)
+{
+	sjm_json_separate(writer);
+	sjm_json_put(writer, "null", 4);
+}
+
+void
+sjm_json_string(
+	sjm_json_writer_t	*writer,
+	const char		*string
+)
+{
+	const char		*run;
+	char			escape[6];
+	unsigned char		c;
+	
+	sjm_json_separate(writer);
+	sjm_json_put(writer, "\"", 1);
+	
+	/* Copy runs of plain characters at once. */
+	for (run = string; '\0' != *string; string++)
+	{
+		c		= (unsigned char)*string;
+		if (c >= 0x20 && '"' != c && '\\' != c)
+		{
+			continue;
+		}
+	
+		sjm_json_put(writer, run, string - run);
+		run		= string + 1;
+		escape[0]	= '\\';
+		switch (c)
+		{
+		 case '"':
+		 case '\\':
+			escape[1]	= c;
+			break;
+		 case '\n':
+			escape[1]	= 'n';
+			break;
+		 case '\r':
+			escape[1]	= 'r';
+			break;
+		 case '\t':
+			escape[1]	= 't';
+			break;
+		 case '\b':
+			escape[1]	= 'b';
+			break;
+		 case '\f':
+			escape[1]	= 'f';
+			break;
+		 default:
+		 {
+			escape[1]	= 'u';
+			escape[2]	= '0';
+			escape[3]	= '0';
+			escape[4]	= "0123456789abcdef"[c >> 4];
+			escape[5]	= "0123456789abcdef"[c & 0xF];
+			sjm_json_put(writer, escape, 6);
+			continue;
+		 }
+		}
+		sjm_json_put(writer, escape, 2);
+	}
+	sjm_json_put(writer, run, string - run);
+	sjm_json_put(writer, "\"", 1);
+}
+
+sjm_error_t
+sjm_json_flush(
+	sjm_json_writer_t	*writer
+)
+{
+	sjm_error_t		error;
+	
+	error			= writer->error;
+	if (SJM_ERROR_OK == error &&
+	    NULL != writer->flush &&
+	    writer->length > 0 &&
+	    !writer->flush(writer->state, writer->buffer, writer->length))
+	{
+		error		= SJM_ERROR_SINK_WRITE;
+	}
+	
+	writer->length		= 0;
+	writer->hold		= -1;
+	writer->depth		= 0;
+	writer->count[0]	= 0;
+	writer->keyed		= false;
+	writer->error		= SJM_ERROR_OK;
+	
+	return error;
+}
+
+#ifdef  SJM_JSON_HANDLING
+sjm_error_t
+sjm_respond_job(
+	sjm_t			*jobmanager,
+	char			*json,
+	sjm_json_writer_t	*writer
+)
+{
+	sjm_error_t		error;
+	char			number[SJM_JSON_NUMBER_SIZE];
+	int			length;
+	int			position;
+	int			offset;
+	int			depth;
+	
+	/* Open the response, keeping it in the buffer, and leave a
+	   place for the status as its first element. */
+	writer->hold		= writer->length;
+	depth			= writer->depth;
+	sjm_json_begin_array(writer);
+	writer->count[writer->depth]
+				= 1;
+	offset			= writer->length - writer->hold;
+	
+	error			= sjm_request_job(jobmanager, json, writer);
+	
+	/* Put the status in its place. */
+	length			= sjm_json_format(number + SJM_JSON_NUMBER_SIZE, error);
+	if (writer->length + length > writer->size)
+	{
+		sjm_json_drain(writer);
+	}
+	if (writer->length + length > writer->size)
+	{
+		if (SJM_ERROR_OK == writer->error)
+		{
+			writer->error
+				= SJM_ERROR_BUFFER_FULL;
+		}
+	}
+	else if (SJM_ERROR_OK == writer->error)
+	{
+		position	= writer->hold + offset;
+		memmove(
+			writer->buffer + position + length,
+			writer->buffer + position,
+			writer->length - position
+		);
+		memcpy(writer->buffer + position, number + SJM_JSON_NUMBER_SIZE - length, length);
+		writer->length	+= length;
+	}
+	
+	writer->depth		= depth + 1;
+	writer->keyed		= false;
+	sjm_json_end_array(writer);
+	writer->hold		= -1;
+	
+	return error;
+}
+#endif
@@ -0,0 +1,259 @@
+/******************************************************************************/
+/**
+@file
+@author		Graeme Douglas
+@brief		A streaming JSON writer for job responses.
+@details	Values are appended to a buffer, with commas, colons and
+		brackets placed automatically, so jobs never format JSON
+		by hand. Numbers are formatted without @c printf: integers
+		two digits at a time from a table, and doubles to a fixed
+		number of decimal places using integer arithmetic.
+		
+		Several top-level values may be written one after another;
+		they are separated by newlines. When the buffer fills, it
+		is handed to a flush callback, if there is one, and reused.
+		To batch responses, write them all and flush once with
+		@ref sjm_json_flush.
+*/
+/******************************************************************************/
+
+#ifndef JOB_JSON_H
+#define JOB_JSON_H
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+#include "jobmanager.h"
+
+/**
+@brief		The deepest nesting of arrays and objects a writer allows.
+*/
+#define SJM_JSON_DEPTH_MAX	8
+
+/**
+@brief		The most decimal places a double may be written with.
+*/
+#define SJM_JSON_PRECISION_MAX	9
+
+/**
+@brief		Takes written JSON out of a writer's buffer.
+@param		state
+			The state given to @ref sjm_json_init.
+@param		data
+			The bytes to write.
+@param		length
+			The number of bytes.
+@returns	@c true if every byte was written.
+*/
+typedef sjm_bool_t (*sjm_json_flush_t)(void *state, const char *data, int length);
+
+/**
+@brief		A streaming JSON writer.
+*/
+typedef struct sjm_json_writer
+{
+	char			*buffer;/**< The caller's buffer. */
+	int			size;	/**< Size of @c buffer. */
+	int			length;	/**< Bytes written to @c buffer. */
+	int			hold;	/**< Bytes of @c buffer that may be
+					     flushed while a response is
+					     open, or -1 if none is. */
+	int			depth;	/**< Current nesting depth. */
+	int			count[SJM_JSON_DEPTH_MAX+1];
+					/**< Values written so far at each
+					     depth. */
+	sjm_bool_t		keyed;	/**< Whether a key awaits its value.
+					*/
+	sjm_error_t		error;	/**< The first error since the last
+					     flush, if anything was lost. */
+	sjm_json_flush_t	flush;	/**< Flush callback, or @c NULL. */
+	void			*state;	/**< State for @c flush. */
+} sjm_json_writer_t;
+
+/**
+@brief		Initialize a JSON writer.
+@param		writer
+			The writer to initialize. This must already be
+			allocated.
+@param		buffer
+			Where to write.
+@param		size
+			The size of @p buffer.
+@param		flush
+			Called with the buffer's contents when it fills and
+			on @ref sjm_json_flush, or @c NULL if the buffer is
+			only ever read by the caller.
+@param		state
+			Passed through to @p flush.
+*/
+void
+sjm_json_init(
+	sjm_json_writer_t	*writer,
+	char			*buffer,
+	int			size,
+	sjm_json_flush_t	flush,
+	void			*state
+);
+
+/**
+@brief		Begin an array.
+*/
+void
+sjm_json_begin_array(
+	sjm_json_writer_t	*writer
+);
+
+/**
+@brief		End the innermost array.
+*/
+void
+sjm_json_end_array(
+	sjm_json_writer_t	*writer
+);
+
+/**
+@brief		Begin an object.
+*/
+void
+sjm_json_begin_object(
+	sjm_json_writer_t	*writer
+);
+
+/**
+@brief		End the innermost object.
+*/
+void
+sjm_json_end_object(
+	sjm_json_writer_t	*writer
+);
+
+/**
+@brief		Write the key of an object member. The member's value
+		must be written next.
+@param		writer
+			The writer.
+@param		key
+			The null-terminated key.
+*/
+void
+sjm_json_key(
+	sjm_json_writer_t	*writer,
+	const char		*key
+);
+
+/**
+@brief		Write an integer.
+@param		writer
+			The writer.
+@param		value
+			The integer.
+*/
+void
+sjm_json_int(
+	sjm_json_writer_t	*writer,
+	long			value
+);
+
+/**
+@brief		Write a double to a fixed number of decimal places.
+@details	Values that are not finite are written as @c null, as
+		JSON has no way to write them. Values too large to scale
+		by @p precision within 63 bits are written in exponent
+		form, with about 16 significant digits.
+@param		writer
+			The writer.
+@param		value
+			The double.
+@param		precision
+			Decimal places, up to @ref SJM_JSON_PRECISION_MAX.
+			The value is rounded to the nearest.
+*/
+void
+sjm_json_double(
+	sjm_json_writer_t	*writer,
+	double			value,
+	int			precision
+);
+
+/**
+@brief		Write @c true or @c false.
+*/
+void
+sjm_json_bool(
+	sjm_json_writer_t	*writer,
+	sjm_bool_t		value
+);
+
+/**
+@brief		Write @c null.
+*/
+void
+sjm_json_null(
+	sjm_json_writer_t	*writer
+);
+
+/**
+@brief		Write a string, escaping it as needed.
+@param		writer
+			The writer.
+@param		string
+			The null-terminated string.
+*/
+void
+sjm_json_string(
+	sjm_json_writer_t	*writer,
+	const char		*string
+);
+
+/**
+@brief		Hand everything written so far to the flush callback.
+@details	Without a flush callback, this only empties the buffer,
+		so read it first.
+@param		writer
+			The writer.
+@returns	@c SJM_ERROR_OK if everything written since the last
+		flush was delivered, @c SJM_ERROR_BUFFER_FULL if some of
+		it did not fit, or @c SJM_ERROR_SINK_WRITE if the flush
+		callback failed. Either way, the writer is then empty and
+		ready for reuse.
+*/
+sjm_error_t
+sjm_json_flush(
+	sjm_json_writer_t	*writer
+);
+
+#ifdef  SJM_JSON_HANDLING
+/**
+@brief		Request a job and write its response.
+@details	The response is an array whose first element is the
+		request's status (an @ref sjm_error_t), followed by any
+		values the job writes. The job receives the writer as its
+		return pointer and writes its results with the functions
+		above, at the level of the response array. For example, a
+		job writing the integer @c 5 gives @c [0,5].
+		
+		The status is only known once the job is done, so the
+		whole response must fit in the writer's buffer; anything
+		written before it may be flushed to make room.
+@param		jobmanager
+			The job manager to use to execute the job.
+@param		json
+			The request; see @ref sjm_request_job.
+@param		writer
+			The writer to append the response to.
+@returns	The status of the request.
+*/
+sjm_error_t
+sjm_respond_job(
+	sjm_t			*jobmanager,
+	char			*json,
+	sjm_json_writer_t	*writer
+);
+#endif
+
+#ifdef  __cplusplus
+}
+#endif
+
+#endif
@@ -7,20 +7,179 @@
 /******************************************************************************/
 
 #include "jobmanager.h"
+#include "jobqueue.h"
+#include "jobbatch.h"
+#include "jobcapture.h"
+#include <stdarg.h>
+#ifdef  SJM_FD_WAITING
+#include <poll.h>
+#endif
+
+/**
+@brief		The cancellation token of the job running on this thread.
+*/
+static SJM_THREAD_LOCAL sjm_cancel_token_t	*sjm_current_token	= NULL;
+
+/**
+@brief		The output ring of the job running on this thread.
+*/
+static SJM_THREAD_LOCAL sjm_ring_t		*sjm_current_ring	= NULL;
 
 sjm_error_t
-sjm_dequeue_next_job(
+sjm_update_job(
 	sjm_t		*jobmanager,
 	sensor_job_t	*job,
-	char		**name
+	char		*name
+);
+
+static sjm_error_t
+sjm_start_resumable_job(
+	sjm_t		*jobmanager,
+	sensor_job_t	*job,
+	char		*name,
+	void		**params,
+	void		*retval,
+	sjm_bool_t	scheduled
+);
+
+static sjm_error_t
+sjm_record_outcome(
+	sjm_t			*jobmanager,
+	char			*name,
+	sensor_job_t		*job,
+	sjm_bool_t		executed,
+	unsigned int		overruns,
+	unsigned int		expiries
+);
+
+#ifdef  SJM_JSON_HANDLING
+static void **
+sjm_bound_params(
+	sjm_t			*jobmanager,
+	char			*name
+);
+
+static sjm_param_names_t *
+sjm_declared_params(
+	sjm_t			*jobmanager,
+	char			*name
+);
+#endif
+
+static milliseconds_t
+sjm_run_job(
+	sjm_t			*jobmanager,
+	sensor_job_t		*job,
+	char			*name,
+	void			**params,
+	void			*retval
 );
 
+/**
+@brief		Find a job store in the master table.
+@param		instance
+			Which job store to find, counting from @c 0 in
+			the order they were made.
+@param		config
+			Where to put the job dictionary's config.
+@returns	@c err_ok if found, @c err_item_not_found if there are
+		not that many job stores, an IonDB error otherwise.
+*/
+static err_t
+sjm_find_store(
+	int				instance,
+	ion_dictionary_config_info_t	*config
+)
+{
+	ion_dictionary_id_t		id;
+	err_t				ion_error;
+	
+	for (id = 1; id < ion_master_table_next_id; id++)
+	{
+		ion_error	= ion_lookup_in_master_table(id, config);
+		if (err_item_not_found == ion_error)
+		{
+			continue;
+		}
+		if (err_ok != ion_error)
+		{
+			return ion_error;
+		}
+		if (SJM_ION_DICT_USE_TYPE == config->use_type && 0 == instance--)
+		{
+			return err_ok;
+		}
+	}
+	
+	return err_item_not_found;
+}
+
+/**
+@brief		Open one of a job store's dictionaries.
+@param		jobmanager
+			The job manager whose handler to use.
+@param		dictionary
+			The dictionary to open.
+@param		id
+			The dictionary's id in the master table.
+@param		use_type
+			The use type the dictionary must have been made with.
+@returns	@c err_ok on success, an IonDB error otherwise.
+*/
+static err_t
+sjm_open_dictionary(
+	sjm_t			*jobmanager,
+	dictionary_t		*dictionary,
+	ion_dictionary_id_t	id,
+	ion_dict_use_t		use_type
+)
+{
+	ion_dictionary_config_info_t	config;
+	err_t				ion_error;
+	
+	ion_error		= ion_lookup_in_master_table(id, &config);
+	if (err_ok != ion_error)
+	{
+		return ion_error;
+	}
+	if (use_type != config.use_type)
+	{
+		return err_dictionary_initialization_failed;
+	}
+	
+	return dictionary_open(&(jobmanager->handler), dictionary, &config);
+}
+
+/**
+@brief		Delete one of a job store's dictionaries, along with
+		its row in the master table.
+*/
+static void
+sjm_drop_dictionary(
+	dictionary_t		*dictionary
+)
+{
+	ion_delete_from_master_table(dictionary);
+	dictionary_delete_dictionary(dictionary);
+}
+
 sjm_error_t
 sjm_init(
 	sjm_t			*jobmanager,
 	int			maximum_name_size,
 	int			maximum_json_tokens
 )
+{
+	return sjm_init_instance(jobmanager, maximum_name_size, maximum_json_tokens, 0);
+}
+
+sjm_error_t
+sjm_init_instance(
+	sjm_t			*jobmanager,
+	int			maximum_name_size,
+	int			maximum_json_tokens,
+	int			instance
+)
 {
 	err_t				ion_error;
 	ion_dictionary_config_info_t	config;
@@ -28,14 +187,21 @@ sjm_init(
 	ms_init();
 	ion_init_master_table();
 	bpptree_init(&(jobmanager->handler));
-	ion_error	= ion_find_by_use_master_table(
-				&config,
-				SJM_ION_DICT_USE_TYPE,
-				ION_MASTER_TABLE_FIND_FIRST
-			);
+	ion_error	= err_item_not_found;
+	if (SJM_INSTANCE_NEW != instance)
+	{
+		ion_error
+			= sjm_find_store(instance, &config);
+	}
 	
 	if (err_ok == ion_error)
 	{
+		/* Names are stored padded to the store's key size. */
+		if (config.key_size != maximum_name_size)
+		{
+			return SJM_ERROR_DICT_INITIALIZATION;
+		}
+		
 		ion_error	= dictionary_open(
 					&(jobmanager->handler),
 					&(jobmanager->dictionary),
@@ -46,6 +212,34 @@ sjm_init(
 		{
 			return SJM_ERROR_DICT_INITIALIZATION;
 		}
+		
+		/* Bound parameters and declared names are made right
+		   after the jobs. */
+		ion_error	= sjm_open_dictionary(
+					jobmanager,
+					&(jobmanager->params_dictionary),
+					config.id + 1,
+					SJM_ION_DICT_PARAMS_USE_TYPE
+				);
+		if (err_ok == ion_error)
+		{
+			ion_error
+				= sjm_open_dictionary(
+					jobmanager,
+					&(jobmanager->names_dictionary),
+					config.id + 2,
+					SJM_ION_DICT_NAMES_USE_TYPE
+				);
+			if (err_ok != ion_error)
+			{
+				dictionary_close(&(jobmanager->params_dictionary));
+			}
+		}
+		if (err_ok != ion_error)
+		{
+			dictionary_close(&(jobmanager->dictionary));
+			return SJM_ERROR_DICT_INITIALIZATION;
+		}
 	}
 	else
 	{
@@ -55,25 +249,71 @@ sjm_init(
 					key_type_char_array,
 					maximum_name_size,
 					sizeof(sensor_job_t),
-					-1
+					BPPTREE_MAP_FILE | BPPTREE_WAL,
+					SJM_ION_DICT_USE_TYPE
 				);
 		
 		if (err_ok != ion_error)
 		{
 			return SJM_ERROR_DICT_INITIALIZATION;
 		}
+		ion_error	= ion_master_table_create_dictionary(
+					&(jobmanager->handler),
+					&(jobmanager->params_dictionary),
+					key_type_char_array,
+					maximum_name_size,
+					SJM_PARAMS_BLOB_SIZE,
+					BPPTREE_WAL,
+					SJM_ION_DICT_PARAMS_USE_TYPE
+				);
+		if (err_ok != ion_error)
+		{
+			sjm_drop_dictionary(&(jobmanager->dictionary));
+			return SJM_ERROR_DICT_INITIALIZATION;
+		}
+		ion_error	= ion_master_table_create_dictionary(
+					&(jobmanager->handler),
+					&(jobmanager->names_dictionary),
+					key_type_char_array,
+					maximum_name_size,
+					SJM_NAMES_BLOB_SIZE,
+					BPPTREE_WAL,
+					SJM_ION_DICT_NAMES_USE_TYPE
+				);
+		if (err_ok != ion_error)
+		{
+			sjm_drop_dictionary(&(jobmanager->params_dictionary));
+			sjm_drop_dictionary(&(jobmanager->dictionary));
+			return SJM_ERROR_DICT_INITIALIZATION;
+		}
 	}
 	
-	if (err_ok != ion_error)
-		return SJM_ERROR_DICT_INITIALIZATION;
-	
 	jobmanager->maximum_name_size
 				= maximum_name_size;
 	jobmanager->maximum_json_tokens
 				= maximum_json_tokens;
 	
-	jobmanager->queue.head	= NULL;
-	jobmanager->queue.tail	= NULL;
+	if (SJM_ERROR_OK != sjm_queue_init(&(jobmanager->queue)))
+	{
+		sjm_drop_dictionary(&(jobmanager->names_dictionary));
+		sjm_drop_dictionary(&(jobmanager->params_dictionary));
+		sjm_drop_dictionary(&(jobmanager->dictionary));
+		return SJM_ERROR_MEMORY_ALLOCATION_FAILURE;
+	}
+	jobmanager->in_flight	= NULL;
+	jobmanager->num_in_flight
+				= 0;
+	jobmanager->running.cancelled
+				= false;
+	jobmanager->running.budget_end
+				= 0;
+	jobmanager->running_name
+				= NULL;
+	jobmanager->batches	= NULL;
+	jobmanager->output	= NULL;
+	jobmanager->bound	= NULL;
+	jobmanager->declared	= NULL;
+	jobmanager->capture	= NULL;
 	return SJM_ERROR_OK;
 }
 
@@ -82,22 +322,71 @@ sjm_delete(
 	sjm_t			*jobmanager
 )
 {
-	sjm_error_t		error;
-	sensor_job_t		job;
-	char			*name;
+	sjm_continuation_t	*continuation;
+	sjm_bound_params_t	*bound;
+	sjm_param_names_t	*declared;
 	
-	error			= SJM_ERROR_OK;
+	sjm_queue_delete(&(jobmanager->queue));
+	sjm_batches_delete(jobmanager);
 	
-	/* Free the job queue entirely. */
-	while (NULL != jobmanager->queue.head && SJM_ERROR_OK == error)
+	while (NULL != jobmanager->bound)
 	{
-		error		= sjm_dequeue_next_job(jobmanager, &job, &name);
-		free(name);
+		bound		= jobmanager->bound;
+		jobmanager->bound
+				= bound->next;
+		free(bound->params);
+		free(bound);
 	}
-	dictionary_delete_dictionary(&(jobmanager->dictionary));
+	while (NULL != jobmanager->declared)
+	{
+		declared	= jobmanager->declared;
+		jobmanager->declared
+				= declared->next;
+		free(declared);
+	}
+	sjm_drop_dictionary(&(jobmanager->names_dictionary));
+	sjm_drop_dictionary(&(jobmanager->params_dictionary));
+	
+	/* Abandon any in-flight resumable jobs. */
+	while (NULL != jobmanager->in_flight)
+	{
+		continuation	= jobmanager->in_flight;
+		jobmanager->in_flight
+				= continuation->next;
+		free(continuation->name);
+		free(continuation);
+	}
+	jobmanager->num_in_flight
+				= 0;
+	sjm_drop_dictionary(&(jobmanager->dictionary));
 	return SJM_ERROR_OK;
 }
 
+void
+sjm_init_job(
+	sensor_job_t		*job,
+	job_function		func,
+	activation_function	needs_execution
+)
+{
+	memset(job, 0, sizeof(sensor_job_t));
+	job->func		= func;
+	job->needs_execution	= needs_execution;
+}
+
+int
+sjm_name_length(
+	sjm_t			*jobmanager,
+	const char		*name
+)
+{
+	int			length;
+	
+	for (length = 0; length <= jobmanager->maximum_name_size && '\0' != name[length]; length++);
+	
+	return length;
+}
+
 sjm_error_t
 sjm_add_job(
 	sjm_t			*jobmanager,
@@ -106,16 +395,11 @@ sjm_add_job(
 )
 {
 	err_t			ion_error;
-	int i;
-	char			buffer[jobmanager->maximum_name_size];
-	for (i = 0; i < jobmanager->maximum_name_size; i++)
-	{
-		buffer[i] = '\0';
-	}
-	strcpy(buffer, jobname);
-	ion_error		= dictionary_insert(
+	
+	ion_error		= dictionary_insert_sized(
 					&(jobmanager->dictionary),
-					(ion_key_t)buffer,
+					jobname,
+					sjm_name_length(jobmanager, jobname),
 					(ion_value_t)job
 				);
 	
@@ -125,6 +409,50 @@ sjm_add_job(
 		return SJM_ERROR_OK;
 }
 
+/**
+@brief		Perform a job that has already been looked up.
+@details	See @ref sjm_perform_job.
+*/
+static sjm_error_t
+sjm_perform_resolved_job(
+	sjm_t			*jobmanager,
+	sensor_job_t		*job,
+	char			*name,
+	void			**params,
+	void			*retval
+)
+{
+	milliseconds_t		elapsed;
+	
+#ifdef  SJM_JSON_HANDLING
+	if (NULL == params && job->bound)
+	{
+		params		= sjm_bound_params(jobmanager, name);
+	}
+#endif
+	
+	if (NULL != job->resume)
+	{
+		return sjm_start_resumable_job(
+			jobmanager,
+			job,
+			name,
+			params,
+			retval,
+			false
+		);
+	}
+	
+	elapsed			= sjm_run_job(jobmanager, job, name, params, retval);
+	
+	if (0 != job->time_budget && elapsed > job->time_budget)
+	{
+		return sjm_record_outcome(jobmanager, name, job, false, 1, 0);
+	}
+	
+	return SJM_ERROR_OK;
+}
+
 sjm_error_t
 sjm_perform_job(
 	sjm_t			*jobmanager,
@@ -135,26 +463,38 @@ sjm_perform_job(
 {
 	err_t			ion_error;
 	sensor_job_t		job;
-	int i;
-	char			buffer[jobmanager->maximum_name_size];
-	for (i = 0; i < jobmanager->maximum_name_size; i++)
-	{
-		buffer[i] = '\0';
-	}
-	strcpy(buffer, name);
 	
-	ion_error		= dictionary_get(
+	ion_error		= dictionary_get_sized(
 					&(jobmanager->dictionary),
-					(ion_key_t)buffer,
+					name,
+					sjm_name_length(jobmanager, name),
 					(ion_value_t)&job
 				);
 	if (err_ok != ion_error)
 	{
 		return SJM_ERROR_DICT_GET_FAILURE;
 	}
-	job.func(params, retval);
 	
-	return SJM_ERROR_OK;
+	return sjm_perform_resolved_job(jobmanager, &job, name, params, retval);
+}
+
+unsigned long
+sjm_hash_name(
+	const char		*name,
+	int			maximum_name_size
+)
+{
+	unsigned long		hash;
+	int			i;
+	
+	hash			= 2166136261UL;
+	for (i = 0; i < maximum_name_size && '\0' != name[i]; i++)
+	{
+		hash		^= (unsigned char)name[i];
+		hash		= (hash * 16777619UL) & 0xFFFFFFFFUL;
+	}
+	
+	return hash;
 }
 
 void
@@ -165,330 +505,1882 @@ sjm_debug_job(
 {
 	err_t			ion_error;
 	sensor_job_t		job;
-	int i;
-	char			buffer[jobmanager->maximum_name_size];
-	for (i = 0; i < jobmanager->maximum_name_size; i++)
+	
+	ion_error		= dictionary_get_sized(
+					&(jobmanager->dictionary),
+					name,
+					sjm_name_length(jobmanager, name),
+					(ion_value_t)&job
+				);
+	
+printf("ion_error=%d\n", (int)ion_error);fflush(stdout);
+printf("jobname=%s\n", name);fflush(stdout);
+printf("job.func=%p\n", job.func);fflush(stdout);
+printf("job.needs_execution=%p\n", job.needs_execution);fflush(stdout);
+printf("job.last_execution_time=%llu\n", job.last_execution_time);fflush(stdout);
+printf("job.last_scheduled_time=%llu\n", job.last_scheduled_time);fflush(stdout);
+}
+
+#ifdef  SJM_JSON_HANDLING
+/**
+@brief		Get the integer value of a JSON primitive.
+@details	Boolean literals, @c true and @c false, are @c 1 and @c 0.
+		Anything else is read as a decimal integer up to its first
+		non-digit. The JSON is not modified.
+@param		json
+			The JSON string the token belongs to.
+@param		token
+			The primitive token.
+@returns	The value of the primitive.
+*/
+static int
+sjm_primitive_value(
+	char			*json,
+	jsmntok_t		*token
+)
+{
+	char			*c;
+	char			*end;
+	int			negative;
+	int			value;
+	
+	c			= json + token->start;
+	end			= json + token->end;
+	
+	/* Nothing else valid starts with these. */
+	if ('t' == *c)
+	{
+		return 1;
+	}
+	if ('f' == *c)
+	{
+		return 0;
+	}
+	
+	negative		= ('-' == *c);
+	if (negative || '+' == *c)
+	{
+		c++;
+	}
+	for (value = 0; c < end && '0' <= *c && *c <= '9'; c++)
+	{
+		value		= value * 10 + (*c - '0');
+	}
+	
+	return negative ? -value : value;
+}
+
+/**
+@brief		Hash a parameter name.
+@details	This is a seeded 32-bit FNV-1a hash of the name, with its
+		bits mixed so that every part of it can be used on its own.
+@param		seed
+			The seed.
+@param		key
+			The name. It need not be null-terminated.
+@param		length
+			The length of @p key.
+@returns	The hash.
+*/
+static unsigned long
+sjm_param_hash(
+	unsigned long		seed,
+	const char		*key,
+	int			length
+)
+{
+	unsigned long		hash;
+	int			i;
+	
+	hash			= 2166136261UL ^ seed;
+	for (i = 0; i < length; i++)
+	{
+		hash		^= (unsigned char)key[i];
+		hash		= (hash * 16777619UL) & 0xFFFFFFFFUL;
+	}
+	hash			^= hash >> 16;
+	hash			= (hash * 0x85EBCA6BUL) & 0xFFFFFFFFUL;
+	hash			^= hash >> 13;
+	
+	return hash;
+}
+
+/**
+@brief		Find the bucket of a parameter name's hash.
+*/
+static unsigned int
+sjm_param_bucket(
+	sjm_param_names_t	*declared,
+	unsigned long		hash
+)
+{
+	return (unsigned int)((((hash * 2654435761UL) & 0xFFFFFFFFUL) >> 16) % declared->buckets);
+}
+
+/**
+@brief		Find the table slot of a parameter name's hash, displaced
+		by @p displace.
+@details	The step taken per displacement is odd, so the displacements
+		of one name reach every slot.
+*/
+static unsigned int
+sjm_param_place(
+	sjm_param_names_t	*declared,
+	unsigned long		hash,
+	unsigned int		displace
+)
+{
+	unsigned int		size;
+	
+	size			= declared->mask + 1;
+	
+	return ((unsigned int)hash +
+	        (displace / size) * (unsigned int)((hash >> 16) | 1) +
+	        displace % size) & declared->mask;
+}
+
+/**
+@brief		Find the table slot of a parameter name.
+@param		declared
+			The declared names, giving the seed, table size and
+			displacements.
+@param		key
+			The name. It need not be null-terminated.
+@param		length
+			The length of @p key.
+@returns	The slot in @p declared's table.
+*/
+static unsigned int
+sjm_param_slot(
+	sjm_param_names_t	*declared,
+	const char		*key,
+	int			length
+)
+{
+	unsigned long		hash;
+	
+	hash			= sjm_param_hash(declared->seed, key, length);
+	
+	return sjm_param_place(
+		declared,
+		hash,
+		declared->displace[sjm_param_bucket(declared, hash)]
+	);
+}
+
+/**
+@brief		Choose the seed and displacements that make the hash of
+		declared names perfect.
+@details	Names are hashed into buckets of a few each. Buckets are
+		then placed largest first, each at the first displacement
+		putting all of its names in empty slots. A bucket can only
+		fail to place if two of its names share all the hash bits
+		used, so few seeds are ever tried; at most
+		@ref SJM_NAMED_PARAMS_SEEDS are.
+@returns	@c SJM_ERROR_OK on successes, @c SJM_ERROR_PARAMS_UNHASHABLE
+		if no seed worked.
+*/
+static sjm_error_t
+sjm_param_perfect(
+	sjm_param_names_t	*declared
+)
+{
+	unsigned long		hashes[declared->count+1];
+	unsigned int		bucket_of[declared->count+1];
+	int			order[declared->count+1];
+	int			first[declared->buckets+1];
+	int			fill[declared->buckets];
+	int			largest;
+	unsigned int		size;
+	unsigned int		displace;
+	unsigned int		slot;
+	unsigned int		b;
+	int			placed;
+	int			n;
+	int			i;
+	
+	size			= declared->mask + 1;
+	for (declared->seed = 0; declared->seed < SJM_NAMED_PARAMS_SEEDS; declared->seed++)
+	{
+		memset(declared->table, 0, size);
+		
+		/* Group the names by bucket; bucket b's names are
+		   order[first[b]] up to order[first[b+1]]. */
+		memset(first, 0, sizeof(first));
+		for (i = 0; i < declared->count; i++)
+		{
+			hashes[i]	= sjm_param_hash(declared->seed, declared->names[i], declared->lengths[i]);
+			bucket_of[i]	= sjm_param_bucket(declared, hashes[i]);
+			first[bucket_of[i]+1]++;
+		}
+		largest		= 0;
+		for (b = 0; b < declared->buckets; b++)
+		{
+			if (first[b+1] > largest)
+			{
+				largest	= first[b+1];
+			}
+			first[b+1]	+= first[b];
+			fill[b]		= first[b];
+		}
+		for (i = 0; i < declared->count; i++)
+		{
+			order[fill[bucket_of[i]]++]
+					= i;
+		}
+		
+		/* Place the largest buckets first, while slots are free. */
+		for (n = largest; n > 0; n--)
+		{
+			for (b = 0; b < declared->buckets; b++)
+			{
+				if (first[b+1] - first[b] != n)
+				{
+					continue;
+				}
+				for (displace = 0; displace < size * size; displace++)
+				{
+					for (placed = 0; placed < n; placed++)
+					{
+						i	= order[first[b]+placed];
+						slot	= sjm_param_place(declared, hashes[i], displace);
+						if (0 != declared->table[slot])
+						{
+							break;
+						}
+						declared->table[slot]
+							= i + 1;
+					}
+					if (placed == n)
+					{
+						break;
+					}
+					while (placed-- > 0)
+					{
+						i	= order[first[b]+placed];
+						declared->table[sjm_param_place(declared, hashes[i], displace)]
+							= 0;
+					}
+				}
+				if (displace == size * size)
+				{
+					break;
+				}
+				declared->displace[b]
+						= displace;
+			}
+			if (b < declared->buckets)
+			{
+				break;
+			}
+		}
+		if (0 == n)
+		{
+			return SJM_ERROR_OK;
+		}
+	}
+	
+	return SJM_ERROR_PARAMS_UNHASHABLE;
+}
+
+/**
+@brief		Request a job with a JSON object of named arguments.
+@details	See @ref sjm_request_job.
+@param		jobmanager
+			The job manager to use to execute the job.
+@param		json
+			The JSON request, already parsed.
+@param		tokens
+			The request's tokens.
+@param		num_tokens
+			The number of tokens parsed.
+@param		returnval
+			A pointer used to extract return data into.
+@returns	@c SJM_ERROR_OK on successes, an appropriate error code
+		otherwise.
+*/
+static sjm_error_t
+sjm_request_job_object(
+	sjm_t			*jobmanager,
+	char			*json,
+	jsmntok_t		*tokens,
+	int			num_tokens,
+	void			*returnval
+)
+{
+	err_t			ion_error;
+	sensor_job_t		job;
+	sjm_param_names_t	*declared;
+	jsmntok_t		*jobname;
+	jsmntok_t		*args;
+	jsmntok_t		*key;
+	jsmntok_t		*value;
+	char			buffer[jobmanager->maximum_name_size];
+	int			length;
+	int			slot;
+	int			i;
+	
+	/* Pick out the two members, in either order. */
+	jobname			= NULL;
+	args			= NULL;
+	for (i = 1; i + 1 < num_tokens; i += 2)
+	{
+		key		= tokens+i;
+		length		= key->end - key->start;
+		if (JSMN_STRING == key->type && 3 == length &&
+		    0 == strncmp("job", json+key->start, 3) &&
+		    JSMN_STRING == tokens[i+1].type)
+		{
+			jobname	= tokens+i+1;
+		}
+		else if (JSMN_STRING == key->type && 4 == length &&
+		         0 == strncmp("args", json+key->start, 4) &&
+		         JSMN_OBJECT == tokens[i+1].type)
+		{
+			/* Skip over the arguments, which must be flat. */
+			args	= tokens+i+1;
+			i	+= 2 * args->size;
+		}
+		else
+		{
+			return SJM_ERROR_UNSUPPORTED_JSON_FORMAT;
+		}
+	}
+	if (NULL == jobname || NULL == args || i != num_tokens ||
+	    jobname->end - jobname->start >= jobmanager->maximum_name_size)
+	{
+		return SJM_ERROR_UNSUPPORTED_JSON_FORMAT;
+	}
+	
+	/* Keep the name whole; it is passed on to the job. */
+	length			= jobname->end - jobname->start;
+	memcpy(buffer, json+jobname->start, length);
+	buffer[length]		= '\0';
+	
+	ion_error		= dictionary_get_sized(
+					&(jobmanager->dictionary),
+					buffer,
+					length,
+					(ion_value_t)&job
+				);
+	if (err_ok != ion_error)
+	{
+		return SJM_ERROR_DICT_GET_FAILURE;
+	}
+	declared		= job.named ? sjm_declared_params(jobmanager, buffer) : NULL;
+	if (NULL == declared || args->size != declared->count)
+	{
+		return SJM_ERROR_UNSUPPORTED_JSON_FORMAT;
+	}
+	
+	/* Since C requires arrays have non-zero size, add 1. :( */
+	void			*params[declared->count+1];
+	int			integers[declared->count+1];
+	
+	for (i = 0; i < declared->count; i++)
+	{
+		params[i]	= NULL;
+	}
+	for (key = args+1; key < args+1+2*args->size; key += 2)
+	{
+		value		= key+1;
+		length		= key->end - key->start;
+		slot		= declared->table[sjm_param_slot(declared, json+key->start, length)] - 1;
+		if (JSMN_STRING != key->type ||
+		    slot < 0 ||
+		    length != declared->lengths[slot] ||
+		    0 != strncmp(declared->names[slot], json+key->start, length) ||
+		    NULL != params[slot])
+		{
+			return SJM_ERROR_UNSUPPORTED_JSON_FORMAT;
+		}
+		
+		switch (value->type)
+		{
+		 case JSMN_STRING:
+		 {
+			params[slot]	= json+value->start;
+		 } break;
+		 case JSMN_PRIMITIVE:
+		 {
+			integers[slot]	= sjm_primitive_value(json, value);
+			params[slot]	= integers+slot;
+		 } break;
+		 default:
+			return SJM_ERROR_UNSUPPORTED_JSON_FORMAT;
+		}
+	}
+	
+	return sjm_perform_resolved_job(jobmanager, &job, buffer, params, returnval);
+}
+
+sjm_error_t
+sjm_request_job(
+	sjm_t			*jobmanager,
+	char			*json,
+	void			*returnval
+)
+{
+	char			*jobname;
+	jsmn_parser		jsonparser;
+	jsmntok_t		tokens[jobmanager->maximum_json_tokens];
+	jsmnerr_t		jsmnerror;
+	int			i;
+	int			count;
+	char			original;
+	sjm_error_t		error;
+	
+#ifdef  SJM_CAPTURE
+	if (NULL != jobmanager->capture)
+	{
+		sjm_capture_request(jobmanager->capture, json);
+	}
+#endif
+	
+	jsmntok_clear(tokens, jobmanager->maximum_json_tokens);
+	jsmn_init(&jsonparser);
+	jsmnerror		= jsmn_parse(
+					&jsonparser,
+					json,
+					strlen(json),
+					tokens,
+					jobmanager->maximum_json_tokens
+				);
+	if (jsmnerror < 2)
+		return SJM_ERROR_UNSUPPORTED_JSON_FORMAT;
+	
+	if (JSMN_OBJECT == tokens[0].type)
+	{
+		return sjm_request_job_object(
+			jobmanager,
+			json,
+			tokens,
+			(int)jsmnerror,
+			returnval
+		);
+	}
+	
+	/* Must be JSON array. */
+	/* First parameter in array must be string identifying query. */
+	if (JSMN_ARRAY != tokens[0].type || JSMN_STRING != tokens[1].type)
+		return SJM_ERROR_UNSUPPORTED_JSON_FORMAT;
+	jobname	= json+tokens[1].start;
+	
+	/* Every token after the name is a parameter. */
+	count			= (int)jsmnerror - 2;
+	/* Since C requires arrays have non-zero size, add 1. :( */
+	void			*params[count+1];
+	int			integers[count+1];
+	
+	for (i = 0; i < count; i++)
+	{
+		switch (tokens[i+2].type) {
+		 case JSMN_STRING:
+		 {
+			params[i]	= json+tokens[i+2].start;
+		 } break;
+		 case JSMN_PRIMITIVE:
+		 {
+			integers[i]	= sjm_primitive_value(json, tokens+i+2);
+			params[i]	= integers+i;
+		 } break;
+		 default:
+			return SJM_ERROR_UNSUPPORTED_JSON_FORMAT;
+		}
+	}
+	
+	original		= json[tokens[1].end];
+	json[tokens[1].end]	= '\0';
+	
+	error			= sjm_perform_job(
+					jobmanager,
+					jobname,
+					params,
+					returnval
+				);
+	
+	json[tokens[1].end]	= original;
+	
+	return error;
+}
+
+sjm_error_t
+sjm_prepare(
+	sjm_t			*jobmanager,
+	sjm_prepared_t		*prepared,
+	char			*json
+)
+{
+	jsmn_parser		jsonparser;
+	jsmntok_t		tokens[jobmanager->maximum_json_tokens];
+	jsmnerr_t		jsmnerror;
+	jsmntok_t		*token;
+	err_t			ion_error;
+	int			*integers;
+	char			*text;
+	int			length;
+	int			count;
+	int			i;
+	
+	length			= strlen(json);
+	jsmntok_clear(tokens, jobmanager->maximum_json_tokens);
+	jsmn_init(&jsonparser);
+	jsmnerror		= jsmn_parse(
+					&jsonparser,
+					json,
+					length,
+					tokens,
+					jobmanager->maximum_json_tokens
+				);
+	
+	/* A flat array, named by its first element. */
+	if (jsmnerror < 2 ||
+	    JSMN_ARRAY != tokens[0].type ||
+	    JSMN_STRING != tokens[1].type ||
+	    tokens[0].size != (int)jsmnerror - 1 ||
+	    tokens[1].end - tokens[1].start >= jobmanager->maximum_name_size)
+	{
+		return SJM_ERROR_UNSUPPORTED_JSON_FORMAT;
+	}
+	count			= (int)jsmnerror - 2;
+	
+	/* Everything lives in one allocation: the parameters, the
+	   placeholder slots and types, constant integers, and a copy
+	   of the text for the name and constant strings. */
+	prepared->params	= malloc(count * (sizeof(void *) + 2 * sizeof(int) + sizeof(sjm_arg_type_t)) + length + 1);
+	if (NULL == prepared->params)
+	{
+		return SJM_ERROR_MEMORY_ALLOCATION_FAILURE;
+	}
+	prepared->types		= (sjm_arg_type_t *)(prepared->params + count);
+	prepared->slots		= (int *)(prepared->types + count);
+	integers		= prepared->slots + count;
+	text			= (char *)(integers + count);
+	memcpy(text, json, length + 1);
+	
+	prepared->jobmanager	= jobmanager;
+	prepared->count		= count;
+	prepared->num_args	= 0;
+	prepared->name		= text + tokens[1].start;
+	text[tokens[1].end]	= '\0';
+	
+	for (i = 0; i < count; i++)
+	{
+		token			= tokens + i + 2;
+		prepared->params[i]	= NULL;
+		switch (token->type)
+		{
+		 case JSMN_STRING:
+		 {
+			text[token->end]	= '\0';
+			prepared->params[i]	= text + token->start;
+		 } break;
+		 case JSMN_PRIMITIVE:
+		 {
+			if (token->end - token->start == 2 &&
+			    0 == strncmp(SJM_PREPARED_INT, json + token->start, 2))
+			{
+				prepared->types[prepared->num_args]
+						= SJM_ARG_INT;
+				prepared->slots[prepared->num_args++]
+						= i;
+			}
+			else if (token->end - token->start == 2 &&
+			         0 == strncmp(SJM_PREPARED_STRING, json + token->start, 2))
+			{
+				prepared->types[prepared->num_args]
+						= SJM_ARG_STRING;
+				prepared->slots[prepared->num_args++]
+						= i;
+			}
+			else
+			{
+				integers[i]		= sjm_primitive_value(json, token);
+				prepared->params[i]	= integers + i;
+			}
+		 } break;
+		 default:
+		 {
+			free(prepared->params);
+			return SJM_ERROR_UNSUPPORTED_JSON_FORMAT;
+		 }
+		}
+	}
+	
+	ion_error		= dictionary_get_sized(
+					&(jobmanager->dictionary),
+					prepared->name,
+					sjm_name_length(jobmanager, prepared->name),
+					(ion_value_t)&(prepared->job)
+				);
+	if (err_ok != ion_error)
+	{
+		free(prepared->params);
+		return SJM_ERROR_DICT_GET_FAILURE;
+	}
+	
+	return SJM_ERROR_OK;
+}
+
+sjm_error_t
+sjm_execute_prepared(
+	sjm_prepared_t		*prepared,
+	void			*retval,
+	...
+)
+{
+	va_list			args;
+	sensor_job_t		job;
+	int			i;
+	/* Since C requires arrays have non-zero size, add 1. :( */
+	void			*params[prepared->count+1];
+	int			integers[prepared->num_args+1];
+	
+	memcpy(params, prepared->params, prepared->count * sizeof(void *));
+	va_start(args, retval);
+	for (i = 0; i < prepared->num_args; i++)
+	{
+		if (SJM_ARG_INT == prepared->types[i])
+		{
+			integers[i]	= va_arg(args, int);
+			params[prepared->slots[i]]
+					= integers+i;
+		}
+		else
+		{
+			params[prepared->slots[i]]
+					= va_arg(args, char *);
+		}
+	}
+	va_end(args);
+	
+	/* Runs may update the job, so the prepared copy stays intact. */
+	job			= prepared->job;
+	
+	return sjm_perform_resolved_job(
+		prepared->jobmanager,
+		&job,
+		prepared->name,
+		params,
+		retval
+	);
+}
+
+void
+sjm_prepared_delete(
+	sjm_prepared_t		*prepared
+)
+{
+	free(prepared->params);
+	prepared->params	= NULL;
+}
+
+/**
+@brief		Decode a JSON array of parameters.
+@details	Parameters are interpreted as by @ref sjm_request_job. The
+		pointers, the integers and a copy of the text that strings
+		point into are all in one allocation, starting at the
+		returned vector.
+@param		jobmanager
+			The job manager, for its token limit.
+@param		json
+			The JSON array.
+@param		decoded
+			Set to the decoded parameters, to be freed by the
+			caller.
+@param		count
+			Set to the number of parameters.
+@returns	@c SJM_ERROR_OK on successes, an appropriate error code
+		otherwise.
+*/
+static sjm_error_t
+sjm_decode_params(
+	sjm_t			*jobmanager,
+	char			*json,
+	void			***decoded,
+	int			*count
+)
+{
+	jsmn_parser		jsonparser;
+	jsmntok_t		tokens[jobmanager->maximum_json_tokens];
+	jsmnerr_t		jsmnerror;
+	void			**params;
+	int			*integers;
+	char			*text;
+	int			length;
+	int			n;
+	int			i;
+	
+	length			= strlen(json);
+	jsmntok_clear(tokens, jobmanager->maximum_json_tokens);
+	jsmn_init(&jsonparser);
+	jsmnerror		= jsmn_parse(
+					&jsonparser,
+					json,
+					length,
+					tokens,
+					jobmanager->maximum_json_tokens
+				);
+	
+	/* Only a flat array will do. */
+	if (jsmnerror < 1 ||
+	    JSMN_ARRAY != tokens[0].type ||
+	    tokens[0].size != (int)jsmnerror - 1)
+	{
+		return SJM_ERROR_UNSUPPORTED_JSON_FORMAT;
+	}
+	n			= (int)jsmnerror - 1;
+	
+	params			= malloc(n * (sizeof(void *) + sizeof(int)) + length + 1);
+	if (NULL == params)
+	{
+		return SJM_ERROR_MEMORY_ALLOCATION_FAILURE;
+	}
+	integers		= (int *)(params + n);
+	text			= (char *)(integers + n);
+	memcpy(text, json, length + 1);
+	
+	for (i = 0; i < n; i++)
+	{
+		switch (tokens[i+1].type)
+		{
+		 case JSMN_STRING:
+		 {
+			text[tokens[i+1].end]	= '\0';
+			params[i]		= text + tokens[i+1].start;
+		 } break;
+		 case JSMN_PRIMITIVE:
+		 {
+			integers[i]		= sjm_primitive_value(text, tokens+i+1);
+			params[i]		= integers + i;
+		 } break;
+		 default:
+		 {
+			free(params);
+			return SJM_ERROR_UNSUPPORTED_JSON_FORMAT;
+		 }
+		}
+	}
+	
+	*decoded		= params;
+	*count			= n;
+	
+	return SJM_ERROR_OK;
+}
+
+/**
+@brief		Cache a job's decoded parameters, replacing any cached
+		before.
+@details	The cached entry is updated in place, so that runs of
+		the job already queued get the new parameters too. On
+		failure, @p decoded is freed.
+*/
+static sjm_error_t
+sjm_cache_params(
+	sjm_t			*jobmanager,
+	char			*name,
+	void			**decoded,
+	int			count
+)
+{
+	sjm_bound_params_t	*bound;
+	
+	for (bound = jobmanager->bound; NULL != bound; bound = bound->next)
+	{
+		if (0 == strncmp(bound->name, name, jobmanager->maximum_name_size))
+		{
+			break;
+		}
+	}
+	if (NULL == bound)
+	{
+		bound		= calloc(1, sizeof(sjm_bound_params_t) + jobmanager->maximum_name_size + 1);
+		if (NULL == bound)
+		{
+			free(decoded);
+			return SJM_ERROR_MEMORY_ALLOCATION_FAILURE;
+		}
+		bound->name	= (char *)(bound+1);
+		strncpy(bound->name, name, jobmanager->maximum_name_size);
+		bound->next	= jobmanager->bound;
+		jobmanager->bound
+				= bound;
+	}
+	free(bound->params);
+	bound->params		= decoded;
+	bound->count		= count;
+	
+	return SJM_ERROR_OK;
+}
+
+/**
+@brief		Get the parameters bound to a job.
+@details	They are decoded from their stored form the first time
+		they are needed, and cached for every run after.
+@returns	The decoded parameters, or @c NULL if they cannot be
+		read or decoded.
+*/
+static void **
+sjm_bound_params(
+	sjm_t			*jobmanager,
+	char			*name
+)
+{
+	sjm_bound_params_t	*bound;
+	void			**decoded;
+	int			count;
+	char			blob[SJM_PARAMS_BLOB_SIZE];
+	
+	for (bound = jobmanager->bound; NULL != bound; bound = bound->next)
+	{
+		if (0 == strncmp(bound->name, name, jobmanager->maximum_name_size))
+		{
+			return bound->params;
+		}
+	}
+	
+	if (err_ok != dictionary_get_sized(
+			&(jobmanager->params_dictionary),
+			name,
+			sjm_name_length(jobmanager, name),
+			(ion_value_t)blob
+		) ||
+	    SJM_ERROR_OK != sjm_decode_params(jobmanager, blob, &decoded, &count) ||
+	    SJM_ERROR_OK != sjm_cache_params(jobmanager, name, decoded, count))
+	{
+		return NULL;
+	}
+	
+	return decoded;
+}
+
+sjm_error_t
+sjm_add_job_with_params(
+	sjm_t			*jobmanager,
+	char			*jobname,
+	sensor_job_t		*job,
+	char			*params
+)
+{
+	sjm_error_t		error;
+	
+	error			= sjm_add_job(jobmanager, jobname, job);
+	if (SJM_ERROR_OK != error)
+	{
+		return error;
+	}
+	
+	return sjm_bind_params(jobmanager, jobname, params);
+}
+
+sjm_error_t
+sjm_bind_params(
+	sjm_t			*jobmanager,
+	char			*name,
+	char			*params
+)
+{
+	err_t			ion_error;
+	sjm_error_t		error;
+	sensor_job_t		job;
+	void			**decoded;
+	int			count;
+	char			blob[SJM_PARAMS_BLOB_SIZE];
+	
+	if (strlen(params) + 1 > SJM_PARAMS_BLOB_SIZE)
+	{
+		return SJM_ERROR_PARAMS_TOO_LARGE;
+	}
+	
+	ion_error		= dictionary_get_sized(
+					&(jobmanager->dictionary),
+					name,
+					sjm_name_length(jobmanager, name),
+					(ion_value_t)&job
+				);
+	if (err_ok != ion_error)
+	{
+		return SJM_ERROR_DICT_GET_FAILURE;
+	}
+	
+	error			= sjm_decode_params(jobmanager, params, &decoded, &count);
+	if (SJM_ERROR_OK != error)
+	{
+		return error;
+	}
+	
+	/* Keep the encoded form alongside the jobs. */
+	memset(blob, 0, SJM_PARAMS_BLOB_SIZE);
+	strcpy(blob, params);
+	ion_error		= dictionary_update_sized(
+					&(jobmanager->params_dictionary),
+					name,
+					sjm_name_length(jobmanager, name),
+					(ion_value_t)blob
+				);
+	if (err_ok != ion_error)
+	{
+		free(decoded);
+		return SJM_ERROR_DICT_UPDATE_FAILURE;
+	}
+	
+	error			= sjm_cache_params(jobmanager, name, decoded, count);
+	if (SJM_ERROR_OK != error)
+	{
+		return error;
+	}
+	
+	if (job.bound)
+	{
+		return SJM_ERROR_OK;
+	}
+	job.bound		= true;
+	
+	return sjm_update_job(jobmanager, &job, name);
+}
+
+/**
+@brief		Hash a job's parameter names into a perfect hash table.
+@param		jobmanager
+			The job manager holding the job.
+@param		name
+			The job's name.
+@param		names
+			The parameter names, in parameter order.
+@param		count
+			The number of names.
+@param		hashed
+			Set to the hashed names, to be freed by the caller.
+@returns	@c SJM_ERROR_OK on successes, an appropriate error code
+		otherwise.
+*/
+static sjm_error_t
+sjm_hash_names(
+	sjm_t			*jobmanager,
+	char			*name,
+	char			**names,
+	int			count,
+	sjm_param_names_t	**hashed
+)
+{
+	sjm_error_t		error;
+	sjm_param_names_t	*declared;
+	char			*text;
+	unsigned int		size;
+	unsigned int		buckets;
+	int			length;
+	int			i;
+	int			j;
+	
+	/* Names that are the same can never be told apart. */
+	for (i = 0; i < count; i++)
+	{
+		for (j = 0; j < i; j++)
+		{
+			if (0 == strcmp(names[i], names[j]))
+			{
+				return SJM_ERROR_UNSUPPORTED_JSON_FORMAT;
+			}
+		}
+	}
+	
+	/* Twice as many slots as names, and a few names per bucket,
+	   make displacements easy to find. */
+	for (size = 2; size < 2 * (unsigned int)count; size *= 2);
+	buckets			= (count + SJM_NAMED_PARAMS_BUCKET - 1) / SJM_NAMED_PARAMS_BUCKET;
+	if (0 == buckets)
+	{
+		buckets		= 1;
+	}
+	
+	length			= jobmanager->maximum_name_size + 1;
+	for (i = 0; i < count; i++)
+	{
+		length		+= strlen(names[i]) + 1;
+	}
+	declared		= calloc(1, sizeof(sjm_param_names_t) + count * (sizeof(char *) + sizeof(int)) + buckets * sizeof(unsigned int) + size + length);
+	if (NULL == declared)
+	{
+		return SJM_ERROR_MEMORY_ALLOCATION_FAILURE;
+	}
+	declared->names		= (char **)(declared+1);
+	declared->lengths	= (int *)(declared->names + count);
+	declared->displace	= (unsigned int *)(declared->lengths + count);
+	declared->table		= (unsigned char *)(declared->displace + buckets);
+	declared->count		= count;
+	declared->buckets	= buckets;
+	declared->mask		= size - 1;
+	declared->name		= (char *)(declared->table + size);
+	strncpy(declared->name, name, jobmanager->maximum_name_size);
+	text			= declared->name + jobmanager->maximum_name_size + 1;
+	for (i = 0; i < count; i++)
+	{
+		declared->names[i]	= text;
+		declared->lengths[i]	= strlen(names[i]);
+		strcpy(text, names[i]);
+		text		+= declared->lengths[i] + 1;
+	}
+	
+	error			= sjm_param_perfect(declared);
+	if (SJM_ERROR_OK != error)
+	{
+		free(declared);
+		return error;
+	}
+	
+	*hashed			= declared;
+	
+	return SJM_ERROR_OK;
+}
+
+/**
+@brief		Cache a job's hashed parameter names, freeing any cached
+		before.
+*/
+static void
+sjm_cache_names(
+	sjm_t			*jobmanager,
+	sjm_param_names_t	*declared
+)
+{
+	sjm_param_names_t	*old;
+	sjm_param_names_t	**link;
+	
+	for (link = &(jobmanager->declared); NULL != *link; link = &((*link)->next))
+	{
+		if (0 == strncmp((*link)->name, declared->name, jobmanager->maximum_name_size))
+		{
+			old		= *link;
+			*link		= old->next;
+			free(old);
+			break;
+		}
+	}
+	declared->next		= jobmanager->declared;
+	jobmanager->declared	= declared;
+}
+
+/**
+@brief		Get the names declared for a job's parameters.
+@details	They are hashed from their stored form the first time
+		they are needed, and cached for every request after.
+@returns	The hashed names, or @c NULL if they cannot be read or
+		hashed.
+*/
+static sjm_param_names_t *
+sjm_declared_params(
+	sjm_t			*jobmanager,
+	char			*name
+)
+{
+	sjm_param_names_t	*declared;
+	char			blob[SJM_NAMES_BLOB_SIZE];
+	char			*names[SJM_NAMED_PARAMS_MAX+1];
+	int			count;
+	int			offset;
+	int			i;
+	
+	for (declared = jobmanager->declared; NULL != declared; declared = declared->next)
+	{
+		if (0 == strncmp(declared->name, name, jobmanager->maximum_name_size))
+		{
+			return declared;
+		}
+	}
+	
+	if (err_ok != dictionary_get_sized(
+			&(jobmanager->names_dictionary),
+			name,
+			sjm_name_length(jobmanager, name),
+			(ion_value_t)blob
+		))
+	{
+		return NULL;
+	}
+	
+	/* The number of names, then each name in turn. */
+	blob[SJM_NAMES_BLOB_SIZE-1]
+				= '\0';
+	count			= (unsigned char)blob[0];
+	offset			= 1;
+	for (i = 0; i < count; i++)
+	{
+		if (offset >= SJM_NAMES_BLOB_SIZE)
+		{
+			return NULL;
+		}
+		names[i]	= blob + offset;
+		offset		+= strlen(names[i]) + 1;
+	}
+	
+	if (SJM_ERROR_OK != sjm_hash_names(jobmanager, name, names, count, &declared))
+	{
+		return NULL;
+	}
+	sjm_cache_names(jobmanager, declared);
+	
+	return declared;
+}
+
+sjm_error_t
+sjm_declare_params(
+	sjm_t			*jobmanager,
+	char			*name,
+	char			**names,
+	int			count
+)
+{
+	err_t			ion_error;
+	sensor_job_t		job;
+	sjm_error_t		error;
+	sjm_param_names_t	*declared;
+	char			blob[SJM_NAMES_BLOB_SIZE];
+	int			offset;
+	int			length;
+	int			i;
+	
+	if (count > SJM_NAMED_PARAMS_MAX)
+	{
+		return SJM_ERROR_PARAMS_TOO_LARGE;
+	}
+	
+	/* Keep the names alongside the jobs, as their number and then
+	   each name in turn. */
+	memset(blob, 0, SJM_NAMES_BLOB_SIZE);
+	blob[0]			= (char)count;
+	offset			= 1;
+	for (i = 0; i < count; i++)
+	{
+		length		= strlen(names[i]) + 1;
+		if (offset + length > SJM_NAMES_BLOB_SIZE)
+		{
+			return SJM_ERROR_PARAMS_TOO_LARGE;
+		}
+		memcpy(blob + offset, names[i], length);
+		offset		+= length;
+	}
+	
+	ion_error		= dictionary_get_sized(
+					&(jobmanager->dictionary),
+					name,
+					sjm_name_length(jobmanager, name),
+					(ion_value_t)&job
+				);
+	if (err_ok != ion_error)
+	{
+		return SJM_ERROR_DICT_GET_FAILURE;
+	}
+	
+	error			= sjm_hash_names(jobmanager, name, names, count, &declared);
+	if (SJM_ERROR_OK != error)
+	{
+		return error;
+	}
+	
+	ion_error		= dictionary_update_sized(
+					&(jobmanager->names_dictionary),
+					name,
+					sjm_name_length(jobmanager, name),
+					(ion_value_t)blob
+				);
+	if (err_ok != ion_error)
+	{
+		free(declared);
+		return SJM_ERROR_DICT_UPDATE_FAILURE;
+	}
+	
+	if (!job.named)
+	{
+		job.named	= true;
+		error		= sjm_update_job(jobmanager, &job, name);
+		if (SJM_ERROR_OK != error)
+		{
+			free(declared);
+			return error;
+		}
+	}
+	
+	sjm_cache_names(jobmanager, declared);
+	
+	return SJM_ERROR_OK;
+}
+#endif
+
+/**
+@brief		Update a job in the key-value store.
+@param		jobmanager
+			The job manager to update the job in.
+@param		job
+			The updated job to store.
+@param		name
+			The name (key) of the job to update.
+@returns	@c SJM_ERROR_OK on success, otherwise an error code
+		appropriately describing the situation. 
+*/
+sjm_error_t
+sjm_update_job(
+	sjm_t		*jobmanager,
+	sensor_job_t	*job,
+	char		*name
+)
+{
+	err_t		ion_error;
+	
+	ion_error	= dictionary_update_sized(
+				&(jobmanager->dictionary),
+				name,
+				sjm_name_length(jobmanager, name),
+				(ion_value_t)(job)
+			);
+	
+	if (err_ok != ion_error)
+	{
+		return SJM_ERROR_DICT_UPDATE_FAILURE;
+	}
+	
+	return SJM_ERROR_OK;
+}
+
+/**
+@brief		Record the outcome of running (or not running) a job in
+		its stored record.
+@details	The stored record is re-read first, rather than writing
+		back a copy, since the copy may be stale: the job may have
+		been rescheduled, or its counters bumped, in the meantime.
+@param		jobmanager
+			The job manager the job belongs to.
+@param		name
+			The job's name.
+@param		job
+			A copy of the job, used if the stored record cannot
+			be read.
+@param		executed
+			If true, the job's last execution time is set to now.
+@param		overruns
+			Number to add to the job's overrun count.
+@param		expiries
+			Number to add to the job's expired count.
+@returns	@c SJM_ERROR_OK on successes, an appropriate error code
+		otherwise.
+*/
+static sjm_error_t
+sjm_record_outcome(
+	sjm_t			*jobmanager,
+	char			*name,
+	sensor_job_t		*job,
+	sjm_bool_t		executed,
+	unsigned int		overruns,
+	unsigned int		expiries
+)
+{
+	err_t			ion_error;
+	sensor_job_t		stored;
+	
+	ion_error		= dictionary_get_sized(
+					&(jobmanager->dictionary),
+					name,
+					sjm_name_length(jobmanager, name),
+					(ion_value_t)&stored
+				);
+	if (err_ok != ion_error)
+	{
+		stored		= *job;
+	}
+	
+	if (executed)
+	{
+		stored.last_execution_time
+				= ms_milliseconds();
+	}
+	stored.overrun_count	+= overruns;
+	stored.expired_count	+= expiries;
+	
+	return sjm_update_job(jobmanager, &stored, name);
+}
+
+/**
+@brief		Set up a (non-resumable) job's cancellation token and
+		output ring before running it.
+@details	A job run from inside another job shares the outer job's
+		token, so cancelling the outer job cancels both.
+@param		jobmanager
+			The job manager running the job.
+@param		job
+			The job about to run.
+@param		name
+			The job's name. It must stay valid while the job runs.
+@param		previous
+			Set to the token in use before, for
+			@ref sjm_run_leave.
+@param		ring
+			Set to the output ring in use before, for
+			@ref sjm_run_leave.
+@returns	The time the job starts.
+*/
+static milliseconds_t
+sjm_run_enter(
+	sjm_t			*jobmanager,
+	sensor_job_t		*job,
+	char			*name,
+	sjm_cancel_token_t	**previous,
+	sjm_ring_t		**ring
+)
+{
+	milliseconds_t		start;
+	
+	*ring			= sjm_current_ring;
+	sjm_current_ring	= (NULL != job->output) ? job->output : jobmanager->output;
+	*previous		= sjm_current_token;
+	start			= ms_milliseconds();
+	if (NULL == *previous)
+	{
+		jobmanager->running.cancelled
+				= false;
+		jobmanager->running.budget_end
+				= 0;
+		if (0 != job->time_budget)
+		{
+			jobmanager->running.budget_end
+				= start + job->time_budget;
+		}
+		jobmanager->running_name
+				= name;
+		sjm_current_token
+				= &(jobmanager->running);
+	}
+	
+	return start;
+}
+
+/**
+@brief		Put back the cancellation token and output ring in use
+		before @ref sjm_run_enter.
+*/
+static void
+sjm_run_leave(
+	sjm_t			*jobmanager,
+	sjm_cancel_token_t	*previous,
+	sjm_ring_t		*ring
+)
+{
+	if (NULL == previous)
+	{
+		sjm_current_token
+				= NULL;
+		jobmanager->running_name
+				= NULL;
+	}
+	sjm_current_ring	= ring;
+}
+
+/**
+@brief		Run a (non-resumable) job under a cancellation token.
+@details	See @ref sjm_run_enter.
+@param		jobmanager
+			The job manager running the job.
+@param		job
+			The job to run.
+@param		name
+			The job's name. It must stay valid while the job runs.
+@param		params
+			See @ref job_function.
+@param		retval
+			See @ref job_function.
+@returns	The number of milliseconds the job ran for.
+*/
+static milliseconds_t
+sjm_run_job(
+	sjm_t			*jobmanager,
+	sensor_job_t		*job,
+	char			*name,
+	void			**params,
+	void			*retval
+)
+{
+	sjm_cancel_token_t	*previous;
+	sjm_ring_t		*ring;
+	milliseconds_t		start;
+	
+	start			= sjm_run_enter(jobmanager, job, name, &previous, &ring);
+	job->func(params, retval);
+	sjm_run_leave(jobmanager, previous, ring);
+	
+	return ms_milliseconds() - start;
+}
+
+sjm_error_t
+sjm_run_job_batch(
+	sjm_t			*jobmanager,
+	sensor_job_t		*job,
+	char			*name,
+	unsigned char		*params,
+	unsigned char		*results,
+	int			count
+)
+{
+	sjm_cancel_token_t	*previous;
+	sjm_ring_t		*ring;
+	milliseconds_t		start;
+	milliseconds_t		elapsed;
+	void			*set[1];
+	int			i;
+	
+	start			= sjm_run_enter(jobmanager, job, name, &previous, &ring);
+	if (NULL != job->batch)
+	{
+		job->batch(params, results, count);
+	}
+	else
+	{
+		/* One call per set, until the batch is cancelled. */
+		for (i = 0; i < count && !sjm_cancel_requested(); i++)
+		{
+			set[0]	= params + i * job->param_size;
+			job->func(set, 0 == job->result_size ? NULL : results + i * job->result_size);
+		}
+	}
+	sjm_run_leave(jobmanager, previous, ring);
+	elapsed			= ms_milliseconds() - start;
+	
+	if (0 != job->time_budget && elapsed > job->time_budget)
+	{
+		return sjm_record_outcome(jobmanager, name, job, false, 1, 0);
+	}
+	
+	return SJM_ERROR_OK;
+}
+
+sjm_error_t
+sjm_execute_queued_job(
+	sjm_t		*jobmanager
+)
+{
+	sjm_error_t	error;
+	sensor_job_t	job;
+	char		name[jobmanager->maximum_name_size+1];
+	milliseconds_t	deadline;
+	milliseconds_t	elapsed;
+	void		**params;
+	
+	/* Drop anything that has already missed its deadline rather than
+	   spend time running it. */
+	while (1)
+	{
+		error		= sjm_dequeue_next_job(jobmanager, &job, name, &deadline);
+		if (SJM_ERROR_NO_MORE_QUEUED_JOBS == error)
+		{
+			return SJM_ERROR_OK;
+		}
+		else if (SJM_ERROR_OK != error)
+		{
+			return error;
+		}
+		
+		if (0 == deadline || ms_milliseconds() <= deadline)
+		{
+			break;
+		}
+		
+		error		= sjm_record_outcome(jobmanager, name, &job, false, 0, 1);
+		if (SJM_ERROR_OK != error)
+		{
+			return error;
+		}
+	}
+	
+	params			= NULL;
+#ifdef  SJM_JSON_HANDLING
+	if (job.bound)
+	{
+		params		= sjm_bound_params(jobmanager, name);
+	}
+#endif
+	if (NULL != job.resume)
 	{
-		buffer[i] = '\0';
+		return sjm_start_resumable_job(
+			jobmanager,
+			&job,
+			name,
+			params,
+			NULL,
+			true
+		);
 	}
-	strcpy(buffer, name);
 	
-	ion_error		= dictionary_get(
-					&(jobmanager->dictionary),
-					(ion_key_t)buffer,
-					(ion_value_t)&job
-				);
+	elapsed			= sjm_run_job(jobmanager, &job, name, params, NULL);
 	
-printf("ion_error=%d\n", (int)ion_error);fflush(stdout);
-printf("jobname=%s\n", name);fflush(stdout);
-printf("job.func=%p\n", job.func);fflush(stdout);
-printf("job.needs_execution=%p\n", job.needs_execution);fflush(stdout);
-printf("job.last_execution_time=%llu\n", job.last_execution_time);fflush(stdout);
-printf("job.last_scheduled_time=%llu\n", job.last_scheduled_time);fflush(stdout);
+	return sjm_record_outcome(
+		jobmanager,
+		name,
+		&job,
+		true,
+		(0 != job.time_budget && elapsed > job.time_budget) ? 1 : 0,
+		0
+	);
 }
 
-#ifdef  SJM_JSON_HANDLING
 sjm_error_t
-sjm_request_job(
-	sjm_t			*jobmanager,
-	char			*json,
-	void			*returnval
+sjm_execute_queued_jobs(
+	sjm_t		*jobmanager
 )
 {
-	char			*jobname;
-	jsmn_parser		jsonparser;
-	jsmntok_t		tokens[jobmanager->maximum_json_tokens];
-	jsmnerr_t		jsmnerror;
-	int			i;
-	int			length;
-	int			numints;
-	char			original;
+	sjm_queue_t		*queue;
+	sjm_queue_node_t	*node;
+	sjm_queue_node_t	*next;
 	sjm_error_t		error;
+	milliseconds_t		start;
+	milliseconds_t		budget;
+	unsigned char		lowest;
 	
-	jsmntok_clear(tokens, jobmanager->maximum_json_tokens);
-	jsmn_init(&jsonparser);
-	jsmnerror		= jsmn_parse(
-					&jsonparser,
-					json,
-					strlen(json),
-					tokens,
-					jobmanager->maximum_json_tokens
-				);
-	if (jsmnerror < 2)
-		return SJM_ERROR_UNSUPPORTED_JSON_FORMAT;
-	
-	/* Must be JSON array. */
-	/* First parameter in array must be string identifying query. */
-	if (JSMN_ARRAY != tokens[0].type || JSMN_STRING != tokens[1].type)
-		return SJM_ERROR_UNSUPPORTED_JSON_FORMAT;
-	jobname	= json+tokens[1].start;
-	
-	length			= 0;
-	numints			= 0;
-	while (JSMN_PRIMITIVE <= tokens[length].type &&
-	       tokens[length].type <= JSMN_STRING &&
-	       length <= jobmanager->maximum_json_tokens)
+	queue			= &(jobmanager->queue);
+	start			= ms_milliseconds();
+	budget			= queue->admission.tick_budget;
+	while (NULL != queue->head)
 	{
-		switch (tokens[length].type)
+		if (0 != budget && ms_milliseconds() - start >= budget)
 		{
-		 case JSMN_ARRAY:
-		 case JSMN_UNINITIALIZED:
 			break;
-		 case JSMN_STRING:
-		 case JSMN_PRIMITIVE:
-		 {
-			numints++;
-		 } break;
-		 default:
-			return SJM_ERROR_UNSUPPORTED_JSON_FORMAT;
 		}
-		length++;
+		
+		error		= sjm_execute_queued_job(jobmanager);
+		if (SJM_ERROR_OK != error)
+		{
+			return error;
+		}
 	}
 	
-	if (length < 2)	return SJM_ERROR_UNSUPPORTED_JSON_FORMAT;
-	void			*params[length-2];
-	/* Since C requires arrays have non-zero size, add 1. :( */
-	int			integers[numints+1];
+	if (NULL == queue->head)
+	{
+		queue->closed	= false;
+		return SJM_ERROR_OK;
+	}
 	
-	i			= 2;
-	numints			= 0;
-	while (JSMN_PRIMITIVE <= tokens[i].type &&
-	       tokens[i].type <= JSMN_STRING &&
-	       i <= jobmanager->maximum_json_tokens)
+	/* Out of budget with a backlog. */
+	switch (queue->admission.tick_policy)
 	{
-		switch (tokens[i].type) {
-		 case JSMN_ARRAY:
-		 case JSMN_UNINITIALIZED:
-			break;
-		 case JSMN_STRING:
-		 {
-			params[i-2]	= json+tokens[i].start;
-		 } break;
-		 case JSMN_PRIMITIVE:
-		 {
-			/* If this primative is 'true'. */
-			if (tokens[i].end - tokens[i].start == 4 &&
-			    0==strncmp("true", json+tokens[i].start, 4))
-			{
-				integers[numints]
-						= 1;
-				params[i-2]	= integers+numints;
-				numints++;
-			}
-			/* If this primative is 'true'. */
-			else if (tokens[i].end - tokens[i].start == 5 &&
-			         0==strncmp("false", json+tokens[i].start, 5))
+	 case SJM_SHED_REJECT_NEW:
+		queue->closed	= true;
+		break;
+	 case SJM_SHED_DROP_OLDEST:
+	 {
+		/* The queue's list is in arrival order. */
+		while (NULL != queue->head && queue->head->enqueue_time < start)
+		{
+			sjm_queue_remove(queue, queue->head);
+			queue->shed.budget++;
+		}
+	 } break;
+	 case SJM_SHED_DROP_LOWEST_PRIORITY:
+	 {
+		lowest		= SJM_PRIORITY_MAX;
+		for (node = queue->head; NULL != node; node = node->next)
+		{
+			if (node->job.priority < lowest)
 			{
-				integers[numints]
-						= 0;
-				params[i-2]	= integers+numints;
-				numints++;
+				lowest	= node->job.priority;
 			}
-			else
+		}
+		for (node = queue->head; NULL != node; node = next)
+		{
+			next	= node->next;
+			if (node->job.priority == lowest)
 			{
-				original	= json[tokens[i].end];
-				json[tokens[i].end]
-						= '\0';	
-				integers[numints]
-						= atoi(json+tokens[i].start);
-				params[i-2]	= integers+numints;
-				json[tokens[i].end]
-						= original;
-				numints++;
+				sjm_queue_remove(queue, node);
+				queue->shed.budget++;
 			}
-		 } break;
-		 default:
-			return SJM_ERROR_UNSUPPORTED_JSON_FORMAT;
 		}
-		i++;
+	 } break;
 	}
 	
-	original		= jobname[tokens[1].end];
-	json[tokens[1].end]	= '\0';
-	
-	error			= sjm_perform_job(
-					jobmanager,
-					jobname,
-					params,
-					returnval
-				);
-	
-	json[tokens[1].end]	= original;
-	
-	return error;
+	return SJM_ERROR_OK;
 }
-#endif
 
 /**
-@brief		Add a job to the back of the execution queue.
+@brief		Retire a resumable job that has run to completion.
+@details	If the job came off of the execution queue, its last
+		execution time is recorded, and if it ran over its time
+		budget, that is recorded too.
 @param		jobmanager
-			The jobmanager whose queue we wish to add the job
-			to.
-@param		job
-			The job to add to the back of the queue.
-@param		name
-			The name for the job. It will also get allocated into
-			permanent memory.
+			The job manager the job was run by.
+@param		continuation
+			The finished job's continuation. It is freed.
 @returns	@c SJM_ERROR_OK on successes, an appropriate error code
 		otherwise.
 */
-sjm_error_t
-sjm_enqueue_job(
-	sjm_t		*jobmanager,
-	sensor_job_t	*job,
-	char		*name
+static sjm_error_t
+sjm_finish_resumable_job(
+	sjm_t			*jobmanager,
+	sjm_continuation_t	*continuation
 )
 {
-	if (NULL == jobmanager->queue.tail)
+	sjm_error_t		error;
+	unsigned int		overruns;
+	
+	error			= SJM_ERROR_OK;
+	overruns		= 0;
+	if (0 != continuation->job.time_budget &&
+	    continuation->run_time > continuation->job.time_budget)
 	{
-		jobmanager->queue.tail	= malloc(sizeof(sjm_queue_node_t));
-		jobmanager->queue.tail->job
-					= *job;
-		jobmanager->queue.tail->next
-					= NULL;
-		jobmanager->queue.tail->prev
-					= NULL;
-		jobmanager->queue.tail->name
-					= malloc(strlen(name)+1);
-		strcpy(jobmanager->queue.tail->name, name);
-		jobmanager->queue.head	= jobmanager->queue.tail;
-		return SJM_ERROR_OK;
+		overruns	= 1;
 	}
 	
-	jobmanager->queue.tail->next	= malloc(sizeof(sjm_queue_node_t));
-	if (NULL == jobmanager->queue.tail->next)
+	if (continuation->scheduled || 0 < overruns)
 	{
-		return SJM_ERROR_MEMORY_ALLOCATION_FAILURE;
+		error		= sjm_record_outcome(
+					jobmanager,
+					continuation->name,
+					&(continuation->job),
+					continuation->scheduled,
+					overruns,
+					0
+				);
 	}
-	jobmanager->queue.tail->next->prev
-					= jobmanager->queue.tail;
-	jobmanager->queue.tail->next->next
-					= NULL;
-	jobmanager->queue.tail->next->job
-					= *job;
-	jobmanager->queue.tail->next->name
-					= malloc(strlen(name)+1);
-	strcpy(jobmanager->queue.tail->next->name, name);
-	jobmanager->queue.tail		= jobmanager->queue.tail->next;
 	
-	return SJM_ERROR_OK;
+	free(continuation->name);
+	free(continuation);
+	
+	return error;
 }
 
 /**
-@brief		Get the next job to execute from front of queue.
+@brief		Run a resumable job up to its next yield (or completion)
+		under its own cancellation token.
 @param		jobmanager
-			The jobmanager whose queue we wish to retrieve from.
-@param		job
-			A pointer to a job variable that can safely be written
-			to (it is already allocated).
-@param		name
-			A pointer to a character array pointer that should
-			be set to the job name. NOTE THAT THE CALLEE
-			IS RESPONSIBLE FOR FREEING THE NAME ONCE IT IS DONE
-			WITH IT.
-@returns	@c SJM_ERROR_OK on successes, an appropriate error code
-		otherwise.
+			The job manager running the job.
+@param		continuation
+			The job's continuation.
+@param		params
+			See @ref resumable_job_function.
+@param		retval
+			See @ref resumable_job_function.
+@returns	Whether the job finished or yielded.
 */
-sjm_error_t
-sjm_dequeue_next_job(
-	sjm_t		*jobmanager,
-	sensor_job_t	*job,
-	char		**name
+static sjm_continuation_status_t
+sjm_step_resumable_job(
+	sjm_t			*jobmanager,
+	sjm_continuation_t	*continuation,
+	void			**params,
+	void			*retval
 )
 {
-	sjm_queue_node_t	*tempjobp;
+	sjm_cancel_token_t		*previous;
+	sjm_ring_t			*ring;
+	sjm_continuation_status_t	status;
+	milliseconds_t			start;
+	milliseconds_t			budget;
 	
-	if (NULL == jobmanager->queue.head)
+	start			= ms_milliseconds();
+	budget			= continuation->job.time_budget;
+	continuation->token.budget_end
+				= 0;
+	if (0 != budget)
 	{
-		return SJM_ERROR_NO_MORE_QUEUED_JOBS;
+		/* The budget counts time spent running, not time spent
+		   yielded. */
+		continuation->token.budget_end
+				= start;
+		if (continuation->run_time < budget)
+		{
+			continuation->token.budget_end
+				+= budget - continuation->run_time;
+		}
 	}
 	
-	*name			= jobmanager->queue.head->name;
-	*job			= jobmanager->queue.head->job;
-	tempjobp		= jobmanager->queue.head->next;
-	if (NULL != tempjobp)
-	{
-		tempjobp->prev	= NULL;
-	}
-	free(jobmanager->queue.head);
-	jobmanager->queue.head	= tempjobp;
-	if (NULL == jobmanager->queue.head)
-	{
-		jobmanager->queue.tail
-				= NULL;
-	}
+	previous		= sjm_current_token;
+	ring			= sjm_current_ring;
+	sjm_current_token	= &(continuation->token);
+	sjm_current_ring	= (NULL != continuation->job.output) ?
+				  continuation->job.output : jobmanager->output;
+	status			= continuation->job.resume(continuation, params, retval);
+	sjm_current_token	= previous;
+	sjm_current_ring	= ring;
 	
-	return SJM_ERROR_OK;
+	continuation->run_time	+= ms_milliseconds() - start;
+	
+	return status;
 }
 
 /**
-@brief		Update a job in the key-value store.
+@brief		Start a resumable job, running it up to its first yield.
+@details	If the job yields, it is added to the job manager's set of
+		in-flight jobs and will be continued by
+		@ref sjm_resume_jobs.
 @param		jobmanager
-			The job manager to update the job in.
+			The job manager running the job.
 @param		job
-			The updated job to store.
+			The job to start.
 @param		name
-			The name (key) of the job to update.
-@returns	@c SJM_ERROR_OK on success, otherwise an error code
-		appropriately describing the situation. 
+			The job's name. This is copied.
+@param		params
+			Parameters for the first invocation.
+@param		retval
+			Return pointer for the first invocation.
+@param		scheduled
+			Whether the job came off of the execution queue.
+@returns	@c SJM_ERROR_OK on successes, an appropriate error code
+		otherwise.
 */
-sjm_error_t
-sjm_update_job(
+static sjm_error_t
+sjm_start_resumable_job(
 	sjm_t		*jobmanager,
 	sensor_job_t	*job,
-	char		*name
+	char		*name,
+	void		**params,
+	void		*retval,
+	sjm_bool_t	scheduled
 )
 {
-	err_t		ion_error;
-	char		buffer[jobmanager->maximum_name_size];
-	int		i;
+	sjm_continuation_t		*continuation;
+	sjm_continuation_status_t	status;
 	
-	for (i = 0; i < jobmanager->maximum_name_size; i++)
+	continuation		= malloc(sizeof(sjm_continuation_t) + job->state_size);
+	if (NULL == continuation)
 	{
-		buffer[i] = '\0';
+		return SJM_ERROR_MEMORY_ALLOCATION_FAILURE;
+	}
+	memset(continuation, 0, sizeof(sjm_continuation_t) + job->state_size);
+	continuation->name	= malloc(strlen(name)+1);
+	if (NULL == continuation->name)
+	{
+		free(continuation);
+		return SJM_ERROR_MEMORY_ALLOCATION_FAILURE;
 	}
-	strcpy(buffer, name);
+	strcpy(continuation->name, name);
+	continuation->wait_fd	= -1;
+	continuation->job	= *job;
+	continuation->scheduled	= scheduled;
+	continuation->params	= params;
+	continuation->returned	= retval;
 	
-	ion_error	= dictionary_update(
-				&(jobmanager->dictionary),
-				(ion_key_t)buffer,
-				(ion_value_t)(job)
-			);
+	status			= sjm_step_resumable_job(jobmanager, continuation, params, retval);
 	
-	if (err_ok != ion_error)
+	/* These belong to the caller and are only valid until the first
+	   yield. */
+	continuation->params	= NULL;
+	continuation->returned	= NULL;
+	
+	if (SJM_CONTINUATION_DONE == status)
 	{
-		return SJM_ERROR_DICT_UPDATE_FAILURE;
+		return sjm_finish_resumable_job(jobmanager, continuation);
 	}
 	
+	continuation->next	= jobmanager->in_flight;
+	jobmanager->in_flight	= continuation;
+	jobmanager->num_in_flight++;
+	
 	return SJM_ERROR_OK;
 }
 
 sjm_error_t
-sjm_execute_queued_job(
+sjm_resume_jobs(
 	sjm_t		*jobmanager
 )
 {
-	sjm_error_t	error;
-	sensor_job_t	job;
-	char		*name;
+	sjm_continuation_t		**link;
+	sjm_continuation_t		*continuation;
+	sjm_continuation_status_t	status;
+	sjm_error_t			error;
+	sjm_error_t			first;
+	milliseconds_t			now;
+	sjm_bool_t			ready;
+#ifdef  SJM_FD_WAITING
+	struct pollfd			fds[jobmanager->num_in_flight+1];
+	int				num_fds;
+	int				i;
 	
-	error			= sjm_dequeue_next_job(jobmanager, &job, &name);
-	if (SJM_ERROR_NO_MORE_QUEUED_JOBS == error)
+	/* Check every waited on file descriptor with a single poll. */
+	num_fds			= 0;
+	for (continuation = jobmanager->in_flight; NULL != continuation; continuation = continuation->next)
 	{
-		return SJM_ERROR_OK;
+		continuation->ready	= false;
+		if (-1 != continuation->wait_fd)
+		{
+			fds[num_fds].fd		= continuation->wait_fd;
+			fds[num_fds].events	= 0;
+			fds[num_fds].revents	= 0;
+			if (continuation->wait_events & SJM_WAIT_READ)
+			{
+				fds[num_fds].events	|= POLLIN;
+			}
+			if (continuation->wait_events & SJM_WAIT_WRITE)
+			{
+				fds[num_fds].events	|= POLLOUT;
+			}
+			num_fds++;
+		}
 	}
-	else if (SJM_ERROR_OK != error)
+	if (0 < num_fds && 0 < poll(fds, num_fds, 0))
 	{
-		return error;
+		i		= 0;
+		for (continuation = jobmanager->in_flight; NULL != continuation; continuation = continuation->next)
+		{
+			if (-1 != continuation->wait_fd)
+			{
+				continuation->ready	= (0 != fds[i].revents);
+				i++;
+			}
+		}
 	}
+#endif
 	
-	job.func(NULL, NULL);
-	
-	job.last_execution_time	= ms_milliseconds();
-	error			= sjm_update_job(jobmanager, &job, name);
-	free(name);
+	first			= SJM_ERROR_OK;
+	now			= ms_milliseconds();
+	link			= &(jobmanager->in_flight);
+	while (NULL != (continuation = *link))
+	{
+		if (-1 != continuation->wait_fd)
+		{
+			ready	= continuation->ready ||
+				  (0 != continuation->wake_time &&
+				   now >= continuation->wake_time);
+		}
+		else
+		{
+			ready	= (now >= continuation->wake_time);
+		}
+		
+		if (!ready)
+		{
+			link	= &(continuation->next);
+			continue;
+		}
+		
+		continuation->wake_time	= 0;
+		continuation->wait_fd	= -1;
+		continuation->ready	= false;
+		status			= sjm_step_resumable_job(
+							jobmanager,
+							continuation,
+							NULL,
+							NULL
+						);
+		
+		if (SJM_CONTINUATION_DONE == status)
+		{
+			/* The job may have started others, which are added
+			   at the head. */
+			while (*link != continuation)
+			{
+				link	= &((*link)->next);
+			}
+			*link		= continuation->next;
+			jobmanager->num_in_flight--;
+			error		= sjm_finish_resumable_job(
+						jobmanager,
+						continuation
+					);
+			if (SJM_ERROR_OK == first)
+			{
+				first	= error;
+			}
+		}
+		else
+		{
+			link	= &(continuation->next);
+		}
+	}
 	
-	return error;
+	return first;
 }
 
 sjm_error_t
@@ -503,8 +2395,11 @@ sjm_queue_scheduled_jobs(
 	sjm_error_t	sjmerror;
 	sensor_job_t	*job;
 	milliseconds_t	milliseconds;
-	char		keydata[jobmanager->dictionary.instance->record.key_size];
+	/* Names as long as keys get have no terminator of their own. */
+	char		keydata[jobmanager->dictionary.instance->record.key_size+1];
 	char		valuedata[jobmanager->dictionary.instance->record.value_size];
+	keydata[jobmanager->dictionary.instance->record.key_size]
+					= '\0';
 	record.key			= (void *)keydata;
 	record.value			= (void *)valuedata;
 	sjmerror			= SJM_ERROR_OK;
@@ -513,7 +2408,8 @@ sjm_queue_scheduled_jobs(
 		return SJM_ERROR_MEMORY_ALLOCATION_FAILURE;
 	}
 	
-	/* Get a cursor over all the items in the job dictionary. */
+	/* Get a cursor over all the items in the job dictionary.  It sees
+	   them as they are now, so jobs can be updated as it goes. */
 	cursor				= NULL;
 	error				= dictionary_build_predicate(
 						&predicate,
@@ -530,17 +2426,21 @@ sjm_queue_scheduled_jobs(
 		milliseconds		= ms_milliseconds();
 		
 		job			= (void *)(record.value);
-		if (job->needs_execution(job, MS_GET_BASE_MILLIS, milliseconds))
+		if (NULL != job->needs_execution && job->needs_execution(job, MS_GET_BASE_MILLIS, milliseconds))
 		{
 			sjmerror	= sjm_enqueue_job(
 						jobmanager,
 						job,
-						(char *)(record.key)
+						(char *)(record.key),
+						NULL
 					);
-			if (SJM_ERROR_OK != sjmerror)
+			/* A shed job still counts as scheduled; it was
+			   dealt with, just not by running it. */
+			if (SJM_ERROR_OK != sjmerror &&
+			    SJM_ERROR_JOB_SHED != sjmerror)
 			{
 				cursor->destroy(&cursor);
-				return error;
+				return sjmerror;
 			}
 			job->last_scheduled_time
 					= ms_milliseconds();
@@ -549,5 +2449,126 @@ sjm_queue_scheduled_jobs(
 	}
 	cursor->destroy(&cursor);
 	
+	/* Changes logged before a lull are synced here rather than
+	   waiting on the next. */
+	if (err_ok != bpptree_poll(&(jobmanager->dictionary)) ||
+	    err_ok != bpptree_poll(&(jobmanager->params_dictionary)) ||
+	    err_ok != bpptree_poll(&(jobmanager->names_dictionary)))
+	{
+		return SJM_ERROR_DICT_UPDATE_FAILURE;
+	}
+	
 	return SJM_ERROR_OK;
 }
+
+sjm_error_t
+sjm_queue_job(
+	sjm_t			*jobmanager,
+	char			*name,
+	sjm_job_handle_t	*handle
+)
+{
+	err_t			ion_error;
+	sjm_error_t		error;
+	sensor_job_t		job;
+	
+	ion_error		= dictionary_get_sized(
+					&(jobmanager->dictionary),
+					name,
+					sjm_name_length(jobmanager, name),
+					(ion_value_t)&job
+				);
+	if (err_ok != ion_error)
+	{
+		return SJM_ERROR_DICT_GET_FAILURE;
+	}
+	
+	error			= sjm_enqueue_job(jobmanager, &job, name, handle);
+	
+	/* Keep the rate limit's token bucket. */
+	if (SJM_ERROR_OK == error && 0 != job.rate_limit)
+	{
+		error		= sjm_update_job(jobmanager, &job, name);
+	}
+	
+	return error;
+}
+
+int
+sjm_cancel_jobs(
+	sjm_t			*jobmanager,
+	char			*name
+)
+{
+	sjm_queue_t		*queue;
+	sjm_queue_node_t	*node;
+	sjm_queue_node_t	*next;
+	sjm_continuation_t	*continuation;
+	unsigned long		hash;
+	int			count;
+	
+	queue			= &(jobmanager->queue);
+	hash			= sjm_hash_name(name, jobmanager->maximum_name_size);
+	count			= 0;
+	for (node = queue->index[hash & (queue->index_size-1)]; NULL != node; node = next)
+	{
+		next		= node->index_next;
+		if (node->hash == hash &&
+		    0 == strncmp(node->name, name, jobmanager->maximum_name_size))
+		{
+			sjm_queue_remove(queue, node);
+			count++;
+		}
+	}
+	
+	for (continuation = jobmanager->in_flight; NULL != continuation; continuation = continuation->next)
+	{
+		if (0 == strncmp(continuation->name, name, jobmanager->maximum_name_size))
+		{
+			continuation->token.cancelled
+					= true;
+		}
+	}
+	
+	if (NULL != jobmanager->running_name &&
+	    0 == strncmp(jobmanager->running_name, name, jobmanager->maximum_name_size))
+	{
+		jobmanager->running.cancelled
+				= true;
+	}
+	
+	return count;
+}
+
+void
+sjm_cancel_running_job(
+	sjm_t			*jobmanager
+)
+{
+	jobmanager->running.cancelled	= true;
+}
+
+sjm_bool_t
+sjm_cancel_requested(
+	void
+)
+{
+	sjm_cancel_token_t	*token;
+	
+	token			= sjm_current_token;
+	if (NULL == token)
+	{
+		return false;
+	}
+	
+	return token->cancelled ||
+	       (0 != token->budget_end && ms_milliseconds() > token->budget_end);
+}
+
+sjm_ring_t *
+sjm_current_output(
+	void
+)
+{
+	return sjm_current_ring;
+}
@@ -27,6 +27,22 @@ extern "C" {
 */
 #define SJM_ION_DICT_USE_TYPE	1
 
+/**
+@brief		The use type for the bound parameters dictionary.
+*/
+#define SJM_ION_DICT_PARAMS_USE_TYPE	2
+
+/**
+@brief		The use type for the declared names dictionary.
+*/
+#define SJM_ION_DICT_NAMES_USE_TYPE	3
+
+/**
+@brief		Passed to @ref sjm_init_instance to always make a new
+		job store.
+*/
+#define SJM_INSTANCE_NEW	-1
+
 /**
 @brief		Do not define if no JSON handling is required.
 */
@@ -40,8 +56,21 @@ extern "C" {
 #endif
 #include "millisec.h"
 
+/**
+@brief		Defined if resumable jobs may wait on file descriptors.
+*/
+#if MILLISEC_PLATFORM != MILLISEC_PLATFORM_AVR
+#define SJM_FD_WAITING
+#endif
+
 /* Forward declarations for resolve typing issues. */
 typedef struct sensor_job	sensor_job_t;
+typedef struct sjm_continuation	sjm_continuation_t;
+typedef struct sjm_batch	sjm_batch_t;
+typedef struct sjm_ring		sjm_ring_t;
+typedef struct sjm_bound_params	sjm_bound_params_t;
+typedef struct sjm_param_names	sjm_param_names_t;
+typedef struct sjm_capture	sjm_capture_t;
 
 /**
 @brief		A boolean type.
@@ -62,6 +91,64 @@ typedef char			sjm_bool_t;
 #define false ((char)0)
 #endif
 
+/**
+@brief		The errors that the sensor job manager may throw.
+*/
+typedef enum    sensor_job_manager_error
+{
+	SJM_ERROR_OK,				/**< No error. */
+	SJM_ERROR_DICT_INITIALIZATION,		/**< IonDB dictionary could
+						     not be initialized. */
+	SJM_ERROR_DICT_UPDATE_FAILURE,		/**< Dictionary update failure.
+						*/
+	SJM_ERROR_DICT_GET_FAILURE,		/**< Dictionary get failure. */
+	SJM_ERROR_ADD_JOB,			/**< IonDB dictionary could
+						     not add job. */
+	SJM_ERROR_GET_JOB,			/**< IonDB dictionary could
+						     not get job. */
+	SJM_ERROR_UNSUPPORTED_JSON_FORMAT,	/**< Unsupported JSON input. */
+	SJM_ERROR_NO_MORE_QUEUED_JOBS,		/**< No queued jobs to execute.
+						*/
+	SJM_ERROR_MEMORY_ALLOCATION_FAILURE,	/**< Memory could not be
+						     could not be allocated. */
+	SJM_ERROR_THREAD_CREATION,		/**< A worker thread could not
+						     be started. */
+	SJM_ERROR_NOT_QUEUED,			/**< The job is no longer
+						     queued. */
+	SJM_ERROR_JOB_SHED,			/**< The job was not queued
+						     because of admission
+						     control. */
+	SJM_ERROR_SINK_WRITE,			/**< An output sink could not
+						     write. */
+	SJM_ERROR_PARAMS_TOO_LARGE,		/**< Encoded parameters do not
+						     fit in
+						     @ref SJM_PARAMS_BLOB_SIZE,
+						     or too many parameter
+						     names were declared to
+						     fit in
+						     @ref SJM_NAMES_BLOB_SIZE. */
+	SJM_ERROR_FRAME_INCOMPLETE,		/**< More bytes are needed
+						     for a whole frame. */
+	SJM_ERROR_FRAME_CORRUPT,		/**< A frame is malformed or
+						     fails its CRC. */
+	SJM_ERROR_FRAME_TOO_LARGE,		/**< A frame does not fit its
+						     buffer, or has too many
+						     arguments. */
+	SJM_ERROR_BUFFER_FULL,			/**< Output did not fit its
+						     buffer. */
+	SJM_ERROR_SOCKET,			/**< A socket could not be set
+						     up. */
+	SJM_ERROR_END_OF_CAPTURE,		/**< No more requests are
+						     captured. */
+	SJM_ERROR_CAPTURE_CORRUPT,		/**< A capture file is not
+						     one, or is cut short. */
+	SJM_ERROR_PARAMS_UNHASHABLE,		/**< No perfect hash of
+						     declared parameter names
+						     was found within
+						     @ref SJM_NAMED_PARAMS_SEEDS
+						     seeds. */
+} sjm_error_t;
+
 /**
 @brief		Job function. Every job have this type of signature.
 @details	This is a type signature for functions that can be called
@@ -77,6 +164,58 @@ typedef char			sjm_bool_t;
 */
 typedef void (*job_function)(void** params, void* returned);
 
+/**
+@brief		What a resumable job reports each time it returns.
+*/
+typedef enum sjm_continuation_status
+{
+	SJM_CONTINUATION_DONE,		/**< The job ran to completion. */
+	SJM_CONTINUATION_YIELDED,	/**< The job yielded and wants to be
+					     resumed later. */
+} sjm_continuation_status_t;
+
+/**
+@brief		Resumable job function.
+@details	A resumable job does not have to run to completion in a
+		single call. Instead it may yield (see @ref SJM_YIELD,
+		@ref SJM_SLEEP_UNTIL and @ref SJM_WAIT_FD) and will be
+		resumed by @ref sjm_resume_jobs when whatever it was waiting
+		on is ready. Bodies must be bracketed by @ref SJM_BEGIN and
+		@ref SJM_END.
+		
+		Local variables DO NOT survive a yield. Anything that must
+		persist belongs in the continuation's state area (see
+		@ref SJM_CONTINUATION_STATE), sized by the job's
+		@c state_size.
+@param		continuation
+			The continuation tracking this job's progress.
+@param		params
+			See @ref job_function. Only valid until the first
+			yield; copy anything needed into the state area.
+@param		returned
+			See @ref job_function. Only valid until the first
+			yield.
+@returns	Whether the job finished or yielded. Use the macros rather
+		than returning directly.
+*/
+typedef sjm_continuation_status_t (*resumable_job_function)(sjm_continuation_t *continuation, void **params, void *returned);
+
+/**
+@brief		Batch job function.
+@details	Runs a job over many parameter sets at once, so that it can
+		vectorize and keep its working set in cache. Parameter sets
+		and results are fixed-size records (of the job's
+		@c param_size and @c result_size bytes) laid out
+		contiguously.
+@param		params
+			@p count parameter sets, one after another.
+@param		results
+			Room for @p count results, one after another.
+@param		count
+			The number of parameter sets.
+*/
+typedef void (*batch_job_function)(void *params, void *results, int count);
+
 /**
 @brief		Checks if a job needs to be scheduled for execution.
 @param		job
@@ -114,10 +253,283 @@ struct sensor_job
 	milliseconds_t		last_scheduled_time;
 					/**< The last time it was added to
  *					     the execution queue. */
+	resumable_job_function	resume;	/**< If not @c NULL, the job is
+					     resumable and this is called
+					     instead of @c func. */
+	unsigned int		state_size;
+					/**< Bytes of state each in-flight
+					     instance of a resumable job
+					     needs. */
+	milliseconds_t		relative_deadline;
+					/**< If not 0, a queued instance of
+					     the job that has not started
+					     within this many milliseconds of
+					     being queued is dropped. */
+	milliseconds_t		time_budget;
+					/**< If not 0, the number of
+					     milliseconds a single run may
+					     take before it is counted as an
+					     overrun. */
+	unsigned int		overrun_count;
+					/**< Number of runs that took longer
+					     than @c time_budget. */
+	unsigned int		expired_count;
+					/**< Number of queued instances
+					     dropped for missing their
+					     deadline. */
+	unsigned char		priority;
+					/**< Priority class, from 0 (least
+					     urgent) to @ref SJM_PRIORITY_MAX.
+					     Only used by priority
+					     scheduling and load shedding. */
+	unsigned int		rate_limit;
+					/**< If not 0, the number of
+					     instances per second that may be
+					     queued, over the long run. */
+	unsigned int		burst;	/**< How many instances may be
+					     queued at once when rate limited.
+					     0 is treated as 1. */
+	milliseconds_t		bucket_time;
+					/**< When the rate limit's token
+					     bucket was last refilled. */
+	unsigned long		bucket_tokens;
+					/**< Thousandths of a token left in
+					     the bucket. */
+	batch_job_function	batch;	/**< If not @c NULL, runs many
+					     parameter sets in one call. */
+	unsigned int		param_size;
+					/**< Bytes in one parameter set, for
+					     batches. */
+	unsigned int		result_size;
+					/**< Bytes in one result, for
+					     batches. */
+	sjm_ring_t		*output;/**< If not @c NULL, the job's own
+					     output ring, used instead of the
+					     job manager's. */
+	sjm_bool_t		bound;	/**< Whether parameters are bound
+					     to the job, used whenever it
+					     runs without any. See
+					     @ref sjm_bind_params. */
+	sjm_bool_t		named;	/**< Whether the job's parameters
+					     are declared names, for
+					     object-form requests. See
+					     @ref sjm_declare_params. */
+};
+
+/**
+@brief		The most bytes an encoded parameter blob may take,
+		including its null terminator.
+*/
+#define SJM_PARAMS_BLOB_SIZE	128
+
+/**
+@brief		Parameters bound to a job, decoded and ready to use.
+@details	One exists per job with bound parameters that has run, made
+		from the stored parameters the first time they are needed.
+		It stays put for the life of the job manager; binding new
+		parameters replaces its contents.
+*/
+struct sjm_bound_params
+{
+	void			**params;
+					/**< The decoded parameters. Strings
+					     and integers are stored in the
+					     same allocation. */
+	int			count;	/**< Number of parameters. */
+	char			*name;	/**< The job's name. */
+	struct sjm_bound_params	*next;	/**< Next job's parameters. */
+};
+
+/**
+@brief		The most parameters a job may declare names for.
+*/
+#define SJM_NAMED_PARAMS_MAX	255
+
+/**
+@brief		The most bytes a job's declared parameter names may take
+		when stored: one for their number, and each name with its
+		null terminator.
+*/
+#define SJM_NAMES_BLOB_SIZE	2048
+
+/**
+@brief		Declared parameter names hashed to each bucket, on
+		average.
+*/
+#define SJM_NAMED_PARAMS_BUCKET	4
+
+/**
+@brief		The most hash seeds tried when declaring parameter names.
+*/
+#define SJM_NAMED_PARAMS_SEEDS	8
+
+/**
+@brief		The declared parameter names of a job.
+@details	Names are found through a perfect hash, chosen when the
+		names are declared: a name's hash picks a bucket, and the
+		bucket's displacement moves it to the name's own slot of
+		@c table, so a lookup is one hash and one comparison.
+		
+		One exists per job whose names were declared, or were
+		needed by a request, since the job manager was opened;
+		declaring names again frees it.
+*/
+struct sjm_param_names
+{
+	char			**names;/**< The names, in parameter order. */
+	int			*lengths;
+					/**< The length of each name. */
+	int			count;	/**< Number of parameters. */
+	unsigned long		seed;	/**< Hash seed making the hash
+					     perfect. */
+	unsigned int		buckets;/**< Number of buckets. */
+	unsigned int		*displace;
+					/**< Displacement of each bucket. */
+	unsigned int		mask;	/**< Table size less one. */
+	unsigned char		*table;	/**< One more than the parameter
+					     index hashing to each slot, or
+					     0 for none. */
+	char			*name;	/**< The job's name. */
+	struct sjm_param_names	*next;	/**< Next job's names. */
+};
+
+/**
+@brief		The most urgent priority class a job can have.
+*/
+#define SJM_PRIORITY_MAX	255
+
+/**
+@brief		Storage class for per-thread job manager state.
+*/
+#if MILLISEC_PLATFORM != MILLISEC_PLATFORM_AVR
+#define SJM_THREAD_LOCAL	__thread
+#else
+#define SJM_THREAD_LOCAL
+#endif
+
+/**
+@brief		A cooperative cancellation token.
+@details	Every running job has one. Jobs that may run for a while
+		should periodically call @ref sjm_cancel_requested and stop
+		early if it returns true.
+*/
+typedef struct sjm_cancel_token
+{
+	volatile sjm_bool_t	cancelled;
+					/**< Set when cancellation is
+					     requested. */
+	milliseconds_t		budget_end;
+					/**< If not 0, the time at which the
+					     job's time budget runs out. */
+} sjm_cancel_token_t;
+
+/**
+@brief		Wait for a file descriptor to become readable.
+*/
+#define SJM_WAIT_READ	0x1
+
+/**
+@brief		Wait for a file descriptor to become writable.
+*/
+#define SJM_WAIT_WRITE	0x2
+
+/**
+@brief		An in-flight resumable job.
+@details	The job's state area, if any, immediately follows this
+		structure in memory.
+*/
+struct sjm_continuation
+{
+	int			line;	/**< Where to resume. */
+	milliseconds_t		wake_time;
+					/**< If not 0, resume once this
+					     time has been reached. */
+	int			wait_fd;/**< If not -1, resume once this
+					     file descriptor is ready. */
+	int			wait_events;
+					/**< @ref SJM_WAIT_READ and/or
+					     @ref SJM_WAIT_WRITE. */
+	sjm_bool_t		ready;	/**< Set by the scheduler when
+					     @c wait_fd is ready. */
+	sjm_bool_t		scheduled;
+					/**< Whether the job came off of the
+					     execution queue. */
+	void			**params;
+					/**< Parameters, until first yield.
+					*/
+	void			*returned;
+					/**< Return pointer, until first
+					     yield. */
+	sensor_job_t		job;	/**< The job being run. */
+	char			*name;	/**< The job's name. */
+	sjm_cancel_token_t	token;	/**< The job's cancellation token.
+					*/
+	milliseconds_t		run_time;
+					/**< Milliseconds spent running so
+					     far, not counting time spent
+					     yielded. */
+	struct sjm_continuation	*next;	/**< Next in-flight job. */
 };
 
+/**
+@brief		Get a pointer to a continuation's state area.
+*/
+#define SJM_CONTINUATION_STATE(continuation) ((void *)((continuation)+1))
+
+/**
+@brief		Begin the body of a resumable job.
+*/
+#define SJM_BEGIN(continuation) switch ((continuation)->line) { case 0:
+
+/**
+@brief		Yield, to be resumed on the next pass of the scheduler.
+*/
+#define SJM_YIELD(continuation) \
+	do { \
+		(continuation)->line = __LINE__; \
+		return SJM_CONTINUATION_YIELDED; \
+		case __LINE__:; \
+	} while (0)
+
+/**
+@brief		Yield until the given time (in milliseconds, as per
+		@ref ms_milliseconds) has been reached.
+*/
+#define SJM_SLEEP_UNTIL(continuation, time) \
+	do { \
+		(continuation)->wake_time = (time); \
+		SJM_YIELD(continuation); \
+	} while (0)
+
+/**
+@brief		Yield until a file descriptor is ready for the given
+		events (@ref SJM_WAIT_READ, @ref SJM_WAIT_WRITE).
+*/
+#define SJM_WAIT_FD(continuation, fd, events) \
+	do { \
+		(continuation)->wait_fd = (fd); \
+		(continuation)->wait_events = (events); \
+		SJM_YIELD(continuation); \
+	} while (0)
+
+/**
+@brief		End the body of a resumable job.
+*/
+#define SJM_END(continuation) } (continuation)->line = 0; return SJM_CONTINUATION_DONE;
+
+typedef struct sjm_queue sjm_queue_t;
+
+/**
+@brief		The initial number of buckets in a queue's name index.
+		Must be a power of two.
+*/
+#define SJM_QUEUE_INDEX_SIZE	16
+
 /**
 @brief		Sensor job queue node.
+@details	Nodes are recycled rather than freed, so a node's memory
+		stays valid for the life of the job manager. The name is
+		stored immediately after the node.
 */
 typedef struct sjm_queue_node
 {
@@ -125,16 +537,159 @@ typedef struct sjm_queue_node
 	struct sjm_queue_node	*next;	/**< Next node in queue. */
 	struct sjm_queue_node	*prev;	/**< Previous node in queue. */
 	char			*name;	/**< Job name. */
+	milliseconds_t		deadline;
+					/**< If not 0, the time by which the
+					     job must start. */
+	unsigned long		generation;
+					/**< Identifies this use of the node,
+					     or 0 if it is not queued. */
+	unsigned long		hash;	/**< Hash of the job name. */
+	struct sjm_queue_node	*index_next;
+					/**< Next node in the same index
+					     bucket. */
+	struct sjm_queue_node	*index_prev;
+					/**< Previous node in the same index
+					     bucket. */
+	milliseconds_t		enqueue_time;
+					/**< When the job was queued. */
+	milliseconds_t		key;	/**< Ordering key assigned by the
+					     scheduling policy. */
+	unsigned int		heap_index;
+					/**< Position in the policy's heap,
+					     if it uses one. */
 } sjm_queue_node_t;
 
+/**
+@brief		A scheduling policy, deciding which queued job runs next.
+@details	Every queued node is kept on the queue's list in arrival
+		order regardless of policy; a policy only maintains
+		whatever extra ordering it needs. Policies are filled in
+		by an initialization function such as
+		@ref sjm_queue_fifo_init, much like dictionary handlers.
+*/
+typedef struct sjm_queue_policy
+{
+	sjm_error_t		(*push)(sjm_queue_t *queue, sjm_queue_node_t *node);
+					/**< Take a newly queued node into
+					     account. */
+	sjm_queue_node_t	*(*peek)(sjm_queue_t *queue);
+					/**< Return the node to run next, or
+					     @c NULL if the queue is empty. */
+	void			(*remove)(sjm_queue_t *queue, sjm_queue_node_t *node);
+					/**< Forget a node leaving the queue.
+					*/
+	milliseconds_t		(*key)(sjm_queue_t *queue, sjm_queue_node_t *node);
+					/**< For heap-based policies, the
+					     node's key; smaller runs
+					     sooner. */
+	milliseconds_t		aging;	/**< For priority scheduling, how
+					     many milliseconds of waiting
+					     are worth one priority class.
+					*/
+} sjm_queue_policy_t;
+
+/**
+@brief		What to shed when an admission limit is hit.
+*/
+typedef enum sjm_shed_policy
+{
+	SJM_SHED_REJECT_NEW,		/**< Turn away the incoming job. */
+	SJM_SHED_DROP_OLDEST,		/**< Drop the longest waiting job
+					     in its place. */
+	SJM_SHED_DROP_LOWEST_PRIORITY,	/**< Drop the least urgent job, if
+					     it is less urgent than the
+					     incoming one. */
+} sjm_shed_policy_t;
+
+/**
+@brief		Admission control limits for a queue.
+@details	Fill in with @ref sjm_admission_init, adjust, then install
+		with @ref sjm_set_admission.
+*/
+typedef struct sjm_admission
+{
+	unsigned int		max_depth;
+					/**< If not 0, the most jobs that
+					     may be queued at once. */
+	sjm_shed_policy_t	depth_policy;
+					/**< What to shed when the queue is
+					     at @c max_depth. */
+	sjm_shed_policy_t	rate_policy;
+					/**< What to shed when a job is over
+					     its @c rate_limit. Dropping
+					     replaces the oldest queued
+					     instance of the same job;
+					     lowest priority is treated as
+					     reject new. */
+	milliseconds_t		tick_budget;
+					/**< If not 0, the most milliseconds
+					     @ref sjm_execute_queued_jobs may
+					     spend per call. */
+	sjm_shed_policy_t	tick_policy;
+					/**< What to shed when the budget
+					     runs out with jobs still
+					     queued. See
+					     @ref sjm_execute_queued_jobs. */
+} sjm_admission_t;
+
+/**
+@brief		Counts of everything admission control has done.
+*/
+typedef struct sjm_shed_counters
+{
+	unsigned long		admitted;
+					/**< Jobs queued. */
+	unsigned long		depth;	/**< Jobs shed for queue depth. */
+	unsigned long		rate;	/**< Jobs shed for rate limits. */
+	unsigned long		budget;	/**< Jobs shed for the tick
+					     budget. */
+} sjm_shed_counters_t;
+
 /**
 @brief		Sensor job queue.
 */
-typedef struct sjm_queue
+struct sjm_queue
 {
 	sjm_queue_node_t	*head;	/**< Head of queue. */
 	sjm_queue_node_t	*tail;	/**< Tail of queue. */
-} sjm_queue_t;
+	sjm_queue_node_t	*free;	/**< Nodes available for reuse. */
+	sjm_queue_node_t	**index;/**< Queued nodes, hashed by name.
+					*/
+	unsigned int		index_size;
+					/**< Number of index buckets. */
+	unsigned int		length;	/**< Number of queued jobs. */
+	unsigned long		generation;
+					/**< Last generation handed out. */
+	sjm_queue_policy_t	policy;	/**< The scheduling policy. */
+	sjm_queue_node_t	**heap;	/**< Heap used by heap-based
+					     policies. */
+	unsigned int		heap_length;
+					/**< Nodes in the heap. */
+	unsigned int		heap_capacity;
+					/**< Space in the heap. */
+	unsigned int		allocated;
+					/**< Nodes allocated, queued or free.
+					*/
+	sjm_admission_t		admission;
+					/**< Admission control limits. */
+	sjm_shed_counters_t	shed;	/**< Admission control counters.
+					*/
+	sjm_bool_t		closed;	/**< Whether new jobs are being
+					     turned away until the backlog
+					     clears. */
+};
+
+/**
+@brief		A handle to a queued job, used to cancel it.
+@details	A handle stays safe to use after the job has left the
+		queue; it simply no longer refers to anything.
+*/
+typedef struct sjm_job_handle
+{
+	sjm_queue_node_t	*node;		/**< The queue node. */
+	unsigned long		generation;	/**< The node's generation
+						     when queued. */
+} sjm_job_handle_t;
 
 /**
 @brief		The job manager.
@@ -154,35 +709,55 @@ typedef struct sensor_job_manager
 							     of json tokens. */
 	sjm_queue_t		queue;			/**< Queue of jobs to
 							     execute. */
+	sjm_continuation_t	*in_flight;		/**< Resumable jobs
+							     that have yielded.
+							*/
+	int			num_in_flight;		/**< Number of
+							     in-flight jobs. */
+	sjm_cancel_token_t	running;		/**< Cancellation token
+							     of the running
+							     (non-resumable)
+							     job. */
+	char			*running_name;		/**< Name of the
+							     running job, or
+							     @c NULL. */
+	sjm_batch_t		*batches;		/**< Requests gathered
+							     for batching, one
+							     batch per job. */
+	sjm_ring_t		*output;		/**< If not @c NULL,
+							     the output ring
+							     shared by jobs
+							     without their own.
+							*/
+	sjm_bound_params_t	*bound;			/**< Every job's bound
+							     parameters, as
+							     decoded so far. */
+	dictionary_t		params_dictionary;	/**< Encoded bound
+							     parameters, by job
+							     name. */
+	sjm_param_names_t	*declared;		/**< Every job's
+							     declared parameter
+							     names, as hashed
+							     so far. */
+	dictionary_t		names_dictionary;	/**< Encoded declared
+							     parameter names,
+							     by job name. */
+	sjm_capture_t		*capture;		/**< If not @c NULL,
+							     where requests
+							     are captured. */
 } sjm_t;
 
-/**
-@brief		The errors that the sensor job manager may throw.
-*/
-typedef enum    sensor_job_manager_error
-{
-	SJM_ERROR_OK,				/**< No error. */
-	SJM_ERROR_DICT_INITIALIZATION,		/**< IonDB dictionary could
-						     not be initialized. */
-	SJM_ERROR_DICT_UPDATE_FAILURE,		/**< Dictionary update failure.
-						*/
-	SJM_ERROR_DICT_GET_FAILURE,		/**< Dictionary get failure. */
-	SJM_ERROR_ADD_JOB,			/**< IonDB dictionary could
-						     not add job. */
-	SJM_ERROR_GET_JOB,			/**< IonDB dictionary could
-						     not get job. */
-	SJM_ERROR_UNSUPPORTED_JSON_FORMAT,	/**< Unsupported JSON input. */
-	SJM_ERROR_NO_MORE_QUEUED_JOBS,		/**< No queued jobs to execute.
-						*/
-	SJM_ERROR_MEMORY_ALLOCATION_FAILURE,	/**< Memory could not be
-						     could not be allocated. */
-} sjm_error_t;
 
 
 /**
 @brief		Initialize a job manager.
 @details	This will open the IonDB dictionary needed for the manager.
 		It will also setup any other control information necessary.
+		
+		The first job store in the master table is reopened if
+		there is one, recovering anything logged before an
+		unclean shutdown; otherwise a new one is made. See
+		@ref sjm_init_instance.
 @param		jobmanager
 			A pointer to the job manager structure to initialize.
 			Note that this must already be allocated, and will
@@ -215,10 +790,39 @@ sjm_init(
 	int			maximum_json_tokens
 );
 
+/**
+@brief		Initialize a job manager on a given job store.
+@details	As @ref sjm_init, but reopens the @p instance-th job
+		store (counting from @c 0 in the order they were made),
+		so that several job managers in one process each keep
+		their own. A new store is made if there are not that
+		many.
+@param		jobmanager
+			See @ref sjm_init.
+@param		maximum_name_size
+			See @ref sjm_init. A store is only reopened with
+			the name size it was made with.
+@param		maximum_json_tokens
+			See @ref sjm_init.
+@param		instance
+			Which job store to open, or @ref SJM_INSTANCE_NEW
+			to always make a new one.
+@returns	@c SJM_ERROR_OK on successes, an appropriate error code
+		otherwise.
+*/
+sjm_error_t
+sjm_init_instance(
+	sjm_t			*jobmanager,
+	int			maximum_name_size,
+	int			maximum_json_tokens,
+	int			instance
+);
+
 /**
 @brief		Delete/destroy a job manager.
 @details	This will complete destroy anything to do with the job
-		manager.
+		manager, including its job store and the store's rows in
+		the master table.
 @param		jobmanager
 			A pointer to the job manager structure to destroy.
 			This WILL NOT free the pointer, that is up to the
@@ -231,6 +835,81 @@ sjm_delete(
 	sjm_t			*jobmanager
 );
 
+/**
+@brief		Initialize a job before filling it in.
+@details	Every field not covered by the arguments is set to its
+		default (zero/@c NULL). Jobs should always be initialized
+		this way so that fields added in the future have sane
+		values.
+@param		job
+			The job to initialize.
+@param		func
+			The job function.
+@param		needs_execution
+			The activation function, or @c NULL if the job is
+			never scheduled.
+*/
+void
+sjm_init_job(
+	sensor_job_t		*job,
+	job_function		func,
+	activation_function	needs_execution
+);
+
+/**
+@brief		Get the length of a job name for its dictionary key.
+@details	Counting stops one past the longest name allowed, so a
+		longer one is refused by the dictionary rather than cut
+		short into another job's name. Names as long as the
+		maximum need no terminator.
+@param		jobmanager
+			The job manager the name is looked up in.
+@param		name
+			The job's name.
+@returns	The number of bytes of the name to use as its key.
+*/
+int
+sjm_name_length(
+	sjm_t			*jobmanager,
+	const char		*name
+);
+
+/**
+@brief		Run a (non-resumable) job over contiguous parameter sets,
+		as @ref sjm_perform_job runs it once.
+@details	The whole batch runs under one cancellation token, time
+		budget and output ring, and an overrun of the budget is
+		recorded for the job. The job's batch entry point is used
+		if it has one; otherwise its function is called once per
+		set, and sets not yet run when the batch is cancelled are
+		skipped. See @ref sjm_perform_job_batch.
+@param		jobmanager
+			The job manager holding the job.
+@param		job
+			The job, as stored.
+@param		name
+			The job's name. It must stay valid while the job runs.
+@param		params
+			@p count parameter sets of the job's @c param_size
+			bytes each.
+@param		results
+			Room for @p count results of the job's
+			@c result_size bytes each.
+@param		count
+			The number of parameter sets.
+@returns	@c SJM_ERROR_OK on successes, an appropriate error code
+		otherwise.
+*/
+sjm_error_t
+sjm_run_job_batch(
+	sjm_t			*jobmanager,
+	sensor_job_t		*job,
+	char			*name,
+	unsigned char		*params,
+	unsigned char		*results,
+	int			count
+);
+
 /**
 @brief		Add a named job to manage.
 @param		jobmanager
@@ -309,6 +988,15 @@ sjm_perform_job(
 			call. Boolean literals, @c true and @c false,
 			will be interpreted as the integers @c 1 and
 			@c 0, respectively.
+			
+			Jobs with declared parameter names (see
+			@ref sjm_declare_params) may also be requested with
+			a JSON object naming the job and its arguments:
+			
+				{"job":<job-name>,"args":{<name>:<value>, ...}}
+			
+			Every declared parameter must be given, and the
+			job gets them in declared order.
 @param		returnval
 			A pointer used to extract return data into.
 			This is passed into the job function directly.
@@ -323,6 +1011,201 @@ sjm_request_job(
 );
 #endif
 
+#ifdef  SJM_JSON_HANDLING
+/**
+@brief		Add a named job along with parameters to run it with.
+@details	See @ref sjm_add_job and @ref sjm_bind_params.
+*/
+sjm_error_t
+sjm_add_job_with_params(
+	sjm_t			*jobmanager,
+	char			*jobname,
+	sensor_job_t		*job,
+	char			*params
+);
+
+/**
+@brief		Bind parameters to a job.
+@details	Scheduled runs of the job, and direct calls made without
+		parameters, then get these parameters. They are stored
+		once, encoded, in a dictionary alongside the jobs, and
+		decoded once, here or by the first run after the job
+		manager is opened again, so that every run reuses the
+		decoded form without any parsing or storage reads.
+		
+		Rebinding replaces the decoded parameters, so it must not
+		be done while the job is running.
+@param		jobmanager
+			The job manager holding the job.
+@param		name
+			The job's name.
+@param		params
+			A JSON array of parameters, interpreted as they are by
+			@ref sjm_request_job. For example, @c [3,"abc",true].
+			At most @ref SJM_PARAMS_BLOB_SIZE bytes with its null
+			terminator.
+@returns	@c SJM_ERROR_OK on successes, an appropriate error code
+		otherwise.
+*/
+sjm_error_t
+sjm_bind_params(
+	sjm_t			*jobmanager,
+	char			*name,
+	char			*params
+);
+
+/**
+@brief		Declare the names of a job's parameters.
+@details	This lets the job be requested with named arguments. The
+		names are hashed once, here, into a perfect hash table,
+		and stored alongside the jobs; when the job manager is
+		opened again, they are hashed again by the first request
+		that needs them. Declaring names again replaces the old
+		ones.
+@param		jobmanager
+			The job manager holding the job.
+@param		name
+			The job's name.
+@param		names
+			The parameter names, in the order the job expects its
+			parameters.
+@param		count
+			The number of names. At most
+			@ref SJM_NAMED_PARAMS_MAX, and all of them at most
+			@ref SJM_NAMES_BLOB_SIZE bytes as stored.
+@returns	@c SJM_ERROR_OK on successes, an appropriate error code
+		otherwise.
+*/
+sjm_error_t
+sjm_declare_params(
+	sjm_t			*jobmanager,
+	char			*name,
+	char			**names,
+	int			count
+);
+
+/**
+@brief		The placeholder for an integer argument in a prepared
+		request template.
+*/
+#define SJM_PREPARED_INT	"%d"
+
+/**
+@brief		The placeholder for a string argument in a prepared
+		request template.
+*/
+#define SJM_PREPARED_STRING	"%s"
+
+/**
+@brief		The type of a prepared request argument.
+*/
+typedef enum sjm_arg_type
+{
+	SJM_ARG_INT,		/**< An @c int. */
+	SJM_ARG_STRING,		/**< A @c char @c *. */
+} sjm_arg_type_t;
+
+/**
+@brief		A request parsed once, to be executed many times.
+@details	The job is looked up when the request is prepared, and
+		constant parameters are decoded then too. Only the
+		placeholders are filled in on each execution.
+*/
+typedef struct sjm_prepared
+{
+	sjm_t			*jobmanager;	/**< The owning job manager.
+						*/
+	sensor_job_t		job;		/**< The resolved job. */
+	char			*name;		/**< The job's name. */
+	void			**params;	/**< Parameter template, with
+						     constants in place. */
+	int			count;		/**< Number of parameters. */
+	int			*slots;		/**< Parameter index of each
+						     placeholder. */
+	sjm_arg_type_t		*types;		/**< Type of each placeholder.
+						*/
+	int			num_args;	/**< Number of placeholders. */
+} sjm_prepared_t;
+
+/**
+@brief		Prepare a request template for repeated execution.
+@details	The template has the format of a @ref sjm_request_job
+		request, except that any parameter may be the bare
+		placeholder @ref SJM_PREPARED_INT or
+		@ref SJM_PREPARED_STRING, to be supplied on each
+		execution. For example, @c ["read_channel",%d].
+		
+		The job is resolved now, so a job replaced after this
+		must be prepared again.
+@param		jobmanager
+			The job manager holding the job.
+@param		prepared
+			The prepared request to initialize. This must already
+			be allocated.
+@param		json
+			The request template. It is not modified.
+@returns	@c SJM_ERROR_OK on successes, an appropriate error code
+		otherwise.
+*/
+sjm_error_t
+sjm_prepare(
+	sjm_t			*jobmanager,
+	sjm_prepared_t		*prepared,
+	char			*json
+);
+
+/**
+@brief		Execute a prepared request.
+@details	See @ref sjm_perform_job. No parsing or job lookup is
+		done.
+@param		prepared
+			The prepared request.
+@param		retval
+			A pointer that is to be set with the return data.
+@param		...
+			One argument per placeholder, in template order:
+			an @c int for each @ref SJM_PREPARED_INT and a
+			@c char @c * for each @ref SJM_PREPARED_STRING.
+@returns	@c SJM_ERROR_OK on successes, an appropriate error code
+		otherwise.
+*/
+sjm_error_t
+sjm_execute_prepared(
+	sjm_prepared_t		*prepared,
+	void			*retval,
+	...
+);
+
+/**
+@brief		Free a prepared request's memory.
+@param		prepared
+			The prepared request. The pointer itself is not
+			freed.
+*/
+void
+sjm_prepared_delete(
+	sjm_prepared_t		*prepared
+);
+#endif
+
+/**
+@brief		Hash a job name.
+@details	This is a 32-bit FNV-1a hash over the characters of the
+		name, stopping at the first null character or after
+		@p maximum_name_size characters, whichever comes first. It
+		is stable across runs, so it may be used to partition jobs.
+@param		name
+			The job name to hash.
+@param		maximum_name_size
+			The maximum number of characters to consider.
+@returns	The hash of the name.
+*/
+unsigned long
+sjm_hash_name(
+	const char		*name,
+	int			maximum_name_size
+);
+
 /**
 @brief		Execute the next queued job.
 @param		jobmanager
@@ -336,9 +1219,49 @@ sjm_execute_queued_job(
 	sjm_t		*jobmanager
 );
 
+/**
+@brief		Execute queued jobs until the queue is empty or the tick
+		budget is spent.
+@details	If the budget runs out with jobs still queued, the queue's
+		tick policy decides what happens to them:
+		
+			Reject new:	They are kept, but new jobs are turned
+					away until a call empties the queue.
+			Drop oldest:	Those queued before this call began
+					are dropped.
+			Drop lowest:	Those in the lowest priority class
+					still queued are dropped.
+@param		jobmanager
+			The job manager whose queue to drain.
+@returns	@c SJM_ERROR_OK on successes, an appropriate error code
+		otherwise.
+*/
+sjm_error_t
+sjm_execute_queued_jobs(
+	sjm_t		*jobmanager
+);
+
+/**
+@brief		Resume every in-flight resumable job that is ready.
+@details	A job is ready if it plainly yielded, if the time it is
+		sleeping until has been reached, or if the file descriptor
+		it is waiting on is ready. This never blocks. Call it from
+		the same loop that calls @ref sjm_execute_queued_job.
+@param		jobmanager
+			The job manager whose in-flight jobs to resume.
+@returns	@c SJM_ERROR_OK on successes, an appropriate error code
+		otherwise.
+*/
+sjm_error_t
+sjm_resume_jobs(
+	sjm_t		*jobmanager
+);
+
 /**
 @brief		This loops through all jobs and adds new jobs to the
 		queue, if necessary.
+@details	Job changes logged but not yet synced are synced here
+		once the oldest has waited out the commit interval.
 @param		jobmanager
 			The job manager that manages the scheduled jobs.
 @returns	@c SJM_ERROR_OK on successes, an appropriate error code
@@ -349,6 +1272,129 @@ sjm_queue_scheduled_jobs(
 	sjm_t		*jobmanager
 );
 
+/**
+@brief		Add a named job to the back of the execution queue.
+@param		jobmanager
+			The job manager whose queue to add the job to.
+@param		name
+			The name of the job to queue.
+@param		handle
+			If not @c NULL, set to a handle that can be used to
+			cancel this queued instance of the job.
+@returns	@c SJM_ERROR_OK on successes, an appropriate error code
+		otherwise.
+*/
+sjm_error_t
+sjm_queue_job(
+	sjm_t			*jobmanager,
+	char			*name,
+	sjm_job_handle_t	*handle
+);
+
+/**
+@brief		Change how the job manager's queue picks the next job.
+@details	Jobs already queued are reordered under the new policy.
+@param		jobmanager
+			The job manager whose queue to change.
+@param		policy
+			The policy, as filled in by one of
+			@ref sjm_queue_fifo_init, @ref sjm_queue_priority_init
+			or @ref sjm_queue_edf_init. It is copied.
+@returns	@c SJM_ERROR_OK on successes, an appropriate error code
+		otherwise. On failure the previous policy stays in place.
+*/
+sjm_error_t
+sjm_set_queue_policy(
+	sjm_t			*jobmanager,
+	sjm_queue_policy_t	*policy
+);
+
+/**
+@brief		Install admission control limits on a job manager's queue.
+@details	If a maximum depth is set, enough queue nodes are
+		allocated up front that queueing never allocates memory.
+@param		jobmanager
+			The job manager whose queue to limit.
+@param		admission
+			The limits, as filled in by @ref sjm_admission_init
+			and adjusted. They are copied.
+@returns	@c SJM_ERROR_OK on successes, an appropriate error code
+		otherwise.
+*/
+sjm_error_t
+sjm_set_admission(
+	sjm_t			*jobmanager,
+	sjm_admission_t		*admission
+);
+
+/**
+@brief		Remove a single queued job before it runs.
+@param		jobmanager
+			The job manager whose queue holds the job.
+@param		handle
+			The handle set when the job was queued.
+@returns	@c SJM_ERROR_OK if the job was removed,
+		@c SJM_ERROR_NOT_QUEUED if it had already left the queue.
+*/
+sjm_error_t
+sjm_cancel_queued_job(
+	sjm_t			*jobmanager,
+	sjm_job_handle_t	*handle
+);
+
+/**
+@brief		Cancel every instance of a named job.
+@details	Queued instances are removed. In-flight resumable instances,
+		and the running instance if there is one, have cancellation
+		requested and stop once they next check
+		@ref sjm_cancel_requested.
+@param		jobmanager
+			The job manager running the jobs.
+@param		name
+			The name of the job to cancel.
+@returns	The number of queued instances removed.
+*/
+int
+sjm_cancel_jobs(
+	sjm_t			*jobmanager,
+	char			*name
+);
+
+/**
+@brief		Request cancellation of the running (non-resumable) job.
+@details	This may be called from another thread or a signal handler.
+		If no job is running, the request is ignored.
+@param		jobmanager
+			The job manager running the job.
+*/
+void
+sjm_cancel_running_job(
+	sjm_t			*jobmanager
+);
+
+/**
+@brief		Check whether the calling job should stop.
+@details	This is true once cancellation of the job has been
+		requested, or once the job has used up its time budget.
+		It is always false outside of a job.
+@returns	Whether the calling job should stop early.
+*/
+sjm_bool_t
+sjm_cancel_requested(
+	void
+);
+
+/**
+@brief		Get the output ring of the job running on this thread.
+@details	This is the job's own ring if it has one, otherwise its
+		job manager's shared ring. See @ref jobring.h.
+@returns	The ring, or @c NULL outside of a job or if there is none.
+*/
+sjm_ring_t *
+sjm_current_output(
+	void
+);
+
 #ifdef  __cplusplus
 }
 #endif
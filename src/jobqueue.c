@@ -0,0 +1,910 @@
+/******************************************************************************/
+/**
+@file
+@author		Graeme Douglas
+@details	For more information, see @ref jobqueue.h.
+*/
+/******************************************************************************/
+
+#include "jobqueue.h"
+
+/**
+@brief		Link a node into a name index.
+@param		index
+			The index buckets.
+@param		size
+			The number of buckets, a power of two.
+@param		node
+			The node to link in.
+*/
+static void
+sjm_index_link(
+	sjm_queue_node_t	**index,
+	unsigned int		size,
+	sjm_queue_node_t	*node
+)
+{
+	unsigned int		bucket;
+	
+	bucket			= node->hash & (size-1);
+	node->index_prev	= NULL;
+	node->index_next	= index[bucket];
+	if (NULL != index[bucket])
+	{
+		index[bucket]->index_prev
+				= node;
+	}
+	index[bucket]		= node;
+}
+
+/**
+@brief		Add a node to a queue's name index, doubling the number
+		of buckets first if chains are getting long.
+@details	If the index cannot grow, chains simply get longer.
+@param		queue
+			The queue the node was added to.
+@param		node
+			The node to index.
+*/
+static void
+sjm_index_insert(
+	sjm_queue_t		*queue,
+	sjm_queue_node_t	*node
+)
+{
+	sjm_queue_node_t	**index;
+	sjm_queue_node_t	*cursor;
+	sjm_queue_node_t	*next;
+	unsigned int		size;
+	unsigned int		i;
+	
+	if (queue->length > 2 * queue->index_size)
+	{
+		size		= 2 * queue->index_size;
+		index		= calloc(size, sizeof(sjm_queue_node_t *));
+		if (NULL != index)
+		{
+			for (i = 0; i < queue->index_size; i++)
+			{
+				for (cursor = queue->index[i]; NULL != cursor; cursor = next)
+				{
+					next	= cursor->index_next;
+					sjm_index_link(index, size, cursor);
+				}
+			}
+			free(queue->index);
+			queue->index		= index;
+			queue->index_size	= size;
+		}
+	}
+	
+	sjm_index_link(queue->index, queue->index_size, node);
+}
+
+/**
+@brief		Whether node @p a should run before node @p b under a
+		heap-based policy. Equal keys run in arrival order.
+*/
+static sjm_bool_t
+sjm_heap_before(
+	sjm_queue_node_t	*a,
+	sjm_queue_node_t	*b
+)
+{
+	return a->key < b->key ||
+	       (a->key == b->key && a->generation < b->generation);
+}
+
+/**
+@brief		Place a node at a heap position, keeping its index current.
+*/
+static void
+sjm_heap_place(
+	sjm_queue_t		*queue,
+	sjm_queue_node_t	*node,
+	unsigned int		i
+)
+{
+	queue->heap[i]		= node;
+	node->heap_index	= i;
+}
+
+/**
+@brief		Move the node at heap position @p i up towards the root
+		until the heap property holds.
+*/
+static void
+sjm_heap_sift_up(
+	sjm_queue_t		*queue,
+	unsigned int		i
+)
+{
+	sjm_queue_node_t	*node;
+	unsigned int		parent;
+	
+	node			= queue->heap[i];
+	while (0 < i)
+	{
+		parent		= (i-1) / SJM_QUEUE_HEAP_ARITY;
+		if (!sjm_heap_before(node, queue->heap[parent]))
+		{
+			break;
+		}
+		sjm_heap_place(queue, queue->heap[parent], i);
+		i		= parent;
+	}
+	sjm_heap_place(queue, node, i);
+}
+
+/**
+@brief		Move the node at heap position @p i down towards the
+		leaves until the heap property holds.
+*/
+static void
+sjm_heap_sift_down(
+	sjm_queue_t		*queue,
+	unsigned int		i
+)
+{
+	sjm_queue_node_t	*node;
+	unsigned int		child;
+	unsigned int		best;
+	unsigned int		last;
+	
+	node			= queue->heap[i];
+	while (1)
+	{
+		child		= i * SJM_QUEUE_HEAP_ARITY + 1;
+		if (child >= queue->heap_length)
+		{
+			break;
+		}
+		
+		best		= child;
+		last		= child + SJM_QUEUE_HEAP_ARITY;
+		if (last > queue->heap_length)
+		{
+			last	= queue->heap_length;
+		}
+		for (child++; child < last; child++)
+		{
+			if (sjm_heap_before(queue->heap[child], queue->heap[best]))
+			{
+				best	= child;
+			}
+		}
+		
+		if (!sjm_heap_before(queue->heap[best], node))
+		{
+			break;
+		}
+		sjm_heap_place(queue, queue->heap[best], i);
+		i		= best;
+	}
+	sjm_heap_place(queue, node, i);
+}
+
+/**
+@brief		Make sure the heap can hold at least @p capacity nodes.
+*/
+static sjm_error_t
+sjm_heap_reserve(
+	sjm_queue_t		*queue,
+	unsigned int		capacity
+)
+{
+	sjm_queue_node_t	**heap;
+	unsigned int		size;
+	
+	if (capacity <= queue->heap_capacity)
+	{
+		return SJM_ERROR_OK;
+	}
+	
+	size			= (0 == queue->heap_capacity) ? SJM_QUEUE_INDEX_SIZE : queue->heap_capacity;
+	while (size < capacity)
+	{
+		size		*= 2;
+	}
+	heap			= realloc(queue->heap, size * sizeof(sjm_queue_node_t *));
+	if (NULL == heap)
+	{
+		return SJM_ERROR_MEMORY_ALLOCATION_FAILURE;
+	}
+	queue->heap		= heap;
+	queue->heap_capacity	= size;
+	
+	return SJM_ERROR_OK;
+}
+
+/**
+@brief		Heap-based policy push: key the node and sift it into place.
+*/
+static sjm_error_t
+sjm_heap_push(
+	sjm_queue_t		*queue,
+	sjm_queue_node_t	*node
+)
+{
+	sjm_error_t		error;
+	
+	error			= sjm_heap_reserve(queue, queue->heap_length+1);
+	if (SJM_ERROR_OK != error)
+	{
+		return error;
+	}
+	
+	node->key		= queue->policy.key(queue, node);
+	queue->heap[queue->heap_length]
+				= node;
+	sjm_heap_sift_up(queue, queue->heap_length++);
+	
+	return SJM_ERROR_OK;
+}
+
+/**
+@brief		Heap-based policy peek: the root of the heap.
+*/
+static sjm_queue_node_t *
+sjm_heap_peek(
+	sjm_queue_t		*queue
+)
+{
+	if (0 == queue->heap_length)
+	{
+		return NULL;
+	}
+	
+	return queue->heap[0];
+}
+
+/**
+@brief		Heap-based policy remove, from anywhere in the heap.
+*/
+static void
+sjm_heap_remove(
+	sjm_queue_t		*queue,
+	sjm_queue_node_t	*node
+)
+{
+	sjm_queue_node_t	*last;
+	unsigned int		i;
+	
+	i			= node->heap_index;
+	last			= queue->heap[--queue->heap_length];
+	if (i == queue->heap_length)
+	{
+		return;
+	}
+	
+	/* Fill the hole with the last node, which may belong either
+	   above or below it. */
+	sjm_heap_place(queue, last, i);
+	sjm_heap_sift_up(queue, i);
+	sjm_heap_sift_down(queue, last->heap_index);
+}
+
+/**
+@brief		Priority policy key. See @ref sjm_queue_priority_init.
+*/
+static milliseconds_t
+sjm_priority_key(
+	sjm_queue_t		*queue,
+	sjm_queue_node_t	*node
+)
+{
+	return node->enqueue_time +
+	       (milliseconds_t)(SJM_PRIORITY_MAX - node->job.priority) * queue->policy.aging;
+}
+
+/**
+@brief		EDF policy key: the absolute deadline, or the latest
+		possible time for jobs without one.
+*/
+static milliseconds_t
+sjm_edf_key(
+	sjm_queue_t		*queue,
+	sjm_queue_node_t	*node
+)
+{
+	if (0 == node->deadline)
+	{
+		return ~((milliseconds_t)0);
+	}
+	
+	return node->deadline;
+}
+
+/**
+@brief		FIFO policy push. The queue's list is already in arrival
+		order, so there is nothing to do.
+*/
+static sjm_error_t
+sjm_fifo_push(
+	sjm_queue_t		*queue,
+	sjm_queue_node_t	*node
+)
+{
+	return SJM_ERROR_OK;
+}
+
+/**
+@brief		FIFO policy peek: the oldest queued node.
+*/
+static sjm_queue_node_t *
+sjm_fifo_peek(
+	sjm_queue_t		*queue
+)
+{
+	return queue->head;
+}
+
+/**
+@brief		FIFO policy remove. Nothing to do.
+*/
+static void
+sjm_fifo_remove(
+	sjm_queue_t		*queue,
+	sjm_queue_node_t	*node
+)
+{
+}
+
+void
+sjm_queue_fifo_init(
+	sjm_queue_policy_t	*policy
+)
+{
+	policy->push		= sjm_fifo_push;
+	policy->peek		= sjm_fifo_peek;
+	policy->remove		= sjm_fifo_remove;
+	policy->key		= NULL;
+	policy->aging		= 0;
+}
+
+void
+sjm_queue_priority_init(
+	sjm_queue_policy_t	*policy
+)
+{
+	policy->push		= sjm_heap_push;
+	policy->peek		= sjm_heap_peek;
+	policy->remove		= sjm_heap_remove;
+	policy->key		= sjm_priority_key;
+	policy->aging		= SJM_QUEUE_DEFAULT_AGING;
+}
+
+void
+sjm_queue_edf_init(
+	sjm_queue_policy_t	*policy
+)
+{
+	policy->push		= sjm_heap_push;
+	policy->peek		= sjm_heap_peek;
+	policy->remove		= sjm_heap_remove;
+	policy->key		= sjm_edf_key;
+	policy->aging		= 0;
+}
+
+sjm_error_t
+sjm_queue_init(
+	sjm_queue_t		*queue
+)
+{
+	queue->head		= NULL;
+	queue->tail		= NULL;
+	queue->free		= NULL;
+	queue->length		= 0;
+	queue->generation	= 0;
+	queue->heap		= NULL;
+	queue->heap_length	= 0;
+	queue->heap_capacity	= 0;
+	queue->allocated	= 0;
+	queue->closed		= false;
+	memset(&(queue->shed), 0, sizeof(sjm_shed_counters_t));
+	sjm_admission_init(&(queue->admission));
+	sjm_queue_fifo_init(&(queue->policy));
+	queue->index_size	= SJM_QUEUE_INDEX_SIZE;
+	queue->index		= calloc(SJM_QUEUE_INDEX_SIZE, sizeof(sjm_queue_node_t *));
+	if (NULL == queue->index)
+	{
+		return SJM_ERROR_MEMORY_ALLOCATION_FAILURE;
+	}
+	
+	return SJM_ERROR_OK;
+}
+
+void
+sjm_queue_delete(
+	sjm_queue_t		*queue
+)
+{
+	sjm_queue_node_t	*node;
+	
+	/* Recycled nodes included. */
+	while (NULL != queue->head)
+	{
+		node		= queue->head;
+		queue->head	= node->next;
+		free(node);
+	}
+	while (NULL != queue->free)
+	{
+		node		= queue->free;
+		queue->free	= node->next;
+		free(node);
+	}
+	queue->tail		= NULL;
+	queue->length		= 0;
+	queue->allocated	= 0;
+	free(queue->index);
+	queue->index		= NULL;
+	free(queue->heap);
+	queue->heap		= NULL;
+	queue->heap_length	= 0;
+	queue->heap_capacity	= 0;
+}
+
+/**
+@brief		Take a node off of the queue's list and out of its index,
+		and set it aside for reuse. The policy is not told.
+*/
+static void
+sjm_queue_unlink(
+	sjm_queue_t		*queue,
+	sjm_queue_node_t	*node
+)
+{
+	if (NULL != node->prev)
+	{
+		node->prev->next	= node->next;
+	}
+	else
+	{
+		queue->head		= node->next;
+	}
+	if (NULL != node->next)
+	{
+		node->next->prev	= node->prev;
+	}
+	else
+	{
+		queue->tail		= node->prev;
+	}
+	
+	if (NULL != node->index_prev)
+	{
+		node->index_prev->index_next
+					= node->index_next;
+	}
+	else
+	{
+		queue->index[node->hash & (queue->index_size-1)]
+					= node->index_next;
+	}
+	if (NULL != node->index_next)
+	{
+		node->index_next->index_prev
+					= node->index_prev;
+	}
+	
+	queue->length--;
+	node->generation	= 0;
+	node->next		= queue->free;
+	queue->free		= node;
+}
+
+void
+sjm_queue_remove(
+	sjm_queue_t		*queue,
+	sjm_queue_node_t	*node
+)
+{
+	queue->policy.remove(queue, node);
+	sjm_queue_unlink(queue, node);
+}
+
+/**
+@brief		Allocate a new queue node, with room for the name.
+*/
+static sjm_queue_node_t *
+sjm_queue_node_alloc(
+	sjm_t			*jobmanager
+)
+{
+	sjm_queue_node_t	*node;
+	
+	node			= malloc(sizeof(sjm_queue_node_t) + jobmanager->maximum_name_size + 1);
+	if (NULL == node)
+	{
+		return NULL;
+	}
+	node->name		= (char *)(node+1);
+	node->generation	= 0;
+	jobmanager->queue.allocated++;
+	
+	return node;
+}
+
+/**
+@brief		Refill a job's token bucket for the time that has passed.
+@param		job
+			The rate limited job.
+@param		now
+			The current time.
+*/
+static void
+sjm_bucket_refill(
+	sensor_job_t		*job,
+	milliseconds_t		now
+)
+{
+	unsigned long		capacity;
+	milliseconds_t		gained;
+	
+	capacity		= 1000UL * (0 == job->burst ? 1 : job->burst);
+	if (job->bucket_tokens > capacity)
+	{
+		job->bucket_tokens
+				= capacity;
+	}
+	
+	/* The rate is per second and time is in milliseconds, so this
+	   is in thousandths of a token. */
+	if (now > job->bucket_time)
+	{
+		gained		= (now - job->bucket_time) * job->rate_limit;
+		if (gained >= capacity - job->bucket_tokens)
+		{
+			job->bucket_tokens
+				= capacity;
+		}
+		else
+		{
+			job->bucket_tokens
+				+= gained;
+		}
+	}
+	job->bucket_time	= now;
+}
+
+/**
+@brief		Find the longest waiting queued instance of a job.
+@returns	The node, or @c NULL if none is queued.
+*/
+static sjm_queue_node_t *
+sjm_queue_find_oldest(
+	sjm_t			*jobmanager,
+	char			*name,
+	unsigned long		hash
+)
+{
+	sjm_queue_t		*queue;
+	sjm_queue_node_t	*node;
+	sjm_queue_node_t	*oldest;
+	
+	queue			= &(jobmanager->queue);
+	oldest			= NULL;
+	for (node = queue->index[hash & (queue->index_size-1)]; NULL != node; node = node->index_next)
+	{
+		if (node->hash == hash &&
+		    0 == strncmp(node->name, name, jobmanager->maximum_name_size) &&
+		    (NULL == oldest || node->generation < oldest->generation))
+		{
+			oldest	= node;
+		}
+	}
+	
+	return oldest;
+}
+
+/**
+@brief		Find the longest waiting job in the lowest priority class
+		queued.
+@details	This walks the queue, but only runs when the queue is
+		already full.
+@returns	The node, or @c NULL if the queue is empty.
+*/
+static sjm_queue_node_t *
+sjm_queue_find_lowest(
+	sjm_queue_t		*queue
+)
+{
+	sjm_queue_node_t	*node;
+	sjm_queue_node_t	*lowest;
+	
+	lowest			= queue->head;
+	for (node = queue->head; NULL != node; node = node->next)
+	{
+		if (node->job.priority < lowest->job.priority)
+		{
+			lowest	= node;
+		}
+	}
+	
+	return lowest;
+}
+
+void
+sjm_admission_init(
+	sjm_admission_t		*admission
+)
+{
+	admission->max_depth	= 0;
+	admission->depth_policy	= SJM_SHED_REJECT_NEW;
+	admission->rate_policy	= SJM_SHED_REJECT_NEW;
+	admission->tick_budget	= 0;
+	admission->tick_policy	= SJM_SHED_REJECT_NEW;
+}
+
+sjm_error_t
+sjm_set_admission(
+	sjm_t			*jobmanager,
+	sjm_admission_t		*admission
+)
+{
+	sjm_queue_t		*queue;
+	sjm_queue_node_t	*node;
+	sjm_error_t		error;
+	
+	queue			= &(jobmanager->queue);
+	queue->admission	= *admission;
+	queue->closed		= false;
+	
+	while (queue->allocated < admission->max_depth)
+	{
+		node		= sjm_queue_node_alloc(jobmanager);
+		if (NULL == node)
+		{
+			return SJM_ERROR_MEMORY_ALLOCATION_FAILURE;
+		}
+		node->next	= queue->free;
+		queue->free	= node;
+	}
+	
+	if (NULL != queue->policy.key)
+	{
+		error		= sjm_heap_reserve(queue, admission->max_depth);
+		if (SJM_ERROR_OK != error)
+		{
+			return error;
+		}
+	}
+	
+	return SJM_ERROR_OK;
+}
+
+sjm_error_t
+sjm_enqueue_job(
+	sjm_t			*jobmanager,
+	sensor_job_t		*job,
+	char			*name,
+	sjm_job_handle_t	*handle
+)
+{
+	sjm_error_t		error;
+	sjm_queue_t		*queue;
+	sjm_queue_node_t	*node;
+	sjm_queue_node_t	*victim;
+	unsigned long		hash;
+	milliseconds_t		now;
+	sjm_bool_t		replaced;
+	
+	queue			= &(jobmanager->queue);
+	now			= ms_milliseconds();
+	hash			= sjm_hash_name(name, jobmanager->maximum_name_size);
+	replaced		= false;
+	
+	/* Admission control. */
+	if (queue->closed)
+	{
+		queue->shed.budget++;
+		return SJM_ERROR_JOB_SHED;
+	}
+	
+	if (0 != job->rate_limit)
+	{
+		sjm_bucket_refill(job, now);
+		if (job->bucket_tokens < 1000)
+		{
+			victim	= NULL;
+			if (SJM_SHED_DROP_OLDEST == queue->admission.rate_policy)
+			{
+				victim	= sjm_queue_find_oldest(jobmanager, name, hash);
+			}
+			queue->shed.rate++;
+			if (NULL == victim)
+			{
+				return SJM_ERROR_JOB_SHED;
+			}
+			sjm_queue_remove(queue, victim);
+			replaced	= true;
+		}
+	}
+	
+	if (0 != queue->admission.max_depth &&
+	    queue->length >= queue->admission.max_depth)
+	{
+		victim		= NULL;
+		if (SJM_SHED_DROP_OLDEST == queue->admission.depth_policy)
+		{
+			victim	= queue->head;
+		}
+		else if (SJM_SHED_DROP_LOWEST_PRIORITY == queue->admission.depth_policy)
+		{
+			/* Only a more urgent job may displace another. */
+			victim	= sjm_queue_find_lowest(queue);
+			if (NULL != victim && victim->job.priority >= job->priority)
+			{
+				victim	= NULL;
+			}
+		}
+		queue->shed.depth++;
+		if (NULL == victim)
+		{
+			return SJM_ERROR_JOB_SHED;
+		}
+		sjm_queue_remove(queue, victim);
+	}
+	
+	if (NULL != queue->free)
+	{
+		node		= queue->free;
+		queue->free	= node->next;
+	}
+	else
+	{
+		node		= sjm_queue_node_alloc(jobmanager);
+		if (NULL == node)
+		{
+			return SJM_ERROR_MEMORY_ALLOCATION_FAILURE;
+		}
+	}
+	
+	/* Spend the token only once the job is definitely queued, and
+	   not at all if it took the place of an earlier instance. */
+	if (0 != job->rate_limit && !replaced)
+	{
+		job->bucket_tokens
+				-= 1000;
+	}
+	
+	node->job		= *job;
+	strncpy(node->name, name, jobmanager->maximum_name_size);
+	node->name[jobmanager->maximum_name_size]
+				= '\0';
+	node->hash		= hash;
+	
+	/* Generation 0 means "not queued", so skip it on wrap around. */
+	if (0 == ++queue->generation)
+	{
+		queue->generation++;
+	}
+	node->generation	= queue->generation;
+	node->enqueue_time	= now;
+	node->deadline		= 0;
+	if (0 != job->relative_deadline)
+	{
+		node->deadline	= node->enqueue_time + job->relative_deadline;
+	}
+	
+	node->next		= NULL;
+	node->prev		= queue->tail;
+	if (NULL != queue->tail)
+	{
+		queue->tail->next
+				= node;
+	}
+	else
+	{
+		queue->head	= node;
+	}
+	queue->tail		= node;
+	queue->length++;
+	sjm_index_insert(queue, node);
+	
+	error			= queue->policy.push(queue, node);
+	if (SJM_ERROR_OK != error)
+	{
+		sjm_queue_unlink(queue, node);
+		if (0 != job->rate_limit && !replaced)
+		{
+			job->bucket_tokens
+				+= 1000;
+		}
+		return error;
+	}
+	queue->shed.admitted++;
+	
+	if (NULL != handle)
+	{
+		handle->node		= node;
+		handle->generation	= node->generation;
+	}
+	
+	return SJM_ERROR_OK;
+}
+
+sjm_error_t
+sjm_dequeue_next_job(
+	sjm_t		*jobmanager,
+	sensor_job_t	*job,
+	char		*name,
+	milliseconds_t	*deadline
+)
+{
+	sjm_queue_node_t	*node;
+	
+	node			= jobmanager->queue.policy.peek(&(jobmanager->queue));
+	if (NULL == node)
+	{
+		return SJM_ERROR_NO_MORE_QUEUED_JOBS;
+	}
+	
+	*job			= node->job;
+	strcpy(name, node->name);
+	if (NULL != deadline)
+	{
+		*deadline	= node->deadline;
+	}
+	sjm_queue_remove(&(jobmanager->queue), node);
+	
+	return SJM_ERROR_OK;
+}
+
+sjm_error_t
+sjm_set_queue_policy(
+	sjm_t			*jobmanager,
+	sjm_queue_policy_t	*policy
+)
+{
+	sjm_queue_t		*queue;
+	sjm_queue_node_t	*node;
+	sjm_error_t		error;
+	
+	queue			= &(jobmanager->queue);
+	
+	/* Reserve room up front so that re-queueing under the new
+	   policy cannot fail part way through. */
+	if (NULL != policy->key)
+	{
+		error		= sjm_heap_reserve(
+					queue,
+					queue->length > queue->admission.max_depth ?
+					queue->length : queue->admission.max_depth
+				);
+		if (SJM_ERROR_OK != error)
+		{
+			return error;
+		}
+	}
+	
+	queue->heap_length	= 0;
+	queue->policy		= *policy;
+	for (node = queue->head; NULL != node; node = node->next)
+	{
+		queue->policy.push(queue, node);
+	}
+	
+	return SJM_ERROR_OK;
+}
+
+sjm_error_t
+sjm_cancel_queued_job(
+	sjm_t			*jobmanager,
+	sjm_job_handle_t	*handle
+)
+{
+	/* Nodes are never freed while the job manager is alive, so a
+	   stale handle can be checked safely. */
+	if (NULL == handle->node ||
+	    0 == handle->generation ||
+	    handle->node->generation != handle->generation)
+	{
+		return SJM_ERROR_NOT_QUEUED;
+	}
+	
+	sjm_queue_remove(&(jobmanager->queue), handle->node);
+	
+	return SJM_ERROR_OK;
+}
@@ -0,0 +1,185 @@
+/******************************************************************************/
+/**
+@file
+@author		Graeme Douglas
+@brief		The job manager's execution queue and its scheduling
+		policies.
+@details	Queued jobs are always kept on a doubly linked list in
+		arrival order, and in a hash index by name so they can be
+		cancelled without a search. Which job runs next is decided
+		by a pluggable scheduling policy (see
+		@ref sjm_queue_policy_t). The built-in policies are:
+		
+			FIFO:		Arrival order. O(1).
+			Priority:	Highest priority class first, with
+					aging so that low priority jobs are
+					not starved. O(log n).
+			EDF:		Earliest absolute deadline first;
+					jobs without a deadline run last, in
+					arrival order. O(log n).
+		
+		The priority and EDF policies share a 4-ary heap that
+		tracks each node's position, so cancelling a job from the
+		middle of the queue is also O(log n).
+*/
+/******************************************************************************/
+
+#ifndef JOB_QUEUE_H
+#define JOB_QUEUE_H
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+#include "jobmanager.h"
+
+/**
+@brief		The arity of the heap used by heap-based policies.
+*/
+#define SJM_QUEUE_HEAP_ARITY	4
+
+/**
+@brief		The default number of milliseconds of waiting worth one
+		priority class under priority scheduling.
+*/
+#define SJM_QUEUE_DEFAULT_AGING	10
+
+/**
+@brief		Initialize an empty queue with the FIFO policy.
+@param		queue
+			The queue to initialize.
+@returns	@c SJM_ERROR_OK on successes, an appropriate error code
+		otherwise.
+*/
+sjm_error_t
+sjm_queue_init(
+	sjm_queue_t		*queue
+);
+
+/**
+@brief		Free everything a queue holds.
+@param		queue
+			The queue to destroy. The pointer itself is not freed.
+*/
+void
+sjm_queue_delete(
+	sjm_queue_t		*queue
+);
+
+/**
+@brief		Fill in the first-in, first-out policy.
+@param		policy
+			The policy to fill in.
+*/
+void
+sjm_queue_fifo_init(
+	sjm_queue_policy_t	*policy
+);
+
+/**
+@brief		Fill in the priority policy.
+@details	A job's key is the time it was queued, pushed back by
+		@c aging milliseconds for every class its priority falls
+		short of @ref SJM_PRIORITY_MAX. Higher classes therefore run
+		first, but a job that has waited long enough will overtake
+		newer jobs of higher classes. The aging defaults to
+		@ref SJM_QUEUE_DEFAULT_AGING and may be changed after
+		initialization.
+@param		policy
+			The policy to fill in.
+*/
+void
+sjm_queue_priority_init(
+	sjm_queue_policy_t	*policy
+);
+
+/**
+@brief		Fill in the earliest-deadline-first policy.
+@details	Deadlines come from each job's @c relative_deadline.
+@param		policy
+			The policy to fill in.
+*/
+void
+sjm_queue_edf_init(
+	sjm_queue_policy_t	*policy
+);
+
+/**
+@brief		Fill in admission limits that admit everything.
+@param		admission
+			The limits to fill in.
+*/
+void
+sjm_admission_init(
+	sjm_admission_t		*admission
+);
+
+/**
+@brief		Add a job to the execution queue.
+@details	The job is subject to admission control. If it is rate
+		limited, its token bucket is updated in place; callers
+		should store the job back once it has been queued.
+@param		jobmanager
+			The jobmanager whose queue we wish to add the job
+			to.
+@param		job
+			The job to add to the queue.
+@param		name
+			The name for the job. It is copied into the queue node.
+@param		handle
+			If not @c NULL, set to a handle for the queued job.
+@returns	@c SJM_ERROR_OK on successes, @c SJM_ERROR_JOB_SHED if
+		admission control turned the job away, an appropriate error
+		code otherwise.
+*/
+sjm_error_t
+sjm_enqueue_job(
+	sjm_t			*jobmanager,
+	sensor_job_t		*job,
+	char			*name,
+	sjm_job_handle_t	*handle
+);
+
+/**
+@brief		Take the job that should run next off of the queue.
+@param		jobmanager
+			The jobmanager whose queue we wish to retrieve from.
+@param		job
+			A pointer to a job variable that can safely be written
+			to (it is already allocated).
+@param		name
+			A buffer of at least @c maximum_name_size+1 characters
+			that the job name is copied to.
+@param		deadline
+			If not @c NULL, set to the time by which the job
+			must start, or 0 if it has no deadline.
+@returns	@c SJM_ERROR_OK on successes, an appropriate error code
+		otherwise.
+*/
+sjm_error_t
+sjm_dequeue_next_job(
+	sjm_t		*jobmanager,
+	sensor_job_t	*job,
+	char		*name,
+	milliseconds_t	*deadline
+);
+
+/**
+@brief		Take a node out of the queue, its index and its policy,
+		and set it aside for reuse.
+@param		queue
+			The queue holding the node.
+@param		node
+			The queued node to remove.
+*/
+void
+sjm_queue_remove(
+	sjm_queue_t		*queue,
+	sjm_queue_node_t	*node
+);
+
+#ifdef  __cplusplus
+}
+#endif
+
+#endif
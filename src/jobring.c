@@ -0,0 +1,379 @@
+/******************************************************************************/
+/**
+@file
+@author		Graeme Douglas
+@details	For more information, see @ref jobring.h.
+*/
+/******************************************************************************/
+
+#include "jobring.h"
+#ifdef  SJM_RING_FD_SINK
+#include <errno.h>
+#include <sys/uio.h>
+#endif
+
+/**
+@brief		Round a number of bytes up to a whole number of headers,
+		keeping every record aligned.
+*/
+#define SJM_RING_ALIGN(bytes) \
+	(((bytes) + sizeof(sjm_ring_header_t) - 1) & ~((unsigned long)sizeof(sjm_ring_header_t) - 1))
+
+/**
+@brief		Load a ring position published by the other side.
+*/
+#define SJM_RING_LOAD(position)		__atomic_load_n(&(position), __ATOMIC_ACQUIRE)
+
+/**
+@brief		Publish a ring position to the other side.
+*/
+#define SJM_RING_STORE(position, value)	__atomic_store_n(&(position), (value), __ATOMIC_RELEASE)
+
+/**
+@brief		Get the header of the record at a ring position.
+*/
+#define SJM_RING_HEADER(ring, position) \
+	((sjm_ring_header_t *)((ring)->buffer + ((position) & ((ring)->size - 1))))
+
+sjm_error_t
+sjm_ring_init(
+	sjm_ring_t		*ring,
+	unsigned long		size,
+	sjm_ring_sink_t		*sink
+)
+{
+	unsigned long		actual;
+	
+	actual			= 2 * sizeof(sjm_ring_header_t);
+	while (actual < size)
+	{
+		actual		*= 2;
+	}
+	
+	ring->buffer		= malloc(actual);
+	if (NULL == ring->buffer)
+	{
+		return SJM_ERROR_MEMORY_ALLOCATION_FAILURE;
+	}
+	ring->size		= actual;
+	ring->head		= 0;
+	ring->tail		= 0;
+	ring->reserved		= 0;
+	ring->sink		= sink;
+	ring->dropped		= 0;
+	ring->records		= 0;
+	ring->bytes		= 0;
+	
+	return SJM_ERROR_OK;
+}
+
+void
+sjm_ring_delete(
+	sjm_ring_t		*ring
+)
+{
+	free(ring->buffer);
+	ring->buffer		= NULL;
+	ring->size		= 0;
+}
+
+void *
+sjm_ring_reserve(
+	sjm_ring_t		*ring,
+	unsigned int		length
+)
+{
+	unsigned long		head;
+	unsigned long		tail;
+	unsigned long		need;
+	unsigned long		skip;
+	
+	head			= ring->head;
+	tail			= SJM_RING_LOAD(ring->tail);
+	need			= SJM_RING_ALIGN(sizeof(sjm_ring_header_t) + length);
+	
+	/* Records do not wrap; skip whatever is left before the end if
+	   this one will not fit there. */
+	skip			= ring->size - (head & (ring->size - 1));
+	if (skip >= need)
+	{
+		skip		= 0;
+	}
+	
+	if (head + skip + need - tail > ring->size)
+	{
+		ring->dropped++;
+		return NULL;
+	}
+	
+	if (0 != skip)
+	{
+		SJM_RING_HEADER(ring, head)->length
+				= SJM_RING_PADDING | (unsigned int)skip;
+	}
+	ring->reserved		= head + skip;
+	
+	return SJM_RING_HEADER(ring, ring->reserved) + 1;
+}
+
+void
+sjm_ring_commit(
+	sjm_ring_t		*ring,
+	unsigned int		length
+)
+{
+	SJM_RING_HEADER(ring, ring->reserved)->length
+				= length;
+	
+	/* Publishes the padding, if any, along with the record. */
+	SJM_RING_STORE(
+		ring->head,
+		ring->reserved + SJM_RING_ALIGN(sizeof(sjm_ring_header_t) + length)
+	);
+}
+
+sjm_error_t
+sjm_ring_drain(
+	sjm_ring_t		*ring
+)
+{
+	sjm_ring_record_t	records[SJM_RING_DRAIN_BATCH];
+	sjm_ring_header_t	*header;
+	sjm_error_t		error;
+	unsigned long		head;
+	unsigned long		tail;
+	unsigned long		bytes;
+	int			count;
+	
+	error			= SJM_ERROR_OK;
+	tail			= ring->tail;
+	head			= SJM_RING_LOAD(ring->head);
+	while (tail != head)
+	{
+		count		= 0;
+		bytes		= 0;
+		while (tail != head && count < SJM_RING_DRAIN_BATCH)
+		{
+			header	= SJM_RING_HEADER(ring, tail);
+			if (header->length & SJM_RING_PADDING)
+			{
+				tail	+= header->length & ~SJM_RING_PADDING;
+				continue;
+			}
+			
+			records[count].data	= header + 1;
+			records[count].length	= header->length;
+			bytes			+= header->length;
+			count++;
+			tail	+= SJM_RING_ALIGN(sizeof(sjm_ring_header_t) + header->length);
+		}
+		
+		if (0 < count)
+		{
+			error	= ring->sink->write(ring->sink, records, count);
+			if (SJM_ERROR_OK != error)
+			{
+				break;
+			}
+			ring->records	+= count;
+			ring->bytes	+= bytes;
+		}
+		
+		/* Hand the space back to the producer. */
+		SJM_RING_STORE(ring->tail, tail);
+		head		= SJM_RING_LOAD(ring->head);
+	}
+	
+	if (NULL != ring->sink->flush)
+	{
+		if (SJM_ERROR_OK == error)
+		{
+			error	= ring->sink->flush(ring->sink);
+		}
+		else
+		{
+			ring->sink->flush(ring->sink);
+		}
+	}
+	
+	return error;
+}
+
+/**
+@brief		File sink write: each record's data, through the file's
+		buffer.
+*/
+static sjm_error_t
+sjm_ring_file_write(
+	sjm_ring_sink_t		*sink,
+	sjm_ring_record_t	*records,
+	int			count
+)
+{
+	int			i;
+	
+	for (i = 0; i < count; i++)
+	{
+		if (1 != fwrite(records[i].data, records[i].length, 1, sink->file) &&
+		    0 != records[i].length)
+		{
+			return SJM_ERROR_SINK_WRITE;
+		}
+	}
+	
+	return SJM_ERROR_OK;
+}
+
+/**
+@brief		File sink flush.
+*/
+static sjm_error_t
+sjm_ring_file_flush(
+	sjm_ring_sink_t		*sink
+)
+{
+	if (0 != fflush(sink->file))
+	{
+		return SJM_ERROR_SINK_WRITE;
+	}
+	
+	return SJM_ERROR_OK;
+}
+
+void
+sjm_ring_file_sink_init(
+	sjm_ring_sink_t		*sink,
+	FILE			*file
+)
+{
+	memset(sink, 0, sizeof(sjm_ring_sink_t));
+	sink->write		= sjm_ring_file_write;
+	sink->flush		= sjm_ring_file_flush;
+	sink->file		= file;
+	sink->fd		= -1;
+}
+
+#ifdef  SJM_RING_FD_SINK
+/**
+@brief		Descriptor sink write: the whole batch with one
+		@c writev, continuing after partial writes.
+*/
+static sjm_error_t
+sjm_ring_fd_write(
+	sjm_ring_sink_t		*sink,
+	sjm_ring_record_t	*records,
+	int			count
+)
+{
+	struct iovec		iov[SJM_RING_DRAIN_BATCH];
+	struct iovec		*next;
+	ssize_t			written;
+	int			left;
+	int			i;
+	
+	for (i = 0; i < count; i++)
+	{
+		iov[i].iov_base	= records[i].data;
+		iov[i].iov_len	= records[i].length;
+	}
+	
+	next			= iov;
+	left			= count;
+	while (0 < left)
+	{
+		written		= writev(sink->fd, next, left);
+		if (0 > written)
+		{
+			if (EINTR == errno)
+			{
+				continue;
+			}
+			return SJM_ERROR_SINK_WRITE;
+		}
+		
+		while (0 < left && (size_t)written >= next->iov_len)
+		{
+			written	-= next->iov_len;
+			next++;
+			left--;
+		}
+		if (0 < left)
+		{
+			next->iov_base	= (char *)next->iov_base + written;
+			next->iov_len	-= written;
+		}
+	}
+	
+	return SJM_ERROR_OK;
+}
+
+void
+sjm_ring_fd_sink_init(
+	sjm_ring_sink_t		*sink,
+	int			fd
+)
+{
+	memset(sink, 0, sizeof(sjm_ring_sink_t));
+	sink->write		= sjm_ring_fd_write;
+	sink->flush		= NULL;
+	sink->fd		= fd;
+}
+#endif
+
+/**
+@brief		Dictionary sink write: one insert per record, under
+		consecutive keys.
+*/
+static sjm_error_t
+sjm_ring_dictionary_write(
+	sjm_ring_sink_t		*sink,
+	sjm_ring_record_t	*records,
+	int			count
+)
+{
+	err_t			ion_error;
+	int			value_size;
+	char			value[sink->dictionary->instance->record.value_size];
+	unsigned int		length;
+	int			i;
+	
+	value_size		= sink->dictionary->instance->record.value_size;
+	for (i = 0; i < count; i++)
+	{
+		length		= records[i].length;
+		if (length > (unsigned int)value_size)
+		{
+			length	= value_size;
+		}
+		memcpy(value, records[i].data, length);
+		memset(value + length, 0, value_size - length);
+		
+		ion_error	= dictionary_insert(
+					sink->dictionary,
+					(ion_key_t)&(sink->sequence),
+					(ion_value_t)value
+				);
+		if (err_ok != ion_error)
+		{
+			return SJM_ERROR_SINK_WRITE;
+		}
+		sink->sequence++;
+	}
+	
+	return SJM_ERROR_OK;
+}
+
+void
+sjm_ring_dictionary_sink_init(
+	sjm_ring_sink_t		*sink,
+	dictionary_t		*dictionary,
+	unsigned long		first_key
+)
+{
+	memset(sink, 0, sizeof(sjm_ring_sink_t));
+	sink->write		= sjm_ring_dictionary_write;
+	sink->flush		= NULL;
+	sink->fd		= -1;
+	sink->dictionary	= dictionary;
+	sink->sequence		= first_key;
+}
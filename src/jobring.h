@@ -0,0 +1,239 @@
+/******************************************************************************/
+/**
+@file
+@author		Graeme Douglas
+@brief		Lock-free output rings for job results.
+@details	Jobs other than direct calls have nowhere to put their
+		output: scheduled jobs are called with @c NULL parameters
+		and return pointer. An output ring gives them somewhere.
+		A job reserves space for a record directly in the ring,
+		fills it in place, and commits it; nothing is copied. A
+		sink (a file, a file descriptor such as a socket, or an
+		IonDB dictionary) later drains every committed record in a
+		few large batches rather than one write per record.
+		
+		A ring has exactly one producer and one consumer, which may
+		be different threads; no locks are taken. A job manager can
+		have a shared ring, and any job can have its own; a running
+		job finds the right one with @ref sjm_current_output.
+		
+		Records never wrap around the end of the ring. If a record
+		does not fit in the space left before the end, that space
+		is skipped with a padding record.
+*/
+/******************************************************************************/
+
+#ifndef JOB_RING_H
+#define JOB_RING_H
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include "jobmanager.h"
+
+/**
+@brief		Defined if rings can drain to file descriptors.
+*/
+#if MILLISEC_PLATFORM != MILLISEC_PLATFORM_AVR
+#define SJM_RING_FD_SINK
+#endif
+
+/**
+@brief		The most records handed to a sink in one call.
+*/
+#define SJM_RING_DRAIN_BATCH	64
+
+/**
+@brief		Record header. Padded so that every record's data is
+		suitably aligned for any type.
+*/
+typedef union sjm_ring_header
+{
+	unsigned int		length;	/**< Bytes of data, or bytes to skip
+					     if @ref SJM_RING_PADDING is set.
+					*/
+	double			align_double;
+	void			*align_pointer;
+} sjm_ring_header_t;
+
+/**
+@brief		Flag marking a padding record.
+*/
+#define SJM_RING_PADDING	(1U << (sizeof(unsigned int)*8-1))
+
+/**
+@brief		A committed record, as handed to a sink.
+*/
+typedef struct sjm_ring_record
+{
+	void			*data;	/**< The record's data, in the ring.
+					*/
+	unsigned int		length;	/**< Bytes of data. */
+} sjm_ring_record_t;
+
+typedef struct sjm_ring_sink sjm_ring_sink_t;
+
+/**
+@brief		Somewhere to drain a ring to.
+@details	Fill in with one of the sink initialization functions, in
+		the same way as dictionary handlers.
+*/
+struct sjm_ring_sink
+{
+	sjm_error_t		(*write)(sjm_ring_sink_t *sink, sjm_ring_record_t *records, int count);
+					/**< Consume a batch of records. The
+					     records are only valid for the
+					     duration of the call. */
+	sjm_error_t		(*flush)(sjm_ring_sink_t *sink);
+					/**< Called once a drain is done. */
+	FILE			*file;	/**< File sinks: the file. */
+	int			fd;	/**< Descriptor sinks: the file
+					     descriptor. */
+	dictionary_t		*dictionary;
+					/**< Dictionary sinks: the
+					     dictionary. */
+	unsigned long		sequence;
+					/**< Dictionary sinks: key of the next
+					     record. */
+};
+
+/**
+@brief		A single-producer, single-consumer output ring.
+*/
+struct sjm_ring
+{
+	unsigned char		*buffer;	/**< The ring's storage. */
+	unsigned long		size;		/**< Bytes of storage, a power
+						     of two. */
+	unsigned long		head;		/**< Where the producer has
+						     committed up to. */
+	unsigned long		tail;		/**< Where the consumer has
+						     drained up to. */
+	unsigned long		reserved;	/**< Producer only: where the
+						     reserved record begins. */
+	sjm_ring_sink_t		*sink;		/**< Where to drain to. */
+	unsigned long		dropped;	/**< Reservations refused
+						     for lack of space. */
+	unsigned long		records;	/**< Records drained. */
+	unsigned long		bytes;		/**< Bytes of data drained. */
+};
+
+/**
+@brief		Initialize an output ring.
+@param		ring
+			The ring to initialize.
+@param		size
+			Bytes of storage. Rounded up to a power of two.
+@param		sink
+			Where to drain to. Not copied; it must outlive the
+			ring.
+@returns	@c SJM_ERROR_OK on successes, an appropriate error code
+		otherwise.
+*/
+sjm_error_t
+sjm_ring_init(
+	sjm_ring_t		*ring,
+	unsigned long		size,
+	sjm_ring_sink_t		*sink
+);
+
+/**
+@brief		Free a ring's storage. Undrained records are lost.
+@param		ring
+			The ring to destroy. The pointer itself is not freed.
+*/
+void
+sjm_ring_delete(
+	sjm_ring_t		*ring
+);
+
+/**
+@brief		Reserve space for a record. Producer only.
+@details	At most one record may be reserved at a time.
+@param		ring
+			The ring to reserve in.
+@param		length
+			The most bytes the record will need.
+@returns	Where to write the record, or @c NULL if there is no room
+		(in which case the ring's @c dropped count goes up).
+*/
+void *
+sjm_ring_reserve(
+	sjm_ring_t		*ring,
+	unsigned int		length
+);
+
+/**
+@brief		Commit the reserved record, making it visible to the
+		consumer. Producer only.
+@param		ring
+			The ring the record was reserved in.
+@param		length
+			The bytes actually used, no more than were reserved.
+*/
+void
+sjm_ring_commit(
+	sjm_ring_t		*ring,
+	unsigned int		length
+);
+
+/**
+@brief		Hand every committed record to the ring's sink, in
+		batches of up to @ref SJM_RING_DRAIN_BATCH. Consumer only.
+@param		ring
+			The ring to drain.
+@returns	@c SJM_ERROR_OK on successes, an appropriate error code
+		otherwise. Records in a batch the sink failed on stay in
+		the ring.
+*/
+sjm_error_t
+sjm_ring_drain(
+	sjm_ring_t		*ring
+);
+
+/**
+@brief		Fill in a sink writing each record's data to a file.
+@details	Records are written through the file's buffer, and the file
+		is flushed once per drain. Give the file a large buffer
+		with @c setvbuf for the fewest writes.
+*/
+void
+sjm_ring_file_sink_init(
+	sjm_ring_sink_t		*sink,
+	FILE			*file
+);
+
+#ifdef  SJM_RING_FD_SINK
+/**
+@brief		Fill in a sink writing each record's data to a file
+		descriptor, such as a socket, with one @c writev per batch.
+*/
+void
+sjm_ring_fd_sink_init(
+	sjm_ring_sink_t		*sink,
+	int			fd
+);
+#endif
+
+/**
+@brief		Fill in a sink inserting each record into an IonDB
+		dictionary.
+@details	Keys are consecutive unsigned numbers starting at
+		@p first_key, so the dictionary must have unsigned numeric
+		keys of @c sizeof(unsigned long) bytes. Records are
+		truncated or zero padded to the dictionary's value size.
+*/
+void
+sjm_ring_dictionary_sink_init(
+	sjm_ring_sink_t		*sink,
+	dictionary_t		*dictionary,
+	unsigned long		first_key
+);
+
+#ifdef  __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,485 @@
+/******************************************************************************/
+/**
+@file
+@author		Graeme Douglas
+@details	For more information, see @ref jobserver.h.
+*/
+/******************************************************************************/
+
+#ifdef  __linux__
+#define _GNU_SOURCE
+#endif
+#include "jobserver.h"
+
+#ifdef  SJM_SERVER
+#include <errno.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+/**
+@brief		Responses are only started while a connection's output
+		is at most this full, leaving room for one more.
+*/
+#define SJM_SERVER_OUTPUT_LOW	(SJM_SERVER_OUTPUT_SIZE / 2)
+
+/**
+@brief		Set up everything common to every kind of server around
+		a bound socket.
+@param		server
+			The server to initialize.
+@param		jobmanager
+			The job manager to perform requests with.
+@param		fd
+			The bound, non-blocking socket. It is closed on
+			failure.
+@param		max_connections
+			The most clients served at once.
+@returns	@c SJM_ERROR_OK on successes, an appropriate error code
+		otherwise.
+*/
+static sjm_error_t
+sjm_server_start(
+	sjm_server_t		*server,
+	sjm_t			*jobmanager,
+	int			fd,
+	int			max_connections
+)
+{
+	struct epoll_event	event;
+	int			i;
+	
+	server->jobmanager	= jobmanager;
+	server->listen_fd	= fd;
+	server->max_connections	= max_connections;
+	server->requests	= 0;
+	server->epoll_fd	= -1;
+	server->connections	= malloc(sizeof(sjm_server_connection_t) * max_connections);
+	if (NULL == server->connections)
+	{
+		close(fd);
+		return SJM_ERROR_MEMORY_ALLOCATION_FAILURE;
+	}
+	for (i = 0; i < max_connections; i++)
+	{
+		server->connections[i].fd
+				= -1;
+	}
+	
+	server->epoll_fd	= epoll_create1(EPOLL_CLOEXEC);
+	if (0 > server->epoll_fd || 0 > listen(fd, SOMAXCONN))
+	{
+		sjm_server_close(server);
+		return SJM_ERROR_SOCKET;
+	}
+	
+	/* The listening socket is the only one without a connection. */
+	event.events		= EPOLLIN;
+	event.data.ptr		= NULL;
+	if (0 > epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, fd, &event))
+	{
+		sjm_server_close(server);
+		return SJM_ERROR_SOCKET;
+	}
+	
+	return SJM_ERROR_OK;
+}
+
+sjm_error_t
+sjm_server_listen_unix(
+	sjm_server_t		*server,
+	sjm_t			*jobmanager,
+	char			*path,
+	int			max_connections
+)
+{
+	struct sockaddr_un	address;
+	int			fd;
+	
+	server->path		= NULL;
+	server->port		= 0;
+	if (strlen(path) >= sizeof(address.sun_path))
+	{
+		return SJM_ERROR_SOCKET;
+	}
+	
+	memset(&address, 0, sizeof(address));
+	address.sun_family	= AF_UNIX;
+	strcpy(address.sun_path, path);
+	
+	fd			= socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (0 > fd)
+	{
+		return SJM_ERROR_SOCKET;
+	}
+	unlink(path);
+	if (0 > bind(fd, (struct sockaddr *)&address, sizeof(address)))
+	{
+		close(fd);
+		return SJM_ERROR_SOCKET;
+	}
+	server->path		= path;
+	
+	return sjm_server_start(server, jobmanager, fd, max_connections);
+}
+
+sjm_error_t
+sjm_server_listen_tcp(
+	sjm_server_t		*server,
+	sjm_t			*jobmanager,
+	int			port,
+	int			max_connections
+)
+{
+	struct sockaddr_in	address;
+	socklen_t		length;
+	int			fd;
+	int			on;
+	
+	server->path		= NULL;
+	server->port		= 0;
+	
+	memset(&address, 0, sizeof(address));
+	address.sin_family	= AF_INET;
+	address.sin_port	= htons((unsigned short)port);
+	address.sin_addr.s_addr	= htonl(INADDR_LOOPBACK);
+	
+	fd			= socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (0 > fd)
+	{
+		return SJM_ERROR_SOCKET;
+	}
+	on			= 1;
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+	length			= sizeof(address);
+	if (	0 > bind(fd, (struct sockaddr *)&address, sizeof(address)) ||
+		0 > getsockname(fd, (struct sockaddr *)&address, &length))
+	{
+		close(fd);
+		return SJM_ERROR_SOCKET;
+	}
+	server->port		= ntohs(address.sin_port);
+	
+	return sjm_server_start(server, jobmanager, fd, max_connections);
+}
+
+/**
+@brief		Disconnect a client, freeing its connection.
+*/
+static void
+sjm_server_disconnect(
+	sjm_server_t		*server,
+	sjm_server_connection_t	*connection
+)
+{
+	epoll_ctl(server->epoll_fd, EPOLL_CTL_DEL, connection->fd, NULL);
+	close(connection->fd);
+	connection->fd		= -1;
+}
+
+/**
+@brief		Accept every waiting client.
+*/
+static void
+sjm_server_accept(
+	sjm_server_t		*server
+)
+{
+	sjm_server_connection_t	*connection;
+	struct epoll_event	event;
+	int			fd;
+	int			on;
+	int			i;
+	
+	while (0 <= (fd = accept4(server->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)))
+	{
+		connection	= NULL;
+		for (i = 0; i < server->max_connections; i++)
+		{
+			if (-1 == server->connections[i].fd)
+			{
+				connection
+					= &server->connections[i];
+				break;
+			}
+		}
+	
+		if (NULL == connection)
+		{
+			close(fd);
+			continue;
+		}
+	
+		/* Responses are already batched; don't hold them back
+		   any further. */
+		if (0 != server->port)
+		{
+			on	= 1;
+			setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+		}
+	
+		connection->fd	= fd;
+		connection->events
+				= EPOLLIN;
+		connection->input_length
+				= 0;
+		sjm_json_init(&connection->writer, connection->output, SJM_SERVER_OUTPUT_SIZE, NULL, NULL);
+	
+		event.events	= EPOLLIN;
+		event.data.ptr	= connection;
+		if (0 > epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, fd, &event))
+		{
+			close(fd);
+			connection->fd
+				= -1;
+		}
+	}
+}
+
+/**
+@brief		Perform every whole request received, while there is room
+		for the responses.
+@param		server
+			The server.
+@param		connection
+			The client's connection.
+@returns	@c true if the client is still in good standing, @c false
+		if it must be disconnected.
+*/
+static sjm_bool_t
+sjm_server_serve(
+	sjm_server_t		*server,
+	sjm_server_connection_t	*connection
+)
+{
+	sjm_json_writer_t	*writer;
+	char			*line;
+	char			*end;
+	char			*newline;
+	
+	writer			= &connection->writer;
+	line			= connection->input;
+	end			= connection->input + connection->input_length;
+	while (	writer->length <= SJM_SERVER_OUTPUT_LOW &&
+		NULL != (newline = memchr(line, '\n', end - line)))
+	{
+		*newline	= '\0';
+		if (newline > line && '\r' == newline[-1])
+		{
+			newline[-1]
+				= '\0';
+		}
+	
+		if ('\0' != *line)
+		{
+			sjm_respond_job(server->jobmanager, line, writer);
+	
+			/* End every response with a newline of its own,
+			   rather than only between responses. */
+			if (SJM_ERROR_OK != writer->error || writer->length == writer->size)
+			{
+				return false;
+			}
+			writer->buffer[writer->length++]
+				= '\n';
+			writer->count[0]
+				= 0;
+			server->requests++;
+		}
+	
+		line		= newline + 1;
+	}
+	
+	connection->input_length
+				= end - line;
+	memmove(connection->input, line, connection->input_length);
+	
+	/* A full buffer without a whole request never will have one. */
+	return	connection->input_length < SJM_SERVER_INPUT_SIZE ||
+		NULL != memchr(connection->input, '\n', connection->input_length);
+}
+
+/**
+@brief		Send as many waiting responses as the client will take, in
+		one call.
+@returns	@c true if the client is still in good standing, @c false
+		if it must be disconnected.
+*/
+static sjm_bool_t
+sjm_server_send(
+	sjm_server_connection_t	*connection
+)
+{
+	sjm_json_writer_t	*writer;
+	ssize_t			sent;
+	
+	writer			= &connection->writer;
+	if (0 == writer->length)
+	{
+		return true;
+	}
+	
+	sent			= send(connection->fd, writer->buffer, writer->length, MSG_NOSIGNAL);
+	if (0 > sent)
+	{
+		return EAGAIN == errno || EWOULDBLOCK == errno || EINTR == errno;
+	}
+	
+	writer->length		-= sent;
+	memmove(writer->buffer, writer->buffer + sent, writer->length);
+	
+	return true;
+}
+
+/**
+@brief		Serve a client that is ready.
+@param		server
+			The server.
+@param		connection
+			The client's connection.
+@param		events
+			The events the client is ready for.
+*/
+static void
+sjm_server_handle(
+	sjm_server_t		*server,
+	sjm_server_connection_t	*connection,
+	unsigned int		events
+)
+{
+	struct epoll_event	event;
+	ssize_t			received;
+	sjm_bool_t		closed;
+	
+	closed			= false;
+	if (	(events & (EPOLLIN | EPOLLHUP | EPOLLERR)) &&
+		connection->input_length < SJM_SERVER_INPUT_SIZE)
+	{
+		received	= recv(
+					connection->fd,
+					connection->input + connection->input_length,
+					SJM_SERVER_INPUT_SIZE - connection->input_length,
+					0
+				);
+		if (0 < received)
+		{
+			connection->input_length
+				+= received;
+		}
+		else if (0 == received || (EAGAIN != errno && EWOULDBLOCK != errno && EINTR != errno))
+		{
+			closed	= true;
+		}
+	}
+	
+	/* Sending may make room for responses to requests held back
+	   earlier, so keep going until neither can go further. */
+	do
+	{
+		if (!sjm_server_serve(server, connection) || !sjm_server_send(connection))
+		{
+			sjm_server_disconnect(server, connection);
+			return;
+		}
+	} while (	connection->writer.length <= SJM_SERVER_OUTPUT_LOW &&
+			NULL != memchr(connection->input, '\n', connection->input_length));
+	
+	if (closed)
+	{
+		sjm_server_disconnect(server, connection);
+		return;
+	}
+	
+	/* Stop reading from clients that aren't reading their
+	   responses. */
+	event.events		= 0;
+	if (	connection->writer.length <= SJM_SERVER_OUTPUT_LOW &&
+		connection->input_length < SJM_SERVER_INPUT_SIZE)
+	{
+		event.events	|= EPOLLIN;
+	}
+	if (0 < connection->writer.length)
+	{
+		event.events	|= EPOLLOUT;
+	}
+	if (event.events != connection->events)
+	{
+		event.data.ptr	= connection;
+		epoll_ctl(server->epoll_fd, EPOLL_CTL_MOD, connection->fd, &event);
+		connection->events
+				= event.events;
+	}
+}
+
+sjm_error_t
+sjm_server_poll(
+	sjm_server_t		*server,
+	int			timeout
+)
+{
+	struct epoll_event	events[SJM_SERVER_EVENTS_MAX];
+	int			count;
+	int			i;
+	
+	count			= epoll_wait(server->epoll_fd, events, SJM_SERVER_EVENTS_MAX, timeout);
+	if (0 > count)
+	{
+		return (EINTR == errno) ? SJM_ERROR_OK : SJM_ERROR_SOCKET;
+	}
+	
+	for (i = 0; i < count; i++)
+	{
+		if (NULL == events[i].data.ptr)
+		{
+			sjm_server_accept(server);
+		}
+		else
+		{
+			sjm_server_handle(server, events[i].data.ptr, events[i].events);
+		}
+	}
+	
+	return SJM_ERROR_OK;
+}
+
+void
+sjm_server_close(
+	sjm_server_t		*server
+)
+{
+	int			i;
+	
+	for (i = 0; i < server->max_connections; i++)
+	{
+		if (-1 != server->connections[i].fd)
+		{
+			close(server->connections[i].fd);
+		}
+	}
+	free(server->connections);
+	server->connections	= NULL;
+	server->max_connections	= 0;
+	
+	if (0 <= server->epoll_fd)
+	{
+		close(server->epoll_fd);
+		server->epoll_fd
+				= -1;
+	}
+	if (0 <= server->listen_fd)
+	{
+		close(server->listen_fd);
+		server->listen_fd
+				= -1;
+	}
+	if (NULL != server->path)
+	{
+		unlink(server->path);
+		server->path	= NULL;
+	}
+}
+#endif
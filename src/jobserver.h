@@ -0,0 +1,185 @@
+/******************************************************************************/
+/**
+@file
+@author		Graeme Douglas
+@brief		A request server for local sockets.
+@details	Listens on a Unix domain socket or a TCP loopback port and
+		serves many clients at once from one thread, using
+		@c epoll. Each request is one line of JSON, as accepted by
+		@ref sjm_request_job, and each response is one line, as
+		written by @ref sjm_respond_job.
+		
+		Clients may pipeline requests, sending many without waiting
+		for responses. Whatever arrives is parsed a whole line at a
+		time, with partial lines kept until the rest comes. Every
+		response to one batch of input is written to the client in
+		a single call.
+		
+		A client that sends requests faster than it reads responses
+		is not read from until its responses drain. A client that
+		sends a line longer than @ref SJM_SERVER_INPUT_SIZE, or whose
+		response does not fit in half of
+		@ref SJM_SERVER_OUTPUT_SIZE, is disconnected.
+*/
+/******************************************************************************/
+
+#ifndef JOB_SERVER_H
+#define JOB_SERVER_H
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+#include "jobjson.h"
+
+/**
+@brief		Defined if the request server is available.
+*/
+#if defined(__linux__) && defined(SJM_JSON_HANDLING)
+#define SJM_SERVER
+#endif
+
+#ifdef  SJM_SERVER
+
+/**
+@brief		Bytes of requests buffered per connection.
+*/
+#define SJM_SERVER_INPUT_SIZE	4096
+
+/**
+@brief		Bytes of responses buffered per connection.
+*/
+#define SJM_SERVER_OUTPUT_SIZE	8192
+
+/**
+@brief		The most readiness events handled per poll.
+*/
+#define SJM_SERVER_EVENTS_MAX	64
+
+/**
+@brief		One client connection.
+*/
+typedef struct sjm_server_connection
+{
+	int			fd;	/**< The client's socket, or -1 if
+					     this connection is free. */
+	unsigned int		events;	/**< Events being waited for. */
+	int			input_length;
+					/**< Bytes in @c input. */
+	sjm_json_writer_t	writer;	/**< Writes responses to
+					     @c output. */
+	char			input[SJM_SERVER_INPUT_SIZE];
+					/**< Requests received, possibly
+					     ending in a partial one. */
+	char			output[SJM_SERVER_OUTPUT_SIZE];
+					/**< Responses not yet sent. */
+} sjm_server_connection_t;
+
+/**
+@brief		A request server.
+*/
+typedef struct sjm_server
+{
+	sjm_t			*jobmanager;
+					/**< Performs the requested jobs. */
+	int			listen_fd;
+					/**< The listening socket. */
+	int			epoll_fd;
+					/**< The @c epoll instance. */
+	int			port;	/**< The TCP port listened on, or 0
+					     for a Unix domain socket. */
+	char			*path;	/**< The Unix domain socket's path,
+					     removed on close, or @c NULL. */
+	sjm_server_connection_t	*connections;
+					/**< Every connection, in use or
+					     not. */
+	int			max_connections;
+					/**< Size of @c connections. */
+	unsigned long		requests;
+					/**< Requests served so far. */
+} sjm_server_t;
+
+/**
+@brief		Start a server on a Unix domain socket.
+@param		server
+			The server to initialize. This must already be
+			allocated.
+@param		jobmanager
+			The job manager to perform requests with.
+@param		path
+			The socket's path. Anything already there is
+			replaced. The string must outlive the server.
+@param		max_connections
+			The most clients served at once. Clients beyond
+			this are disconnected as soon as they connect.
+@returns	@c SJM_ERROR_OK on successes, an appropriate error code
+		otherwise.
+*/
+sjm_error_t
+sjm_server_listen_unix(
+	sjm_server_t		*server,
+	sjm_t			*jobmanager,
+	char			*path,
+	int			max_connections
+);
+
+/**
+@brief		Start a server on a TCP loopback port.
+@param		server
+			The server to initialize. This must already be
+			allocated.
+@param		jobmanager
+			The job manager to perform requests with.
+@param		port
+			The port, or 0 for any free port. The port chosen
+			is left in the server's @c port.
+@param		max_connections
+			The most clients served at once.
+@returns	@c SJM_ERROR_OK on successes, an appropriate error code
+		otherwise.
+*/
+sjm_error_t
+sjm_server_listen_tcp(
+	sjm_server_t		*server,
+	sjm_t			*jobmanager,
+	int			port,
+	int			max_connections
+);
+
+/**
+@brief		Wait for clients, and serve whatever is ready.
+@details	Accepts new clients, performs every whole request
+		received, and sends responses, then returns. Call this in
+		a loop.
+@param		server
+			The server.
+@param		timeout
+			The most milliseconds to wait for anything to be
+			ready, or -1 to wait indefinitely.
+@returns	@c SJM_ERROR_OK on successes, an appropriate error code
+		otherwise. Problems with a single client only disconnect
+		that client.
+*/
+sjm_error_t
+sjm_server_poll(
+	sjm_server_t		*server,
+	int			timeout
+);
+
+/**
+@brief		Stop a server, disconnecting every client.
+@param		server
+			The server to stop.
+*/
+void
+sjm_server_close(
+	sjm_server_t		*server
+);
+
+#endif
+
+#ifdef  __cplusplus
+}
+#endif
+
+#endif
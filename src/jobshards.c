@@ -0,0 +1,934 @@
+/******************************************************************************/
+/**
+@file
+@author		Graeme Douglas
+@details	For more information, see @ref jobshards.h.
+*/
+/******************************************************************************/
+
+#ifdef  __linux__
+#define _GNU_SOURCE
+#include <sched.h>
+#endif
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include "jobshards.h"
+
+/**
+@brief		Collect all jobs of a shard's job manager into a listing.
+@param		jobmanager
+			The job manager to list.
+@param		request
+			The request whose @c listings and @c count are to be
+			set. The listing array and every name in it are
+			heap allocated and must be freed by the submitter.
+@returns	@c SJM_ERROR_OK on successes, an appropriate error code
+		otherwise.
+*/
+static sjm_error_t
+sjm_shards_collect(
+	sjm_t			*jobmanager,
+	sjm_shard_request_t	*request
+)
+{
+	dict_cursor_t		*cursor;
+	predicate_t		predicate;
+	ion_record_t		record;
+	int			capacity;
+	sjm_shard_listing_t	*grown;
+	int			key_size;
+	char			keydata[jobmanager->dictionary.instance->record.key_size];
+	char			valuedata[jobmanager->dictionary.instance->record.value_size];
+	
+	key_size		= jobmanager->dictionary.instance->record.key_size;
+	record.key		= (void *)keydata;
+	record.value		= (void *)valuedata;
+	request->listings	= NULL;
+	request->count		= 0;
+	capacity		= 0;
+	
+	cursor			= NULL;
+	dictionary_build_predicate(&predicate, predicate_all_records);
+	if (err_ok != dictionary_find(&(jobmanager->dictionary), &predicate, &cursor))
+	{
+		return SJM_ERROR_DICT_GET_FAILURE;
+	}
+	
+	while (cs_end_of_results != cursor->next(cursor, &record))
+	{
+		if (request->count == capacity)
+		{
+			capacity	= (0 == capacity) ? 16 : capacity * 2;
+			grown		= realloc(
+						request->listings,
+						capacity * sizeof(sjm_shard_listing_t)
+					);
+			if (NULL == grown)
+			{
+				cursor->destroy(&cursor);
+				return SJM_ERROR_MEMORY_ALLOCATION_FAILURE;
+			}
+			request->listings
+					= grown;
+		}
+	
+		request->listings[request->count].name
+					= malloc(key_size+1);
+		if (NULL == request->listings[request->count].name)
+		{
+			cursor->destroy(&cursor);
+			return SJM_ERROR_MEMORY_ALLOCATION_FAILURE;
+		}
+		memcpy(request->listings[request->count].name, keydata, key_size);
+		request->listings[request->count].name[key_size]
+					= '\0';
+		memcpy(
+			&(request->listings[request->count].job),
+			valuedata,
+			sizeof(sensor_job_t)
+		);
+		request->count++;
+	}
+	cursor->destroy(&cursor);
+	
+	return SJM_ERROR_OK;
+}
+
+/**
+@brief		Service a single request on its shard's worker thread.
+*/
+static void
+sjm_shards_service(
+	sjm_shard_t		*shard,
+	sjm_shard_request_t	*request
+)
+{
+	sjm_t			*jobmanager;
+	sjm_error_t		error;
+	int			i;
+	
+	jobmanager		= &(shard->jobmanager);
+	
+	switch (request->type)
+	{
+	 case SJM_SHARD_REQUEST_ADD:
+		request->error	= sjm_add_job(
+					jobmanager,
+					request->name,
+					request->job
+				);
+		break;
+	 case SJM_SHARD_REQUEST_BULK_ADD:
+		request->error	= SJM_ERROR_OK;
+		for (i = 0; i < request->count; i++)
+		{
+			error	= sjm_add_job(
+					jobmanager,
+					request->names[request->indices[i]],
+					request->jobs+request->indices[i]
+				);
+			if (SJM_ERROR_OK != error && SJM_ERROR_OK == request->error)
+			{
+				request->error
+					= error;
+			}
+		}
+		break;
+	 case SJM_SHARD_REQUEST_PERFORM:
+		request->error	= sjm_perform_job(
+					jobmanager,
+					request->name,
+					request->params,
+					request->retval
+				);
+		break;
+#ifdef  SJM_JSON_HANDLING
+	 case SJM_SHARD_REQUEST_JSON:
+		request->error	= sjm_request_job(
+					jobmanager,
+					request->json,
+					request->retval
+				);
+		break;
+#endif
+	 case SJM_SHARD_REQUEST_LIST:
+		request->error	= sjm_shards_collect(jobmanager, request);
+		break;
+	}
+}
+
+/**
+@brief		Run a scheduling pass on a shard: queue any jobs due for
+		execution, drain the queue, and resume in-flight jobs.
+*/
+static void
+sjm_shards_schedule(
+	sjm_shard_t		*shard
+)
+{
+	sjm_t			*jobmanager;
+	
+	jobmanager		= &(shard->jobmanager);
+	
+	sjm_queue_scheduled_jobs(jobmanager);
+	sjm_execute_queued_jobs(jobmanager);
+	sjm_resume_jobs(jobmanager);
+}
+
+/**
+@brief		Find when a shard's in-flight jobs should next be resumed.
+@details	That is the earliest time one of them sleeps until, or
+		@ref SJM_SHARDS_RESUME_INTERVAL from @p now for those
+		waiting on a file descriptor, which cannot wake the worker.
+		Jobs that just yielded are resumed at once.
+@param		shard
+			The shard whose jobs to look at.
+@param		now
+			The current time.
+@param		resume_time
+			Set to the time to resume at.
+@returns	Whether any job is in flight.
+*/
+static sjm_bool_t
+sjm_shards_resume_time(
+	sjm_shard_t		*shard,
+	milliseconds_t		now,
+	milliseconds_t		*resume_time
+)
+{
+	sjm_continuation_t	*continuation;
+	milliseconds_t		wake_time;
+	
+	continuation		= shard->jobmanager.in_flight;
+	if (NULL == continuation)
+	{
+		return false;
+	}
+	
+	*resume_time		= now + SJM_SHARDS_RESUME_INTERVAL;
+	for (; NULL != continuation; continuation = continuation->next)
+	{
+		wake_time	= continuation->wake_time;
+		if (-1 == continuation->wait_fd && 0 == wake_time)
+		{
+			wake_time
+				= now;
+		}
+		if (0 != wake_time && wake_time < *resume_time)
+		{
+			*resume_time
+				= wake_time;
+		}
+	}
+	
+	return true;
+}
+
+/**
+@brief		Compute an absolute time @p ms milliseconds from now for
+		use with @c pthread_cond_timedwait.
+*/
+static void
+sjm_shards_deadline(
+	struct timespec		*deadline,
+	milliseconds_t		ms
+)
+{
+	clock_gettime(CLOCK_REALTIME, deadline);
+	deadline->tv_sec	+= ms / 1000;
+	deadline->tv_nsec	+= (ms % 1000) * 1000000L;
+	if (deadline->tv_nsec >= 1000000000L)
+	{
+		deadline->tv_sec++;
+		deadline->tv_nsec	-= 1000000000L;
+	}
+}
+
+/**
+@brief		The worker loop owning a single shard.
+@details	Requests are taken off the submission ring in batches, so
+		the lock is taken once per batch rather than once per
+		request.
+*/
+static void *
+sjm_shards_worker(
+	void			*argument
+)
+{
+	sjm_shard_t		*shard;
+	sjm_shard_request_t	*batch[SJM_SHARDS_QUEUE_SIZE];
+	int			count;
+	int			i;
+	milliseconds_t		tick;
+	milliseconds_t		next_tick;
+	milliseconds_t		wait_until;
+	milliseconds_t		resume_time;
+	sjm_bool_t		waiting;
+	milliseconds_t		now;
+	struct timespec		deadline;
+	
+	shard			= (sjm_shard_t *)argument;
+	tick			= shard->parent->tick;
+	next_tick		= ms_milliseconds() + tick;
+	
+	pthread_mutex_lock(&(shard->lock));
+	while (shard->running || 0 < shard->length)
+	{
+		if (0 == shard->length)
+		{
+			/* Wake for the next pass, or for in-flight jobs to
+			   be resumed, whichever comes first. */
+			now		= ms_milliseconds();
+			waiting		= (0 != tick);
+			wait_until	= next_tick;
+			if (sjm_shards_resume_time(shard, now, &resume_time) &&
+			    (!waiting || resume_time < wait_until))
+			{
+				waiting	= true;
+				wait_until
+					= resume_time;
+			}
+			
+			if (!waiting)
+			{
+				pthread_cond_wait(&(shard->submitted), &(shard->lock));
+			}
+			else if (now < wait_until)
+			{
+				sjm_shards_deadline(&deadline, wait_until - now);
+				pthread_cond_timedwait(
+					&(shard->submitted),
+					&(shard->lock),
+					&deadline
+				);
+			}
+		}
+	
+		/* Take every pending request in one go. */
+		count		= 0;
+		while (0 < shard->length)
+		{
+			batch[count++]	= shard->queue[shard->head];
+			shard->head	= (shard->head + 1) % SJM_SHARDS_QUEUE_SIZE;
+			shard->length--;
+		}
+		pthread_mutex_unlock(&(shard->lock));
+	
+		for (i = 0; i < count; i++)
+		{
+			sjm_shards_service(shard, batch[i]);
+		}
+	
+		if (0 < count)
+		{
+			pthread_mutex_lock(&(shard->lock));
+			for (i = 0; i < count; i++)
+			{
+				batch[i]->done	= true;
+			}
+			pthread_cond_broadcast(&(shard->completed));
+			pthread_mutex_unlock(&(shard->lock));
+		}
+	
+		if (0 != tick && ms_milliseconds() >= next_tick)
+		{
+			sjm_shards_schedule(shard);
+			next_tick	= ms_milliseconds() + tick;
+		}
+		else if (0 < shard->jobmanager.num_in_flight)
+		{
+			/* Jobs started by requests finish without
+			   scheduling passes too. */
+			sjm_resume_jobs(&(shard->jobmanager));
+		}
+	
+		pthread_mutex_lock(&(shard->lock));
+	}
+	pthread_mutex_unlock(&(shard->lock));
+	
+	return NULL;
+}
+
+sjm_error_t
+sjm_shards_init(
+	sjm_shards_t		*shards,
+	int			num_shards,
+	int			maximum_name_size,
+	int			maximum_json_tokens,
+	milliseconds_t		tick,
+	sjm_bool_t		pin
+)
+{
+	sjm_error_t		error;
+	sjm_shard_t		*shard;
+	int			i;
+#ifdef  __linux__
+	cpu_set_t		cpus;
+	long			num_cpus;
+#endif
+	
+	if (num_shards < 1)
+	{
+		num_shards	= 1;
+	}
+	
+	shards->shards		= malloc(num_shards * sizeof(sjm_shard_t));
+	if (NULL == shards->shards)
+	{
+		return SJM_ERROR_MEMORY_ALLOCATION_FAILURE;
+	}
+	shards->num_shards	= 0;
+	shards->maximum_name_size
+				= maximum_name_size;
+	shards->tick		= tick;
+	
+	/* Every shard opens its own job store, the one matching its
+	   index. This must be done here, on a single thread, since the
+	   master table is shared. */
+	for (i = 0; i < num_shards; i++)
+	{
+		shard		= shards->shards+i;
+		error		= sjm_init_instance(
+					&(shard->jobmanager),
+					maximum_name_size,
+					maximum_json_tokens,
+					i
+				);
+		if (SJM_ERROR_OK != error)
+		{
+			sjm_shards_delete(shards);
+			return error;
+		}
+	
+		shard->parent	= shards;
+		shard->index	= i;
+		shard->head	= 0;
+		shard->length	= 0;
+		shard->running	= true;
+		pthread_mutex_init(&(shard->lock), NULL);
+		pthread_cond_init(&(shard->submitted), NULL);
+		pthread_cond_init(&(shard->completed), NULL);
+	
+		if (0 != pthread_create(
+				&(shard->thread),
+				NULL,
+				sjm_shards_worker,
+				shard))
+		{
+			pthread_cond_destroy(&(shard->completed));
+			pthread_cond_destroy(&(shard->submitted));
+			pthread_mutex_destroy(&(shard->lock));
+			sjm_delete(&(shard->jobmanager));
+			sjm_shards_delete(shards);
+			return SJM_ERROR_THREAD_CREATION;
+		}
+		shards->num_shards++;
+	
+#ifdef  __linux__
+		if (pin)
+		{
+			num_cpus	= sysconf(_SC_NPROCESSORS_ONLN);
+			if (num_cpus > 0)
+			{
+				CPU_ZERO(&cpus);
+				CPU_SET(i % num_cpus, &cpus);
+				/* Pinning is best-effort. */
+				pthread_setaffinity_np(
+					shard->thread,
+					sizeof(cpus),
+					&cpus
+				);
+			}
+		}
+#endif
+	}
+	
+	return SJM_ERROR_OK;
+}
+
+sjm_error_t
+sjm_shards_delete(
+	sjm_shards_t		*shards
+)
+{
+	sjm_shard_t		*shard;
+	int			i;
+	
+	for (i = 0; i < shards->num_shards; i++)
+	{
+		shard		= shards->shards+i;
+		pthread_mutex_lock(&(shard->lock));
+		shard->running	= false;
+		pthread_cond_signal(&(shard->submitted));
+		pthread_mutex_unlock(&(shard->lock));
+	}
+	
+	for (i = 0; i < shards->num_shards; i++)
+	{
+		shard		= shards->shards+i;
+		pthread_join(shard->thread, NULL);
+		pthread_cond_destroy(&(shard->completed));
+		pthread_cond_destroy(&(shard->submitted));
+		pthread_mutex_destroy(&(shard->lock));
+		sjm_delete(&(shard->jobmanager));
+	}
+	
+	free(shards->shards);
+	shards->shards		= NULL;
+	shards->num_shards	= 0;
+	
+	return SJM_ERROR_OK;
+}
+
+int
+sjm_shards_owner(
+	sjm_shards_t		*shards,
+	char			*name
+)
+{
+	return (int)(sjm_hash_name(name, shards->maximum_name_size)
+			% (unsigned long)shards->num_shards);
+}
+
+void
+sjm_shards_submit(
+	sjm_shards_t		*shards,
+	int			shard,
+	sjm_shard_request_t	*request
+)
+{
+	sjm_shard_t		*target;
+	
+	target			= shards->shards+shard;
+	request->done		= false;
+	request->error		= SJM_ERROR_OK;
+	
+	pthread_mutex_lock(&(target->lock));
+	while (SJM_SHARDS_QUEUE_SIZE == target->length)
+	{
+		pthread_cond_wait(&(target->completed), &(target->lock));
+	}
+	target->queue[(target->head + target->length) % SJM_SHARDS_QUEUE_SIZE]
+				= request;
+	target->length++;
+	pthread_cond_signal(&(target->submitted));
+	pthread_mutex_unlock(&(target->lock));
+}
+
+sjm_error_t
+sjm_shards_wait(
+	sjm_shards_t		*shards,
+	int			shard,
+	sjm_shard_request_t	*request
+)
+{
+	sjm_shard_t		*target;
+	
+	target			= shards->shards+shard;
+	
+	pthread_mutex_lock(&(target->lock));
+	while (!request->done)
+	{
+		pthread_cond_wait(&(target->completed), &(target->lock));
+	}
+	pthread_mutex_unlock(&(target->lock));
+	
+	return request->error;
+}
+
+sjm_error_t
+sjm_shards_add_job(
+	sjm_shards_t		*shards,
+	char			*jobname,
+	sensor_job_t		*job
+)
+{
+	sjm_shard_request_t	request;
+	int			shard;
+	
+	request.type		= SJM_SHARD_REQUEST_ADD;
+	request.name		= jobname;
+	request.job		= job;
+	shard			= sjm_shards_owner(shards, jobname);
+	
+	sjm_shards_submit(shards, shard, &request);
+	return sjm_shards_wait(shards, shard, &request);
+}
+
+sjm_error_t
+sjm_shards_add_jobs(
+	sjm_shards_t		*shards,
+	char			**names,
+	sensor_job_t		*jobs,
+	int			count
+)
+{
+	sjm_shard_request_t	requests[shards->num_shards];
+	int			*indices;
+	int			*owners;
+	int			offset;
+	int			i;
+	int			shard;
+	sjm_error_t		error;
+	sjm_error_t		first;
+	
+	indices			= malloc((2 * count + 1) * sizeof(int));
+	if (NULL == indices)
+	{
+		return SJM_ERROR_MEMORY_ALLOCATION_FAILURE;
+	}
+	owners			= indices + count;
+	
+	for (shard = 0; shard < shards->num_shards; shard++)
+	{
+		requests[shard].type	= SJM_SHARD_REQUEST_BULK_ADD;
+		requests[shard].names	= names;
+		requests[shard].jobs	= jobs;
+		requests[shard].count	= 0;
+	}
+	
+	/* Partition: count per shard, then lay each shard's indices out
+	   contiguously. */
+	for (i = 0; i < count; i++)
+	{
+		owners[i]	= sjm_shards_owner(shards, names[i]);
+		requests[owners[i]].count++;
+	}
+	offset			= 0;
+	for (shard = 0; shard < shards->num_shards; shard++)
+	{
+		requests[shard].indices	= indices + offset;
+		offset			+= requests[shard].count;
+		requests[shard].count	= 0;
+	}
+	for (i = 0; i < count; i++)
+	{
+		requests[owners[i]].indices[requests[owners[i]].count++]
+				= i;
+	}
+	
+	for (shard = 0; shard < shards->num_shards; shard++)
+	{
+		if (0 < requests[shard].count)
+		{
+			sjm_shards_submit(shards, shard, requests+shard);
+		}
+	}
+	
+	first			= SJM_ERROR_OK;
+	for (shard = 0; shard < shards->num_shards; shard++)
+	{
+		if (0 < requests[shard].count)
+		{
+			error	= sjm_shards_wait(shards, shard, requests+shard);
+			if (SJM_ERROR_OK == first)
+			{
+				first	= error;
+			}
+		}
+	}
+	
+	free(indices);
+	return first;
+}
+
+sjm_error_t
+sjm_shards_perform_job(
+	sjm_shards_t		*shards,
+	char			*name,
+	void			**params,
+	void			*retval
+)
+{
+	sjm_shard_request_t	request;
+	int			shard;
+	
+	request.type		= SJM_SHARD_REQUEST_PERFORM;
+	request.name		= name;
+	request.params		= params;
+	request.retval		= retval;
+	shard			= sjm_shards_owner(shards, name);
+	
+	sjm_shards_submit(shards, shard, &request);
+	return sjm_shards_wait(shards, shard, &request);
+}
+
+#ifdef  SJM_JSON_HANDLING
+/**
+@brief		Skip JSON whitespace.
+*/
+static char *
+sjm_shards_skip_space(
+	char			*json
+)
+{
+	while (' ' == *json || '\t' == *json || '\r' == *json || '\n' == *json)
+	{
+		json++;
+	}
+	
+	return json;
+}
+
+/**
+@brief		Find the end of a JSON string.
+@param		json
+			Just past the string's opening quote.
+@param		escapes
+			Whether the string may hold escapes. Names may not,
+			since they are matched byte for byte.
+@returns	The string's closing quote, or @c NULL if there is none
+		or it holds an escape it may not.
+*/
+static char *
+sjm_shards_string_end(
+	char			*json,
+	sjm_bool_t		escapes
+)
+{
+	for (; '"' != *json; json++)
+	{
+		if ('\0' == *json)
+		{
+			return NULL;
+		}
+		if ('\\' == *json)
+		{
+			if (!escapes || '\0' == json[1])
+			{
+				return NULL;
+			}
+			json++;
+		}
+	}
+	
+	return json;
+}
+
+/**
+@brief		Pick out the name of the job a JSON request is for.
+@details	Only as much is scanned as is needed to find the name;
+		the owning shard does the real parse. Both request forms
+		are understood: the name leading an array, or the value of
+		an object's @c "job" member, where the last such member
+		wins as it does in @ref sjm_request_job.
+@param		json
+			The request.
+@param		end
+			Set to the closing quote of the name.
+@returns	The start of the name, or @c NULL if there is none.
+*/
+static char *
+sjm_shards_json_name(
+	char			*json,
+	char			**end
+)
+{
+	char			*name;
+	char			*closing;
+	int			depth;
+	sjm_bool_t		expect_key;
+	
+	json			= sjm_shards_skip_space(json);
+	if ('[' == *json)
+	{
+		json		= sjm_shards_skip_space(json+1);
+		if ('"' != *json)
+		{
+			return NULL;
+		}
+		*end		= sjm_shards_string_end(json+1, false);
+		return (NULL == *end) ? NULL : json+1;
+	}
+	if ('{' != *json)
+	{
+		return NULL;
+	}
+	
+	name			= NULL;
+	depth			= 1;
+	expect_key		= true;
+	for (json++; 0 < depth && '\0' != *json; json++)
+	{
+		switch (*json)
+		{
+		 case '"':
+			closing	= sjm_shards_string_end(json+1, true);
+			if (NULL == closing)
+			{
+				return NULL;
+			}
+			if (1 == depth && expect_key && 3 == closing - json - 1 &&
+			    0 == strncmp("job", json+1, 3))
+			{
+				json	= sjm_shards_skip_space(closing+1);
+				if (':' != *json)
+				{
+					return NULL;
+				}
+				json	= sjm_shards_skip_space(json+1);
+				if ('"' != *json)
+				{
+					return NULL;
+				}
+				name	= json+1;
+				closing	= sjm_shards_string_end(name, false);
+				if (NULL == closing)
+				{
+					return NULL;
+				}
+				*end	= closing;
+			}
+			expect_key
+				= false;
+			json	= closing;
+			break;
+		 case '{':
+		 case '[':
+			depth++;
+			break;
+		 case '}':
+		 case ']':
+			depth--;
+			break;
+		 case ',':
+			expect_key
+				= (1 == depth);
+			break;
+		}
+	}
+	
+	return name;
+}
+
+sjm_error_t
+sjm_shards_request_job(
+	sjm_shards_t		*shards,
+	char			*json,
+	void			*returnval
+)
+{
+	sjm_shard_request_t	request;
+	char			*start;
+	char			*end;
+	char			original;
+	int			shard;
+	
+	start			= sjm_shards_json_name(json, &end);
+	if (NULL == start)
+	{
+		return SJM_ERROR_UNSUPPORTED_JSON_FORMAT;
+	}
+	
+	original		= *end;
+	*end			= '\0';
+	shard			= sjm_shards_owner(shards, start);
+	*end			= original;
+	
+	request.type		= SJM_SHARD_REQUEST_JSON;
+	request.json		= json;
+	request.retval		= returnval;
+	
+	sjm_shards_submit(shards, shard, &request);
+	return sjm_shards_wait(shards, shard, &request);
+}
+#endif
+
+sjm_error_t
+sjm_shards_frame_request_job(
+	sjm_shards_t		*shards,
+	unsigned char		*buffer,
+	int			length,
+	void			*retval,
+	int			*consumed
+)
+{
+	sjm_frame_t		frame;
+	sjm_error_t		error;
+	
+	/* Decoding copies nothing, so the frame can be performed as is. */
+	error			= sjm_frame_decode(buffer, length, &frame, consumed);
+	if (SJM_ERROR_OK != error)
+	{
+		return error;
+	}
+	if ((int)strlen(frame.name) >= shards->maximum_name_size)
+	{
+		return SJM_ERROR_DICT_GET_FAILURE;
+	}
+	
+	return sjm_shards_perform_job(shards, frame.name, frame.params, retval);
+}
+
+sjm_error_t
+sjm_shards_list_jobs(
+	sjm_shards_t			*shards,
+	sjm_shards_list_callback_t	callback,
+	void				*state
+)
+{
+	sjm_shard_request_t	requests[shards->num_shards];
+	int			positions[shards->num_shards];
+	int			shard;
+	int			best;
+	int			i;
+	sjm_error_t		error;
+	sjm_error_t		first;
+	sjm_shard_listing_t	*listing;
+	
+	for (shard = 0; shard < shards->num_shards; shard++)
+	{
+		requests[shard].type	= SJM_SHARD_REQUEST_LIST;
+		requests[shard].listings
+					= NULL;
+		requests[shard].count	= 0;
+		positions[shard]	= 0;
+		sjm_shards_submit(shards, shard, requests+shard);
+	}
+	
+	first			= SJM_ERROR_OK;
+	for (shard = 0; shard < shards->num_shards; shard++)
+	{
+		error		= sjm_shards_wait(shards, shard, requests+shard);
+		if (SJM_ERROR_OK == first)
+		{
+			first	= error;
+		}
+	}
+	
+	/* K-way merge of the already sorted per-shard listings. */
+	while (SJM_ERROR_OK == first)
+	{
+		best		= -1;
+		for (shard = 0; shard < shards->num_shards; shard++)
+		{
+			if (positions[shard] < requests[shard].count &&
+			    (-1 == best ||
+			     0 > strcmp(
+					requests[shard].listings[positions[shard]].name,
+					requests[best].listings[positions[best]].name)))
+			{
+				best	= shard;
+			}
+		}
+		if (-1 == best)
+		{
+			break;
+		}
+		listing		= requests[best].listings+positions[best];
+		callback(listing->name, &(listing->job), state);
+		positions[best]++;
+	}
+	
+	for (shard = 0; shard < shards->num_shards; shard++)
+	{
+		for (i = 0; i < requests[shard].count; i++)
+		{
+			free(requests[shard].listings[i].name);
+		}
+		free(requests[shard].listings);
+	}
+	
+	return first;
+}
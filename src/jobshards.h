@@ -0,0 +1,353 @@
+/******************************************************************************/
+/**
+@file
+@author		Graeme Douglas
+@brief		A shared-nothing, sharded front end for the job manager.
+@details	A single job manager is backed by a single B+ tree and a
+		single queue, so every request against it is serialized.
+		The sharded front end partitions jobs by the hash of their
+		name across a number of completely independent job managers.
+		Each shard owns its own dictionary files, its own execution
+		queue, and a worker thread (pinned to a core where the
+		platform supports it) that is the only thread to ever touch
+		that shard's job manager.
+
+		Requests are routed to the owning shard through a per-shard
+		submission queue. Operations spanning every shard (listing
+		all jobs, adding many jobs at once) are fanned out to all
+		shards in parallel and their results merged.
+*/
+/******************************************************************************/
+
+#ifndef JOB_SHARDS_H
+#define JOB_SHARDS_H
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+#include <pthread.h>
+#include "jobmanager.h"
+#include "jobframe.h"
+
+/**
+@brief		The number of requests each shard's submission queue can
+		hold before submitters must wait.
+*/
+#define SJM_SHARDS_QUEUE_SIZE	64
+
+/**
+@brief		The most milliseconds a worker waits between resumes of a
+		job waiting on a file descriptor.
+*/
+#define SJM_SHARDS_RESUME_INTERVAL	5
+
+/**
+@brief		The kinds of requests a shard can service.
+*/
+typedef enum sjm_shard_request_type
+{
+	SJM_SHARD_REQUEST_ADD,		/**< Add a single job. */
+	SJM_SHARD_REQUEST_BULK_ADD,	/**< Add a subset of many jobs. */
+	SJM_SHARD_REQUEST_PERFORM,	/**< Perform a job by name. */
+#ifdef  SJM_JSON_HANDLING
+	SJM_SHARD_REQUEST_JSON,		/**< Perform a JSON job request. */
+#endif
+	SJM_SHARD_REQUEST_LIST,		/**< Collect all of a shard's jobs. */
+} sjm_shard_request_type_t;
+
+/**
+@brief		A single job as collected when listing jobs.
+*/
+typedef struct sjm_shard_listing
+{
+	char			*name;	/**< Null-terminated job name. */
+	sensor_job_t		job;	/**< The stored job. */
+} sjm_shard_listing_t;
+
+/**
+@brief		A request submitted to a shard.
+@details	Requests are owned by the submitter and must stay alive
+		until they have completed. All fields other than
+		@c error and @c done are inputs (or, for listings, outputs
+		allocated by the shard).
+*/
+typedef struct sjm_shard_request
+{
+	sjm_shard_request_type_t type;		/**< What to do. */
+	char			*name;		/**< Job name, if any. */
+	sensor_job_t		*job;		/**< Job to add, if any. */
+	void			**params;	/**< Job parameters. */
+	void			*retval;	/**< Job return pointer. */
+	char			*json;		/**< JSON request. */
+	char			**names;	/**< Names for bulk adds. */
+	sensor_job_t		*jobs;		/**< Jobs for bulk adds. */
+	int			*indices;	/**< Indices into @c names
+						     and @c jobs that belong
+						     to this shard. */
+	int			count;		/**< Number of @c indices, or
+						     the number of listings
+						     produced. */
+	sjm_shard_listing_t	*listings;	/**< Listing output. */
+	sjm_error_t		error;		/**< Result of the request. */
+	sjm_bool_t		done;		/**< Whether the request has
+						     completed. */
+} sjm_shard_request_t;
+
+typedef struct sjm_shards sjm_shards_t;
+
+/**
+@brief		A single shard: one job manager and the thread that owns it.
+*/
+typedef struct sjm_shard
+{
+	sjm_t			jobmanager;	/**< This shard's manager. */
+	sjm_shards_t		*parent;	/**< The owning front end. */
+	int			index;		/**< Index of this shard. */
+	pthread_t		thread;		/**< The worker thread. */
+	pthread_mutex_t		lock;		/**< Guards the queue and
+						     request completion. */
+	pthread_cond_t		submitted;	/**< Signalled on submission.
+						*/
+	pthread_cond_t		completed;	/**< Broadcast on completion
+						     and when queue space
+						     frees up. */
+	sjm_shard_request_t	*queue[SJM_SHARDS_QUEUE_SIZE];
+						/**< Submission ring. */
+	unsigned int		head;		/**< Next request to take. */
+	unsigned int		length;		/**< Requests in the ring. */
+	sjm_bool_t		running;	/**< Cleared to stop worker. */
+} sjm_shard_t;
+
+/**
+@brief		The sharded job manager front end.
+*/
+struct sjm_shards
+{
+	sjm_shard_t		*shards;		/**< The shards. */
+	int			num_shards;		/**< Number of shards.
+							*/
+	int			maximum_name_size;	/**< Maximum job name
+							     size. */
+	milliseconds_t		tick;			/**< Milliseconds
+							     between scheduling
+							     passes, or 0 to
+							     never schedule. */
+};
+
+/**
+@brief		A callback receiving each job when listing all jobs.
+@param		name
+			The null-terminated job name.
+@param		job
+			The stored job.
+@param		state
+			The user state passed to @ref sjm_shards_list_jobs.
+*/
+typedef void (*sjm_shards_list_callback_t)(char *name, sensor_job_t *job, void *state);
+
+/**
+@brief		Initialize a sharded job manager and start its workers.
+@param		shards
+			A pointer to the front end to initialize. This must
+			already be allocated.
+@param		num_shards
+			The number of shards (and worker threads) to create.
+			Typically one per core. Shard @c i reopens the
+			@c i-th job store, see @ref sjm_init_instance.
+@param		maximum_name_size
+			See @ref sjm_init.
+@param		maximum_json_tokens
+			See @ref sjm_init.
+@param		tick
+			The number of milliseconds between scheduling passes
+			on each shard (@ref sjm_queue_scheduled_jobs followed
+			by draining the shard's queue and
+			@ref sjm_resume_jobs). Use 0 to disable scheduling;
+			resumable jobs started by requests are still resumed
+			while they are in flight.
+@param		pin
+			If true, each worker thread is pinned to a core
+			(round-robin), where the platform supports it.
+@returns	@c SJM_ERROR_OK on successes, an appropriate error code
+		otherwise.
+*/
+sjm_error_t
+sjm_shards_init(
+	sjm_shards_t		*shards,
+	int			num_shards,
+	int			maximum_name_size,
+	int			maximum_json_tokens,
+	milliseconds_t		tick,
+	sjm_bool_t		pin
+);
+
+/**
+@brief		Stop all workers and delete every shard's job manager.
+@param		shards
+			The front end to destroy. The pointer itself is
+			not freed.
+@returns	@c SJM_ERROR_OK on successes, an appropriate error code
+		otherwise.
+*/
+sjm_error_t
+sjm_shards_delete(
+	sjm_shards_t		*shards
+);
+
+/**
+@brief		Find the shard owning a job name.
+@param		shards
+			The front end.
+@param		name
+			The job name.
+@returns	The index of the owning shard.
+*/
+int
+sjm_shards_owner(
+	sjm_shards_t		*shards,
+	char			*name
+);
+
+/**
+@brief		Submit a request to a shard without waiting for it.
+@details	Blocks only while the shard's submission queue is full.
+		Use @ref sjm_shards_wait to wait for completion.
+@param		shards
+			The front end.
+@param		shard
+			The index of the shard to submit to.
+@param		request
+			The request. It must remain valid until completion.
+*/
+void
+sjm_shards_submit(
+	sjm_shards_t		*shards,
+	int			shard,
+	sjm_shard_request_t	*request
+);
+
+/**
+@brief		Wait for a submitted request to complete.
+@param		shards
+			The front end.
+@param		shard
+			The index of the shard the request was submitted to.
+@param		request
+			The request to wait on.
+@returns	The error code of the request.
+*/
+sjm_error_t
+sjm_shards_wait(
+	sjm_shards_t		*shards,
+	int			shard,
+	sjm_shard_request_t	*request
+);
+
+/**
+@brief		Add a job to the shard owning its name.
+@details	See @ref sjm_add_job.
+*/
+sjm_error_t
+sjm_shards_add_job(
+	sjm_shards_t		*shards,
+	char			*jobname,
+	sensor_job_t		*job
+);
+
+/**
+@brief		Add many jobs at once.
+@details	Jobs are partitioned by owner and every shard adds its
+		subset in parallel.
+@param		shards
+			The front end.
+@param		names
+			An array of @p count job names.
+@param		jobs
+			An array of @p count jobs.
+@param		count
+			The number of jobs to add.
+@returns	@c SJM_ERROR_OK if every job was added, otherwise the
+		first error encountered.
+*/
+sjm_error_t
+sjm_shards_add_jobs(
+	sjm_shards_t		*shards,
+	char			**names,
+	sensor_job_t		*jobs,
+	int			count
+);
+
+/**
+@brief		Perform a named job on the shard owning it.
+@details	See @ref sjm_perform_job. The job runs on the owning
+		shard's worker thread; this blocks until it is done. A
+		resumable job is done once it first yields, and is then
+		resumed by the worker until it ends, so @p retval must
+		stay valid until then.
+*/
+sjm_error_t
+sjm_shards_perform_job(
+	sjm_shards_t		*shards,
+	char			*name,
+	void			**params,
+	void			*retval
+);
+
+#ifdef  SJM_JSON_HANDLING
+/**
+@brief		Route a JSON job request to the shard owning it.
+@details	See @ref sjm_request_job. Both the array and the object
+		forms are routed. Only the job name is picked out on the
+		calling thread; the request is parsed and executed by the
+		owning shard.
+*/
+sjm_error_t
+sjm_shards_request_job(
+	sjm_shards_t		*shards,
+	char			*json,
+	void			*returnval
+);
+#endif
+
+/**
+@brief		Route a request frame to the shard owning its job.
+@details	See @ref sjm_frame_request_job. The frame is decoded on
+		the calling thread, and the job is performed by the owning
+		shard.
+*/
+sjm_error_t
+sjm_shards_frame_request_job(
+	sjm_shards_t		*shards,
+	unsigned char		*buffer,
+	int			length,
+	void			*retval,
+	int			*consumed
+);
+
+/**
+@brief		List every job across all shards, in name order.
+@details	Each shard collects its jobs in parallel (already sorted,
+		since each shard is a B+ tree), and the per-shard lists
+		are then merged on the calling thread.
+@param		shards
+			The front end.
+@param		callback
+			Called once per job, in ascending name order.
+@param		state
+			Passed through to @p callback.
+@returns	@c SJM_ERROR_OK on successes, an appropriate error code
+		otherwise.
+*/
+sjm_error_t
+sjm_shards_list_jobs(
+	sjm_shards_t			*shards,
+	sjm_shards_list_callback_t	callback,
+	void				*state
+);
+
+#ifdef  __cplusplus
+}
+#endif
+
+#endif
@@ -2,6 +2,187 @@
 
 #include "jsmn.h"
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define JSMN_SIMD
+#include <immintrin.h>
+#endif
+
+/**
+ * Scanners jump over runs of characters the tokenizer has nothing to do
+ * with, stopping at the first one it must look at (or where too few bytes
+ * remain for a whole block, leaving the rest to the byte-at-a-time loops).
+ * They only ever skip, so every scanner produces exactly the same tokens.
+ */
+typedef struct jsmn_scanner {
+	/* First quote, backslash or '\0' in a string */
+	size_t (*string)(const char *js, size_t pos, size_t len);
+	/* First delimiter or invalid character in a primitive */
+	size_t (*primitive)(const char *js, size_t pos, size_t len);
+	/* First character that is not whitespace */
+	size_t (*space)(const char *js, size_t pos, size_t len);
+} jsmn_scanner;
+
+static size_t jsmn_scan_none(const char *js, size_t pos, size_t len) {
+	return pos;
+}
+
+static const jsmn_scanner jsmn_scanner_scalar = {
+	jsmn_scan_none, jsmn_scan_none, jsmn_scan_none
+};
+
+#ifdef JSMN_SIMD
+/*
+ * Each kernel classifies a whole block at once into a bit mask of the
+ * characters of interest, then jumps to the lowest set bit. Compares are
+ * signed, so bytes of 128 and up count as below ' ' (and so invalid in
+ * primitives, as they are byte at a time).
+ */
+__attribute__((target("sse2")))
+static unsigned int jsmn_string_mask_sse2(__m128i v) {
+	__m128i m = _mm_or_si128(
+			_mm_cmpeq_epi8(v, _mm_set1_epi8('\"')),
+			_mm_cmpeq_epi8(v, _mm_set1_epi8('\\')));
+	m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_setzero_si128()));
+	return _mm_movemask_epi8(m);
+}
+
+__attribute__((target("sse2")))
+static unsigned int jsmn_primitive_mask_sse2(__m128i v) {
+	__m128i m = _mm_or_si128(
+			_mm_cmplt_epi8(v, _mm_set1_epi8(' ' + 1)),
+			_mm_cmpeq_epi8(v, _mm_set1_epi8(127)));
+	m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8(',')));
+	m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8(']')));
+	m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('}')));
+#ifndef JSMN_STRICT
+	m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8(':')));
+#endif
+	return _mm_movemask_epi8(m);
+}
+
+__attribute__((target("sse2")))
+static unsigned int jsmn_space_mask_sse2(__m128i v) {
+	__m128i m = _mm_or_si128(
+			_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')),
+			_mm_cmpeq_epi8(v, _mm_set1_epi8('\t')));
+	m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('\r')));
+	m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('\n')));
+	return ~_mm_movemask_epi8(m) & 0xFFFF;
+}
+
+__attribute__((target("avx2")))
+static unsigned int jsmn_string_mask_avx2(__m256i v) {
+	__m256i m = _mm256_or_si256(
+			_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\"')),
+			_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\\')));
+	m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_setzero_si256()));
+	return _mm256_movemask_epi8(m);
+}
+
+__attribute__((target("avx2")))
+static unsigned int jsmn_primitive_mask_avx2(__m256i v) {
+	/* No signed less-than; greater-than with the sides swapped */
+	__m256i m = _mm256_or_si256(
+			_mm256_cmpgt_epi8(_mm256_set1_epi8(' ' + 1), v),
+			_mm256_cmpeq_epi8(v, _mm256_set1_epi8(127)));
+	m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8(',')));
+	m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8(']')));
+	m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('}')));
+#ifndef JSMN_STRICT
+	m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8(':')));
+#endif
+	return _mm256_movemask_epi8(m);
+}
+
+__attribute__((target("avx2")))
+static unsigned int jsmn_space_mask_avx2(__m256i v) {
+	__m256i m = _mm256_or_si256(
+			_mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')),
+			_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\t')));
+	m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\r')));
+	m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n')));
+	return ~(unsigned int)_mm256_movemask_epi8(m);
+}
+
+/*
+ * Define a scanner over blocks of the given width, handing any remainder to
+ * the next narrower scanner.
+ */
+#define JSMN_SCANNER(kind, isa, type, load, width, narrower) \
+__attribute__((target(#isa))) \
+static size_t jsmn_scan_##kind##_##isa(const char *js, size_t pos, size_t len) { \
+	for (; pos + width <= len; pos += width) { \
+		unsigned int mask = jsmn_##kind##_mask_##isa(load((const type *)(js + pos))); \
+		if (mask != 0) { \
+			return pos + __builtin_ctz(mask); \
+		} \
+	} \
+	return narrower(js, pos, len); \
+}
+
+JSMN_SCANNER(string, sse2, __m128i, _mm_loadu_si128, 16, jsmn_scan_none)
+JSMN_SCANNER(primitive, sse2, __m128i, _mm_loadu_si128, 16, jsmn_scan_none)
+JSMN_SCANNER(space, sse2, __m128i, _mm_loadu_si128, 16, jsmn_scan_none)
+JSMN_SCANNER(string, avx2, __m256i, _mm256_loadu_si256, 32, jsmn_scan_string_sse2)
+JSMN_SCANNER(primitive, avx2, __m256i, _mm256_loadu_si256, 32, jsmn_scan_primitive_sse2)
+JSMN_SCANNER(space, avx2, __m256i, _mm256_loadu_si256, 32, jsmn_scan_space_sse2)
+
+static const jsmn_scanner jsmn_scanner_sse2 = {
+	jsmn_scan_string_sse2, jsmn_scan_primitive_sse2, jsmn_scan_space_sse2
+};
+
+static const jsmn_scanner jsmn_scanner_avx2 = {
+	jsmn_scan_string_avx2, jsmn_scan_primitive_avx2, jsmn_scan_space_avx2
+};
+#endif
+
+/*
+ * Loads and stores of the scanner new parsers start with, so that choosing
+ * one never races with parsers being initialized on other threads.
+ */
+#ifdef __GNUC__
+#define JSMN_SCAN_LOAD(p) __atomic_load_n(&(p), __ATOMIC_ACQUIRE)
+#define JSMN_SCAN_STORE(p, v) __atomic_store_n(&(p), (v), __ATOMIC_RELEASE)
+#else
+#define JSMN_SCAN_LOAD(p) (p)
+#define JSMN_SCAN_STORE(p, v) ((p) = (v))
+#endif
+
+/**
+ * The scanner new parsers start with. Each parser keeps the one it was
+ * initialized with, so changing this never affects a parse under way.
+ */
+static const jsmn_scanner *jsmn_scan = &jsmn_scanner_scalar;
+
+jsmnscan_t jsmn_set_scanner(jsmnscan_t scan) {
+#ifdef JSMN_SIMD
+	__builtin_cpu_init();
+	if (scan == JSMN_SCAN_AUTO || scan == JSMN_SCAN_AVX2) {
+		if (__builtin_cpu_supports("avx2")) {
+			JSMN_SCAN_STORE(jsmn_scan, &jsmn_scanner_avx2);
+			return JSMN_SCAN_AVX2;
+		}
+		scan = JSMN_SCAN_SSE2;
+	}
+	if (scan == JSMN_SCAN_SSE2 && __builtin_cpu_supports("sse2")) {
+		JSMN_SCAN_STORE(jsmn_scan, &jsmn_scanner_sse2);
+		return JSMN_SCAN_SSE2;
+	}
+#endif
+	JSMN_SCAN_STORE(jsmn_scan, &jsmn_scanner_scalar);
+	return JSMN_SCAN_SCALAR;
+}
+
+#ifdef JSMN_SIMD
+/**
+ * Pick the best scanner once, before main and so before any threads.
+ */
+__attribute__((constructor))
+static void jsmn_detect_scanner(void) {
+	jsmn_set_scanner(JSMN_SCAN_AUTO);
+}
+#endif
+
 /**
  * Allocates a fresh unused token from the token pull.
  */
@@ -42,6 +223,10 @@ static jsmnerr_t jsmn_parse_primitive(jsmn_parser *parser, const char *js,
 	start = parser->pos;
 
 	for (; parser->pos < len && js[parser->pos] != '\0'; parser->pos++) {
+		parser->pos = parser->scan->primitive(js, parser->pos, len);
+		if (parser->pos >= len || js[parser->pos] == '\0') {
+			break;
+		}
 		switch (js[parser->pos]) {
 #ifndef JSMN_STRICT
 			/* In strict mode primitive must be followed by "," or "}" or "]" */
@@ -93,7 +278,13 @@ static jsmnerr_t jsmn_parse_string(jsmn_parser *parser, const char *js,
 
 	/* Skip starting quote */
 	for (; parser->pos < len && js[parser->pos] != '\0'; parser->pos++) {
-		char c = js[parser->pos];
+		char c;
+
+		parser->pos = parser->scan->string(js, parser->pos, len);
+		if (parser->pos >= len || js[parser->pos] == '\0') {
+			break;
+		}
+		c = js[parser->pos];
 
 		/* Quote: end of string */
 		if (c == '\"') {
@@ -157,6 +348,11 @@ jsmnerr_t jsmn_parse(jsmn_parser *parser, const char *js, size_t len,
 	jsmntok_t *token;
 	int count = 0;
 
+	/* A parser zeroed rather than initialized */
+	if (parser->scan == NULL) {
+		parser->scan = JSMN_SCAN_LOAD(jsmn_scan);
+	}
+
 	for (; parser->pos < len && js[parser->pos] != '\0'; parser->pos++) {
 		char c;
 		jsmntype_t type;
@@ -235,12 +431,14 @@ jsmnerr_t jsmn_parse(jsmn_parser *parser, const char *js, size_t len,
 					tokens[parser->toksuper].size++;
 				break;
 			case '\t' : case '\r' : case '\n' : case ' ':
+				/* Land on the last of the run */
+				parser->pos = parser->scan->space(js, parser->pos + 1, len) - 1;
 				break;
 			case ':':
 				parser->toksuper = parser->toknext - 1;
 				break;
 			case ',':
-				if (tokens != NULL &&
+				if (tokens != NULL && parser->toksuper != -1 &&
 						tokens[parser->toksuper].type != JSMN_ARRAY &&
 						tokens[parser->toksuper].type != JSMN_OBJECT) {
 #ifdef JSMN_PARENT_LINKS
@@ -263,7 +461,7 @@ jsmnerr_t jsmn_parse(jsmn_parser *parser, const char *js, size_t len,
 			case '5': case '6': case '7' : case '8': case '9':
 			case 't': case 'f': case 'n' :
 				/* And they must not be keys of the object */
-				if (tokens != NULL) {
+				if (tokens != NULL && parser->toksuper != -1) {
 					jsmntok_t *t = &tokens[parser->toksuper];
 					if (t->type == JSMN_OBJECT ||
 							(t->type == JSMN_STRING && t->size != 0)) {
@@ -307,6 +505,7 @@ void jsmn_init(jsmn_parser *parser) {
 	parser->pos = 0;
 	parser->toknext = 0;
 	parser->toksuper = -1;
+	parser->scan = JSMN_SCAN_LOAD(jsmn_scan);
 }
 
 void jsmntok_clear(jsmntok_t *tokens, int numtokens)
@@ -31,6 +31,21 @@ typedef enum {
 	JSMN_ERROR_PART = -3
 } jsmnerr_t;
 
+/**
+ * How the tokenizer scans for the characters it must look at. All scanners
+ * produce exactly the same tokens; the vector ones get there faster.
+ */
+typedef enum {
+	/* The best the CPU supports */
+	JSMN_SCAN_AUTO = 0,
+	/* One byte at a time */
+	JSMN_SCAN_SCALAR = 1,
+	/* 16 bytes at a time */
+	JSMN_SCAN_SSE2 = 2,
+	/* 32 bytes at a time */
+	JSMN_SCAN_AVX2 = 3
+} jsmnscan_t;
+
 /**
  * JSON token description.
  * @param		type	type (object, array, string etc.)
@@ -55,6 +70,7 @@ typedef struct {
 	unsigned int pos; /* offset in the JSON string */
 	unsigned int toknext; /* next token to allocate */
 	int toksuper; /* superior token node, e.g parent object or array */
+	const struct jsmn_scanner *scan; /* scanner chosen at jsmn_init */
 } jsmn_parser;
 
 /**
@@ -69,6 +85,15 @@ void jsmn_init(jsmn_parser *parser);
 jsmnerr_t jsmn_parse(jsmn_parser *parser, const char *js, size_t len,
 		jsmntok_t *tokens, unsigned int num_tokens);
 
+/**
+ * Choose the scanner used by parsers initialized from now on; parsers already
+ * initialized keep theirs. Without a call, the best the CPU supports is chosen
+ * at startup. Safe to call while other threads parse. Returns the scanner
+ * actually chosen, which falls back to a lesser one if the CPU does not
+ * support the one asked for.
+ */
+jsmnscan_t jsmn_set_scanner(jsmnscan_t scan);
+
 /**
  * Clear the data in some tokens.
  * 
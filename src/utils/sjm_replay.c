@@ -0,0 +1,187 @@
+/******************************************************************************/
+/**
+@file
+@author		Graeme Douglas
+@brief		Replays a request capture and reports how it went.
+@details	Usage: sjm_replay <capture-file> [speed]
+		
+		The speed is how many times faster than recorded to
+		replay; 0 replays as fast as possible. The default is 1.
+		
+		Every job named in the capture is stood in for by one that
+		does nothing, so this measures the job manager itself. To
+		measure real jobs, call @ref sjm_replay from a program that
+		adds them.
+*/
+/******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "../jobcapture.h"
+#include "../jsmn/jsmn.h"
+
+/**
+@brief		The longest job name stood in for, including its null.
+		Job names are keys of the job manager's B+ tree, which
+		holds too few of anything much longer per node.
+*/
+#define SJM_REPLAY_NAME_SIZE	16
+
+/**
+@brief		The most JSON tokens in a replayed request.
+*/
+#define SJM_REPLAY_TOKENS	256
+
+/**
+@brief		A name already stood in for.
+*/
+typedef struct sjm_replay_name
+{
+	char			name[SJM_REPLAY_NAME_SIZE];
+	struct sjm_replay_name	*next;
+} sjm_replay_name_t;
+
+/**
+@brief		The job standing in for every captured one.
+*/
+void
+sjm_replay_nothing(
+	void			**params,
+	void			*returnval
+)
+{
+}
+
+/**
+@brief		Find the job name in a request.
+@param		json
+			The request.
+@param		name
+			Set to the name, null-terminated.
+@returns	@c true if the request names a job that fits.
+*/
+sjm_bool_t
+sjm_replay_name_of(
+	char			*json,
+	char			*name
+)
+{
+	jsmn_parser		parser;
+	jsmntok_t		tokens[SJM_REPLAY_TOKENS];
+	jsmntok_t		*found;
+	jsmnerr_t		count;
+	int			i;
+	
+	jsmn_init(&parser);
+	count			= jsmn_parse(&parser, json, strlen(json), tokens, SJM_REPLAY_TOKENS);
+	found			= NULL;
+	if (2 <= count && JSMN_ARRAY == tokens[0].type)
+	{
+		found		= tokens+1;
+	}
+	for (i = 1; 2 <= count && JSMN_OBJECT == tokens[0].type && i + 1 < count; i++)
+	{
+		if (	JSMN_STRING == tokens[i].type && 3 == tokens[i].end - tokens[i].start &&
+			0 == strncmp("job", json+tokens[i].start, 3))
+		{
+			found	= tokens+i+1;
+			break;
+		}
+	}
+	
+	if (	NULL == found || JSMN_STRING != found->type ||
+		found->end - found->start >= SJM_REPLAY_NAME_SIZE)
+	{
+		return false;
+	}
+	memcpy(name, json+found->start, found->end - found->start);
+	name[found->end - found->start]
+				= '\0';
+	
+	return true;
+}
+
+int
+main(
+	int			argc,
+	char			**argv
+)
+{
+	sjm_t			jobmanager;
+	sensor_job_t		job;
+	sjm_capture_reader_t	reader;
+	sjm_replay_stats_t	stats;
+	sjm_replay_name_t	*names;
+	sjm_replay_name_t	*known;
+	sjm_error_t		error;
+	unsigned long long	delay;
+	char			name[SJM_REPLAY_NAME_SIZE];
+	char			*json;
+	double			speed;
+	
+	if (2 > argc || 3 < argc)
+	{
+		fprintf(stderr, "usage: %s <capture-file> [speed]\n", argv[0]);
+		return 2;
+	}
+	speed			= (3 == argc) ? atof(argv[2]) : 1.0;
+	
+	/* Replay into a store of its own, leaving any job store here alone. */
+	if (	SJM_ERROR_OK != ion_init_master_table() ||
+		SJM_ERROR_OK != sjm_init_instance(&jobmanager, SJM_REPLAY_NAME_SIZE, SJM_REPLAY_TOKENS, SJM_INSTANCE_NEW))
+	{
+		fprintf(stderr, "could not create a job manager\n");
+		return 1;
+	}
+	sjm_init_job(&job, sjm_replay_nothing, NULL);
+	
+	/* Stand in for every job named, once each. */
+	names			= NULL;
+	error			= sjm_capture_reader_open(&reader, argv[1]);
+	while (SJM_ERROR_OK == error && SJM_ERROR_OK == (error = sjm_capture_read(&reader, &delay, &json)))
+	{
+		if (!sjm_replay_name_of(json, name))
+		{
+			continue;
+		}
+		for (known = names; NULL != known && 0 != strcmp(known->name, name); known = known->next)
+			;
+		if (NULL == known && NULL != (known = malloc(sizeof(sjm_replay_name_t))))
+		{
+			strcpy(known->name, name);
+			known->next
+				= names;
+			names	= known;
+			sjm_add_job(&jobmanager, name, &job);
+		}
+	}
+	sjm_capture_reader_close(&reader);
+	
+	if (SJM_ERROR_END_OF_CAPTURE == error)
+	{
+		error		= sjm_replay(&jobmanager, argv[1], speed, &stats);
+	}
+	if (SJM_ERROR_OK != error)
+	{
+		fprintf(stderr, "could not replay %s: error %d\n", argv[1], error);
+	}
+	else
+	{
+		printf("requests:   %lu (%lu failed)\n", stats.requests, stats.failures);
+		printf("elapsed:    %.3f s\n", stats.elapsed / 1000000.0);
+		printf("throughput: %.0f requests/s\n", stats.throughput);
+		printf("latency:    p50 %llu us, p90 %llu us, p99 %llu us, p99.9 %llu us, max %llu us\n",
+			stats.p50, stats.p90, stats.p99, stats.p999, stats.max);
+	}
+	
+	while (NULL != names)
+	{
+		known		= names;
+		names		= names->next;
+		free(known);
+	}
+	sjm_delete(&jobmanager);
+	ion_close_master_table();
+	
+	return (SJM_ERROR_OK == error) ? 0 : 1;
+}
@@ -0,0 +1,1340 @@
+/**
+@author		Graeme Douglas
+@brief
+@details
+@copyright	Copyright 2015 Graeme Douglas
+@license	Licensed under the Apache License, Version 2.0 (the "License");
+		you may not use this file except in compliance with the License.
+		You may obtain a copy of the License at
+			http://www.apache.org/licenses/LICENSE-2.0
+
+@par
+		Unless required by applicable law or agreed to in writing,
+		software distributed under the License is distributed on an
+		"AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+		either express or implied. See the License for the specific
+		language governing permissions and limitations under the
+		License.
+*/
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../CuTest.h"
+#include "../../src/iondb/bpptree.h"
+#include "../../src/iondb/bpptreehandler.h"
+
+#define TEST_BPPTREE_FILE	"test_bpptree.idx"
+#define TEST_BPPTREE_KEYS	2000
+#define TEST_BPPTREE_NAME	64
+
+/* Keys in a scrambled order, so that inserts split all over the tree. */
+int test_bpptree_key(int i)
+{
+	return (int)(((long)i * 7919) % TEST_BPPTREE_KEYS);
+}
+
+/* Open a fresh tree of integer keys. */
+bHandleType test_bpptree_open(CuTest *tc, int bufCt, bpp_bool_t pinInternal)
+{
+	bOpenType	info;
+	bHandleType	handle;
+	
+	info.iName		= TEST_BPPTREE_FILE;
+	info.keySize		= sizeof(int);
+	info.dupKeys		= boolean_false;
+	info.sectorSize		= 256;
+	info.comp		= dictionary_compare_signed_value;
+	info.bufCt		= bufCt;
+	info.pinInternal	= pinInternal;
+	info.directIO		= boolean_false;
+	info.packKeys		= boolean_false;
+	info.mapFile		= boolean_false;
+	info.journal		= NULL;
+	CuAssertTrue(tc, bErrOk == bOpen(info, &handle));
+	
+	return handle;
+}
+
+/* Check that every key inserted, and only those, can be found. */
+void test_bpptree_check(CuTest *tc, bHandleType handle, int step)
+{
+	eAdrType	rec;
+	int		key;
+	int		i;
+	
+	for (i = 0; i < TEST_BPPTREE_KEYS; i++)
+	{
+		key	= test_bpptree_key(i);
+		if (0 == key % step)
+		{
+			CuAssertTrue(tc, bErrOk == bFindKey(handle, &key, &rec));
+			CuAssertIntEquals(tc, key * 10, (int)rec);
+		}
+		else
+		{
+			CuAssertTrue(tc, bErrKeyNotFound == bFindKey(handle, &key, &rec));
+		}
+	}
+}
+
+/* With enough buffers for the whole tree, a warm tree needs no reads,
+   and everything written is there after reopening. */
+void test_bpptree_buffers_1(CuTest *tc)
+{
+	bHandleType	handle;
+	eAdrType	rec;
+	bStatsType	before;
+	bStatsType	after;
+	int		key;
+	int		i;
+	
+	ion_fremove(TEST_BPPTREE_FILE);
+	handle		= test_bpptree_open(tc, 1024, boolean_true);
+	for (i = 0; i < TEST_BPPTREE_KEYS; i++)
+	{
+		key	= test_bpptree_key(i);
+		CuAssertTrue(tc, bErrOk == bInsertKey(handle, &key, key * 10));
+	}
+	test_bpptree_check(tc, handle, 1);
+	
+	bStats(handle, &before);
+	test_bpptree_check(tc, handle, 1);
+	bStats(handle, &after);
+	CuAssertIntEquals(tc, before.nDiskReads, after.nDiskReads);
+	CuAssertIntEquals(tc, before.nBufMisses, after.nBufMisses);
+	CuAssertTrue(tc, TEST_BPPTREE_KEYS <= after.nBufHits - before.nBufHits);
+	
+	/* Delete every other key, then check it all lasts. */
+	for (i = 0; i < TEST_BPPTREE_KEYS; i++)
+	{
+		key	= test_bpptree_key(i);
+		if (0 != key % 2)
+		{
+			CuAssertTrue(tc, bErrOk == bDeleteKey(handle, &key, &rec));
+		}
+	}
+	test_bpptree_check(tc, handle, 2);
+	CuAssertTrue(tc, bErrOk == bClose(handle));
+	
+	handle		= test_bpptree_open(tc, 1024, boolean_true);
+	test_bpptree_check(tc, handle, 2);
+	CuAssertTrue(tc, bErrOk == bClose(handle));
+	ion_fremove(TEST_BPPTREE_FILE);
+}
+
+/* With too few buffers for the leaves, pinned internal nodes still
+   keep every lookup to one read at most; the fewest buffers allowed
+   still work. */
+void test_bpptree_buffers_2(CuTest *tc)
+{
+	bHandleType	handle;
+	eAdrType	rec;
+	int		key;
+	bStatsType	before;
+	bStatsType	after;
+	int		i;
+	
+	ion_fremove(TEST_BPPTREE_FILE);
+	handle		= test_bpptree_open(tc, 48, boolean_true);
+	for (i = 0; i < TEST_BPPTREE_KEYS; i++)
+	{
+		key	= test_bpptree_key(i);
+		CuAssertTrue(tc, bErrOk == bInsertKey(handle, &key, key * 10));
+	}
+	test_bpptree_check(tc, handle, 1);
+	
+	for (i = 0; i < TEST_BPPTREE_KEYS; i++)
+	{
+		key	= (i * 13) % TEST_BPPTREE_KEYS;
+		bStats(handle, &before);
+		CuAssertTrue(tc, bErrOk == bFindKey(handle, &key, &rec));
+		bStats(handle, &after);
+		CuAssertTrue(tc, after.nDiskReads - before.nDiskReads <= 1);
+	}
+	CuAssertTrue(tc, bErrOk == bClose(handle));
+	ion_fremove(TEST_BPPTREE_FILE);
+	
+	handle		= test_bpptree_open(tc, 0, boolean_false);
+	for (i = 0; i < TEST_BPPTREE_KEYS; i++)
+	{
+		key	= test_bpptree_key(i);
+		CuAssertTrue(tc, bErrOk == bInsertKey(handle, &key, key * 10));
+	}
+	for (i = 0; i < TEST_BPPTREE_KEYS; i++)
+	{
+		key	= test_bpptree_key(i);
+		if (0 != key % 3)
+		{
+			CuAssertTrue(tc, bErrOk == bDeleteKey(handle, &key, &rec));
+		}
+	}
+	test_bpptree_check(tc, handle, 3);
+	CuAssertTrue(tc, bErrOk == bClose(handle));
+	ion_fremove(TEST_BPPTREE_FILE);
+}
+
+/* Fill a tree with the given page size, then check it reopens with
+   that size whatever size is asked for. */
+void test_bpptree_pages_fill(CuTest *tc, int sectorSize, bpp_bool_t directIO)
+{
+	bOpenType	info;
+	bHandleType	handle;
+	eAdrType	rec;
+	FILE		*file;
+	long		length;
+	int		key;
+	int		i;
+	
+	ion_fremove(TEST_BPPTREE_FILE);
+	info.iName		= TEST_BPPTREE_FILE;
+	info.keySize		= sizeof(int);
+	info.dupKeys		= boolean_false;
+	info.sectorSize		= sectorSize;
+	info.comp		= dictionary_compare_signed_value;
+	info.bufCt		= 16;
+	info.pinInternal	= boolean_true;
+	info.directIO		= directIO;
+	info.packKeys		= boolean_false;
+	info.mapFile		= boolean_false;
+	info.journal		= NULL;
+	CuAssertTrue(tc, bErrOk == bOpen(info, &handle));
+	for (i = 0; i < TEST_BPPTREE_KEYS; i++)
+	{
+		key	= test_bpptree_key(i);
+		CuAssertTrue(tc, bErrOk == bInsertKey(handle, &key, key * 10));
+	}
+	test_bpptree_check(tc, handle, 1);
+	CuAssertTrue(tc, bErrOk == bClose(handle));
+	
+	/* The file is whole pages: a header, the root, then nodes. */
+	file			= fopen(TEST_BPPTREE_FILE, "rb");
+	CuAssertPtrNotNull(tc, file);
+	fseek(file, 0, SEEK_END);
+	length			= ftell(file);
+	fclose(file);
+	CuAssertTrue(tc, 0 == length % sectorSize);
+	CuAssertTrue(tc, 4 * sectorSize <= length);
+	
+	info.sectorSize		= 256;
+	info.directIO		= boolean_false;
+	CuAssertTrue(tc, bErrOk == bOpen(info, &handle));
+	test_bpptree_check(tc, handle, 1);
+	key			= TEST_BPPTREE_KEYS;
+	CuAssertTrue(tc, bErrOk == bInsertKey(handle, &key, key * 10));
+	CuAssertTrue(tc, bErrOk == bClose(handle));
+	
+	info.directIO		= directIO;
+	CuAssertTrue(tc, bErrOk == bOpen(info, &handle));
+	test_bpptree_check(tc, handle, 1);
+	CuAssertTrue(tc, bErrOk == bFindKey(handle, &key, &rec));
+	CuAssertIntEquals(tc, key * 10, (int)rec);
+	CuAssertTrue(tc, bErrOk == bClose(handle));
+	ion_fremove(TEST_BPPTREE_FILE);
+}
+
+/* Pages from 4 KiB to 64 KiB persist, with or without direct I/O,
+   and sizes direct I/O can't use are refused. */
+void test_bpptree_pages_1(CuTest *tc)
+{
+	bOpenType	info;
+	bHandleType	handle;
+	
+	test_bpptree_pages_fill(tc, 4096, boolean_false);
+	test_bpptree_pages_fill(tc, 4096, boolean_true);
+	test_bpptree_pages_fill(tc, 65536, boolean_true);
+	
+	ion_fremove(TEST_BPPTREE_FILE);
+	info.iName		= TEST_BPPTREE_FILE;
+	info.keySize		= sizeof(int);
+	info.dupKeys		= boolean_false;
+	info.sectorSize		= 2048;
+	info.comp		= dictionary_compare_signed_value;
+	info.bufCt		= 16;
+	info.pinInternal	= boolean_true;
+	info.directIO		= boolean_true;
+	info.packKeys		= boolean_false;
+	info.mapFile		= boolean_false;
+	info.journal		= NULL;
+	CuAssertTrue(tc, bErrSectorSize == bOpen(info, &handle));
+	info.sectorSize		= 2 * BPP_MAX_SECTOR_SIZE;
+	info.directIO		= boolean_false;
+	CuAssertTrue(tc, bErrSectorSize == bOpen(info, &handle));
+	ion_fremove(TEST_BPPTREE_FILE);
+}
+
+/* Key i of a kind, with bytes past a string's end set to fill, which
+   compares must ignore. */
+void test_bpptree_prefix_key(char *key, int keySize, ion_dictionary_compare_t comp, int i, char fill)
+{
+	int	value;
+	
+	memset(key, fill, keySize);
+	if (dictionary_compare_signed_value == comp)
+	{
+		value	= i - TEST_BPPTREE_KEYS;
+		memcpy(key, &value, sizeof(value));
+	}
+	else if (dictionary_compare_char_array == comp)
+	{
+		memset(key, 0, keySize);
+		sprintf(key, "job-%011d", i);
+	}
+	else
+	{
+		sprintf(key, "job-%06d", i);
+	}
+}
+
+/* Fill a tree with every other key of a kind, then find each key, and
+   the first key after each one missing. */
+void test_bpptree_prefix_fill(CuTest *tc, int keySize, ion_dictionary_compare_t comp)
+{
+	bOpenType	info;
+	bHandleType	handle;
+	eAdrType	rec;
+	char		key[16];
+	char		mkey[16];
+	char		next[16];
+	int		i;
+	
+	ion_fremove(TEST_BPPTREE_FILE);
+	info.iName		= TEST_BPPTREE_FILE;
+	info.keySize		= keySize;
+	info.dupKeys		= boolean_false;
+	info.sectorSize		= 256;
+	info.comp		= comp;
+	info.bufCt		= 16;
+	info.pinInternal	= boolean_true;
+	info.directIO		= boolean_false;
+	info.packKeys		= boolean_false;
+	info.mapFile		= boolean_false;
+	info.journal		= NULL;
+	CuAssertTrue(tc, bErrOk == bOpen(info, &handle));
+	for (i = 0; i < TEST_BPPTREE_KEYS; i++)
+	{
+		if (0 == test_bpptree_key(i) % 2)
+		{
+			test_bpptree_prefix_key(key, keySize, comp, test_bpptree_key(i), 0x55);
+			CuAssertTrue(tc, bErrOk == bInsertKey(handle, key, test_bpptree_key(i)));
+		}
+	}
+	
+	for (i = 0; i < TEST_BPPTREE_KEYS - 1; i++)
+	{
+		test_bpptree_prefix_key(key, keySize, comp, i, 0x2a);
+		if (0 == i % 2)
+		{
+			CuAssertTrue(tc, bErrOk == bFindKey(handle, key, &rec));
+			CuAssertIntEquals(tc, i, (int)rec);
+		}
+		else
+		{
+			CuAssertTrue(tc, bErrKeyNotFound == bFindKey(handle, key, &rec));
+			CuAssertTrue(tc, bErrOk == bFindFirstGreaterOrEqual(handle, key, mkey, &rec));
+			CuAssertIntEquals(tc, i + 1, (int)rec);
+			test_bpptree_prefix_key(next, keySize, comp, i + 1, 0x55);
+			CuAssertTrue(tc, 0 == comp((ion_key_t)mkey, (ion_key_t)next, keySize));
+		}
+	}
+	test_bpptree_prefix_key(key, keySize, comp, -1, 0x2a);
+	CuAssertTrue(tc, bErrOk == bFindFirstGreaterOrEqual(handle, key, mkey, &rec));
+	CuAssertIntEquals(tc, 0, (int)rec);
+	test_bpptree_prefix_key(key, keySize, comp, TEST_BPPTREE_KEYS, 0x2a);
+	CuAssertTrue(tc, bErrKeyNotFound == bFindKey(handle, key, &rec));
+	CuAssertTrue(tc, bErrOk == bClose(handle));
+	ion_fremove(TEST_BPPTREE_FILE);
+}
+
+/* Searches through key prefixes agree with the compares they stand in
+   for: negative integers, byte arrays longer than a prefix and sharing
+   most of it, and strings with junk past their ends. */
+void test_bpptree_prefix_1(CuTest *tc)
+{
+	test_bpptree_prefix_fill(tc, sizeof(int), dictionary_compare_signed_value);
+	test_bpptree_prefix_fill(tc, 16, dictionary_compare_char_array);
+	test_bpptree_prefix_fill(tc, 16, dictionary_compare_null_terminated_string);
+}
+
+/* Supplies keys 0, 3, 6, ... to a bulk load, going back once by
+   back keys half way if back is set. */
+typedef struct
+{
+	int		next;
+	int		count;
+	int		back;
+} test_bpptree_bulk_t;
+
+bErrType test_bpptree_bulk_next(void *arg, void *key, eAdrType *rec)
+{
+	test_bpptree_bulk_t	*bulk	= arg;
+	int			k;
+	
+	if (bulk->next == bulk->count)
+	{
+		return bErrKeyNotFound;
+	}
+	if (0 != bulk->back && bulk->next == bulk->count / 2)
+	{
+		bulk->next	-= bulk->back;
+		bulk->back	= 0;
+	}
+	k		= 3 * bulk->next++;
+	memcpy(key, &k, sizeof(int));
+	*rec		= k * 10;
+	
+	return bErrOk;
+}
+
+/* Bulk load count keys, check them, then check the tree still takes
+   inserts and deletes. */
+void test_bpptree_bulk_fill(CuTest *tc, int count, int fill)
+{
+	test_bpptree_bulk_t	bulk;
+	bHandleType		handle;
+	eAdrType		rec;
+	bStatsType		before;
+	bStatsType		after;
+	int			key;
+	int			i;
+	
+	ion_fremove(TEST_BPPTREE_FILE);
+	handle		= test_bpptree_open(tc, 16, boolean_true);
+	bulk.next	= 0;
+	bulk.count	= count;
+	bulk.back	= 0;
+	bStats(handle, &before);
+	CuAssertTrue(tc, bErrOk == bBulkLoad(handle, test_bpptree_bulk_next, &bulk, fill));
+	bStats(handle, &after);
+	CuAssertIntEquals(tc, after.nNodesIns - before.nNodesIns, after.nDiskWrites - before.nDiskWrites);
+	
+	/* Every key is there in order, and nothing else. */
+	for (i = 0; i < count; i++)
+	{
+		CuAssertTrue(tc, bErrOk == (i ? bFindNextKey(handle, &key, &rec) : bFindFirstKey(handle, &key, &rec)));
+		CuAssertIntEquals(tc, 3 * i, key);
+		CuAssertIntEquals(tc, key * 10, (int)rec);
+	}
+	CuAssertTrue(tc, bErrKeyNotFound == (count ? bFindNextKey(handle, &key, &rec) : bFindFirstKey(handle, &key, &rec)));
+	for (i = 0; i < 3 * count; i++)
+	{
+		key	= i;
+		CuAssertTrue(tc, (0 == i % 3 ? bErrOk : bErrKeyNotFound) == bFindKey(handle, &key, &rec));
+	}
+	
+	/* Fill in the gaps, then take out all but every ninth key. */
+	for (i = 0; i < 3 * count; i++)
+	{
+		key	= i;
+		if (0 != i % 3)
+		{
+			CuAssertTrue(tc, bErrOk == bInsertKey(handle, &key, key * 10));
+		}
+	}
+	for (i = 0; i < 3 * count; i++)
+	{
+		key	= i;
+		if (0 != i % 9)
+		{
+			CuAssertTrue(tc, bErrOk == bDeleteKey(handle, &key, &rec));
+		}
+	}
+	CuAssertTrue(tc, bErrOk == bClose(handle));
+	
+	handle		= test_bpptree_open(tc, 16, boolean_true);
+	for (i = 0; i < 3 * count; i++)
+	{
+		key	= i;
+		CuAssertTrue(tc, (0 == i % 9 ? bErrOk : bErrKeyNotFound) == bFindKey(handle, &key, &rec));
+	}
+	CuAssertTrue(tc, bErrOk == bClose(handle));
+	ion_fremove(TEST_BPPTREE_FILE);
+}
+
+/* Bulk loads of every shape build trees the rest of the tree code can
+   work with. */
+void test_bpptree_bulk_1(CuTest *tc)
+{
+	int	counts[]	= { 0, 1, 2, 11, 12, 34, 35, 36, 100, 137, 500, 2000 };
+	int	fills[]		= { 0, 75, 1 };
+	int	i;
+	int	j;
+	
+	for (j = 0; j < (int)(sizeof(fills) / sizeof(int)); j++)
+	{
+		for (i = 0; i < (int)(sizeof(counts) / sizeof(int)); i++)
+		{
+			test_bpptree_bulk_fill(tc, counts[i], fills[j]);
+		}
+	}
+}
+
+/* Keys out of order, or a tree already holding keys, are refused, and
+   a refused load leaves the tree empty. */
+void test_bpptree_bulk_2(CuTest *tc)
+{
+	test_bpptree_bulk_t	bulk;
+	bHandleType		handle;
+	eAdrType		rec;
+	int			key;
+	
+	ion_fremove(TEST_BPPTREE_FILE);
+	handle		= test_bpptree_open(tc, 16, boolean_true);
+	bulk.next	= 5;
+	bulk.count	= 500;
+	bulk.back	= 0;
+	CuAssertTrue(tc, bErrOk == bInsertKey(handle, &bulk.next, 0));
+	CuAssertTrue(tc, bErrNotEmpty == bBulkLoad(handle, test_bpptree_bulk_next, &bulk, 0));
+	CuAssertTrue(tc, bErrOk == bDeleteKey(handle, &bulk.next, &rec));
+	CuAssertTrue(tc, bErrOk == bClose(handle));
+	ion_fremove(TEST_BPPTREE_FILE);
+	
+	/* Go back once plenty of nodes are written, to the same key, then
+	   to one before it. */
+	handle		= test_bpptree_open(tc, 16, boolean_true);
+	bulk.next	= 0;
+	bulk.count	= 400;
+	bulk.back	= 1;
+	CuAssertTrue(tc, bErrDupKeys == bBulkLoad(handle, test_bpptree_bulk_next, &bulk, 0));
+	CuAssertTrue(tc, bErrKeyNotFound == bFindFirstKey(handle, &key, &rec));
+	bulk.next	= 0;
+	bulk.back	= 2;
+	CuAssertTrue(tc, bErrKeyOrder == bBulkLoad(handle, test_bpptree_bulk_next, &bulk, 0));
+	CuAssertTrue(tc, bErrKeyNotFound == bFindFirstKey(handle, &key, &rec));
+	bulk.next	= 0;
+	CuAssertTrue(tc, bErrOk == bBulkLoad(handle, test_bpptree_bulk_next, &bulk, 0));
+	CuAssertTrue(tc, bErrOk == bFindLastKey(handle, &key, &rec));
+	CuAssertIntEquals(tc, 3 * 399, key);
+	CuAssertTrue(tc, bErrOk == bClose(handle));
+	ion_fremove(TEST_BPPTREE_FILE);
+}
+
+/* Key i as a job name, mostly shared with its neighbours and padded
+   out with zeros; names ascend with i. */
+void test_bpptree_pack_key(char *key, int i)
+{
+	memset(key, 0, TEST_BPPTREE_NAME);
+	sprintf(key, "site%02d/node%02d/job/%06d", i / 1000, i / 100 % 10, i);
+}
+
+bErrType test_bpptree_pack_next(void *arg, void *key, eAdrType *rec)
+{
+	test_bpptree_bulk_t	*bulk	= arg;
+	
+	if (bulk->next == bulk->count)
+	{
+		return bErrKeyNotFound;
+	}
+	test_bpptree_pack_key(key, bulk->next);
+	*rec		= bulk->next++;
+	
+	return bErrOk;
+}
+
+/* Open a tree of job names, packed or not. */
+bHandleType test_bpptree_pack_open(CuTest *tc, bpp_bool_t packKeys)
+{
+	bOpenType	info;
+	bHandleType	handle;
+	
+	info.iName		= TEST_BPPTREE_FILE;
+	info.keySize		= TEST_BPPTREE_NAME;
+	info.dupKeys		= boolean_false;
+	info.sectorSize		= 2048;
+	info.comp		= dictionary_compare_char_array;
+	info.bufCt		= 16;
+	info.pinInternal	= boolean_false;
+	info.directIO		= boolean_false;
+	info.packKeys		= packKeys;
+	info.mapFile		= boolean_false;
+	info.journal		= NULL;
+	CuAssertTrue(tc, bErrOk == bOpen(info, &handle));
+	
+	return handle;
+}
+
+/* Fill a tree of job names, by insert or bulk load, check them, then
+   delete every other one after reopening the tree as the other kind.
+   Returns the size of the filled tree's file. */
+long test_bpptree_pack_fill(CuTest *tc, bpp_bool_t packKeys, bpp_bool_t bulkLoad)
+{
+	test_bpptree_bulk_t	bulk;
+	bHandleType		handle;
+	eAdrType		rec;
+	FILE			*file;
+	long			length;
+	char			key[TEST_BPPTREE_NAME];
+	char			mkey[TEST_BPPTREE_NAME];
+	char			next[TEST_BPPTREE_NAME];
+	int			i;
+	
+	ion_fremove(TEST_BPPTREE_FILE);
+	handle		= test_bpptree_pack_open(tc, packKeys);
+	if (bulkLoad)
+	{
+		bulk.next	= 0;
+		bulk.count	= TEST_BPPTREE_KEYS;
+		bulk.back	= 0;
+		CuAssertTrue(tc, bErrOk == bBulkLoad(handle, test_bpptree_pack_next, &bulk, 0));
+	}
+	else
+	{
+		for (i = 0; i < TEST_BPPTREE_KEYS; i++)
+		{
+			test_bpptree_pack_key(key, test_bpptree_key(i));
+			CuAssertTrue(tc, bErrOk == bInsertKey(handle, key, test_bpptree_key(i)));
+		}
+	}
+	
+	/* Every name comes back whole, in order, and a name just past
+	   each one finds the next. */
+	for (i = 0; i < TEST_BPPTREE_KEYS; i++)
+	{
+		CuAssertTrue(tc, bErrOk == (i ? bFindNextKey(handle, mkey, &rec) : bFindFirstKey(handle, mkey, &rec)));
+		CuAssertIntEquals(tc, i, (int)rec);
+		test_bpptree_pack_key(key, i);
+		CuAssertTrue(tc, 0 == memcmp(key, mkey, TEST_BPPTREE_NAME));
+	}
+	CuAssertTrue(tc, bErrKeyNotFound == bFindNextKey(handle, mkey, &rec));
+	for (i = 0; i < TEST_BPPTREE_KEYS - 1; i++)
+	{
+		test_bpptree_pack_key(key, i);
+		CuAssertTrue(tc, bErrOk == bFindKey(handle, key, &rec));
+		CuAssertIntEquals(tc, i, (int)rec);
+		strcat(key, "-");
+		CuAssertTrue(tc, bErrKeyNotFound == bFindKey(handle, key, &rec));
+		CuAssertTrue(tc, bErrOk == bFindFirstGreaterOrEqual(handle, key, mkey, &rec));
+		CuAssertIntEquals(tc, i + 1, (int)rec);
+		test_bpptree_pack_key(next, i + 1);
+		CuAssertTrue(tc, 0 == memcmp(next, mkey, TEST_BPPTREE_NAME));
+	}
+	CuAssertTrue(tc, bErrOk == bClose(handle));
+	
+	file		= fopen(TEST_BPPTREE_FILE, "rb");
+	CuAssertPtrNotNull(tc, file);
+	fseek(file, 0, SEEK_END);
+	length		= ftell(file);
+	fclose(file);
+	
+	/* The file, not packKeys, says how the tree is kept. */
+	handle		= test_bpptree_pack_open(tc, packKeys ? boolean_false : boolean_true);
+	for (i = 0; i < TEST_BPPTREE_KEYS; i++)
+	{
+		if (0 != test_bpptree_key(i) % 2)
+		{
+			test_bpptree_pack_key(key, test_bpptree_key(i));
+			CuAssertTrue(tc, bErrOk == bDeleteKey(handle, key, &rec));
+			CuAssertIntEquals(tc, test_bpptree_key(i), (int)rec);
+		}
+	}
+	CuAssertTrue(tc, bErrOk == bClose(handle));
+	
+	handle		= test_bpptree_pack_open(tc, packKeys);
+	for (i = 0; i < TEST_BPPTREE_KEYS; i++)
+	{
+		test_bpptree_pack_key(key, i);
+		CuAssertTrue(tc, (0 == i % 2 ? bErrOk : bErrKeyNotFound) == bFindKey(handle, key, &rec));
+	}
+	CuAssertTrue(tc, bErrOk == bClose(handle));
+	ion_fremove(TEST_BPPTREE_FILE);
+	
+	return length;
+}
+
+/* Packed trees of job names work as unpacked ones do, in a fraction
+   of the file. */
+void test_bpptree_pack_1(CuTest *tc)
+{
+	long	plain;
+	long	packed;
+	
+	plain		= test_bpptree_pack_fill(tc, boolean_false, boolean_false);
+	packed		= test_bpptree_pack_fill(tc, boolean_true, boolean_false);
+	CuAssertTrue(tc, 2 * packed < plain);
+}
+
+/* Bulk loads pack nodes as full as inserts do, or fuller. */
+void test_bpptree_pack_2(CuTest *tc)
+{
+	long	inserted;
+	long	loaded;
+	
+	inserted	= test_bpptree_pack_fill(tc, boolean_true, boolean_false);
+	loaded		= test_bpptree_pack_fill(tc, boolean_true, boolean_true);
+	CuAssertTrue(tc, loaded <= inserted);
+}
+
+/* Open a tree of integer keys, read through a mapping or not. */
+bHandleType test_bpptree_map_open(CuTest *tc, bpp_bool_t mapFile)
+{
+	bOpenType	info;
+	bHandleType	handle;
+	
+	info.iName		= TEST_BPPTREE_FILE;
+	info.keySize		= sizeof(int);
+	info.dupKeys		= boolean_false;
+	info.sectorSize		= 256;
+	info.comp		= dictionary_compare_signed_value;
+	info.bufCt		= 16;
+	info.pinInternal	= boolean_false;
+	info.directIO		= boolean_false;
+	info.packKeys		= boolean_false;
+	info.mapFile		= mapFile;
+	info.journal		= NULL;
+	CuAssertTrue(tc, bErrOk == bOpen(info, &handle));
+	
+	return handle;
+}
+
+/* Lookups in a mapped tree read nodes in place, and changes made
+   between them land in the file. */
+void test_bpptree_map_1(CuTest *tc)
+{
+	bHandleType	handle;
+	eAdrType	rec;
+	bStatsType	before;
+	bStatsType	after;
+	int		key;
+	int		i;
+	
+	ion_fremove(TEST_BPPTREE_FILE);
+	handle		= test_bpptree_map_open(tc, boolean_true);
+	for (i = 0; i < TEST_BPPTREE_KEYS; i++)
+	{
+		key	= test_bpptree_key(i);
+		CuAssertTrue(tc, bErrOk == bInsertKey(handle, &key, key * 10));
+	}
+	CuAssertTrue(tc, bErrOk == bClose(handle));
+	
+	handle		= test_bpptree_map_open(tc, boolean_true);
+	bStats(handle, &before);
+	test_bpptree_check(tc, handle, 1);
+	bStats(handle, &after);
+	CuAssertIntEquals(tc, before.nDiskReads, after.nDiskReads);
+	CuAssertTrue(tc, before.nMapReads < after.nMapReads);
+	
+	/* Take out every odd key, stepping on from the key before it. */
+	for (i = 0; i < TEST_BPPTREE_KEYS / 2; i++)
+	{
+		key	= 2 * i + 1;
+		CuAssertTrue(tc, bErrOk == bDeleteKey(handle, &key, &rec));
+		key	= 2 * i;
+		CuAssertTrue(tc, bErrOk == bFindKey(handle, &key, &rec));
+		if (i + 1 < TEST_BPPTREE_KEYS / 2)
+		{
+			CuAssertTrue(tc, bErrOk == bFindNextKey(handle, &key, &rec));
+			CuAssertIntEquals(tc, 2 * i + 2, key);
+		}
+		else
+		{
+			CuAssertTrue(tc, bErrKeyNotFound == bFindNextKey(handle, &key, &rec));
+		}
+	}
+	test_bpptree_check(tc, handle, 2);
+	CuAssertTrue(tc, bErrOk == bClose(handle));
+	
+	handle		= test_bpptree_map_open(tc, boolean_false);
+	test_bpptree_check(tc, handle, 2);
+	CuAssertTrue(tc, bErrOk == bClose(handle));
+	ion_fremove(TEST_BPPTREE_FILE);
+}
+
+/* Check a scan sees the multiples of step from first to last, and
+   last to first, with 1 added to the record addresses of those below
+   updated. */
+void test_bpptree_snapshot_check(CuTest *tc, bScanType scan, int step, int updated)
+{
+	bErrType	rc;
+	eAdrType	rec;
+	int		seen;
+	int		last;
+	int		key;
+	
+	seen	= 0;
+	last	= -1;
+	for (rc = bScanFirstKey(scan, &key, &rec); bErrOk == rc; rc = bScanNextKey(scan, &key, &rec))
+	{
+		CuAssertTrue(tc, key > last);
+		CuAssertTrue(tc, 0 == key % step);
+		CuAssertIntEquals(tc, key * 10 + (key < updated), (int)rec);
+		seen++;
+		last	= key;
+	}
+	last	= TEST_BPPTREE_KEYS;
+	for (rc = bScanLastKey(scan, &key, &rec); bErrOk == rc; rc = bScanPrevKey(scan, &key, &rec))
+	{
+		CuAssertTrue(tc, key < last);
+		seen--;
+		last	= key;
+	}
+	CuAssertIntEquals(tc, 0, seen);
+}
+
+/* Fill a tree with the even keys, then check snapshots see it as
+   it was as keys are inserted, updated and deleted around them. */
+void test_bpptree_snapshot_fill(CuTest *tc, bpp_bool_t mapFile, bpp_bool_t packKeys)
+{
+	bOpenType	info;
+	bHandleType	handle;
+	bScanType	before;
+	bScanType	between;
+	bScanType	now;
+	eAdrType	rec;
+	int		key;
+	int		i;
+	
+	ion_fremove(TEST_BPPTREE_FILE);
+	info.iName		= TEST_BPPTREE_FILE;
+	info.keySize		= sizeof(int);
+	info.dupKeys		= boolean_false;
+	info.sectorSize		= 256;
+	info.comp		= dictionary_compare_signed_value;
+	info.bufCt		= 16;
+	info.pinInternal	= boolean_true;
+	info.directIO		= boolean_false;
+	info.packKeys		= packKeys;
+	info.mapFile		= mapFile;
+	info.journal		= NULL;
+	CuAssertTrue(tc, bErrOk == bOpen(info, &handle));
+	for (i = 0; i < TEST_BPPTREE_KEYS / 2; i++)
+	{
+		key	= 2 * (test_bpptree_key(i) % (TEST_BPPTREE_KEYS / 2));
+		CuAssertTrue(tc, bErrOk == bInsertKey(handle, &key, key * 10));
+	}
+	
+	/* Splits and updates follow the first snapshot, merges the second. */
+	CuAssertTrue(tc, bErrOk == bOpenSnapshot(handle, &before));
+	for (i = 0; i < TEST_BPPTREE_KEYS / 2; i++)
+	{
+		key	= 2 * (test_bpptree_key(i) % (TEST_BPPTREE_KEYS / 2)) + 1;
+		CuAssertTrue(tc, bErrOk == bInsertKey(handle, &key, key * 10));
+	}
+	for (key = 0; key < TEST_BPPTREE_KEYS / 2; key++)
+	{
+		CuAssertTrue(tc, bErrOk == bUpdateKey(handle, &key, key * 10 + 1));
+	}
+	CuAssertTrue(tc, bErrOk == bOpenSnapshot(handle, &between));
+	for (i = 0; i < TEST_BPPTREE_KEYS; i++)
+	{
+		key	= test_bpptree_key(i);
+		if (0 != key % 4)
+		{
+			CuAssertTrue(tc, bErrOk == bDeleteKey(handle, &key, &rec));
+		}
+	}
+	
+	test_bpptree_snapshot_check(tc, before, 2, 0);
+	test_bpptree_snapshot_check(tc, between, 1, TEST_BPPTREE_KEYS / 2);
+	CuAssertTrue(tc, bErrOk == bOpenScan(handle, &now));
+	test_bpptree_snapshot_check(tc, now, 4, TEST_BPPTREE_KEYS / 2);
+	CuAssertTrue(tc, bScanSnapshot(before));
+	CuAssertTrue(tc, !bScanSnapshot(now));
+	
+	/* A snapshot picks up where it was, wherever changes fall. */
+	key	= 501;
+	CuAssertTrue(tc, bErrOk == bScanFirstGreaterOrEqual(before, &key, &key, &rec));
+	CuAssertIntEquals(tc, 502, key);
+	key	= 0;
+	CuAssertTrue(tc, bErrOk == bDeleteKey(handle, &key, &rec));
+	key	= 504;
+	CuAssertTrue(tc, bErrOk == bDeleteKey(handle, &key, &rec));
+	CuAssertTrue(tc, bErrOk == bScanNextKey(before, &key, &rec));
+	CuAssertIntEquals(tc, 504, key);
+	CuAssertIntEquals(tc, 5040, (int)rec);
+	
+	CuAssertTrue(tc, bErrOk == bCloseScan(before));
+	CuAssertTrue(tc, bErrOk == bCloseScan(between));
+	CuAssertTrue(tc, bErrOk == bCloseScan(now));
+	for (i = 0; i < TEST_BPPTREE_KEYS; i++)
+	{
+		key	= test_bpptree_key(i);
+		if (0 != key % 4)
+		{
+			CuAssertTrue(tc, bErrOk == bInsertKey(handle, &key, key * 10));
+		}
+	}
+	CuAssertTrue(tc, bErrOk == bClose(handle));
+	ion_fremove(TEST_BPPTREE_FILE);
+}
+
+/* Snapshots of plain, mapped and packed trees. */
+void test_bpptree_snapshot_1(CuTest *tc)
+{
+	test_bpptree_snapshot_fill(tc, boolean_false, boolean_false);
+	test_bpptree_snapshot_fill(tc, boolean_true, boolean_false);
+	test_bpptree_snapshot_fill(tc, boolean_false, boolean_true);
+}
+
+#define TEST_BPPTREE_JOURNAL	1024
+
+/* What a tree has journaled since its checkpoint. */
+typedef struct
+{
+	int		count;
+	bAdrType	adr[TEST_BPPTREE_JOURNAL];
+	int		len[TEST_BPPTREE_JOURNAL];
+	char		*old[TEST_BPPTREE_JOURNAL];
+} test_bpptree_journal_t;
+
+bErrType test_bpptree_journal(void *arg, bAdrType adr, int len, void *old)
+{
+	test_bpptree_journal_t	*journal	= arg;
+	
+	if (TEST_BPPTREE_JOURNAL == journal->count)
+	{
+		return bErrMemory;
+	}
+	journal->adr[journal->count]	= adr;
+	journal->len[journal->count]	= len;
+	journal->old[journal->count]	= malloc(len);
+	memcpy(journal->old[journal->count], old, len);
+	journal->count++;
+	
+	return bErrOk;
+}
+
+/* Read what of the tree's file has reached it. */
+char *test_bpptree_read_file(long *size)
+{
+	FILE	*file;
+	char	*bytes;
+	
+	file		= fopen(TEST_BPPTREE_FILE, "rb");
+	fseek(file, 0, SEEK_END);
+	*size		= ftell(file);
+	bytes		= malloc(*size);
+	fseek(file, 0, SEEK_SET);
+	if (1 != fread(bytes, *size, 1, file))
+	{
+		*size	= 0;
+	}
+	fclose(file);
+	
+	return bytes;
+}
+
+/* Whatever reached the file after a checkpoint, putting back what
+   was journaled gives the file as it was then. */
+void test_bpptree_journal_1(CuTest *tc)
+{
+	test_bpptree_journal_t	journal;
+	bOpenType	info;
+	bHandleType	handle;
+	eAdrType	rec;
+	char		*base;
+	char		*now;
+	long		baseSize;
+	long		nowSize;
+	int		key;
+	int		i;
+	int		j;
+	
+	ion_fremove(TEST_BPPTREE_FILE);
+	journal.count		= 0;
+	info.iName		= TEST_BPPTREE_FILE;
+	info.keySize		= sizeof(int);
+	info.dupKeys		= boolean_false;
+	info.sectorSize		= 256;
+	info.comp		= dictionary_compare_signed_value;
+	info.bufCt		= BPP_MIN_BUF_CT + 1;
+	info.pinInternal	= boolean_false;
+	info.directIO		= boolean_false;
+	info.packKeys		= boolean_false;
+	info.mapFile		= boolean_false;
+	info.journal		= test_bpptree_journal;
+	info.journalArg		= &journal;
+	CuAssertTrue(tc, bErrOk == bOpen(info, &handle));
+	
+	/* A new tree has nothing to journal. */
+	for (i = 0; i < TEST_BPPTREE_KEYS / 2; i++)
+	{
+		key	= test_bpptree_key(i);
+		CuAssertTrue(tc, bErrOk == bInsertKey(handle, &key, key * 10));
+	}
+	CuAssertTrue(tc, bErrOk == bCheckpoint(handle));
+	CuAssertIntEquals(tc, 0, journal.count);
+	base		= test_bpptree_read_file(&baseSize);
+	CuAssertTrue(tc, 0 < baseSize);
+	
+	for (i = TEST_BPPTREE_KEYS / 2; i < TEST_BPPTREE_KEYS; i++)
+	{
+		key	= test_bpptree_key(i);
+		CuAssertTrue(tc, bErrOk == bInsertKey(handle, &key, key * 10));
+	}
+	for (i = 0; i < TEST_BPPTREE_KEYS / 2; i += 3)
+	{
+		key	= test_bpptree_key(i);
+		CuAssertTrue(tc, bErrOk == bDeleteKey(handle, &key, &rec));
+	}
+	
+	/* Nodes went out as buffers were replaced, each journaled once,
+	   as it was at the checkpoint. */
+	CuAssertTrue(tc, 0 < journal.count);
+	for (i = 0; i < journal.count; i++)
+	{
+		CuAssertTrue(tc, journal.adr[i] + journal.len[i] <= baseSize);
+		CuAssertTrue(tc, 0 == memcmp(base + journal.adr[i], journal.old[i], journal.len[i]));
+		for (j = 0; j < i; j++)
+		{
+			CuAssertTrue(tc, journal.adr[i] != journal.adr[j]);
+		}
+	}
+	now		= test_bpptree_read_file(&nowSize);
+	CuAssertTrue(tc, baseSize <= nowSize);
+	for (i = 0; i < journal.count; i++)
+	{
+		memcpy(now + journal.adr[i], journal.old[i], journal.len[i]);
+		free(journal.old[i]);
+	}
+	CuAssertTrue(tc, 0 == memcmp(base, now, baseSize));
+	free(base);
+	free(now);
+	
+	/* The checkpoint starts the journal over. */
+	journal.count		= 0;
+	CuAssertTrue(tc, bErrOk == bCheckpoint(handle));
+	for (i = 0; i < journal.count; i++)
+	{
+		free(journal.old[i]);
+	}
+	journal.count		= 0;
+	key			= test_bpptree_key(1);
+	CuAssertTrue(tc, bErrOk == bUpdateKey(handle, &key, 1));
+	CuAssertTrue(tc, bErrOk == bClose(handle));
+	CuAssertIntEquals(tc, 1, journal.count);
+	free(journal.old[0]);
+	ion_fremove(TEST_BPPTREE_FILE);
+}
+
+void test_bpptree_copy_file(CuTest *tc, char *from, char *to)
+{
+	FILE	*in;
+	FILE	*out;
+	char	buffer[4096];
+	size_t	count;
+	
+	in		= fopen(from, "rb");
+	out		= fopen(to, "wb");
+	CuAssertTrue(tc, NULL != in && NULL != out);
+	while (0 < (count = fread(buffer, 1, sizeof(buffer), in)))
+	{
+		CuAssertTrue(tc, count == fwrite(buffer, 1, count, out));
+	}
+	fclose(in);
+	fclose(out);
+}
+
+/* A logged dictionary copied while open, as a crash would leave it,
+   opens with every synced change. */
+void test_bpptree_wal_1(CuTest *tc)
+{
+	dictionary_handler_t		handler;
+	dictionary_t			dictionary;
+	dictionary_t			recovered;
+	ion_dictionary_config_info_t	config;
+	char				from[20];
+	char				to[20];
+	char				*suffix[]	= { "bpt", "val", "wal" };
+	unsigned long			key;
+	unsigned long			value;
+	err_t				error;
+	int				i;
+	
+	bpptree_init(&handler);
+	error		= dictionary_create(
+				&handler,
+				&dictionary,
+				98,
+				key_type_numeric_unsigned,
+				sizeof(unsigned long),
+				sizeof(unsigned long),
+				BPPTREE_WAL
+			);
+	CuAssertTrue(tc, err_ok == error);
+	/* Small enough to checkpoint along the way. */
+	CuAssertTrue(tc, err_ok == bpptree_set_group_commit(&dictionary, 8, 50, 8192));
+	for (i = 0; i < 1000; i++)
+	{
+		key	= i;
+		value	= i;
+		CuAssertTrue(tc, err_ok == dictionary_insert(&dictionary, (ion_key_t)&key, (ion_value_t)&value));
+	}
+	for (i = 0; i < 1000; i += 3)
+	{
+		key	= i;
+		value	= i * 7;
+		CuAssertTrue(tc, err_ok == dictionary_update(&dictionary, (ion_key_t)&key, (ion_value_t)&value));
+	}
+	for (i = 0; i < 1000; i += 5)
+	{
+		key	= i;
+		CuAssertTrue(tc, err_ok == dictionary_delete(&dictionary, (ion_key_t)&key));
+	}
+	CuAssertTrue(tc, err_ok == bpptree_sync(&dictionary));
+	
+	/* A change alone in its group is synced by a poll once it has
+	   waited out the interval. */
+	key		= 1001;
+	value		= 1001;
+	CuAssertTrue(tc, err_ok == dictionary_insert(&dictionary, (ion_key_t)&key, (ion_value_t)&value));
+	usleep(60000);
+	CuAssertTrue(tc, err_ok == bpptree_poll(&dictionary));
+	
+	for (i = 0; i < 3; i++)
+	{
+		sprintf(from, "98.%s", suffix[i]);
+		sprintf(to, "97.%s", suffix[i]);
+		test_bpptree_copy_file(tc, from, to);
+	}
+	
+	config.id		= 97;
+	config.use_type		= 0;
+	config.type		= key_type_numeric_unsigned;
+	config.key_size		= sizeof(unsigned long);
+	config.value_size	= sizeof(unsigned long);
+	config.dictionary_size	= BPPTREE_WAL;
+	CuAssertTrue(tc, err_ok == dictionary_open(&handler, &recovered, &config));
+	for (i = 0; i <= 1001; i++)
+	{
+		key	= i;
+		error	= dictionary_get(&recovered, (ion_key_t)&key, (ion_value_t)&value);
+		if (0 == i % 5)
+		{
+			CuAssertTrue(tc, err_ok != error);
+		}
+		else
+		{
+			CuAssertTrue(tc, err_ok == error);
+			CuAssertTrue(tc, (0 == i % 3 ? i * 7 : i) == value);
+		}
+	}
+	
+	dictionary_delete_dictionary(&recovered);
+	dictionary_delete_dictionary(&dictionary);
+}
+
+#ifdef BPP_THREADS
+#include <pthread.h>
+
+#define TEST_BPPTREE_READERS	4
+#define TEST_BPPTREE_ROUNDS	3
+
+/* What one thread of the threads test does, and how it went. */
+typedef struct
+{
+	bHandleType	handle;
+	int		id;
+	int		failures;
+} test_bpptree_thread_t;
+
+/* Look up every even key, and scan the tree both ways, while odd
+   keys come and go; a snapshot's scans agree with each other. */
+void *test_bpptree_reader(void *arg)
+{
+	test_bpptree_thread_t	*t = arg;
+	bScanType		scan;
+	bScanType		snapshot;
+	bErrType		rc;
+	eAdrType		rec;
+	long			sum;
+	int			round;
+	int			last;
+	int			seen;
+	int			key;
+	int			i;
+
+	if (bErrOk != bOpenScan(t->handle, &scan))
+	{
+		t->failures++;
+		return NULL;
+	}
+	for (round = 0; round < TEST_BPPTREE_ROUNDS; round++)
+	{
+		for (i = 0; i < TEST_BPPTREE_KEYS; i++)
+		{
+			key	= test_bpptree_key(i + t->id) & ~1;
+			if (bErrOk != bFindKey(t->handle, &key, &rec) || rec != key * 10)
+				t->failures++;
+		}
+
+		seen	= 0;
+		last	= -1;
+		for (rc = bScanFirstKey(scan, &key, &rec); bErrOk == rc; rc = bScanNextKey(scan, &key, &rec))
+		{
+			if (key <= last || rec != key * 10)
+				t->failures++;
+			if (0 == key % 2)
+				seen++;
+			last	= key;
+		}
+		if (TEST_BPPTREE_KEYS / 2 != seen)
+			t->failures++;
+
+		seen	= 0;
+		last	= TEST_BPPTREE_KEYS;
+		for (rc = bScanLastKey(scan, &key, &rec); bErrOk == rc; rc = bScanPrevKey(scan, &key, &rec))
+		{
+			if (key >= last || rec != key * 10)
+				t->failures++;
+			if (0 == key % 2)
+				seen++;
+			last	= key;
+		}
+		if (TEST_BPPTREE_KEYS / 2 != seen)
+			t->failures++;
+
+		/* A snapshot sees the same keys both ways. */
+		if (bErrOk != bOpenSnapshot(t->handle, &snapshot))
+		{
+			t->failures++;
+			continue;
+		}
+		seen	= 0;
+		sum	= 0;
+		for (rc = bScanFirstKey(snapshot, &key, &rec); bErrOk == rc; rc = bScanNextKey(snapshot, &key, &rec))
+		{
+			seen++;
+			sum	+= key;
+		}
+		for (rc = bScanLastKey(snapshot, &key, &rec); bErrOk == rc; rc = bScanPrevKey(snapshot, &key, &rec))
+		{
+			seen--;
+			sum	-= key;
+		}
+		if (0 != seen || 0 != sum || !bScanSnapshot(snapshot))
+			t->failures++;
+		bCloseScan(snapshot);
+	}
+	bCloseScan(scan);
+
+	return NULL;
+}
+
+/* Put the odd keys in, and take them out again, round after round;
+   test_bpptree_key spreads over half the keys as it does over all. */
+void *test_bpptree_writer(void *arg)
+{
+	test_bpptree_thread_t	*t = arg;
+	eAdrType		rec;
+	int			round;
+	int			key;
+	int			i;
+
+	for (round = 0; round < TEST_BPPTREE_ROUNDS; round++)
+	{
+		for (i = 0; i < TEST_BPPTREE_KEYS / 2; i++)
+		{
+			key	= 2 * (test_bpptree_key(i) % (TEST_BPPTREE_KEYS / 2)) + 1;
+			if (bErrOk != bInsertKey(t->handle, &key, key * 10))
+				t->failures++;
+		}
+		for (i = 0; i < TEST_BPPTREE_KEYS / 2; i++)
+		{
+			key	= 2 * (test_bpptree_key(i) % (TEST_BPPTREE_KEYS / 2)) + 1;
+			if (bErrOk != bDeleteKey(t->handle, &key, &rec) || rec != key * 10)
+				t->failures++;
+		}
+	}
+
+	return NULL;
+}
+
+/* Run readers alongside a writer on a tree holding the even keys. */
+void test_bpptree_threads_run(CuTest *tc, bpp_bool_t mapFile, bpp_bool_t packKeys)
+{
+	test_bpptree_thread_t	t[TEST_BPPTREE_READERS + 1];
+	pthread_t		thread[TEST_BPPTREE_READERS + 1];
+	bOpenType		info;
+	bHandleType		handle;
+	int			key;
+	int			i;
+
+	ion_fremove(TEST_BPPTREE_FILE);
+	info.iName		= TEST_BPPTREE_FILE;
+	info.keySize		= sizeof(int);
+	info.dupKeys		= boolean_false;
+	info.sectorSize		= 256;
+	info.comp		= dictionary_compare_signed_value;
+	info.bufCt		= 7 + 2 * TEST_BPPTREE_READERS;
+	info.pinInternal	= boolean_true;
+	info.directIO		= boolean_false;
+	info.packKeys		= packKeys;
+	info.mapFile		= mapFile;
+	info.journal		= NULL;
+	CuAssertTrue(tc, bErrOk == bOpen(info, &handle));
+	for (i = 0; i < TEST_BPPTREE_KEYS / 2; i++)
+	{
+		key	= 2 * (test_bpptree_key(i) % (TEST_BPPTREE_KEYS / 2));
+		CuAssertTrue(tc, bErrOk == bInsertKey(handle, &key, key * 10));
+	}
+
+	for (i = 0; i <= TEST_BPPTREE_READERS; i++)
+	{
+		t[i].handle	= handle;
+		t[i].id		= i;
+		t[i].failures	= 0;
+		CuAssertTrue(tc, 0 == pthread_create(&thread[i], NULL, i ? test_bpptree_reader : test_bpptree_writer, &t[i]));
+	}
+	for (i = 0; i <= TEST_BPPTREE_READERS; i++)
+	{
+		pthread_join(thread[i], NULL);
+		CuAssertIntEquals(tc, 0, t[i].failures);
+	}
+
+	CuAssertTrue(tc, bErrOk == bClose(handle));
+	ion_fremove(TEST_BPPTREE_FILE);
+}
+
+/* Lookups and scans see every key that stays put, in order, while
+   other keys are inserted and deleted around them. */
+void test_bpptree_threads_1(CuTest *tc)
+{
+	test_bpptree_threads_run(tc, boolean_false, boolean_false);
+}
+
+/* The same, with nodes read in place and keys packed. */
+void test_bpptree_threads_2(CuTest *tc)
+{
+	test_bpptree_threads_run(tc, boolean_true, boolean_false);
+	test_bpptree_threads_run(tc, boolean_false, boolean_true);
+}
+#endif
+
+CuSuite *BpptreeGetSuite()
+{
+	CuSuite *suite = CuSuiteNew();
+	
+	SUITE_ADD_TEST(suite, test_bpptree_buffers_1);
+	SUITE_ADD_TEST(suite, test_bpptree_buffers_2);
+	SUITE_ADD_TEST(suite, test_bpptree_pages_1);
+	SUITE_ADD_TEST(suite, test_bpptree_prefix_1);
+	SUITE_ADD_TEST(suite, test_bpptree_bulk_1);
+	SUITE_ADD_TEST(suite, test_bpptree_bulk_2);
+	SUITE_ADD_TEST(suite, test_bpptree_pack_1);
+	SUITE_ADD_TEST(suite, test_bpptree_pack_2);
+	SUITE_ADD_TEST(suite, test_bpptree_map_1);
+	SUITE_ADD_TEST(suite, test_bpptree_snapshot_1);
+	SUITE_ADD_TEST(suite, test_bpptree_journal_1);
+	SUITE_ADD_TEST(suite, test_bpptree_wal_1);
+#ifdef BPP_THREADS
+	SUITE_ADD_TEST(suite, test_bpptree_threads_1);
+	SUITE_ADD_TEST(suite, test_bpptree_threads_2);
+#endif
+	
+	return suite;
+}
+
+void runAllTests_bpptree()
+{
+	CuString *output = CuStringNew();
+	CuSuite* suite = BpptreeGetSuite();
+	
+	CuSuiteRun(suite);
+	CuSuiteSummary(suite, output);
+	CuSuiteDetails(suite, output);
+	printf("%s\n", output->buffer);
+	
+	CuSuiteDelete(suite);
+	CuStringDelete(output);
+}
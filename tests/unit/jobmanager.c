@@ -22,6 +22,17 @@
 #include <stdlib.h>
 #include "../CuTest.h"
 #include "../../src/jobmanager.h"
+#include "../../src/jobqueue.h"
+#include "../../src/jobbatch.h"
+#include "../../src/jobring.h"
+#include "../../src/jobshards.h"
+#include "../../src/jobframe.h"
+#include "../../src/jobjson.h"
+#include "../../src/jobserver.h"
+#include "../../src/jobcapture.h"
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
 
 /* These are the test jobs. */
 void testjob_1(void **params, void *returned)
@@ -91,6 +102,120 @@ void testschedulejob_3(void **params, void *returned)
 	printf("Job 3 executed.\n");fflush(stdout);
 }
 
+/* Spins until asked to stop. */
+void testcanceljob_1(void **params, void *returned)
+{
+	while (!sjm_cancel_requested())
+		;
+}
+
+int testcanceljob_runs = 0;
+void testcanceljob_2(void **params, void *returned)
+{
+	testcanceljob_runs++;
+}
+
+/* Each records which job ran, in order. */
+char testorder[16];
+int testorder_length = 0;
+void testorderjob_a(void **params, void *returned) { testorder[testorder_length++] = 'a'; }
+void testorderjob_b(void **params, void *returned) { testorder[testorder_length++] = 'b'; }
+void testorderjob_c(void **params, void *returned) { testorder[testorder_length++] = 'c'; }
+void testorderjob_d(void **params, void *returned) { testorder[testorder_length++] = 'd'; }
+
+void testslowjob(void **params, void *returned)
+{
+	usleep(10000);
+}
+
+/* Sums pairs, either a batch at a time or one at a time. */
+struct testpair { int a; int b; };
+int testbatch_calls = 0;
+void testbatchjob(void *params, void *results, int count)
+{
+	struct testpair	*pairs	= params;
+	int		*sums	= results;
+	int		i;
+	
+	testbatch_calls++;
+	for (i = 0; i < count; i++)
+	{
+		sums[i]	= pairs[i].a + pairs[i].b;
+	}
+}
+
+void testpairjob(void **params, void *returned)
+{
+	struct testpair	*pair	= params[0];
+	
+	*((int *)returned)	= pair->a + pair->b;
+}
+
+/* Sums a pair slowly, noting where its output would go. */
+sjm_ring_t *testbatch_ring = NULL;
+void testslowpairjob(void **params, void *returned)
+{
+	testbatch_calls++;
+	testbatch_ring	= sjm_current_output();
+	usleep(3000);
+	testpairjob(params, returned);
+}
+
+/* Writes a reading to its output ring. */
+int testreading = 0;
+void testoutputjob(void **params, void *returned)
+{
+	sjm_ring_t	*ring	= sjm_current_output();
+	int		*record;
+	
+	record	= sjm_ring_reserve(ring, sizeof(int));
+	if (NULL != record)
+	{
+		*record	= testreading++;
+		sjm_ring_commit(ring, sizeof(int));
+	}
+}
+
+/* Records the parameters it was given. */
+int testbound_number = 0;
+char testbound_text[16];
+void testboundjob(void **params, void *returned)
+{
+	testbound_number	= *((int *)params[0]);
+	strcpy(testbound_text, (char *)params[1]);
+}
+
+int testcapture_total = 0;
+void testcapturejob(void **params, void *returned) { testcapture_total += *((int *)params[0]); }
+
+struct testresumablejob_state { int fd; int total; int *result; };
+sjm_continuation_status_t
+testresumablejob_1(sjm_continuation_t *continuation, void **params, void *returned)
+{
+	struct testresumablejob_state	*state;
+	char				byte;
+	
+	state				= SJM_CONTINUATION_STATE(continuation);
+	SJM_BEGIN(continuation);
+	state->fd			= *((int *)params[0]);
+	state->total			= 0;
+	state->result			= (int *)returned;
+	
+	/* Sleep briefly, then consume bytes until a zero arrives. */
+	SJM_SLEEP_UNTIL(continuation, ms_milliseconds() + 50);
+	while (1)
+	{
+		SJM_WAIT_FD(continuation, state->fd, SJM_WAIT_READ);
+		if (1 != read(state->fd, &byte, 1) || 0 == byte)
+		{
+			break;
+		}
+		state->total		+= byte;
+	}
+	*(state->result)		= state->total;
+	SJM_END(continuation);
+}
+
 sjm_bool_t
 always_activate(
 	sensor_job_t		*job,
@@ -139,7 +264,7 @@ void test_jobmanager_nonjson_generic(
 			);
 	CuAssertTrue(tc, SJM_ERROR_OK == error);
 	
-	job.func	= func;
+	sjm_init_job(&job, func, NULL);
 	error		= sjm_add_job(&jobmanager, jobname, &job);
 	CuAssertTrue(tc, SJM_ERROR_OK == error);
 	
@@ -182,7 +307,7 @@ void test_jobmanager_json_generic(
 			);
 	CuAssertTrue(tc, SJM_ERROR_OK == error);
 	
-	job.func	= func;
+	sjm_init_job(&job, func, NULL);
 	error		= sjm_add_job(&jobmanager, jobname, &job);
 	CuAssertTrue(tc, SJM_ERROR_OK == error);
 	
@@ -288,6 +413,61 @@ void test_jobmanager_nonjson_1(CuTest *tc)
 	CuAssertTrue(tc, x+y == returnval);
 }
 
+/* Names of every length up to the maximum find their jobs, and a
+   longer one is refused rather than cut short. */
+void test_jobmanager_nonjson_2(CuTest *tc)
+{
+	sjm_t		jobmanager;
+	sensor_job_t	job;
+	sjm_error_t	error;
+	void*		params[2];
+	char		jobname[10];
+	int		returnval;
+	int		x;
+	int		y;
+	int		i;
+	
+	params[0]		= &x;
+	params[1]		= &y;
+	
+	error		= ion_init_master_table();
+	CuAssertTrue(tc, SJM_ERROR_OK == error);
+	error		= sjm_init(&jobmanager, 8, 12);
+	CuAssertTrue(tc, SJM_ERROR_OK == error);
+	
+	sjm_init_job(&job, testjob_1, NULL);
+	for (i = 1; i <= 8; i++)
+	{
+		memset(jobname, 0, sizeof(jobname));
+		memset(jobname, 'a', i);
+		error	= sjm_add_job(&jobmanager, jobname, &job);
+		CuAssertTrue(tc, SJM_ERROR_OK == error);
+	}
+	memset(jobname, 'a', 9);
+	error		= sjm_add_job(&jobmanager, jobname, &job);
+	CuAssertTrue(tc, SJM_ERROR_ADD_JOB == error);
+	error		= sjm_perform_job(&jobmanager, jobname, params, &returnval);
+	CuAssertTrue(tc, SJM_ERROR_DICT_GET_FAILURE == error);
+	
+	for (i = 1; i <= 8; i++)
+	{
+		memset(jobname, 0, sizeof(jobname));
+		memset(jobname, 'a', i);
+		x		= i;
+		y		= 1;
+		error	= sjm_perform_job(&jobmanager, jobname, params, &returnval);
+		CuAssertTrue(tc, SJM_ERROR_OK == error);
+		CuAssertIntEquals(tc, i + 1, returnval);
+	}
+	error		= sjm_perform_job(&jobmanager, "b", params, &returnval);
+	CuAssertTrue(tc, SJM_ERROR_DICT_GET_FAILURE == error);
+	
+	error		= sjm_delete(&jobmanager);
+	CuAssertTrue(tc, SJM_ERROR_OK == error);
+	error		= ion_close_master_table();
+	CuAssertTrue(tc, SJM_ERROR_OK == error);
+}
+
 void test_jobmanager_json_1(CuTest *tc)
 {
 	int		maximum_name_size;
@@ -302,7 +482,7 @@ void test_jobmanager_json_1(CuTest *tc)
 	func			= testjob_1;
 	jobname			= "TESTJOB1";
 	json			= "[ \"TESTJOB1\", 1, 2 ]";
-	char			mutablejson[strlen(json)];
+	char			mutablejson[strlen(json)+1];
 	strcpy(mutablejson, json);
 	
 	test_jobmanager_json_generic(
@@ -332,7 +512,7 @@ void test_jobmanager_json_2(CuTest *tc)
 	func			= testjob_2;
 	jobname			= "TESTJOB2";
 	json			= "[ \"TESTJOB2\", 1, 2, false ]";
-	char			mutablejson[strlen(json)];
+	char			mutablejson[strlen(json)+1];
 	strcpy(mutablejson, json);
 	
 	test_jobmanager_json_generic(
@@ -362,7 +542,7 @@ void test_jobmanager_json_3(CuTest *tc)
 	func			= testjob_2;
 	jobname			= "TESTJOB2";
 	json			= "[ \"TESTJOB2\", -7, 2, true ]";
-	char			mutablejson[strlen(json)];
+	char			mutablejson[strlen(json)+1];
 	strcpy(mutablejson, json);
 	
 	test_jobmanager_json_generic(
@@ -393,7 +573,7 @@ void test_jobmanager_json_4(CuTest *tc)
 	func			= testjob_3;
 	jobname			= "TESTJOB3";
 	json			= "[ \"TESTJOB3\", -7, \"2\", true ]";
-	char			mutablejson[strlen(json)];
+	char			mutablejson[strlen(json)+1];
 	strcpy(mutablejson, json);
 	
 	test_jobmanager_json_generic(
@@ -418,8 +598,7 @@ void test_jobmanager_scheduling_1(CuTest *tc)
 	int		num_jobs		= 1;
 	sensor_job_t	jobs[num_jobs];
 	char		*names[num_jobs];
-	jobs[0].func				= testschedulejob_1;
-	jobs[0].needs_execution			= always_activate;
+	sjm_init_job(jobs+0, testschedulejob_1, always_activate);
 	names[0]	= "job1";
 	
 	test_jobmanager_scheduled_generic(
@@ -451,11 +630,9 @@ void test_jobmanager_scheduling_2(CuTest *tc)
 	int		num_jobs		= 2;
 	sensor_job_t	jobs[num_jobs];
 	char		*names[num_jobs];
-	jobs[0].func				= testschedulejob_1;
-	jobs[0].needs_execution			= always_activate;
+	sjm_init_job(jobs+0, testschedulejob_1, always_activate);
 	names[0]	= "job1";
-	jobs[1].func				= testschedulejob_2;
-	jobs[1].needs_execution			= always_activate;
+	sjm_init_job(jobs+1, testschedulejob_2, always_activate);
 	names[1]	= "job2";
 	
 	test_jobmanager_scheduled_generic(
@@ -487,13 +664,14 @@ void test_jobmanager_scheduling_3(CuTest *tc)
 	int		num_jobs		= 2;
 	sensor_job_t	jobs[num_jobs];
 	char		*names[num_jobs];
-	jobs[0].func				= testschedulejob_1;
-	jobs[0].needs_execution			= always_activate;
+	sjm_init_job(jobs+0, testschedulejob_1, always_activate);
 	jobs[0].last_execution_time		= ms_milliseconds();
 	names[0]	= "job1";
-	jobs[1].func				= testschedulejob_2;
-	jobs[1].needs_execution			=
-				activate_if_not_executed_or_scheduled_within_last_second;
+	sjm_init_job(
+		jobs+1,
+		testschedulejob_2,
+		activate_if_not_executed_or_scheduled_within_last_second
+	);
 	jobs[1].last_execution_time		= ms_milliseconds();
 	names[1]	= "job2";
 	
@@ -525,11 +703,1397 @@ void test_jobmanager_scheduling_3(CuTest *tc)
 	);
 }
 
+void test_jobmanager_resumable_1(CuTest *tc)
+{
+	sjm_t		jobmanager;
+	sensor_job_t	job;
+	sjm_error_t	error;
+	int		fds[2];
+	void		*params[1];
+	int		result;
+	char		bytes[]	= { 3, 4, 0 };
+	int		i;
+	
+	CuAssertTrue(tc, 0 == pipe(fds));
+	
+	error		= ion_init_master_table();
+	CuAssertTrue(tc, SJM_ERROR_OK == error);
+	error		= sjm_init(&jobmanager, 10, 5);
+	CuAssertTrue(tc, SJM_ERROR_OK == error);
+	
+	sjm_init_job(&job, NULL, NULL);
+	job.resume	= testresumablejob_1;
+	job.state_size	= sizeof(struct testresumablejob_state);
+	error		= sjm_add_job(&jobmanager, "reader", &job);
+	CuAssertTrue(tc, SJM_ERROR_OK == error);
+	
+	result		= -1;
+	params[0]	= fds;
+	error		= sjm_perform_job(&jobmanager, "reader", params, &result);
+	CuAssertTrue(tc, SJM_ERROR_OK == error);
+	CuAssertTrue(tc, 1 == jobmanager.num_in_flight);
+	
+	/* Still sleeping, and nothing to read yet afterwards. */
+	error		= sjm_resume_jobs(&jobmanager);
+	CuAssertTrue(tc, SJM_ERROR_OK == error);
+	usleep(60000);
+	error		= sjm_resume_jobs(&jobmanager);
+	CuAssertTrue(tc, SJM_ERROR_OK == error);
+	CuAssertTrue(tc, 1 == jobmanager.num_in_flight);
+	CuAssertTrue(tc, -1 == result);
+	
+	for (i = 0; i < 3; i++)
+	{
+		CuAssertTrue(tc, 1 == write(fds[1], bytes+i, 1));
+		error	= sjm_resume_jobs(&jobmanager);
+		CuAssertTrue(tc, SJM_ERROR_OK == error);
+	}
+	CuAssertTrue(tc, 0 == jobmanager.num_in_flight);
+	CuAssertTrue(tc, 7 == result);
+	
+	error		= sjm_delete(&jobmanager);
+	CuAssertTrue(tc, SJM_ERROR_OK == error);
+	error		= ion_close_master_table();
+	CuAssertTrue(tc, SJM_ERROR_OK == error);
+	close(fds[0]);
+	close(fds[1]);
+}
+
+void test_jobmanager_cancel_1(CuTest *tc)
+{
+	sjm_t			jobmanager;
+	sensor_job_t		job;
+	sjm_error_t		error;
+	sjm_job_handle_t	handles[3];
+	char			buffer[10];
+	int			i;
+	
+	error		= ion_init_master_table();
+	CuAssertTrue(tc, SJM_ERROR_OK == error);
+	error		= sjm_init(&jobmanager, 10, 5);
+	CuAssertTrue(tc, SJM_ERROR_OK == error);
+	CuAssertTrue(tc, !sjm_cancel_requested());
+	
+	/* A job that runs until its budget is used up is an overrun. */
+	sjm_init_job(&job, testcanceljob_1, NULL);
+	job.time_budget	= 5;
+	error		= sjm_add_job(&jobmanager, "spin", &job);
+	CuAssertTrue(tc, SJM_ERROR_OK == error);
+	error		= sjm_perform_job(&jobmanager, "spin", NULL, NULL);
+	CuAssertTrue(tc, SJM_ERROR_OK == error);
+	memset(buffer, 0, sizeof(buffer));
+	strcpy(buffer, "spin");
+	dictionary_get(&(jobmanager.dictionary), (ion_key_t)buffer, (ion_value_t)&job);
+	CuAssertTrue(tc, 1 == job.overrun_count);
+	
+	/* Queued work past its deadline is dropped, not run. */
+	testcanceljob_runs	= 0;
+	sjm_init_job(&job, testcanceljob_2, NULL);
+	job.relative_deadline	= 1;
+	error		= sjm_add_job(&jobmanager, "late", &job);
+	CuAssertTrue(tc, SJM_ERROR_OK == error);
+	error		= sjm_queue_job(&jobmanager, "late", NULL);
+	CuAssertTrue(tc, SJM_ERROR_OK == error);
+	usleep(5000);
+	error		= sjm_execute_queued_job(&jobmanager);
+	CuAssertTrue(tc, SJM_ERROR_OK == error);
+	CuAssertTrue(tc, 0 == testcanceljob_runs);
+	CuAssertTrue(tc, 0 == jobmanager.queue.length);
+	memset(buffer, 0, sizeof(buffer));
+	strcpy(buffer, "late");
+	dictionary_get(&(jobmanager.dictionary), (ion_key_t)buffer, (ion_value_t)&job);
+	CuAssertTrue(tc, 1 == job.expired_count);
+	
+	/* Cancellation by handle and by name. */
+	sjm_init_job(&job, testcanceljob_2, NULL);
+	error		= sjm_add_job(&jobmanager, "count", &job);
+	CuAssertTrue(tc, SJM_ERROR_OK == error);
+	for (i = 0; i < 3; i++)
+	{
+		error	= sjm_queue_job(&jobmanager, "count", &handles[i]);
+		CuAssertTrue(tc, SJM_ERROR_OK == error);
+	}
+	CuAssertTrue(tc, SJM_ERROR_OK == sjm_cancel_queued_job(&jobmanager, &handles[1]));
+	CuAssertTrue(tc, SJM_ERROR_NOT_QUEUED == sjm_cancel_queued_job(&jobmanager, &handles[1]));
+	CuAssertTrue(tc, 2 == sjm_cancel_jobs(&jobmanager, "count"));
+	CuAssertTrue(tc, 0 == jobmanager.queue.length);
+	
+	/* A recycled node does not answer to an old handle. */
+	error		= sjm_queue_job(&jobmanager, "count", NULL);
+	CuAssertTrue(tc, SJM_ERROR_OK == error);
+	CuAssertTrue(tc, SJM_ERROR_NOT_QUEUED == sjm_cancel_queued_job(&jobmanager, &handles[0]));
+	CuAssertTrue(tc, SJM_ERROR_NOT_QUEUED == sjm_cancel_queued_job(&jobmanager, &handles[2]));
+	error		= sjm_execute_queued_job(&jobmanager);
+	CuAssertTrue(tc, SJM_ERROR_OK == error);
+	CuAssertTrue(tc, 1 == testcanceljob_runs);
+	
+	/* Enough to force the name index to grow. */
+	for (i = 0; i < 100; i++)
+	{
+		error	= sjm_queue_job(&jobmanager, (i % 2) ? "count" : "late", NULL);
+		CuAssertTrue(tc, SJM_ERROR_OK == error);
+	}
+	CuAssertTrue(tc, 50 == sjm_cancel_jobs(&jobmanager, "count"));
+	CuAssertTrue(tc, 50 == sjm_cancel_jobs(&jobmanager, "late"));
+	CuAssertTrue(tc, NULL == jobmanager.queue.head);
+	
+	error		= sjm_delete(&jobmanager);
+	CuAssertTrue(tc, SJM_ERROR_OK == error);
+	error		= ion_close_master_table();
+	CuAssertTrue(tc, SJM_ERROR_OK == error);
+}
+
+void test_jobmanager_policy_drain(CuTest *tc, sjm_t *jobmanager, char *expected)
+{
+	testorder_length	= 0;
+	while (NULL != jobmanager->queue.head)
+	{
+		CuAssertTrue(tc, SJM_ERROR_OK == sjm_execute_queued_job(jobmanager));
+	}
+	testorder[testorder_length]	= '\0';
+	CuAssertStrEquals(tc, expected, testorder);
+}
+
+void test_jobmanager_policy_1(CuTest *tc)
+{
+	sjm_t			jobmanager;
+	sensor_job_t		job;
+	sjm_error_t		error;
+	sjm_queue_policy_t	policy;
+	sjm_job_handle_t	handle;
+	job_function		funcs[4]	= { testorderjob_a, testorderjob_b, testorderjob_c, testorderjob_d };
+	char			*names[4]	= { "a", "b", "c", "d" };
+	unsigned char		priorities[4]	= { 0, 200, 100, 200 };
+	milliseconds_t		deadlines[4]	= { 3000, 1000, 0, 2000 };
+	int			i;
+	
+	error		= ion_init_master_table();
+	CuAssertTrue(tc, SJM_ERROR_OK == error);
+	error		= sjm_init(&jobmanager, 10, 5);
+	CuAssertTrue(tc, SJM_ERROR_OK == error);
+	for (i = 0; i < 4; i++)
+	{
+		sjm_init_job(&job, funcs[i], NULL);
+		job.priority		= priorities[i];
+		job.relative_deadline	= deadlines[i];
+		error	= sjm_add_job(&jobmanager, names[i], &job);
+		CuAssertTrue(tc, SJM_ERROR_OK == error);
+	}
+	
+	/* FIFO by default. */
+	for (i = 0; i < 4; i++)
+	{
+		CuAssertTrue(tc, SJM_ERROR_OK == sjm_queue_job(&jobmanager, names[i], NULL));
+	}
+	test_jobmanager_policy_drain(tc, &jobmanager, "abcd");
+	
+	/* Highest priority first, equal priorities in arrival order. */
+	sjm_queue_priority_init(&policy);
+	CuAssertTrue(tc, SJM_ERROR_OK == sjm_set_queue_policy(&jobmanager, &policy));
+	for (i = 0; i < 4; i++)
+	{
+		CuAssertTrue(tc, SJM_ERROR_OK == sjm_queue_job(&jobmanager, names[i], NULL));
+	}
+	test_jobmanager_policy_drain(tc, &jobmanager, "bdca");
+	
+	/* A job that has waited long enough overtakes a higher class. */
+	policy.aging	= 1;
+	CuAssertTrue(tc, SJM_ERROR_OK == sjm_set_queue_policy(&jobmanager, &policy));
+	CuAssertTrue(tc, SJM_ERROR_OK == sjm_queue_job(&jobmanager, "c", NULL));
+	usleep(150000);
+	CuAssertTrue(tc, SJM_ERROR_OK == sjm_queue_job(&jobmanager, "b", NULL));
+	test_jobmanager_policy_drain(tc, &jobmanager, "cb");
+	
+	/* Switching policies reorders what is already queued, and
+	   cancelling from the middle of the heap keeps it intact. */
+	sjm_queue_fifo_init(&policy);
+	CuAssertTrue(tc, SJM_ERROR_OK == sjm_set_queue_policy(&jobmanager, &policy));
+	for (i = 0; i < 4; i++)
+	{
+		CuAssertTrue(tc, SJM_ERROR_OK == sjm_queue_job(&jobmanager, names[i], 3 == i ? &handle : NULL));
+	}
+	CuAssertTrue(tc, SJM_ERROR_OK == sjm_queue_job(&jobmanager, "a", NULL));
+	sjm_queue_edf_init(&policy);
+	CuAssertTrue(tc, SJM_ERROR_OK == sjm_set_queue_policy(&jobmanager, &policy));
+	CuAssertTrue(tc, SJM_ERROR_OK == sjm_cancel_queued_job(&jobmanager, &handle));
+	test_jobmanager_policy_drain(tc, &jobmanager, "baac");
+	
+	error		= sjm_delete(&jobmanager);
+	CuAssertTrue(tc, SJM_ERROR_OK == error);
+	error		= ion_close_master_table();
+	CuAssertTrue(tc, SJM_ERROR_OK == error);
+}
+
+void test_jobmanager_admission_1(CuTest *tc)
+{
+	sjm_t			jobmanager;
+	sensor_job_t		job;
+	sjm_error_t		error;
+	sjm_admission_t		admission;
+	int			i;
+	
+	error		= ion_init_master_table();
+	CuAssertTrue(tc, SJM_ERROR_OK == error);
+	error		= sjm_init(&jobmanager, 10, 5);
+	CuAssertTrue(tc, SJM_ERROR_OK == error);
+	sjm_init_job(&job, testcanceljob_2, NULL);
+	CuAssertTrue(tc, SJM_ERROR_OK == sjm_add_job(&jobmanager, "a", &job));
+	job.priority	= 100;
+	CuAssertTrue(tc, SJM_ERROR_OK == sjm_add_job(&jobmanager, "b", &job));
+	sjm_init_job(&job, testcanceljob_2, NULL);
+	job.rate_limit	= 1;
+	job.burst	= 2;
+	CuAssertTrue(tc, SJM_ERROR_OK == sjm_add_job(&jobmanager, "r", &job));
+	sjm_init_job(&job, testslowjob, NULL);
+	CuAssertTrue(tc, SJM_ERROR_OK == sjm_add_job(&jobmanager, "slow", &job));
+	
+	/* A bounded queue is allocated up front and turns jobs away. */
+	sjm_admission_init(&admission);
+	admission.max_depth	= 3;
+	CuAssertTrue(tc, SJM_ERROR_OK == sjm_set_admission(&jobmanager, &admission));
+	CuAssertTrue(tc, 3 == jobmanager.queue.allocated);
+	for (i = 0; i < 3; i++)
+	{
+		CuAssertTrue(tc, SJM_ERROR_OK == sjm_queue_job(&jobmanager, "a", NULL));
+	}
+	CuAssertTrue(tc, SJM_ERROR_JOB_SHED == sjm_queue_job(&jobmanager, "a", NULL));
+	CuAssertTrue(tc, 1 == jobmanager.queue.shed.depth);
+	CuAssertTrue(tc, 3 == jobmanager.queue.allocated);
+	
+	/* Dropping the oldest, then only for more urgent jobs. */
+	admission.depth_policy	= SJM_SHED_DROP_OLDEST;
+	CuAssertTrue(tc, SJM_ERROR_OK == sjm_set_admission(&jobmanager, &admission));
+	CuAssertTrue(tc, SJM_ERROR_OK == sjm_queue_job(&jobmanager, "b", NULL));
+	CuAssertTrue(tc, 3 == jobmanager.queue.length);
+	CuAssertTrue(tc, 0 == strcmp("b", jobmanager.queue.tail->name));
+	admission.depth_policy	= SJM_SHED_DROP_LOWEST_PRIORITY;
+	CuAssertTrue(tc, SJM_ERROR_OK == sjm_set_admission(&jobmanager, &admission));
+	CuAssertTrue(tc, SJM_ERROR_JOB_SHED == sjm_queue_job(&jobmanager, "a", NULL));
+	CuAssertTrue(tc, SJM_ERROR_OK == sjm_queue_job(&jobmanager, "b", NULL));
+	CuAssertTrue(tc, 0 == strcmp("a", jobmanager.queue.head->name));
+	CuAssertTrue(tc, 0 == strcmp("b", jobmanager.queue.head->next->name));
+	CuAssertTrue(tc, 4 == jobmanager.queue.shed.depth);
+	CuAssertTrue(tc, 3 == jobmanager.queue.allocated);
+	CuAssertTrue(tc, SJM_ERROR_OK == sjm_execute_queued_jobs(&jobmanager));
+	CuAssertTrue(tc, NULL == jobmanager.queue.head);
+	
+	/* Rate limits allow a burst, then shed or replace. */
+	CuAssertTrue(tc, SJM_ERROR_OK == sjm_queue_job(&jobmanager, "r", NULL));
+	CuAssertTrue(tc, SJM_ERROR_OK == sjm_queue_job(&jobmanager, "r", NULL));
+	CuAssertTrue(tc, SJM_ERROR_JOB_SHED == sjm_queue_job(&jobmanager, "r", NULL));
+	CuAssertTrue(tc, 1 == jobmanager.queue.shed.rate);
+	admission.rate_policy	= SJM_SHED_DROP_OLDEST;
+	CuAssertTrue(tc, SJM_ERROR_OK == sjm_set_admission(&jobmanager, &admission));
+	CuAssertTrue(tc, SJM_ERROR_OK == sjm_queue_job(&jobmanager, "r", NULL));
+	CuAssertTrue(tc, 2 == jobmanager.queue.length);
+	CuAssertTrue(tc, 2 == jobmanager.queue.shed.rate);
+	CuAssertTrue(tc, 2 == sjm_cancel_jobs(&jobmanager, "r"));
+	
+	/* Out of budget: close admission until the backlog clears. */
+	sjm_admission_init(&admission);
+	admission.tick_budget	= 15;
+	CuAssertTrue(tc, SJM_ERROR_OK == sjm_set_admission(&jobmanager, &admission));
+	for (i = 0; i < 5; i++)
+	{
+		CuAssertTrue(tc, SJM_ERROR_OK == sjm_queue_job(&jobmanager, "slow", NULL));
+	}
+	CuAssertTrue(tc, SJM_ERROR_OK == sjm_execute_queued_jobs(&jobmanager));
+	CuAssertTrue(tc, NULL != jobmanager.queue.head);
+	CuAssertTrue(tc, jobmanager.queue.closed);
+	CuAssertTrue(tc, SJM_ERROR_JOB_SHED == sjm_queue_job(&jobmanager, "a", NULL));
+	CuAssertTrue(tc, 1 == jobmanager.queue.shed.budget);
+	while (jobmanager.queue.closed)
+	{
+		CuAssertTrue(tc, SJM_ERROR_OK == sjm_execute_queued_jobs(&jobmanager));
+	}
+	CuAssertTrue(tc, NULL == jobmanager.queue.head);
+	
+	/* Out of budget: drop what was already waiting. */
+	admission.tick_policy	= SJM_SHED_DROP_OLDEST;
+	CuAssertTrue(tc, SJM_ERROR_OK == sjm_set_admission(&jobmanager, &admission));
+	for (i = 0; i < 5; i++)
+	{
+		CuAssertTrue(tc, SJM_ERROR_OK == sjm_queue_job(&jobmanager, "slow", NULL));
+	}
+	usleep(2000);
+	CuAssertTrue(tc, SJM_ERROR_OK == sjm_execute_queued_jobs(&jobmanager));
+	CuAssertTrue(tc, NULL == jobmanager.queue.head);
+	CuAssertTrue(tc, 1 < jobmanager.queue.shed.budget);
+	CuAssertTrue(tc, !jobmanager.queue.closed);
+	
+	error		= sjm_delete(&jobmanager);
+	CuAssertTrue(tc, SJM_ERROR_OK == error);
+	error		= ion_close_master_table();
+	CuAssertTrue(tc, SJM_ERROR_OK == error);
+}
+
+void test_jobmanager_batch_1(CuTest *tc)
+{
+	sjm_t			jobmanager;
+	sensor_job_t		job;
+	sjm_error_t		error;
+	struct testpair		pairs[100];
+	int			sums[100];
+	sjm_ring_t		ring;
+	int			i;
+	
+	error		= ion_init_master_table();
+	CuAssertTrue(tc, SJM_ERROR_OK == error);
+	error		= sjm_init(&jobmanager, 10, 5);
+	CuAssertTrue(tc, SJM_ERROR_OK == error);
+	sjm_init_job(&job, testpairjob, NULL);
+	job.param_size	= sizeof(struct testpair);
+	job.result_size	= sizeof(int);
+	CuAssertTrue(tc, SJM_ERROR_OK == sjm_add_job(&jobmanager, "single", &job));
+	job.batch	= testbatchjob;
+	CuAssertTrue(tc, SJM_ERROR_OK == sjm_add_job(&jobmanager, "batch", &job));
+	for (i = 0; i < 100; i++)
+	{
+		pairs[i].a	= i;
+		pairs[i].b	= 2*i;
+	}
+	
+	/* One call for the whole batch. */
+	testbatch_calls	= 0;
+	memset(sums, 0, sizeof(sums));
+	error		= sjm_perform_job_batch(&jobmanager, "batch", pairs, sums, 100);
+	CuAssertTrue(tc, SJM_ERROR_OK == error);
+	CuAssertTrue(tc, 1 == testbatch_calls);
+	for (i = 0; i < 100; i++)
+	{
+		CuAssertIntEquals(tc, 3*i, sums[i]);
+	}
+	
+	/* Without a batch entry point, one call per set. */
+	memset(sums, 0, sizeof(sums));
+	error		= sjm_perform_job_batch(&jobmanager, "single", pairs, sums, 100);
+	CuAssertTrue(tc, SJM_ERROR_OK == error);
+	CuAssertIntEquals(tc, 297, sums[99]);
+	
+	/* A name of the longest length allowed is found whole, and one
+	   longer is not cut short onto it. */
+	CuAssertTrue(tc, SJM_ERROR_OK == sjm_add_job(&jobmanager, "batchbatch", &job));
+	testbatch_calls	= 0;
+	memset(sums, 0, sizeof(sums));
+	error		= sjm_perform_job_batch(&jobmanager, "batchbatch", pairs, sums, 100);
+	CuAssertTrue(tc, SJM_ERROR_OK == error);
+	CuAssertTrue(tc, 1 == testbatch_calls);
+	CuAssertIntEquals(tc, 297, sums[99]);
+	error		= sjm_perform_job_batch(&jobmanager, "batchbatchx", pairs, sums, 100);
+	CuAssertTrue(tc, SJM_ERROR_DICT_GET_FAILURE == error);
+	CuAssertTrue(tc, 1 == testbatch_calls);
+	
+	/* Gathered requests run once the batch fills, and on a flush. */
+	testbatch_calls	= 0;
+	memset(sums, 0, sizeof(sums));
+	for (i = 0; i < 100; i++)
+	{
+		error	= sjm_gather_job(&jobmanager, "batch", &pairs[i], &sums[i]);
+		CuAssertTrue(tc, SJM_ERROR_OK == error);
+		error	= sjm_gather_job(&jobmanager, "single", &pairs[i], NULL);
+		CuAssertTrue(tc, SJM_ERROR_OK == error);
+	}
+	CuAssertTrue(tc, 1 == testbatch_calls);
+	CuAssertIntEquals(tc, 3*(SJM_BATCH_SIZE-1), sums[SJM_BATCH_SIZE-1]);
+	CuAssertIntEquals(tc, 0, sums[SJM_BATCH_SIZE]);
+	sjm_flush_batches(&jobmanager);
+	CuAssertTrue(tc, 2 == testbatch_calls);
+	for (i = 0; i < 100; i++)
+	{
+		CuAssertIntEquals(tc, 3*i, sums[i]);
+	}
+	
+	/* A batch runs as one job, with the job's output ring and time
+	   budget; once over budget, the sets left are skipped and the
+	   overrun is recorded. */
+	sjm_init_job(&job, testslowpairjob, NULL);
+	job.param_size	= sizeof(struct testpair);
+	job.result_size	= sizeof(int);
+	job.output	= &ring;
+	job.time_budget	= 1;
+	CuAssertTrue(tc, SJM_ERROR_OK == sjm_add_job(&jobmanager, "slow", &job));
+	testbatch_calls	= 0;
+	memset(sums, 0, sizeof(sums));
+	error		= sjm_perform_job_batch(&jobmanager, "slow", pairs, sums, 100);
+	CuAssertTrue(tc, SJM_ERROR_OK == error);
+	CuAssertIntEquals(tc, 1, testbatch_calls);
+	CuAssertIntEquals(tc, 0, sums[1]);
+	CuAssertTrue(tc, &ring == testbatch_ring);
+	CuAssertTrue(tc, NULL == sjm_current_output());
+	CuAssertTrue(tc, err_ok == dictionary_get_sized(&jobmanager.dictionary, "slow", 4, (ion_value_t)&job));
+	CuAssertIntEquals(tc, 1, job.overrun_count);
+	
+	error		= sjm_delete(&jobmanager);
+	CuAssertTrue(tc, SJM_ERROR_OK == error);
+	error		= ion_close_master_table();
+	CuAssertTrue(tc, SJM_ERROR_OK == error);
+}
+
+void test_jobmanager_ring_1(CuTest *tc)
+{
+	sjm_t			jobmanager;
+	sensor_job_t		job;
+	sjm_error_t		error;
+	sjm_ring_t		shared;
+	sjm_ring_t		own;
+	sjm_ring_t		small;
+	sjm_ring_sink_t		filesink;
+	sjm_ring_sink_t		fdsink;
+	sjm_ring_sink_t		dictsink;
+	dictionary_handler_t	handler;
+	dictionary_t		dictionary;
+	FILE			*file;
+	int			fds[2];
+	int			readings[64];
+	unsigned long		key;
+	char			*text;
+	int			*record;
+	int			i;
+	
+	error		= ion_init_master_table();
+	CuAssertTrue(tc, SJM_ERROR_OK == error);
+	error		= sjm_init(&jobmanager, 10, 5);
+	CuAssertTrue(tc, SJM_ERROR_OK == error);
+	
+	/* Scheduled jobs write to the shared ring; it drains to a file. */
+	file		= tmpfile();
+	CuAssertTrue(tc, NULL != file);
+	sjm_ring_file_sink_init(&filesink, file);
+	CuAssertTrue(tc, SJM_ERROR_OK == sjm_ring_init(&shared, 100, &filesink));
+	CuAssertTrue(tc, 128 == shared.size);
+	jobmanager.output	= &shared;
+	sjm_init_job(&job, testoutputjob, NULL);
+	CuAssertTrue(tc, SJM_ERROR_OK == sjm_add_job(&jobmanager, "shared", &job));
+	testreading	= 0;
+	
+	/* 16 bytes a record: the ninth does not fit until drained, and
+	   records wrap around the end of the ring as it is reused. */
+	for (i = 0; i < 9; i++)
+	{
+		CuAssertTrue(tc, SJM_ERROR_OK == sjm_queue_job(&jobmanager, "shared", NULL));
+	}
+	CuAssertTrue(tc, SJM_ERROR_OK == sjm_execute_queued_jobs(&jobmanager));
+	CuAssertTrue(tc, 8 == testreading);
+	CuAssertTrue(tc, 1 == shared.dropped);
+	CuAssertTrue(tc, SJM_ERROR_OK == sjm_ring_drain(&shared));
+	for (i = 0; i < 20; i++)
+	{
+		CuAssertTrue(tc, SJM_ERROR_OK == sjm_perform_job(&jobmanager, "shared", NULL, NULL));
+		if (0 == i % 3)
+		{
+			CuAssertTrue(tc, SJM_ERROR_OK == sjm_ring_drain(&shared));
+		}
+	}
+	CuAssertTrue(tc, SJM_ERROR_OK == sjm_ring_drain(&shared));
+	CuAssertTrue(tc, 28 == shared.records);
+	rewind(file);
+	CuAssertTrue(tc, 28 == fread(readings, sizeof(int), 64, file));
+	for (i = 0; i < 28; i++)
+	{
+		CuAssertIntEquals(tc, i, readings[i]);
+	}
+	fclose(file);
+	
+	/* A job's own ring, draining to a pipe in one write. */
+	CuAssertTrue(tc, 0 == pipe(fds));
+	sjm_ring_fd_sink_init(&fdsink, fds[1]);
+	CuAssertTrue(tc, SJM_ERROR_OK == sjm_ring_init(&own, 1024, &fdsink));
+	job.output	= &own;
+	CuAssertTrue(tc, SJM_ERROR_OK == sjm_add_job(&jobmanager, "own", &job));
+	testreading	= 0;
+	for (i = 0; i < 10; i++)
+	{
+		CuAssertTrue(tc, SJM_ERROR_OK == sjm_perform_job(&jobmanager, "own", NULL, NULL));
+	}
+	CuAssertTrue(tc, 0 == shared.head - shared.tail);
+	CuAssertTrue(tc, SJM_ERROR_OK == sjm_ring_drain(&own));
+	CuAssertTrue(tc, 10 * sizeof(int) == read(fds[0], readings, sizeof(readings)));
+	CuAssertIntEquals(tc, 9, readings[9]);
+	
+	/* Records that do not fit before the end skip to the start. */
+	CuAssertTrue(tc, SJM_ERROR_OK == sjm_ring_init(&small, 64, &fdsink));
+	for (i = 0; i < 10; i++)
+	{
+		record		= sjm_ring_reserve(&small, 3 * sizeof(int));
+		CuAssertTrue(tc, NULL != record);
+		record[0]	= i;
+		record[1]	= i;
+		record[2]	= i;
+		sjm_ring_commit(&small, 3 * sizeof(int));
+		if (1 == i % 2)
+		{
+			CuAssertTrue(tc, SJM_ERROR_OK == sjm_ring_drain(&small));
+		}
+	}
+	CuAssertTrue(tc, 30 * sizeof(int) == read(fds[0], readings, sizeof(readings)));
+	for (i = 0; i < 30; i++)
+	{
+		CuAssertIntEquals(tc, i / 3, readings[i]);
+	}
+	sjm_ring_delete(&small);
+	close(fds[0]);
+	close(fds[1]);
+	
+	/* Text records into a dictionary, padded to its value size. */
+	bpptree_init(&handler);
+	/* Kept out of the master table, so later managers never reopen it. */
+	error		= dictionary_create(
+				&handler,
+				&dictionary,
+				99,
+				key_type_numeric_unsigned,
+				sizeof(unsigned long),
+				8,
+				-1
+			);
+	CuAssertTrue(tc, err_ok == (err_t)error);
+	sjm_ring_dictionary_sink_init(&dictsink, &dictionary, 100);
+	own.sink	= &dictsink;
+	text		= sjm_ring_reserve(&own, 16);
+	strcpy(text, "abc");
+	sjm_ring_commit(&own, 4);
+	text		= sjm_ring_reserve(&own, 16);
+	strcpy(text, "defghijklm");
+	sjm_ring_commit(&own, 11);
+	CuAssertTrue(tc, SJM_ERROR_OK == sjm_ring_drain(&own));
+	key		= 100;
+	CuAssertTrue(tc, err_ok == dictionary_get(&dictionary, (ion_key_t)&key, (ion_value_t)readings));
+	CuAssertStrEquals(tc, "abc", (char *)readings);
+	key		= 101;
+	CuAssertTrue(tc, err_ok == dictionary_get(&dictionary, (ion_key_t)&key, (ion_value_t)readings));
+	CuAssertTrue(tc, 0 == strncmp("defghijk", (char *)readings, 8));
+	dictionary_delete_dictionary(&dictionary);
+	
+	sjm_ring_delete(&own);
+	sjm_ring_delete(&shared);
+	error		= sjm_delete(&jobmanager);
+	CuAssertTrue(tc, SJM_ERROR_OK == error);
+	error		= ion_close_master_table();
+	CuAssertTrue(tc, SJM_ERROR_OK == error);
+}
+
+void test_jobmanager_bound_1(CuTest *tc)
+{
+	sjm_t			jobmanager;
+	sensor_job_t		job;
+	sjm_error_t		error;
+	char			json[]	= "[42, \"abc\", true]";
+	char			large[SJM_PARAMS_BLOB_SIZE+8];
+	char			buffer[10];
+	char			blob[SJM_PARAMS_BLOB_SIZE];
+	sjm_bound_params_t	*bound;
+	
+	error		= ion_init_master_table();
+	CuAssertTrue(tc, SJM_ERROR_OK == error);
+	error		= sjm_init(&jobmanager, 10, 5);
+	CuAssertTrue(tc, SJM_ERROR_OK == error);
+	sjm_init_job(&job, testboundjob, NULL);
+	error		= sjm_add_job_with_params(&jobmanager, "bound", &job, json);
+	CuAssertTrue(tc, SJM_ERROR_OK == error);
+	CuAssertTrue(tc, 3 == jobmanager.bound->count);
+	CuAssertIntEquals(tc, 1, *((int *)jobmanager.bound->params[2]));
+	
+	/* The encoded form is kept alongside the jobs. */
+	memset(buffer, 0, sizeof(buffer));
+	strcpy(buffer, "bound");
+	CuAssertTrue(tc, err_ok == dictionary_get(&(jobmanager.params_dictionary), (ion_key_t)buffer, (ion_value_t)blob));
+	CuAssertStrEquals(tc, json, blob);
+	
+	/* Scheduled and parameterless runs get the bound parameters. */
+	CuAssertTrue(tc, SJM_ERROR_OK == sjm_queue_job(&jobmanager, "bound", NULL));
+	CuAssertTrue(tc, SJM_ERROR_OK == sjm_execute_queued_job(&jobmanager));
+	CuAssertIntEquals(tc, 42, testbound_number);
+	CuAssertStrEquals(tc, "abc", testbound_text);
+	testbound_number	= 0;
+	CuAssertTrue(tc, SJM_ERROR_OK == sjm_perform_job(&jobmanager, "bound", NULL, NULL));
+	CuAssertIntEquals(tc, 42, testbound_number);
+	
+	/* Without the decoded form, as after opening again, the stored
+	   form is decoded on the next run. */
+	bound		= jobmanager.bound;
+	jobmanager.bound	= NULL;
+	free(bound->params);
+	free(bound);
+	testbound_number	= 0;
+	CuAssertTrue(tc, SJM_ERROR_OK == sjm_perform_job(&jobmanager, "bound", NULL, NULL));
+	CuAssertIntEquals(tc, 42, testbound_number);
+	CuAssertStrEquals(tc, "abc", testbound_text);
+	CuAssertTrue(tc, NULL != jobmanager.bound);
+	
+	/* Rebinding reaches copies that are already queued. */
+	CuAssertTrue(tc, SJM_ERROR_OK == sjm_queue_job(&jobmanager, "bound", NULL));
+	CuAssertTrue(tc, SJM_ERROR_OK == sjm_bind_params(&jobmanager, "bound", "[-7, \"xyz\"]"));
+	CuAssertTrue(tc, SJM_ERROR_OK == sjm_execute_queued_job(&jobmanager));
+	CuAssertIntEquals(tc, -7, testbound_number);
+	CuAssertStrEquals(tc, "xyz", testbound_text);
+	CuAssertTrue(tc, NULL == jobmanager.bound->next);
+	
+	/* Bad parameters leave the old ones in place. */
+	CuAssertTrue(tc, SJM_ERROR_UNSUPPORTED_JSON_FORMAT == sjm_bind_params(&jobmanager, "bound", "[1, [2]]"));
+	memset(large, '1', sizeof(large));
+	large[0]		= '[';
+	large[sizeof(large)-2]	= ']';
+	large[sizeof(large)-1]	= '\0';
+	CuAssertTrue(tc, SJM_ERROR_PARAMS_TOO_LARGE == sjm_bind_params(&jobmanager, "bound", large));
+	CuAssertTrue(tc, SJM_ERROR_OK == sjm_perform_job(&jobmanager, "bound", NULL, NULL));
+	CuAssertIntEquals(tc, -7, testbound_number);
+	
+	error		= sjm_delete(&jobmanager);
+	CuAssertTrue(tc, SJM_ERROR_OK == error);
+	error		= ion_close_master_table();
+	CuAssertTrue(tc, SJM_ERROR_OK == error);
+}
+
+void test_jobmanager_prepared_1(CuTest *tc)
+{
+	sjm_t			jobmanager;
+	sensor_job_t		job;
+	sjm_error_t		error;
+	sjm_prepared_t		prepared;
+	int			returnval;
+	char			json[]	= "[ \"TESTJOB2\", -7, 2, true ]";
+	
+	error		= ion_init_master_table();
+	CuAssertTrue(tc, SJM_ERROR_OK == error);
+	error		= sjm_init(&jobmanager, 10, 6);
+	CuAssertTrue(tc, SJM_ERROR_OK == error);
+	sjm_init_job(&job, testjob_2, NULL);
+	CuAssertTrue(tc, SJM_ERROR_OK == sjm_add_job(&jobmanager, "TESTJOB2", &job));
+	sjm_init_job(&job, testboundjob, NULL);
+	CuAssertTrue(tc, SJM_ERROR_OK == sjm_add_job(&jobmanager, "bound", &job));
+	
+	/* The single pass request path is unchanged. */
+	CuAssertTrue(tc, SJM_ERROR_OK == sjm_request_job(&jobmanager, json, &returnval));
+	CuAssertIntEquals(tc, -5, returnval);
+	CuAssertStrEquals(tc, "[ \"TESTJOB2\", -7, 2, true ]", json);
+	
+	/* Placeholders mixed with constants. */
+	error		= sjm_prepare(&jobmanager, &prepared, "[\"TESTJOB2\", %d, 10, %d]");
+	CuAssertTrue(tc, SJM_ERROR_OK == error);
+	CuAssertIntEquals(tc, 3, prepared.count);
+	CuAssertIntEquals(tc, 2, prepared.num_args);
+	CuAssertTrue(tc, SJM_ERROR_OK == sjm_execute_prepared(&prepared, &returnval, 5, 1));
+	CuAssertIntEquals(tc, 15, returnval);
+	CuAssertTrue(tc, SJM_ERROR_OK == sjm_execute_prepared(&prepared, &returnval, 4, 0));
+	CuAssertIntEquals(tc, -14, returnval);
+	sjm_prepared_delete(&prepared);
+	
+	error		= sjm_prepare(&jobmanager, &prepared, "[\"bound\", %d, %s]");
+	CuAssertTrue(tc, SJM_ERROR_OK == error);
+	CuAssertTrue(tc, SJM_ERROR_OK == sjm_execute_prepared(&prepared, NULL, 12, "channel"));
+	CuAssertIntEquals(tc, 12, testbound_number);
+	CuAssertStrEquals(tc, "channel", testbound_text);
+	sjm_prepared_delete(&prepared);
+	
+	/* Constants only. */
+	error		= sjm_prepare(&jobmanager, &prepared, "[\"bound\", 3, \"abc\"]");
+	CuAssertTrue(tc, SJM_ERROR_OK == error);
+	CuAssertTrue(tc, SJM_ERROR_OK == sjm_execute_prepared(&prepared, NULL));
+	CuAssertIntEquals(tc, 3, testbound_number);
+	CuAssertStrEquals(tc, "abc", testbound_text);
+	sjm_prepared_delete(&prepared);
+	
+	CuAssertTrue(tc, SJM_ERROR_DICT_GET_FAILURE == sjm_prepare(&jobmanager, &prepared, "[\"missing\", %d]"));
+	CuAssertTrue(tc, SJM_ERROR_UNSUPPORTED_JSON_FORMAT == sjm_prepare(&jobmanager, &prepared, "[\"bound\", [1]]"));
+	CuAssertTrue(tc, SJM_ERROR_UNSUPPORTED_JSON_FORMAT == sjm_prepare(&jobmanager, &prepared, "[3, %d]"));
+	
+	error		= sjm_delete(&jobmanager);
+	CuAssertTrue(tc, SJM_ERROR_OK == error);
+	error		= ion_close_master_table();
+	CuAssertTrue(tc, SJM_ERROR_OK == error);
+}
+
+void test_jobmanager_named_1(CuTest *tc)
+{
+	sjm_t			jobmanager;
+	sensor_job_t		job;
+	sjm_error_t		error;
+	sjm_param_names_t	*declared;
+	int			returnval;
+	char			*names[]	= { "x", "y", "add" };
+	char			*many[SJM_NAMED_PARAMS_MAX+1];
+	char			text[SJM_NAMED_PARAMS_MAX+1][5];
+	char			json[96];
+	int			i;
+	int			j;
+	
+	error		= ion_init_master_table();
+	CuAssertTrue(tc, SJM_ERROR_OK == error);
+	error		= sjm_init(&jobmanager, 10, 12);
+	CuAssertTrue(tc, SJM_ERROR_OK == error);
+	sjm_init_job(&job, testjob_2, NULL);
+	CuAssertTrue(tc, SJM_ERROR_OK == sjm_add_job(&jobmanager, "TESTJOB2", &job));
+	CuAssertTrue(tc, SJM_ERROR_OK == sjm_add_job(&jobmanager, "other", &job));
+	
+	/* Without declared names, only arrays will do. */
+	strcpy(json, "{\"job\":\"TESTJOB2\",\"args\":{\"x\":1,\"y\":2,\"add\":true}}");
+	CuAssertTrue(tc, SJM_ERROR_UNSUPPORTED_JSON_FORMAT == sjm_request_job(&jobmanager, json, &returnval));
+	
+	CuAssertTrue(tc, SJM_ERROR_OK == sjm_declare_params(&jobmanager, "TESTJOB2", names, 3));
+	CuAssertTrue(tc, SJM_ERROR_OK == sjm_request_job(&jobmanager, json, &returnval));
+	CuAssertIntEquals(tc, 3, returnval);
+	
+	/* The stored job only says it has names.  Without them hashed,
+	   as after opening again, they are read back and hashed anew. */
+	CuAssertTrue(tc, err_ok == dictionary_get_sized(&jobmanager.dictionary, "TESTJOB2", 8, (ion_value_t)&job));
+	CuAssertTrue(tc, job.named);
+	declared	= jobmanager.declared;
+	jobmanager.declared	= NULL;
+	free(declared);
+	CuAssertTrue(tc, SJM_ERROR_OK == sjm_request_job(&jobmanager, json, &returnval));
+	CuAssertIntEquals(tc, 3, returnval);
+	CuAssertTrue(tc, NULL != jobmanager.declared);
+	CuAssertTrue(tc, NULL == jobmanager.declared->next);
+	CuAssertStrEquals(tc, "add", jobmanager.declared->names[2]);
+	
+	/* Any member and argument order gives the declared layout. */
+	strcpy(json, "{ \"args\": { \"add\": false, \"y\": 2, \"x\": 5 }, \"job\": \"TESTJOB2\" }");
+	CuAssertTrue(tc, SJM_ERROR_OK == sjm_request_job(&jobmanager, json, &returnval));
+	CuAssertIntEquals(tc, -7, returnval);
+	strcpy(json, "[\"TESTJOB2\", 1, 1, true]");
+	CuAssertTrue(tc, SJM_ERROR_OK == sjm_request_job(&jobmanager, json, &returnval));
+	CuAssertIntEquals(tc, 2, returnval);
+	
+	/* Unknown, missing and repeated arguments. */
+	strcpy(json, "{\"job\":\"TESTJOB2\",\"args\":{\"x\":1,\"z\":2,\"add\":true}}");
+	CuAssertTrue(tc, SJM_ERROR_UNSUPPORTED_JSON_FORMAT == sjm_request_job(&jobmanager, json, &returnval));
+	strcpy(json, "{\"job\":\"TESTJOB2\",\"args\":{\"x\":1,\"add\":true}}");
+	CuAssertTrue(tc, SJM_ERROR_UNSUPPORTED_JSON_FORMAT == sjm_request_job(&jobmanager, json, &returnval));
+	strcpy(json, "{\"job\":\"TESTJOB2\",\"args\":{\"x\":1,\"x\":2,\"add\":true}}");
+	CuAssertTrue(tc, SJM_ERROR_UNSUPPORTED_JSON_FORMAT == sjm_request_job(&jobmanager, json, &returnval));
+	strcpy(json, "{\"job\":\"missing\",\"args\":{}}");
+	CuAssertTrue(tc, SJM_ERROR_DICT_GET_FAILURE == sjm_request_job(&jobmanager, json, &returnval));
+	
+	/* Top-level values outside any array or object. */
+	strcpy(json, "1,2");
+	CuAssertTrue(tc, SJM_ERROR_UNSUPPORTED_JSON_FORMAT == sjm_request_job(&jobmanager, json, &returnval));
+	strcpy(json, ",\"TESTJOB2\",1");
+	CuAssertTrue(tc, SJM_ERROR_UNSUPPORTED_JSON_FORMAT == sjm_request_job(&jobmanager, json, &returnval));
+	
+	/* Repeated names cannot be declared. */
+	names[1]	= "x";
+	CuAssertTrue(tc, SJM_ERROR_UNSUPPORTED_JSON_FORMAT == sjm_declare_params(&jobmanager, "other", names, 3));
+	
+	/* Every name finds its own slot, however many there are. */
+	for (i = 0; i <= SJM_NAMED_PARAMS_MAX; i++)
+	{
+		sprintf(text[i], "p%d", i);
+		many[i]	= text[i];
+	}
+	CuAssertTrue(tc, SJM_ERROR_PARAMS_TOO_LARGE == sjm_declare_params(&jobmanager, "other", many, SJM_NAMED_PARAMS_MAX+1));
+	memset(json, 'n', sizeof(json) - 1);
+	json[sizeof(json) - 1]	= '\0';
+	for (i = 0; i < SJM_NAMES_BLOB_SIZE / (int)sizeof(json) + 1; i++)
+	{
+		many[i]	= json;
+	}
+	CuAssertTrue(tc, SJM_ERROR_PARAMS_TOO_LARGE == sjm_declare_params(&jobmanager, "other", many, i));
+	for (i = 0; i <= SJM_NAMED_PARAMS_MAX; i++)
+	{
+		many[i]	= text[i];
+	}
+	CuAssertTrue(tc, SJM_ERROR_OK == sjm_declare_params(&jobmanager, "other", many, 40));
+	CuAssertTrue(tc, SJM_ERROR_OK == sjm_declare_params(&jobmanager, "other", many, SJM_NAMED_PARAMS_MAX));
+	for (declared = jobmanager.declared, j = 0; NULL != declared; declared = declared->next, j++)
+	{
+		if (0 != strcmp("other", declared->name))
+		{
+			continue;
+		}
+		for (i = 0, returnval = 0; i <= (int)declared->mask; i++)
+		{
+			returnval	+= declared->table[i];
+		}
+		CuAssertIntEquals(tc, SJM_NAMED_PARAMS_MAX * (SJM_NAMED_PARAMS_MAX + 1) / 2, returnval);
+	}
+	CuAssertIntEquals(tc, 2, j);
+	
+	error		= sjm_delete(&jobmanager);
+	CuAssertTrue(tc, SJM_ERROR_OK == error);
+	error		= ion_close_master_table();
+	CuAssertTrue(tc, SJM_ERROR_OK == error);
+}
+
+void test_jobmanager_restart_1(CuTest *tc)
+{
+	sjm_t			jobmanager;
+	sensor_job_t		job;
+	sjm_error_t		error;
+	char			*names[]	= { "x", "y", "add" };
+	char			json[64];
+	int			returnval;
+	pid_t			child;
+	int			status;
+	
+	/* The first job manager is never deleted or closed; its process
+	   just ends once the log has had a chance to sync. */
+	child		= fork();
+	CuAssertTrue(tc, -1 != child);
+	if (0 == child)
+	{
+		if (	SJM_ERROR_OK != ion_init_master_table() ||
+			SJM_ERROR_OK != sjm_init(&jobmanager, 10, 12))
+		{
+			_exit(1);
+		}
+		sjm_init_job(&job, testjob_2, NULL);
+		if (	SJM_ERROR_OK != sjm_add_job(&jobmanager, "TESTJOB2", &job) ||
+			SJM_ERROR_OK != sjm_declare_params(&jobmanager, "TESTJOB2", names, 3))
+		{
+			_exit(1);
+		}
+		sjm_init_job(&job, testboundjob, NULL);
+		if (SJM_ERROR_OK != sjm_add_job_with_params(&jobmanager, "bound", &job, "[42, \"abc\"]"))
+		{
+			_exit(1);
+		}
+		usleep((BPPTREE_WAL_INTERVAL + 10) * 1000);
+		_exit(SJM_ERROR_OK == sjm_queue_scheduled_jobs(&jobmanager) ? 0 : 1);
+	}
+	CuAssertTrue(tc, child == waitpid(child, &status, 0));
+	CuAssertTrue(tc, WIFEXITED(status) && 0 == WEXITSTATUS(status));
+	
+	/* A store is only reopened with the name size it was made with. */
+	error		= ion_init_master_table();
+	CuAssertTrue(tc, SJM_ERROR_OK == error);
+	error		= sjm_init(&jobmanager, 12, 12);
+	CuAssertTrue(tc, SJM_ERROR_DICT_INITIALIZATION == error);
+	
+	/* Jobs, bound parameters and declared names all come back. */
+	error		= sjm_init(&jobmanager, 10, 12);
+	CuAssertTrue(tc, SJM_ERROR_OK == error);
+	testbound_number	= 0;
+	CuAssertTrue(tc, SJM_ERROR_OK == sjm_perform_job(&jobmanager, "bound", NULL, NULL));
+	CuAssertIntEquals(tc, 42, testbound_number);
+	CuAssertStrEquals(tc, "abc", testbound_text);
+	strcpy(json, "{\"job\":\"TESTJOB2\",\"args\":{\"x\":1,\"y\":2,\"add\":true}}");
+	CuAssertTrue(tc, SJM_ERROR_OK == sjm_request_job(&jobmanager, json, &returnval));
+	CuAssertIntEquals(tc, 3, returnval);
+	
+	/* Deleting removes the store, so the next one starts empty. */
+	error		= sjm_delete(&jobmanager);
+	CuAssertTrue(tc, SJM_ERROR_OK == error);
+	error		= sjm_init(&jobmanager, 10, 12);
+	CuAssertTrue(tc, SJM_ERROR_OK == error);
+	CuAssertTrue(tc, SJM_ERROR_DICT_GET_FAILURE == sjm_perform_job(&jobmanager, "bound", NULL, NULL));
+	error		= sjm_delete(&jobmanager);
+	CuAssertTrue(tc, SJM_ERROR_OK == error);
+	error		= ion_close_master_table();
+	CuAssertTrue(tc, SJM_ERROR_OK == error);
+}
+
+void test_jobmanager_frame_1(CuTest *tc)
+{
+	sjm_t			jobmanager;
+	sensor_job_t		job;
+	sjm_error_t		error;
+	sjm_frame_writer_t	writer;
+	sjm_frame_t		frame;
+	unsigned char		buffer[64];
+	unsigned char		stream[128];
+	unsigned char		*encoded;
+	void			*result;
+	int			length;
+	int			consumed;
+	int			returnval;
+	int			i;
+	
+	error		= ion_init_master_table();
+	CuAssertTrue(tc, SJM_ERROR_OK == error);
+	error		= sjm_init(&jobmanager, 10, 5);
+	CuAssertTrue(tc, SJM_ERROR_OK == error);
+	sjm_init_job(&job, testjob_2, NULL);
+	CuAssertTrue(tc, SJM_ERROR_OK == sjm_add_job(&jobmanager, "TESTJOB2", &job));
+	sjm_init_job(&job, testboundjob, NULL);
+	CuAssertTrue(tc, SJM_ERROR_OK == sjm_add_job(&jobmanager, "bound", &job));
+	
+	/* Much smaller than the same request as JSON. */
+	sjm_frame_begin(&writer, buffer, sizeof(buffer), "TESTJOB2");
+	sjm_frame_add_int(&writer, -7);
+	sjm_frame_add_int(&writer, 2);
+	sjm_frame_add_int(&writer, 1);
+	CuAssertTrue(tc, SJM_ERROR_OK == sjm_frame_finish(&writer, &encoded, &length));
+	CuAssertIntEquals(tc, 19, length);
+	CuAssertTrue(tc, length < (int)strlen("[\"TESTJOB2\",-7,2,true]"));
+	memcpy(stream, encoded, length);
+	
+	/* Large integers are aligned and used in place; strings too. */
+	sjm_frame_begin(&writer, buffer, sizeof(buffer), "bound");
+	sjm_frame_add_int(&writer, 123456789);
+	sjm_frame_add_string(&writer, "abc");
+	CuAssertTrue(tc, SJM_ERROR_OK == sjm_frame_finish(&writer, &encoded, &length));
+	memcpy(stream + 19, encoded, length);
+	
+	/* Frames arrive in pieces, back to back. */
+	CuAssertTrue(tc, SJM_ERROR_FRAME_INCOMPLETE == sjm_frame_decode(stream, 0, &frame, &consumed));
+	CuAssertTrue(tc, SJM_ERROR_FRAME_INCOMPLETE == sjm_frame_decode(stream, 18, &frame, &consumed));
+	CuAssertTrue(tc, SJM_ERROR_OK == sjm_frame_request_job(&jobmanager, stream, 19 + length, &returnval, &consumed));
+	CuAssertIntEquals(tc, 19, consumed);
+	CuAssertIntEquals(tc, -5, returnval);
+	CuAssertTrue(tc, SJM_ERROR_OK == sjm_frame_decode(stream + 19, length, &frame, &consumed));
+	CuAssertIntEquals(tc, length, consumed);
+	CuAssertIntEquals(tc, 2, frame.count);
+	CuAssertStrEquals(tc, "bound", frame.name);
+	CuAssertIntEquals(tc, 123456789, *((int *)frame.params[0]));
+	CuAssertTrue(tc, (unsigned char *)frame.params[1] > stream + 19 && (unsigned char *)frame.params[1] < stream + 19 + length);
+	CuAssertTrue(tc, SJM_ERROR_OK == sjm_frame_request_job(&jobmanager, stream + 19, length, NULL, &consumed));
+	CuAssertIntEquals(tc, 123456789, testbound_number);
+	CuAssertStrEquals(tc, "abc", testbound_text);
+	
+	/* Every single corrupted byte is caught. */
+	for (i = 0; i < 19; i++)
+	{
+		stream[i]	^= 0x10;
+		error		= sjm_frame_decode(stream, 19, &frame, &consumed);
+		CuAssertTrue(tc, SJM_ERROR_OK != error);
+		stream[i]	^= 0x10;
+	}
+	
+	/* Too many arguments, or not enough room. */
+	sjm_frame_begin(&writer, buffer, sizeof(buffer), "TESTJOB2");
+	for (i = 0; i <= SJM_FRAME_ARGS_MAX; i++)
+	{
+		sjm_frame_add_int(&writer, i);
+	}
+	CuAssertTrue(tc, SJM_ERROR_FRAME_TOO_LARGE == sjm_frame_finish(&writer, &encoded, &length));
+	sjm_frame_begin(&writer, buffer, 12, "TESTJOB2");
+	sjm_frame_add_string(&writer, "abc");
+	CuAssertTrue(tc, SJM_ERROR_FRAME_TOO_LARGE == sjm_frame_finish(&writer, &encoded, &length));
+	
+	/* Responses. */
+	returnval	= -5;
+	CuAssertTrue(tc, SJM_ERROR_OK == sjm_frame_encode_response(buffer, sizeof(buffer), SJM_ERROR_OK, &returnval, sizeof(int), &encoded, &length));
+	CuAssertIntEquals(tc, 1 + 1 + sizeof(int) + SJM_FRAME_CRC_SIZE, length);
+	returnval	= 0;
+	CuAssertTrue(tc, SJM_ERROR_OK == sjm_frame_decode_response(encoded, length, &error, &result, &i, &consumed));
+	CuAssertTrue(tc, SJM_ERROR_OK == error);
+	CuAssertIntEquals(tc, sizeof(int), i);
+	memcpy(&returnval, result, sizeof(int));
+	CuAssertIntEquals(tc, -5, returnval);
+	
+	error		= sjm_delete(&jobmanager);
+	CuAssertTrue(tc, SJM_ERROR_OK == error);
+	error		= ion_close_master_table();
+	CuAssertTrue(tc, SJM_ERROR_OK == error);
+}
+
+void testwriterjob(void **params, void *returned)
+{
+	sjm_json_writer_t	*writer;
+	
+	writer			= (sjm_json_writer_t *)returned;
+	sjm_json_int(writer, 2 * *((int *)params[0]));
+	sjm_json_begin_object(writer);
+	sjm_json_key(writer, "ok");
+	sjm_json_bool(writer, true);
+	sjm_json_end_object(writer);
+}
+
+struct test_json_sink { char text[256]; int length; int calls; };
+sjm_bool_t test_json_sink_flush(void *state, const char *data, int length)
+{
+	struct test_json_sink	*sink;
+	
+	sink			= (struct test_json_sink *)state;
+	memcpy(sink->text + sink->length, data, length);
+	sink->length		+= length;
+	sink->text[sink->length]= '\0';
+	sink->calls++;
+	return true;
+}
+
+void test_jobmanager_json_writer_1(CuTest *tc)
+{
+	sjm_t			jobmanager;
+	sensor_job_t		job;
+	sjm_error_t		error;
+	sjm_json_writer_t	writer;
+	struct test_json_sink	sink;
+	char			buffer[128];
+	char			small[24];
+	char			json[32];
+	
+	/* Formatting, with separators placed automatically. */
+	sjm_json_init(&writer, buffer, sizeof(buffer), NULL, NULL);
+	sjm_json_begin_array(&writer);
+	sjm_json_int(&writer, 0);
+	sjm_json_int(&writer, -1234567890L);
+	sjm_json_double(&writer, 3.14159, 2);
+	sjm_json_double(&writer, -0.001, 2);
+	sjm_json_double(&writer, 2.5, 0);
+	sjm_json_double(&writer, -10.05, 3);
+	sjm_json_double(&writer, 0.0 / 0.0, 2);
+	sjm_json_double(&writer, 1e30, 2);
+	sjm_json_begin_object(&writer);
+	sjm_json_key(&writer, "s");
+	sjm_json_string(&writer, "a\"b\\c\nd\x01");
+	sjm_json_key(&writer, "e");
+	sjm_json_begin_array(&writer);
+	sjm_json_end_array(&writer);
+	sjm_json_end_object(&writer);
+	sjm_json_null(&writer);
+	sjm_json_end_array(&writer);
+	sjm_json_int(&writer, 7);
+	buffer[writer.length]	= '\0';
+	CuAssertStrEquals(tc, "[0,-1234567890,3.14,0.00,3,-10.050,null,1000000000000000e15,{\"s\":\"a\\\"b\\\\c\\nd\\u0001\",\"e\":[]},null]\n7", buffer);
+	CuAssertTrue(tc, SJM_ERROR_OK == sjm_json_flush(&writer));
+	CuAssertIntEquals(tc, 0, writer.length);
+	
+	/* Too much for the buffer, with nowhere to flush it. */
+	sjm_json_init(&writer, small, 4, NULL, NULL);
+	sjm_json_string(&writer, "abcdef");
+	CuAssertTrue(tc, SJM_ERROR_BUFFER_FULL == sjm_json_flush(&writer));
+	
+	/* Responses are batched in a small buffer that flushes as it
+	   fills, except in the middle of a response. */
+	error		= ion_init_master_table();
+	CuAssertTrue(tc, SJM_ERROR_OK == error);
+	error		= sjm_init(&jobmanager, 10, 5);
+	CuAssertTrue(tc, SJM_ERROR_OK == error);
+	sjm_init_job(&job, testwriterjob, NULL);
+	CuAssertTrue(tc, SJM_ERROR_OK == sjm_add_job(&jobmanager, "writer", &job));
+	
+	memset(&sink, 0, sizeof(sink));
+	sjm_json_init(&writer, small, sizeof(small), test_json_sink_flush, &sink);
+	strcpy(json, "[\"writer\", 21]");
+	CuAssertTrue(tc, SJM_ERROR_OK == sjm_respond_job(&jobmanager, json, &writer));
+	strcpy(json, "[\"missing\", 1]");
+	CuAssertTrue(tc, SJM_ERROR_DICT_GET_FAILURE == sjm_respond_job(&jobmanager, json, &writer));
+	strcpy(json, "[\"writer\", -3]");
+	CuAssertTrue(tc, SJM_ERROR_OK == sjm_respond_job(&jobmanager, json, &writer));
+	CuAssertTrue(tc, sink.calls > 0);
+	CuAssertTrue(tc, SJM_ERROR_OK == sjm_json_flush(&writer));
+	CuAssertStrEquals(tc, "[0,42,{\"ok\":true}]\n[3]\n[0,-6,{\"ok\":true}]", sink.text);
+	
+	error		= sjm_delete(&jobmanager);
+	CuAssertTrue(tc, SJM_ERROR_OK == error);
+	error		= ion_close_master_table();
+	CuAssertTrue(tc, SJM_ERROR_OK == error);
+}
+
+/* Read from a client until a whole expected reply is in, serving
+   requests in between. */
+void test_server_expect(CuTest *tc, sjm_server_t *server, int fd, char *expected)
+{
+	char			reply[256];
+	int			length;
+	int			tries;
+	ssize_t			got;
+	
+	length			= 0;
+	for (tries = 0; tries < 100 && length < (int)strlen(expected); tries++)
+	{
+		sjm_server_poll(server, 10);
+		got		= recv(fd, reply + length, sizeof(reply) - 1 - length, MSG_DONTWAIT);
+		if (got > 0)
+		{
+			length	+= got;
+		}
+	}
+	reply[length]		= '\0';
+	CuAssertStrEquals(tc, expected, reply);
+}
+
+void test_jobmanager_server_1(CuTest *tc)
+{
+	sjm_t			jobmanager;
+	sensor_job_t		job;
+	sjm_error_t		error;
+	sjm_server_t		server;
+	struct sockaddr_un	address;
+	int			first;
+	int			second;
+	char			*requests;
+	char			line[SJM_SERVER_INPUT_SIZE];
+	
+	error		= ion_init_master_table();
+	CuAssertTrue(tc, SJM_ERROR_OK == error);
+	error		= sjm_init(&jobmanager, 10, 5);
+	CuAssertTrue(tc, SJM_ERROR_OK == error);
+	sjm_init_job(&job, testwriterjob, NULL);
+	CuAssertTrue(tc, SJM_ERROR_OK == sjm_add_job(&jobmanager, "writer", &job));
+	
+	error		= sjm_server_listen_unix(&server, &jobmanager, "sjm_test_server.sock", 2);
+	CuAssertTrue(tc, SJM_ERROR_OK == error);
+	
+	memset(&address, 0, sizeof(address));
+	address.sun_family	= AF_UNIX;
+	strcpy(address.sun_path, "sjm_test_server.sock");
+	first			= socket(AF_UNIX, SOCK_STREAM, 0);
+	second			= socket(AF_UNIX, SOCK_STREAM, 0);
+	CuAssertTrue(tc, 0 == connect(first, (struct sockaddr *)&address, sizeof(address)));
+	CuAssertTrue(tc, 0 == connect(second, (struct sockaddr *)&address, sizeof(address)));
+	
+	/* Pipelined requests, the last split across two writes. */
+	requests		= "[\"writer\", 1]\n[\"missing\", 1]\r\n\n[\"wri";
+	CuAssertTrue(tc, (ssize_t)strlen(requests) == send(first, requests, strlen(requests), 0));
+	requests		= "[\"writer\", 5]\n";
+	CuAssertTrue(tc, (ssize_t)strlen(requests) == send(second, requests, strlen(requests), 0));
+	test_server_expect(tc, &server, first, "[0,2,{\"ok\":true}]\n[3]\n");
+	test_server_expect(tc, &server, second, "[0,10,{\"ok\":true}]\n");
+	requests		= "ter\", 2]\n";
+	CuAssertTrue(tc, (ssize_t)strlen(requests) == send(first, requests, strlen(requests), 0));
+	test_server_expect(tc, &server, first, "[0,4,{\"ok\":true}]\n");
+	CuAssertTrue(tc, 4 == server.requests);
+	
+	/* A line that can never fit gets its client disconnected. */
+	memset(line, ' ', sizeof(line));
+	CuAssertTrue(tc, (ssize_t)sizeof(line) == send(second, line, sizeof(line), 0));
+	sjm_server_poll(&server, 10);
+	sjm_server_poll(&server, 10);
+	CuAssertTrue(tc, 0 == recv(second, line, sizeof(line), MSG_DONTWAIT));
+	
+	close(first);
+	close(second);
+	sjm_server_close(&server);
+	CuAssertTrue(tc, 0 != access("sjm_test_server.sock", F_OK));
+	
+	error		= sjm_delete(&jobmanager);
+	CuAssertTrue(tc, SJM_ERROR_OK == error);
+	error		= ion_close_master_table();
+	CuAssertTrue(tc, SJM_ERROR_OK == error);
+}
+
+void test_jobmanager_capture_1(CuTest *tc)
+{
+	sjm_t			jobmanager;
+	sensor_job_t		job;
+	sjm_error_t		error;
+	sjm_capture_t		capture;
+	sjm_capture_reader_t	reader;
+	sjm_replay_stats_t	stats;
+	unsigned long long	delay;
+	char			*json;
+	char			request[32];
+	char			*long_request;
+	int			i;
+	
+	error		= ion_init_master_table();
+	CuAssertTrue(tc, SJM_ERROR_OK == error);
+	error		= sjm_init(&jobmanager, 10, 5);
+	CuAssertTrue(tc, SJM_ERROR_OK == error);
+	sjm_init_job(&job, testcapturejob, NULL);
+	CuAssertTrue(tc, SJM_ERROR_OK == sjm_add_job(&jobmanager, "capture", &job));
+	
+	/* Capture a few requests as they come in, one of them bad. */
+	CuAssertTrue(tc, SJM_ERROR_OK == sjm_capture_open(&capture, "sjm_test.capture"));
+	jobmanager.capture	= &capture;
+	for (i = 0; i < 3; i++)
+	{
+		sprintf(request, "[\"capture\", %d]", i);
+		CuAssertTrue(tc, SJM_ERROR_OK == sjm_request_job(&jobmanager, request, NULL));
+	}
+	strcpy(request, "[\"nope\"]");
+	CuAssertTrue(tc, SJM_ERROR_OK != sjm_request_job(&jobmanager, request, NULL));
+	jobmanager.capture	= NULL;
+	CuAssertTrue(tc, 4 == capture.count);
+	CuAssertTrue(tc, 3 == testcapture_total);
+	CuAssertTrue(tc, SJM_ERROR_OK == sjm_capture_close(&capture));
+	
+	/* They read back as they went in. */
+	CuAssertTrue(tc, SJM_ERROR_OK == sjm_capture_reader_open(&reader, "sjm_test.capture"));
+	for (i = 0; i < 3; i++)
+	{
+		CuAssertTrue(tc, SJM_ERROR_OK == sjm_capture_read(&reader, &delay, &json));
+		sprintf(request, "[\"capture\", %d]", i);
+		CuAssertStrEquals(tc, request, json);
+	}
+	CuAssertTrue(tc, SJM_ERROR_OK == sjm_capture_read(&reader, &delay, &json));
+	CuAssertStrEquals(tc, "[\"nope\"]", json);
+	CuAssertTrue(tc, SJM_ERROR_END_OF_CAPTURE == sjm_capture_read(&reader, &delay, &json));
+	sjm_capture_reader_close(&reader);
+	
+	/* Replay them, paced and flat out. */
+	CuAssertTrue(tc, SJM_ERROR_OK == sjm_replay(&jobmanager, "sjm_test.capture", 1.0, &stats));
+	CuAssertTrue(tc, 4 == stats.requests);
+	CuAssertTrue(tc, 1 == stats.failures);
+	CuAssertTrue(tc, stats.p50 <= stats.p99 && stats.p99 <= stats.max);
+	CuAssertTrue(tc, SJM_ERROR_OK == sjm_replay(&jobmanager, "sjm_test.capture", 0, &stats));
+	CuAssertTrue(tc, 4 == stats.requests);
+	CuAssertTrue(tc, 0 < stats.throughput);
+	CuAssertTrue(tc, 9 == testcapture_total);
+	
+	/* Anything else isn't a capture. */
+	CuAssertTrue(tc, SJM_ERROR_CAPTURE_CORRUPT == sjm_capture_reader_open(&reader, "ion_mt.tbl"));
+	
+	/* Requests too long to capture are counted apart, and only the
+	   first error is kept. */
+	long_request	= malloc(SJM_CAPTURE_REQUEST_MAX + 2);
+	CuAssertTrue(tc, NULL != long_request);
+	memset(long_request, ' ', SJM_CAPTURE_REQUEST_MAX + 1);
+	long_request[SJM_CAPTURE_REQUEST_MAX + 1]	= '\0';
+	CuAssertTrue(tc, SJM_ERROR_OK == sjm_capture_open(&capture, "sjm_test.capture"));
+	sjm_capture_request(&capture, "[\"capture\", 1]");
+	sjm_capture_request(&capture, long_request);
+	CuAssertTrue(tc, 1 == capture.count);
+	CuAssertTrue(tc, 1 == capture.dropped);
+	CuAssertTrue(tc, SJM_ERROR_PARAMS_TOO_LARGE == capture.error);
+	capture.error	= SJM_ERROR_SINK_WRITE;
+	sjm_capture_request(&capture, long_request);
+	CuAssertTrue(tc, 2 == capture.dropped);
+	CuAssertTrue(tc, SJM_ERROR_SINK_WRITE == sjm_capture_close(&capture));
+	free(long_request);
+	remove("sjm_test.capture");
+	
+	error		= sjm_delete(&jobmanager);
+	CuAssertTrue(tc, SJM_ERROR_OK == error);
+	error		= ion_close_master_table();
+	CuAssertTrue(tc, SJM_ERROR_OK == error);
+}
+
+struct test_shards_listing { int count; char last[20]; int sorted; };
+
+void test_shards_list_callback(char *name, sensor_job_t *job, void *state)
+{
+	struct test_shards_listing	*listing;
+	
+	listing				= (struct test_shards_listing *)state;
+	if (listing->count > 0 && strcmp(listing->last, name) >= 0)
+	{
+		listing->sorted		= 0;
+	}
+	strcpy(listing->last, name);
+	listing->count++;
+}
+
+void test_jobmanager_shards_1(CuTest *tc)
+{
+	sjm_shards_t	shards;
+	sjm_error_t	error;
+	int		num_jobs		= 12;
+	sensor_job_t	jobs[num_jobs];
+	char		namedata[num_jobs][10];
+	char		*names[num_jobs];
+	void*		params[2];
+	int		x;
+	int		y;
+	int		returnval;
+	int		i;
+	char		*json;
+	struct test_shards_listing
+			listing;
+	char		*argnames[2];
+	sjm_t		*owner;
+	sjm_frame_writer_t
+			writer;
+	unsigned char	framedata[64];
+	unsigned char	*encoded;
+	int		length;
+	int		consumed;
+	sensor_job_t	resumable;
+	int		fds[2];
+	volatile int	result;
+	char		bytes[]	= { 3, 4, 0 };
+	
+	error		= ion_init_master_table();
+	CuAssertTrue(tc, SJM_ERROR_OK == error);
+	
+	error		= sjm_shards_init(&shards, 4, 10, 12, 0, true);
+	CuAssertTrue(tc, SJM_ERROR_OK == error);
+	
+	for (i = 0; i < num_jobs; i++)
+	{
+		sprintf(namedata[i], "job%d", i);
+		names[i]			= namedata[i];
+		sjm_init_job(jobs+i, testjob_1, always_activate);
+	}
+	error		= sjm_shards_add_jobs(&shards, names, jobs, num_jobs);
+	CuAssertTrue(tc, SJM_ERROR_OK == error);
+	
+	params[0]	= &x;
+	params[1]	= &y;
+	for (i = 0; i < num_jobs; i++)
+	{
+		x		= i;
+		y		= 100;
+		returnval	= 0;
+		error		= sjm_shards_perform_job(
+					&shards,
+					names[i],
+					params,
+					&returnval
+				);
+		CuAssertTrue(tc, SJM_ERROR_OK == error);
+		CuAssertTrue(tc, i+100 == returnval);
+	}
+	
+	json		= "[ \"job7\", 5, 6 ]";
+	char		mutablejson[strlen(json)+1];
+	strcpy(mutablejson, json);
+	error		= sjm_shards_request_job(&shards, mutablejson, &returnval);
+	CuAssertTrue(tc, SJM_ERROR_OK == error);
+	CuAssertTrue(tc, 11 == returnval);
+	
+	/* The object form is routed by its "job" member, wherever it is.
+	   The owning shard is idle, so its names can be declared here. */
+	argnames[0]	= "x";
+	argnames[1]	= "y";
+	owner		= &(shards.shards[sjm_shards_owner(&shards, "job3")].jobmanager);
+	CuAssertTrue(tc, SJM_ERROR_OK == sjm_declare_params(owner, "job3", argnames, 2));
+	json		= "{ \"args\": { \"y\": 20, \"x\": 1 }, \"job\": \"job3\" }";
+	char		objectjson[strlen(json)+1];
+	strcpy(objectjson, json);
+	error		= sjm_shards_request_job(&shards, objectjson, &returnval);
+	CuAssertTrue(tc, SJM_ERROR_OK == error);
+	CuAssertTrue(tc, 21 == returnval);
+	strcpy(objectjson, "{ \"args\": { \"job\": \"job3\" } }");
+	error		= sjm_shards_request_job(&shards, objectjson, &returnval);
+	CuAssertTrue(tc, SJM_ERROR_UNSUPPORTED_JSON_FORMAT == error);
+	
+	/* So are frames, by their name. */
+	sjm_frame_begin(&writer, framedata, sizeof(framedata), "job9");
+	sjm_frame_add_int(&writer, 4);
+	sjm_frame_add_int(&writer, 300);
+	CuAssertTrue(tc, SJM_ERROR_OK == sjm_frame_finish(&writer, &encoded, &length));
+	error		= sjm_shards_frame_request_job(&shards, encoded, length, &returnval, &consumed);
+	CuAssertTrue(tc, SJM_ERROR_OK == error);
+	CuAssertTrue(tc, 304 == returnval);
+	CuAssertIntEquals(tc, length, consumed);
+	
+	listing.count	= 0;
+	listing.sorted	= 1;
+	error		= sjm_shards_list_jobs(
+				&shards,
+				test_shards_list_callback,
+				&listing
+			);
+	CuAssertTrue(tc, SJM_ERROR_OK == error);
+	CuAssertTrue(tc, num_jobs == listing.count);
+	CuAssertTrue(tc, 1 == listing.sorted);
+	
+	/* Without scheduling passes, a yielding job is still resumed
+	   by its worker until it ends. */
+	CuAssertTrue(tc, 0 == pipe(fds));
+	sjm_init_job(&resumable, NULL, NULL);
+	resumable.resume	= testresumablejob_1;
+	resumable.state_size	= sizeof(struct testresumablejob_state);
+	CuAssertTrue(tc, SJM_ERROR_OK == sjm_shards_add_job(&shards, "reader", &resumable));
+	params[0]	= fds;
+	result		= -1;
+	CuAssertTrue(tc, SJM_ERROR_OK == sjm_shards_perform_job(&shards, "reader", params, (int *)&result));
+	CuAssertTrue(tc, 2 == write(fds[1], bytes, 2));
+	CuAssertTrue(tc, 1 == write(fds[1], bytes+2, 1));
+	for (i = 0; i < 200 && -1 == result; i++)
+	{
+		usleep(5000);
+	}
+	CuAssertIntEquals(tc, 7, result);
+	close(fds[0]);
+	close(fds[1]);
+	
+	error		= sjm_shards_delete(&shards);
+	CuAssertTrue(tc, SJM_ERROR_OK == error);
+	
+	error		= ion_close_master_table();
+	CuAssertTrue(tc, SJM_ERROR_OK == error);
+}
+
 CuSuite *JobManagerGetSuite()
 {
 	CuSuite *suite = CuSuiteNew();
 	
 	SUITE_ADD_TEST(suite, test_jobmanager_nonjson_1);
+	SUITE_ADD_TEST(suite, test_jobmanager_nonjson_2);
 	SUITE_ADD_TEST(suite, test_jobmanager_json_1);
 	SUITE_ADD_TEST(suite, test_jobmanager_json_2);
 	SUITE_ADD_TEST(suite, test_jobmanager_json_3);
@@ -537,6 +2101,21 @@ CuSuite *JobManagerGetSuite()
 	SUITE_ADD_TEST(suite, test_jobmanager_scheduling_1);
 	SUITE_ADD_TEST(suite, test_jobmanager_scheduling_2);
 	SUITE_ADD_TEST(suite, test_jobmanager_scheduling_3);
+	SUITE_ADD_TEST(suite, test_jobmanager_shards_1);
+	SUITE_ADD_TEST(suite, test_jobmanager_resumable_1);
+	SUITE_ADD_TEST(suite, test_jobmanager_cancel_1);
+	SUITE_ADD_TEST(suite, test_jobmanager_policy_1);
+	SUITE_ADD_TEST(suite, test_jobmanager_admission_1);
+	SUITE_ADD_TEST(suite, test_jobmanager_batch_1);
+	SUITE_ADD_TEST(suite, test_jobmanager_ring_1);
+	SUITE_ADD_TEST(suite, test_jobmanager_bound_1);
+	SUITE_ADD_TEST(suite, test_jobmanager_prepared_1);
+	SUITE_ADD_TEST(suite, test_jobmanager_named_1);
+	SUITE_ADD_TEST(suite, test_jobmanager_restart_1);
+	SUITE_ADD_TEST(suite, test_jobmanager_frame_1);
+	SUITE_ADD_TEST(suite, test_jobmanager_json_writer_1);
+	SUITE_ADD_TEST(suite, test_jobmanager_server_1);
+	SUITE_ADD_TEST(suite, test_jobmanager_capture_1);
 	
 	return suite;
 }
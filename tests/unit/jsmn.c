@@ -0,0 +1,228 @@
+/**
+@author		Graeme Douglas
+@brief
+@details
+@copyright	Copyright 2015 Graeme Douglas
+@license	Licensed under the Apache License, Version 2.0 (the "License");
+		you may not use this file except in compliance with the License.
+		You may obtain a copy of the License at
+			http://www.apache.org/licenses/LICENSE-2.0
+
+@par
+		Unless required by applicable law or agreed to in writing,
+		software distributed under the License is distributed on an
+		"AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+		either express or implied. See the License for the specific
+		language governing permissions and limitations under the
+		License.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "../CuTest.h"
+#include "../../src/jsmn/jsmn.h"
+
+#define TEST_JSMN_TOKENS	64
+
+/* Parse with one scanner, then every other one the CPU supports, and
+   check that each gives the same result, parser state, and tokens. */
+void test_jsmn_compare(CuTest *tc, const char *js, size_t len)
+{
+	jsmn_parser	expected_parser;
+	jsmntok_t	expected_tokens[TEST_JSMN_TOKENS];
+	jsmnerr_t	expected;
+	jsmn_parser	parser;
+	jsmntok_t	tokens[TEST_JSMN_TOKENS];
+	jsmnerr_t	result;
+	jsmnscan_t	scan;
+	
+	CuAssertTrue(tc, JSMN_SCAN_SCALAR == jsmn_set_scanner(JSMN_SCAN_SCALAR));
+	memset(expected_tokens, 0, sizeof(expected_tokens));
+	jsmn_init(&expected_parser);
+	expected	= jsmn_parse(&expected_parser, js, len, expected_tokens, TEST_JSMN_TOKENS);
+	
+	for (scan = JSMN_SCAN_SSE2; scan <= JSMN_SCAN_AVX2; scan++)
+	{
+		if (scan != jsmn_set_scanner(scan))
+		{
+			continue;
+		}
+		memset(tokens, 0, sizeof(tokens));
+		jsmn_init(&parser);
+		result	= jsmn_parse(&parser, js, len, tokens, TEST_JSMN_TOKENS);
+		CuAssertIntEquals(tc, expected, result);
+		CuAssertIntEquals(tc, expected_parser.pos, parser.pos);
+		CuAssertIntEquals(tc, expected_parser.toknext, parser.toknext);
+		CuAssertIntEquals(tc, expected_parser.toksuper, parser.toksuper);
+		CuAssertTrue(tc, 0 == memcmp(expected_tokens, tokens, sizeof(tokens)));
+	}
+	
+	jsmn_set_scanner(JSMN_SCAN_AUTO);
+}
+
+void test_jsmn_scanners_1(CuTest *tc)
+{
+	const char	*cases[]	= {
+		"[ \"TESTJOB1\", 1, 2 ]",
+		"{\"job\":\"read_channel\",\"args\":{\"channel\":3,\"gain\":2}}",
+		"[\"a string that is long enough to cross a few blocks of thirty-two\", 123456789012345678901234567890, true]",
+		"[\"escapes \\\" and \\\\ and \\u00e9 and \\n, all past the sixteenth byte\"]",
+		"[\"a bad escape, well past the first block of the string \\q\"]",
+		"[\"a bad unicode escape that sits past the first block \\u12G4\"]",
+		"[\"an unterminated string that runs on for more than thirty-two bytes",
+		"[a_primitive_that_is_longer_than_thirty_two_bytes_in_total, 1]",
+		"[primitive_with_a_colon_well_past_the_first_block:1, 2]",
+		"[\n\t\r                                                        1\n\n\n]",
+		"[1,                                                                  ]",
+		"[\"high \xc3\xa9 bytes inside a string that keeps going and going\"]",
+		"[primitive_with_a_high_byte_past_the_first_block_\xc3\xa9, 2]",
+		"[primitive_with_a_control_byte_past_the_first_block_\x01, 2]",
+		"[primitive_with_delete_past_the_first_block_of_it_\x7f, 2]",
+		"{\"a\":[1,2,{\"b\":\"c\"}],\"d\":\"e\"}}",
+		"[1, 2]]",
+		"1,2",
+		",\"a\",[1,2],",
+		"",
+		"   ",
+	};
+	char		buffer[160];
+	size_t		length;
+	size_t		i;
+	size_t		j;
+	
+	for (i = 0; i < sizeof(cases) / sizeof(cases[0]); i++)
+	{
+		length	= strlen(cases[i]);
+		/* Every prefix, so each block boundary falls everywhere. */
+		for (j = 0; j <= length; j++)
+		{
+			test_jsmn_compare(tc, cases[i], j);
+		}
+		
+		/* An early terminator, and input that does not end in one. */
+		strcpy(buffer, cases[i]);
+		if (length > 40)
+		{
+			buffer[40]	= '\0';
+			test_jsmn_compare(tc, buffer, length);
+		}
+	}
+}
+
+void test_jsmn_scanners_2(CuTest *tc)
+{
+	const char	alphabet[]	= "[]{}:,\"\\ \t\nu0aF-e\x01\x7f\xe9";
+	char		buffer[128];
+	int		length;
+	int		i;
+	int		j;
+	
+	/* Random soup of everything the tokenizer cares about. */
+	srand(1);
+	for (i = 0; i < 5000; i++)
+	{
+		length	= rand() % (int)sizeof(buffer);
+		for (j = 0; j < length; j++)
+		{
+			/* Mostly plain letters, so runs get long. */
+			if (rand() % 4)
+			{
+				buffer[j]	= 'g' + rand() % 16;
+			}
+			else
+			{
+				buffer[j]	= alphabet[rand() % (sizeof(alphabet) - 1)];
+			}
+		}
+		test_jsmn_compare(tc, buffer, length);
+	}
+}
+
+#define TEST_JSMN_THREADS	4
+
+const char test_jsmn_threaded_json[]	= "{\"job\":\"read_channel\",\"args\":{\"channel\":3,\"gain\":2}}";
+
+/* Parse over and over, counting results that are not the 9 tokens. */
+void *test_jsmn_parse_thread(void *arg)
+{
+	jsmn_parser	parser;
+	jsmntok_t	tokens[TEST_JSMN_TOKENS];
+	int		*wrong	= arg;
+	int		i;
+	
+	for (i = 0; i < 20000; i++)
+	{
+		jsmn_init(&parser);
+		if (9 != jsmn_parse(&parser, test_jsmn_threaded_json, sizeof(test_jsmn_threaded_json) - 1, tokens, TEST_JSMN_TOKENS))
+		{
+			(*wrong)++;
+		}
+	}
+	
+	return NULL;
+}
+
+void test_jsmn_scanners_3(CuTest *tc)
+{
+	jsmn_parser	before;
+	jsmn_parser	after;
+	jsmntok_t	tokens[TEST_JSMN_TOKENS];
+	pthread_t	threads[TEST_JSMN_THREADS];
+	int		wrong[TEST_JSMN_THREADS];
+	jsmnscan_t	chosen;
+	int		i;
+	
+	/* A parser keeps the scanner it was initialized with. */
+	jsmn_set_scanner(JSMN_SCAN_SCALAR);
+	jsmn_init(&before);
+	chosen		= jsmn_set_scanner(JSMN_SCAN_AUTO);
+	jsmn_init(&after);
+	jsmn_set_scanner(JSMN_SCAN_SCALAR);
+	CuAssertTrue(tc, (JSMN_SCAN_SCALAR == chosen) == (before.scan == after.scan));
+	CuAssertIntEquals(tc, 9, jsmn_parse(&after, test_jsmn_threaded_json, sizeof(test_jsmn_threaded_json) - 1, tokens, TEST_JSMN_TOKENS));
+	
+	/* Choosing a scanner while other threads parse. */
+	for (i = 0; i < TEST_JSMN_THREADS; i++)
+	{
+		wrong[i]	= 0;
+		CuAssertTrue(tc, 0 == pthread_create(threads+i, NULL, test_jsmn_parse_thread, wrong+i));
+	}
+	for (i = 0; i < 20000; i++)
+	{
+		jsmn_set_scanner((jsmnscan_t)(i % 4));
+	}
+	for (i = 0; i < TEST_JSMN_THREADS; i++)
+	{
+		pthread_join(threads[i], NULL);
+		CuAssertIntEquals(tc, 0, wrong[i]);
+	}
+	
+	jsmn_set_scanner(JSMN_SCAN_AUTO);
+}
+
+CuSuite *JsmnGetSuite()
+{
+	CuSuite *suite = CuSuiteNew();
+	
+	SUITE_ADD_TEST(suite, test_jsmn_scanners_1);
+	SUITE_ADD_TEST(suite, test_jsmn_scanners_2);
+	SUITE_ADD_TEST(suite, test_jsmn_scanners_3);
+	
+	return suite;
+}
+
+void runAllTests_jsmn()
+{
+	CuString *output = CuStringNew();
+	CuSuite* suite = JsmnGetSuite();
+	
+	CuSuiteRun(suite);
+	CuSuiteSummary(suite, output);
+	CuSuiteDetails(suite, output);
+	printf("%s\n", output->buffer);
+	
+	CuSuiteDelete(suite);
+	CuStringDelete(output);
+}
@@ -0,0 +1,7 @@
+void runAllTests_bpptree();
+
+int main(void)
+{
+	runAllTests_bpptree();
+	return 0;
+}
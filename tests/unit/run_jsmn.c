@@ -0,0 +1,7 @@
+void runAllTests_jsmn();
+
+int main(void)
+{
+	runAllTests_jsmn();
+	return 0;
+}